@@ -28,6 +28,12 @@
 # PH_SFZ_CORE_ROOT: Optional path to the root of the sfzCore directory, if you don't want to
 #                   download from GitHub.
 
+# PH_COMPONENT_MASK_NUM_BITS: Optional number of bits in ph::ComponentMask, i.e. the max number of
+#                             component types in a game state. 64 (default), 128 or 256.
+
+# PH_BUILD_TESTS: Will build the PhantasyEngineTests (registered with CTest) and
+#                 PhantasyEngineBenchmarks executables if defined
+
 # Miscallenous initialization operations
 # ------------------------------------------------------------------------------------------------
 
@@ -21,74 +21,200 @@
 
 #include <cstdint>
 
+// The number of bits in a ComponentMask, i.e. the max number of component types (including the
+// active bit). May be set to 64, 128 or 256 when compiling, everything using the engine must be
+// compiled with the same value. Game states store the width they were created with and can only
+// be loaded by builds using the same width.
+#ifndef PH_COMPONENT_MASK_NUM_BITS
+#define PH_COMPONENT_MASK_NUM_BITS 64
+#endif
+
+#if PH_COMPONENT_MASK_NUM_BITS > 64
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PH_COMPONENT_MASK_SSE2
+#include <emmintrin.h>
+#endif
+#endif
+
 namespace ph {
 
 // Component Mask
 // ------------------------------------------------------------------------------------------------
 
-// A 64-bit mask specifying which components an entity have.
+// A NumBits-bit mask specifying which components an entity have, NumBits must be 64, 128 or 256.
+// Use the ComponentMask alias below, which has the width the engine is compiled with.
 //
 // Not all bits need to have associated component data, some can be used as pure data-less flag.
 // One such data-less flag is the first bit (0:th), which just indicates if the given entity exists
 // or not.
-struct ComponentMask final {
+template<uint32_t NumBits>
+struct ComponentMaskT final {
+
+	static_assert(NumBits == 64 || NumBits == 128 || NumBits == 256, "Unsupported mask width");
+	static constexpr uint32_t NUM_BITS = NumBits;
+	static constexpr uint32_t NUM_WORDS = NumBits / 64;
 
 	// Members
 	// --------------------------------------------------------------------------------------------
 
-	// The raw 64-bit mask.
-	uint64_t rawMask;
+	// The raw mask, bit i of the mask is bit (i % 64) of word (i / 64).
+	uint64_t words[NUM_WORDS];
 
 	// Constructor methods
 	// --------------------------------------------------------------------------------------------
 
-	static constexpr ComponentMask fromRawValue(uint64_t bits) noexcept { return { bits }; }
-	static constexpr ComponentMask empty() noexcept { return ComponentMask::fromRawValue(0); }
-	static constexpr ComponentMask fromType(uint32_t componentType) noexcept
+	// Creates a mask with the lowest 64 bits set to the given bits, the rest cleared.
+	static constexpr ComponentMaskT fromRawValue(uint64_t bits) noexcept
+	{
+		ComponentMaskT mask = {};
+		mask.words[0] = bits;
+		return mask;
+	}
+	static constexpr ComponentMaskT empty() noexcept { return ComponentMaskT{}; }
+	static constexpr ComponentMaskT all() noexcept { return ~ComponentMaskT{}; }
+	static constexpr ComponentMaskT fromType(uint32_t componentType) noexcept
 	{
-		return ComponentMask::fromRawValue(uint64_t(1) << uint64_t(componentType));
+		ComponentMaskT mask = {};
+		mask.words[componentType / 64] = uint64_t(1) << uint64_t(componentType % 64);
+		return mask;
 	}
-	static constexpr ComponentMask activeMask() noexcept
+	static constexpr ComponentMaskT activeMask() noexcept
 	{
-		return ComponentMask::fromRawValue(1);
+		return ComponentMaskT::fromRawValue(1);
 	}
 
 	// Operators
 	// --------------------------------------------------------------------------------------------
 
-	constexpr bool operator== (const ComponentMask& o) const noexcept { return rawMask == o.rawMask; }
-	constexpr bool operator!= (const ComponentMask& o) const noexcept { return rawMask != o.rawMask; }
-	constexpr ComponentMask operator& (const ComponentMask& o) const noexcept { return { rawMask & o.rawMask }; }
-	constexpr ComponentMask operator| (const ComponentMask& o) const noexcept { return { rawMask | o.rawMask }; }
-	constexpr ComponentMask operator~ () const noexcept { return { ~rawMask }; }
+	constexpr bool operator== (const ComponentMaskT& o) const noexcept
+	{
+		uint64_t diff = 0;
+		for (uint32_t i = 0; i < NUM_WORDS; i++) diff |= words[i] ^ o.words[i];
+		return diff == 0;
+	}
+	constexpr bool operator!= (const ComponentMaskT& o) const noexcept { return !(*this == o); }
+	constexpr ComponentMaskT operator& (const ComponentMaskT& o) const noexcept
+	{
+		ComponentMaskT mask = {};
+		for (uint32_t i = 0; i < NUM_WORDS; i++) mask.words[i] = words[i] & o.words[i];
+		return mask;
+	}
+	constexpr ComponentMaskT operator| (const ComponentMaskT& o) const noexcept
+	{
+		ComponentMaskT mask = {};
+		for (uint32_t i = 0; i < NUM_WORDS; i++) mask.words[i] = words[i] | o.words[i];
+		return mask;
+	}
+	constexpr ComponentMaskT operator~ () const noexcept
+	{
+		ComponentMaskT mask = {};
+		for (uint32_t i = 0; i < NUM_WORDS; i++) mask.words[i] = ~words[i];
+		return mask;
+	}
 
 	// Methods
 	// --------------------------------------------------------------------------------------------
 
-	// Checks whether this mask contains the specified component type or not, somewhat slow.
-	// Prefer to build a mask with all bits you want to check, then you fulfills() with it instead.
+	// Checks whether this mask contains the specified component type or not.
 	constexpr bool hasComponentType(uint32_t componentType) const noexcept
 	{
-		return this->fulfills(ComponentMask::fromType(componentType));
+		return (words[componentType / 64] & (uint64_t(1) << uint64_t(componentType % 64))) != 0;
 	}
 
 	// Sets the specified bit of this mask to the specified value.
 	constexpr void setComponentType(uint32_t componentType, bool value) noexcept
 	{
-		if (value) this->rawMask |= ComponentMask::fromType(componentType).rawMask;
-		else this->rawMask &= ~ComponentMask::fromType(componentType).rawMask;
+		const uint64_t bit = uint64_t(1) << uint64_t(componentType % 64);
+		if (value) this->words[componentType / 64] |= bit;
+		else this->words[componentType / 64] &= ~bit;
+	}
+
+	// Returns the given byte of the mask, byte i contains bits [8 * i, 8 * i + 8).
+	constexpr uint8_t byteAt(uint32_t byteIdx) const noexcept
+	{
+		return uint8_t(words[byteIdx / 8] >> ((byteIdx % 8) * 8));
+	}
+
+	// Sets the given byte of the mask, see byteAt().
+	constexpr void setByte(uint32_t byteIdx, uint8_t byte) noexcept
+	{
+		const uint32_t shift = (byteIdx % 8) * 8;
+		uint64_t& word = this->words[byteIdx / 8];
+		word = (word & ~(uint64_t(0xFF) << shift)) | (uint64_t(byte) << shift);
 	}
 
 	// Checks whether this mask has all the components in the specified parameter mask
-	constexpr bool fulfills(const ComponentMask& constraints) const noexcept
+	bool fulfills(const ComponentMaskT& constraints) const noexcept
+	{
+#ifdef PH_COMPONENT_MASK_SSE2
+		__m128i missing = _mm_setzero_si128();
+		for (uint32_t i = 0; i < NUM_WORDS; i += 2) {
+			__m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i));
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(constraints.words + i));
+			missing = _mm_or_si128(missing, _mm_andnot_si128(m, c));
+		}
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xFFFF;
+#else
+		uint64_t missing = 0;
+		for (uint32_t i = 0; i < NUM_WORDS; i++) {
+			missing |= ~words[i] & constraints.words[i];
+		}
+		return missing == 0;
+#endif
+	}
+
+	// Checks whether this mask has all the components in the required mask and none of the
+	// components in the excluded mask
+	bool fulfills(const ComponentMaskT& required, const ComponentMaskT& excluded) const noexcept
 	{
-		return (this->rawMask & constraints.rawMask) == constraints.rawMask;
+#ifdef PH_COMPONENT_MASK_SSE2
+		__m128i failed = _mm_setzero_si128();
+		for (uint32_t i = 0; i < NUM_WORDS; i += 2) {
+			__m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i));
+			__m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(required.words + i));
+			__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(excluded.words + i));
+			failed = _mm_or_si128(failed, _mm_or_si128(_mm_andnot_si128(m, r), _mm_and_si128(m, e)));
+		}
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(failed, _mm_setzero_si128())) == 0xFFFF;
+#else
+		uint64_t failed = 0;
+		for (uint32_t i = 0; i < NUM_WORDS; i++) {
+			failed |= (~words[i] & required.words[i]) | (words[i] & excluded.words[i]);
+		}
+		return failed == 0;
+#endif
 	}
 
 	// Checks whether the entity associated with this mask is active or not (i.e. whether the 0:th
 	// bit is set or not)
-	constexpr bool active() const noexcept { return this->fulfills(ComponentMask::activeMask()); }
+	constexpr bool active() const noexcept { return (words[0] & uint64_t(1)) != 0; }
 };
-static_assert(sizeof(ComponentMask) == 8, "ComponentMask is padded");
+
+using ComponentMask = ComponentMaskT<PH_COMPONENT_MASK_NUM_BITS>;
+static_assert(sizeof(ComponentMask) == PH_COMPONENT_MASK_NUM_BITS / 8, "ComponentMask is padded");
+
+// The max number of component types (including the active bit) a game state can have.
+constexpr uint32_t COMPONENT_MASK_NUM_BITS = ComponentMask::NUM_BITS;
+constexpr uint32_t COMPONENT_MASK_NUM_BYTES = COMPONENT_MASK_NUM_BITS / 8;
+
+// Component mask scanning
+// ------------------------------------------------------------------------------------------------
+
+// Scans a contiguous array of component masks and writes the indices (i.e. entity ids) of all
+// masks which fulfills the required mask and has none of the bits in the excluded mask set. The
+// indices are written in ascending order to indicesOut, which must have space for numMasks
+// indices. Returns the number of matching masks.
+//
+// Tests multiple masks per instruction using AVX2 or SSE2, AVX2 is selected at runtime if
+// supported by the CPU. Falls back to a scalar loop on non-x86 platforms.
+uint32_t scanComponentMasks(
+	const ComponentMask* masks,
+	uint32_t numMasks,
+	ComponentMask required,
+	ComponentMask excluded,
+	uint32_t* indicesOut) noexcept;
+
+// Returns the name of the scan implementation selected at runtime ("AVX2", "SSE2" or "Scalar").
+const char* componentMaskScanImplName() noexcept;
 
 } // namespace ph
@@ -0,0 +1,179 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include <sfz/Context.hpp>
+#include <sfz/memory/Allocator.hpp>
+
+#include "ph/state/Entity.hpp"
+
+namespace ph {
+
+// Forward declarations
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHeader;
+
+// DeferredEntity struct
+// ------------------------------------------------------------------------------------------------
+
+// A placeholder for an entity created by an EntityCommandBuffer. The real entity does not exist
+// until the buffer is played back, after which it can be retrieved using resolveEntity(). Only
+// valid for the buffer that created it, and only until the buffer is cleared.
+//
+// Commands targeting a deferred entity must be recorded with a sort key at least as high as the
+// one it was created with, so that they are played back after the entity is created. This is
+// asserted, and such commands are given the sort key of the creation if asserts are disabled.
+struct DeferredEntity final {
+	uint32_t idx = ~0u;
+
+	bool operator== (DeferredEntity other) const noexcept { return this->idx == other.idx; }
+	bool operator!= (DeferredEntity other) const noexcept { return this->idx != other.idx; }
+};
+static_assert(sizeof(DeferredEntity) == 4, "DeferredEntity is padded");
+
+// EntityCommandBuffer class
+// ------------------------------------------------------------------------------------------------
+
+struct EntityCommandBufferState;
+
+// Records structural changes (creating/deleting entities, adding/deleting components) to be applied
+// to a game state later. Intended to be used with one buffer per thread (see
+// ThreadPool::currentThreadIdx()), so that systems running in parallel can spawn and despawn
+// entities without modifying the shared game state. The buffers are then played back on a single
+// thread at a sync point using playbackEntityCommandBuffers().
+//
+// Each recorded command is tagged with the current sort key (see setSortKey()). On playback the
+// commands of all buffers are executed ordered by (sort key, buffer index, recording order). The
+// resulting game state is deterministic regardless of which thread recorded what as long as all
+// commands with the same sort key are recorded by the same thread, e.g. by using the id of the
+// entity being processed as sort key.
+class EntityCommandBuffer final {
+public:
+	// Constructors & destructors
+	// --------------------------------------------------------------------------------------------
+
+	EntityCommandBuffer() noexcept = default;
+	EntityCommandBuffer(const EntityCommandBuffer&) = delete;
+	EntityCommandBuffer& operator= (const EntityCommandBuffer&) = delete;
+	EntityCommandBuffer(EntityCommandBuffer&& o) noexcept { this->swap(o); }
+	EntityCommandBuffer& operator= (EntityCommandBuffer&& o) noexcept { this->swap(o); return *this; }
+	~EntityCommandBuffer() noexcept { this->destroy(); }
+
+	// State methods
+	// --------------------------------------------------------------------------------------------
+
+	void init(
+		uint32_t initialCapacityBytes,
+		sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+	void swap(EntityCommandBuffer& other) noexcept;
+	void destroy() noexcept;
+
+	// Methods
+	// --------------------------------------------------------------------------------------------
+
+	bool isValid() const noexcept { return mState != nullptr; }
+
+	// Sets the sort key all subsequently recorded commands are tagged with, see above. Defaults to
+	// 0 and is reset to 0 by clear().
+	void setSortKey(uint32_t sortKey) noexcept;
+	uint32_t sortKey() const noexcept;
+
+	// Returns the number of recorded commands.
+	uint32_t numCommands() const noexcept;
+
+	// Removes all recorded commands and all deferred entities.
+	void clear() noexcept;
+
+	// Returns the real entity a deferred entity was resolved to during playback. Returns
+	// Entity::invalid() if the buffer has not been played back yet or if the entity could not be
+	// created (e.g. out of free entity ids).
+	Entity resolveEntity(DeferredEntity entity) const noexcept;
+
+	// Recording commands
+	// --------------------------------------------------------------------------------------------
+
+	// See GameStateHeader::createEntity() and cloneEntity()
+	DeferredEntity createEntity() noexcept;
+	DeferredEntity cloneEntity(Entity entity) noexcept;
+
+	// See GameStateHeader::deleteEntity()
+	void deleteEntity(Entity entity) noexcept;
+	void deleteEntity(DeferredEntity entity) noexcept;
+
+	// See GameStateHeader::addComponentUntyped() and addComponent(). The component data is copied
+	// into the buffer, the component is zero initialized if data is nullptr.
+	void addComponentUntyped(
+		Entity entity, uint32_t componentType, const uint8_t* data, uint32_t dataSize) noexcept;
+	void addComponentUntyped(
+		DeferredEntity entity, uint32_t componentType, const uint8_t* data, uint32_t dataSize) noexcept;
+
+	template<typename T>
+	void addComponent(Entity entity, uint32_t componentType, const T& component) noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+		this->addComponentUntyped(
+			entity, componentType, reinterpret_cast<const uint8_t*>(&component), sizeof(T));
+	}
+
+	template<typename T>
+	void addComponent(DeferredEntity entity, uint32_t componentType, const T& component) noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+		this->addComponentUntyped(
+			entity, componentType, reinterpret_cast<const uint8_t*>(&component), sizeof(T));
+	}
+
+	// See GameStateHeader::setComponentUnsized()
+	void setComponentUnsized(Entity entity, uint32_t componentType, bool value) noexcept;
+	void setComponentUnsized(DeferredEntity entity, uint32_t componentType, bool value) noexcept;
+
+	// See GameStateHeader::deleteComponent()
+	void deleteComponent(Entity entity, uint32_t componentType) noexcept;
+	void deleteComponent(DeferredEntity entity, uint32_t componentType) noexcept;
+
+	// Private members
+	// --------------------------------------------------------------------------------------------
+private:
+	friend uint32_t playbackEntityCommandBuffers(
+		GameStateHeader*, EntityCommandBuffer*, uint32_t, sfz::Allocator*) noexcept;
+
+	EntityCommandBufferState* mState = nullptr;
+};
+
+// Playback functions
+// ------------------------------------------------------------------------------------------------
+
+// Executes the commands of all the given buffers on the game state, ordered by (sort key, buffer
+// index, recording order), see EntityCommandBuffer. Must not run concurrently with anything else
+// accessing the game state. Commands targeting invalid entities fail silently, in the same way as
+// the corresponding GameStateHeader functions. The buffers are not cleared, so that deferred
+// entities can be resolved afterwards. The allocator is used for temporary allocations. Returns
+// the number of commands that failed.
+uint32_t playbackEntityCommandBuffers(
+	GameStateHeader* state,
+	EntityCommandBuffer* buffers,
+	uint32_t numBuffers,
+	sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+
+} // namespace ph
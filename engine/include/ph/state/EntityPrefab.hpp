@@ -0,0 +1,142 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include <sfz/Assert.hpp>
+#include <sfz/Context.hpp>
+#include <sfz/containers/DynArray.hpp>
+#include <sfz/memory/Allocator.hpp>
+
+#include "ph/state/ComponentMask.hpp"
+#include "ph/state/Entity.hpp"
+
+namespace ph {
+
+// Forward declarations
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHeader;
+
+// PrefabComponent struct
+// ------------------------------------------------------------------------------------------------
+
+// A component stored in an EntityPrefab, the data is at the given offset in the prefab's data.
+struct PrefabComponent final {
+	uint32_t componentType;
+	uint32_t sizeInBytes;
+	uint32_t offset;
+};
+static_assert(sizeof(PrefabComponent) == 12, "PrefabComponent is padded");
+
+// EntityPrefab class
+// ------------------------------------------------------------------------------------------------
+
+// A template for spawning many identical entities, see GameStateHeader::instantiatePrefab().
+//
+// A prefab is captured from an existing (template) entity and stores its component mask and a
+// copy of its components, packed into a single buffer. Instantiating the prefab writes the
+// components one component type at a time for the whole batch, instead of walking all component
+// types for each new entity as cloneEntity() does. The template entity can be deleted after the
+// capture, and the captured components can be modified through component().
+//
+// A prefab is only valid for game states with the same component types as the state it was
+// captured from.
+class EntityPrefab final {
+public:
+	// Constructors & destructors
+	// --------------------------------------------------------------------------------------------
+
+	EntityPrefab() noexcept = default;
+	EntityPrefab(const EntityPrefab&) = delete;
+	EntityPrefab& operator= (const EntityPrefab&) = delete;
+	EntityPrefab(EntityPrefab&& o) noexcept { this->swap(o); }
+	EntityPrefab& operator= (EntityPrefab&& o) noexcept { this->swap(o); return *this; }
+	~EntityPrefab() noexcept { this->destroy(); }
+
+	// State methods
+	// --------------------------------------------------------------------------------------------
+
+	// Captures the mask and components of the given entity, replacing any previous contents.
+	// Returns false (and leaves the prefab empty) if the entity is not valid.
+	bool capture(
+		const GameStateHeader* state,
+		Entity entity,
+		sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+	void swap(EntityPrefab& other) noexcept;
+	void destroy() noexcept;
+
+	// Methods
+	// --------------------------------------------------------------------------------------------
+
+	bool isValid() const noexcept { return mMask.active(); }
+
+	// The component mask of the instances, including the active bit.
+	ComponentMask mask() const noexcept { return mMask; }
+
+	// The number of component types in the state the prefab was captured from.
+	uint32_t numComponentTypes() const noexcept { return mNumComponentTypes; }
+
+	// The components with data stored in the prefab, in ascending component type order. Data-less
+	// component types (flags) are only stored in the mask.
+	uint32_t numComponents() const noexcept { return mComponents.size(); }
+	const PrefabComponent* components() const noexcept { return mComponents.data(); }
+	const uint8_t* data() const noexcept { return mData.data(); }
+
+	// Returns the stored component of the given type, nullptr if the prefab does not have it or
+	// if the component type has no data. The second parameter returns the size of the component.
+	uint8_t* componentUntyped(uint32_t componentType, uint32_t& componentSizeBytesOut) noexcept;
+	const uint8_t* componentUntyped(
+		uint32_t componentType, uint32_t& componentSizeBytesOut) const noexcept;
+
+	// Returns typed pointer to the stored component of the given type, see componentUntyped().
+	// The requested type (T) must be of the correct size.
+	template<typename T>
+	T* component(uint32_t componentType) noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+		uint32_t componentSize = 0;
+		T* component = (T*)componentUntyped(componentType, componentSize);
+		sfz_assert(component == nullptr || sizeof(T) == componentSize);
+		return component;
+	}
+	template<typename T>
+	const T* component(uint32_t componentType) const noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+		uint32_t componentSize = 0;
+		const T* component = (const T*)componentUntyped(componentType, componentSize);
+		sfz_assert(component == nullptr || sizeof(T) == componentSize);
+		return component;
+	}
+
+private:
+	// Private members
+	// --------------------------------------------------------------------------------------------
+
+	ComponentMask mMask = ComponentMask::empty();
+	uint32_t mNumComponentTypes = 0;
+	sfz::DynArray<PrefabComponent> mComponents;
+	sfz::DynArray<uint8_t> mData;
+};
+
+} // namespace ph
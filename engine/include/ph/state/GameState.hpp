@@ -35,6 +35,11 @@ namespace ph {
 
 using sfz::Allocator;
 
+// Forward declarations
+// ------------------------------------------------------------------------------------------------
+
+class EntityPrefab;
+
 // Constants
 // ------------------------------------------------------------------------------------------------
 
@@ -50,7 +55,7 @@ constexpr uint64_t GAME_STATE_MAGIC_NUMBER =
 	uint64_t('E') << 56;
 
 // The current data layout version of the game state
-constexpr uint64_t GAME_STATE_VERSION = 4;
+constexpr uint64_t GAME_STATE_VERSION = 15;
 
 // The maximum number of entities a game state can hold
 //
@@ -58,6 +63,26 @@ constexpr uint64_t GAME_STATE_VERSION = 4;
 // the default-value when constructing an Entity) as an error code.
 constexpr uint32_t GAME_STATE_ECS_MAX_NUM_ENTITIES = ENTITY_ID_MAX - 1;
 
+// The number of entities the initialized part of the entity indexed arrays of a growable game
+// state grows by at a time, see GameStateCreateInfo::growable.
+constexpr uint32_t GAME_STATE_GROW_BLOCK_SIZE = 4096;
+
+// The granularity in bytes at which the memory of a growable game state is committed, the page
+// size of the supported platforms. See GameStateUncommittedRanges.
+constexpr uint32_t GAME_STATE_COMMIT_PAGE_SIZE = 4096;
+
+// The number of entities per block in the change block ticks of change tracked component types,
+// see the change tracking API in GameStateHeader.
+constexpr uint32_t GAME_STATE_CHANGE_BLOCK_SIZE = 64;
+
+// The kinds of changes recorded for change tracked component types, combined as flags when
+// querying changed entities.
+constexpr uint32_t COMPONENT_CHANGE_ADDED = 1u << 0;
+constexpr uint32_t COMPONENT_CHANGE_REMOVED = 1u << 1;
+constexpr uint32_t COMPONENT_CHANGE_WRITTEN = 1u << 2;
+constexpr uint32_t COMPONENT_CHANGE_ANY =
+	COMPONENT_CHANGE_ADDED | COMPONENT_CHANGE_REMOVED | COMPONENT_CHANGE_WRITTEN;
+
 // SingletonRegistryEntry struct
 // ------------------------------------------------------------------------------------------------
 
@@ -79,13 +104,179 @@ struct ComponentRegistryEntry final {
 	// if there is no associated data with the given component type.
 	uint32_t offset;
 
+	// The offsets in bytes to the ArrayHeaders of the sparse set for the specific type, ~0
+	// (UINT32_MAX) if the component type uses dense storage. The slots array (uint32_t) maps each
+	// entity id to the slot of its component in the components array, ~0 if the entity does not
+	// have the component. The entity ids array (uint32_t) maps each used slot to its entity id.
+	uint32_t offsetSparseSlots;
+	uint32_t offsetSparseEntityIds;
+
+	// The offset in bytes to the ArrayHeader of ComponentField for component types stored as
+	// structure-of-arrays, ~0 (UINT32_MAX) if the component type is stored as array-of-structs.
+	uint32_t offsetFields;
+
+	// The offsets in bytes to the ArrayHeaders of the change ticks (ComponentChangeTicks, one per
+	// entity) and the change block ticks (uint32_t, the latest tick stamped in each block of
+	// GAME_STATE_CHANGE_BLOCK_SIZE entities), ~0 (UINT32_MAX) if the component type is not change
+	// tracked.
+	uint32_t offsetChangeTicks;
+	uint32_t offsetChangeBlockTicks;
+
 	// Returns whether the component type has associated data or not.
 	bool componentTypeHasData() const noexcept { return offset != ~0u; }
 
-	static ComponentRegistryEntry createSized(uint32_t offset) noexcept { return { offset }; }
-	static ComponentRegistryEntry createUnsized() noexcept { return { ~0u }; }
+	// Returns whether the component type is stored as a sparse set or not.
+	bool componentTypeIsSparse() const noexcept { return offsetSparseSlots != ~0u; }
+
+	// Returns whether the component type is stored as structure-of-arrays or not.
+	bool componentTypeIsSoA() const noexcept { return offsetFields != ~0u; }
+
+	// Returns whether changes to the component type are tracked or not.
+	bool componentTypeIsChangeTracked() const noexcept { return offsetChangeTicks != ~0u; }
+
+	static ComponentRegistryEntry createSized(uint32_t offset) noexcept
+	{
+		return { offset, ~0u, ~0u, ~0u, ~0u, ~0u };
+	}
+	static ComponentRegistryEntry createSparse(
+		uint32_t offset, uint32_t offsetSlots, uint32_t offsetEntityIds) noexcept
+	{
+		return { offset, offsetSlots, offsetEntityIds, ~0u, ~0u, ~0u };
+	}
+	static ComponentRegistryEntry createSoA(uint32_t offset, uint32_t offsetFields) noexcept
+	{
+		return { offset, ~0u, ~0u, offsetFields, ~0u, ~0u };
+	}
+	static ComponentRegistryEntry createUnsized() noexcept
+	{
+		return { ~0u, ~0u, ~0u, ~0u, ~0u, ~0u };
+	}
+};
+static_assert(sizeof(ComponentRegistryEntry) == 24, "ComponentRegistryEntry is padded");
+
+// ComponentChangeTicks struct
+// ------------------------------------------------------------------------------------------------
+
+// The ticks at which a component type was last added to, removed from and written for an entity
+// id, see the change tracking API in GameStateHeader. 0 means never.
+struct ComponentChangeTicks final {
+	uint32_t added;
+	uint32_t removed;
+	uint32_t written;
+	uint32_t ___PADDING_UNUSED___;
+};
+static_assert(sizeof(ComponentChangeTicks) == 16, "ComponentChangeTicks is padded");
+
+// ComponentField struct
+// ------------------------------------------------------------------------------------------------
+
+// A field of a component type stored as structure-of-arrays. The fields of a component type
+// partition the component struct, i.e. field i + 1 starts where field i ends and the last field
+// ends at the end of the struct.
+struct ComponentField final {
+
+	// The offset in bytes to the field inside the component struct. The field's column starts
+	// at the same offset multiplied with the capacity of the components array.
+	uint32_t offset;
+
+	// The size in bytes of the field
+	uint32_t sizeInBytes;
+};
+static_assert(sizeof(ComponentField) == 8, "ComponentField is padded");
+
+// The number of entities the columns of a structure-of-arrays component type are padded to a
+// multiple of. Makes all columns 32-byte aligned regardless of field sizes.
+constexpr uint32_t GAME_STATE_SOA_COLUMN_ALIGNMENT = 32;
+
+// EntityQuery struct
+// ------------------------------------------------------------------------------------------------
+
+// A query for entities, matches all active entities which have all the components in the
+// required mask and none of the components in the excluded mask.
+//
+// Queries are registered when the game state is created. The game state then keeps a dense sorted
+// list of the ids of all entities matching each query, which is updated incrementally each time a
+// component mask is modified. Iterating over the entities matching a query is thus proportional to
+// the number of matching entities, not to the maximum number of entities.
+struct EntityQuery final {
+	ComponentMask required = ComponentMask::activeMask();
+	ComponentMask excluded = ComponentMask::empty();
+};
+
+// QueryRegistryEntry struct
+// ------------------------------------------------------------------------------------------------
+
+struct QueryRegistryEntry final {
+
+	// The mask of components a matching entity must have. Always includes the active bit.
+	ComponentMask required;
+
+	// The mask of components a matching entity must not have.
+	ComponentMask excluded;
+
+	// The offset in bytes to the ArrayHeader of ids (uint32_t) of the entities matching the query
+	uint32_t offset;
+
+	// Unused padding to ensure entry is 8-byte aligned.
+	uint32_t ___PADDING_UNUSED___;
+
+	bool matches(ComponentMask mask) const noexcept { return mask.fulfills(required, excluded); }
+};
+static_assert(sizeof(QueryRegistryEntry) == sizeof(ComponentMask) * 2 + 8, "QueryRegistryEntry is padded");
+
+// EntityRemap struct
+// ------------------------------------------------------------------------------------------------
+
+// An entity moved to a new id, see GameStateHeader::compactEntities().
+struct EntityRemap final {
+	Entity oldEntity;
+	Entity newEntity;
+};
+static_assert(sizeof(EntityRemap) == 8, "EntityRemap is padded");
+
+// ExternalIdSlot struct
+// ------------------------------------------------------------------------------------------------
+
+// A slot in the external id index, see the external id API in GameStateHeader. Only meaningful if
+// the slot's control byte marks it as full, all other slots are zero.
+struct ExternalIdSlot final {
+	uint64_t externalId;
+	Entity entity;
+	uint32_t ___PADDING_UNUSED___;
+};
+static_assert(sizeof(ExternalIdSlot) == 16, "ExternalIdSlot is padded");
+
+// EventQueueRegistryEntry struct
+// ------------------------------------------------------------------------------------------------
+
+struct EventQueueRegistryEntry final {
+
+	// The offset in bytes to the ArrayHeader of events. The size of the array is the number of
+	// events currently in the queue.
+	uint32_t offset;
+
+	// The number of events dropped because the queue was full since it was last cleared.
+	uint32_t numDroppedEvents;
+};
+static_assert(sizeof(EventQueueRegistryEntry) == 8, "EventQueueRegistryEntry is padded");
+
+// EntityAllocationPolicy enum
+// ------------------------------------------------------------------------------------------------
+
+// The policy used to pick which free entity id to hand out when creating an entity.
+enum class EntityAllocationPolicy : uint32_t {
+
+	// The most recently freed entity id is reused first. Stored as a stack of free entity ids.
+	// Cheapest option, but after a lot of churn the live entities end up scattered over the
+	// entire id range.
+	LIFO = 0,
+
+	// The lowest free entity id is always used. Stored as a hierarchical bitset with one bit per
+	// entity id (set if free) and one bit per 64-bit word on each level above. Keeps the live
+	// entities densely packed at the start of the id range, and thus also the entityHighWaterMark
+	// low.
+	LOWEST_ID_FIRST = 1
 };
-static_assert(sizeof(ComponentRegistryEntry) == 4, "ComponentRegistryEntry is padded");
 
 // GameState
 // ------------------------------------------------------------------------------------------------
@@ -100,6 +291,8 @@ static_assert(sizeof(ComponentRegistryEntry) == 4, "ComponentRegistryEntry is pa
 // S = number of singletons
 // N = max number of entities
 // K = number of component systems
+// Q = number of entity queries
+// E = number of event queues
 // The game state has the following representation in memory:
 //
 // | GameState header |
@@ -135,6 +328,81 @@ static_assert(sizeof(ComponentRegistryEntry) == 4, "ComponentRegistryEntry is pa
 // | Component type K-1, entity 0 |
 // | ... |
 // | Component type K-1, entity N-1 |
+// | (Component type K-1 sparse slots array header) |
+// | (Component type K-1 sparse slot, entity 0) |
+// | ... |
+// | (Component type K-1 sparse entity ids array header) |
+// | ... |
+// | (Component type K-1 fields array header) |
+// | (Component type K-1 field 0) |
+// | ... |
+// | Query registry array header |
+// | QueryRegistryEntry 0 |
+// | ... |
+// | QueryRegistryEntry Q-1 |
+// | Query 0 entity ids array header |
+// | Query 0, matching entity id 0 |
+// | ... |
+// | Query 0, matching entity id N-1 |
+// | ... |
+// | Query Q-1 entity ids array header |
+// | Query Q-1, matching entity id 0 |
+// | ... |
+// | Query Q-1, matching entity id N-1 |
+// | Free entity ids bitset array header |
+// | Free entity ids bitset word 0 |
+// | ... |
+// | Dirty bitset array header |
+// | Dirty bitset, component type 0, word 0 |
+// | ... |
+// | Dirty bitset, component type K-1, last word |
+// | (Change tracked component type k change ticks array header) |
+// | (Change tracked component type k change ticks, entity 0) |
+// | ... |
+// | (Change tracked component type k change block ticks array header) |
+// | ... |
+// | Hash cache array header |
+// | Cached hash, component type 0 |
+// | ... |
+// | Cached hash, singleton S-1 |
+// | External ids array header |
+// | External id, entity 0 |
+// | ... |
+// | External id, entity N-1 |
+// | External id index control bytes array header |
+// | Control byte, slot 0 |
+// | ... |
+// | External id index slots array header |
+// | ExternalIdSlot 0 |
+// | ... |
+// | Event queue registry array header |
+// | EventQueueRegistryEntry 0 |
+// | ... |
+// | EventQueueRegistryEntry E-1 |
+// | Event queue 0 events array header |
+// | Event queue 0, event 0 |
+// | ... |
+// | Event queue E-1 events array header |
+// | ... |
+//
+// Only one of the free entity ids list and the free entity ids bitset is used depending on the
+// EntityAllocationPolicy, the other one has a capacity of 0. The dirty bitset has a capacity of 0
+// if dirty tracking is disabled. The external ids and the external id index have a capacity of 0
+// if external ids are disabled.
+//
+// Component types using sparse storage (see GameStateCreateInfo) instead have a packed array of
+// only as many components as they have slots, followed by the sparse slots and entity ids arrays
+// (see ComponentRegistryEntry). The components are kept packed at the start of the array, the
+// array's size is the number of entities currently having the component.
+//
+// Component types using structure-of-arrays storage (see GameStateCreateInfo) have the same
+// components array, but its data is split into one column per field instead of one struct per
+// entity. The array's capacity is maxNumEntities rounded up to GAME_STATE_SOA_COLUMN_ALIGNMENT,
+// and the column of a field starts at the field's offset in the struct times the capacity. The
+// array is followed by the fields array (ComponentField) describing the columns.
+//
+// Each change tracked component type (see GameStateCreateInfo) has a change ticks array and a
+// change block ticks array, in ascending component type order.
 struct GameStateHeader {
 
 	// Members
@@ -176,7 +444,8 @@ struct GameStateHeader {
 	// offsets to the ArrayHeaders for the various component types
 	uint32_t offsetComponentRegistry;
 
-	// Offset in bytes to the ArrayHeader of free entity ids (uint32_t)
+	// Offset in bytes to the ArrayHeader of free entity ids (uint32_t), only used with the LIFO
+	// EntityAllocationPolicy.
 	uint32_t offsetFreeEntityIdsList;
 
 	// Offset in bytes to the ArrayHeader of ComponentMask, each entity is its own index into this
@@ -186,8 +455,76 @@ struct GameStateHeader {
 	// Offset in bytes to the ArrayHeader of entity generations (uint8_t)
 	uint32_t offsetEntityGenerationsList;
 
+	// The number of entity queries registered in the game state.
+	uint32_t numQueries;
+
+	// Offset in bytes to the ArrayHeader of QueryRegistryEntry which in turn contains the offsets
+	// to the ArrayHeaders of entity ids matching each query.
+	uint32_t offsetQueryRegistry;
+
+	// The EntityAllocationPolicy used by this game state.
+	EntityAllocationPolicy entityAllocationPolicy;
+
+	// Offset in bytes to the ArrayHeader of the hierarchical free entity ids bitset (uint64_t),
+	// only used with the LOWEST_ID_FIRST EntityAllocationPolicy.
+	uint32_t offsetFreeEntityIdsBitset;
+
+	// One past the highest id of any currently existing entity, 0 if there are no entities. It is
+	// safe to use this as the upper bound when iterating over all entities, all ids above it are
+	// guaranteed to be inactive.
+	uint32_t entityHighWaterMark;
+
+	// The number of entities per block in the dirty bitset, 0 if dirty tracking is disabled.
+	uint32_t dirtyBlockSize;
+
+	// Offset in bytes to the ArrayHeader of the dirty bitset (uint64_t). The bitset has one row
+	// per component type, each with one bit per block of dirtyBlockSize entities.
+	uint32_t offsetDirtyBitset;
+
+	// Bit i is set if singleton i has been marked as dirty.
+	uint64_t dirtySingletons;
+
+	// Offset in bytes to the ArrayHeader of cached hashes (uint64_t), one per component type
+	// followed by one per singleton. 0 means that there is no valid cached hash (a hash that
+	// happens to be 0 is remapped to 1), see the state hash API.
+	uint32_t offsetHashCache;
+
+	// The number of bits in each ComponentMask (PH_COMPONENT_MASK_NUM_BITS) the state was created
+	// with, a state can only be used by code compiled with the same mask width.
+	uint32_t componentMaskNumBits;
+
+	// The current change tick, stamped on all changes to change tracked component types. Starts
+	// at 1, 0 if no component type is change tracked. See the change tracking API.
+	uint32_t changeTick;
+
+	// The number of entity ids for which the entity indexed arrays are committed and initialized.
+	// Grows along with the entityHighWaterMark in growable game states (see GameStateCreateInfo),
+	// the memory above it is zero and never accessed (see GameStateUncommittedRanges). Always
+	// equal to maxNumEntities in other game states.
+	uint32_t committedNumEntities;
+
+	// Offset in bytes to the ArrayHeader of external ids (uint64_t), each entity is its own index
+	// into this array. See the external id API.
+	uint32_t offsetExternalIds;
+
+	// Offset in bytes to the ArrayHeader of the external id index's control bytes (uint8_t), which
+	// is directly followed by the ArrayHeader of its slots (ExternalIdSlot). See the external id
+	// API.
+	uint32_t offsetExternalIdIndex;
+
+	// The external id to try to give the next created entity. Starts at 1, 0 if external ids are
+	// disabled. See the external id API.
+	uint64_t nextExternalId;
+
+	// The number of event queues in the game state.
+	uint32_t numEventQueues;
+
+	// Offset in bytes to the ArrayHeader of EventQueueRegistryEntry which in turn contains the
+	// offsets to the ArrayHeaders of the events of each queue.
+	uint32_t offsetEventQueueRegistry;
+
 	// Unused padding to ensure header is 32-byte aligned.
-	uint32_t ___PADDING_UNUSED___[1];
+	uint32_t ___PADDING_UNUSED___[6];
 
 	// Singleton state API
 	// --------------------------------------------------------------------------------------------
@@ -224,21 +561,94 @@ struct GameStateHeader {
 	// --------------------------------------------------------------------------------------------
 
 	// Creates a new entity with no associated components. Index is guaranteed to be smaller than
-	// the ECS system's maximum number of entities. Indices used for removed entities will be used.
-	// Returns Entity::invalid() if no more free entities are available.
+	// the ECS system's maximum number of entities. Indices used for removed entities will be used,
+	// which one is picked depends on the EntityAllocationPolicy. Returns Entity::invalid() if no
+	// more free entities are available.
 	// Complexity: O(1)
 	Entity createEntity() noexcept;
 
 	// Deletes the given entity and deletes (clears) all associated components. Returns whether
 	// successful or not.
-	// Complexity: O(K) where K is number of component types
+	// Complexity: O(K) where K is number of component types the entity has
 	bool deleteEntity(Entity entity) noexcept;
 	bool deleteEntity(uint32_t entityId) noexcept;
 
-	// Clones a given entity and all its components. Returns Entity::invalid() on failure.
+	// Clones a given entity and all its components. Returns Entity::invalid() on failure, which
+	// includes running out of slots for one of the entity's sparse component types.
 	// Complexity: O(K) where K is number of component types
 	Entity cloneEntity(Entity entity) noexcept;
 
+	// Bulk versions of the above. These produce the exact same state as calling the single entity
+	// versions in a loop, but pop/push the free entity ids list in one go and update each cached
+	// query once per batch instead of once per entity.
+	//
+	// createEntities() creates up to numEntities entities and writes them to entitiesOut, returns
+	// the number of entities created (fewer than requested if the free entity ids ran out).
+	//
+	// deleteEntities() deletes all the given entities, invalid entities (wrong generation, already
+	// deleted, etc) are skipped. Returns the number of entities deleted.
+	//
+	// cloneEntityN() creates up to numClones clones of the given entity and writes them to
+	// entitiesOut, returns the number of clones created (0 if the entity is invalid). Fewer clones
+	// are created if the entity's sparse component types do not have enough free slots.
+	//
+	// Complexity: O(N * K + Q * M) where N is number of entities in the batch, K is number of
+	// component types, Q is number of queries and M is max number of entities.
+	uint32_t createEntities(uint32_t numEntities, Entity* entitiesOut) noexcept;
+	uint32_t deleteEntities(const Entity* entities, uint32_t numEntities) noexcept;
+	uint32_t cloneEntityN(Entity entity, uint32_t numClones, Entity* entitiesOut) noexcept;
+
+	// Creates up to numInstances entities with the mask and components of the given prefab (see
+	// EntityPrefab) and writes them to entitiesOut. Returns the number of entities created, fewer
+	// than requested if the free entity ids or the slots of the prefab's sparse component types
+	// ran out. Produces the same state as cloneEntityN() on the prefab's template entity, but the
+	// components are written one component type at a time, as one contiguous fill per run of
+	// consecutive entity ids.
+	//
+	// The second version calls overrideFunc(uint32_t instanceIdx, Entity entity) for each created
+	// entity after all components have been written, e.g. to give each instance its own position.
+	// The components of the new entities are already marked dirty, so the callback may write to
+	// them directly without calling markDirty().
+	//
+	// Complexity: O(N * C + Q * M) where N is number of entities created, C is the size of the
+	// prefab's components, Q is number of queries and M is max number of entities.
+	uint32_t instantiatePrefab(
+		const EntityPrefab& prefab, uint32_t numInstances, Entity* entitiesOut) noexcept;
+
+	template<typename Func>
+	uint32_t instantiatePrefab(
+		const EntityPrefab& prefab,
+		uint32_t numInstances,
+		Entity* entitiesOut,
+		Func&& overrideFunc) noexcept
+	{
+		uint32_t numCreated = this->instantiatePrefab(prefab, numInstances, entitiesOut);
+		for (uint32_t i = 0; i < numCreated; i++) {
+			overrideFunc(i, entitiesOut[i]);
+		}
+		return numCreated;
+	}
+
+	// Moves up to maxNumMoves of the highest live entities to the lowest free ids, so that after
+	// a lot of spawn and despawn churn the live entities end up densely packed at the start of the
+	// id range again. Intended to be called with a small budget once per frame until it returns
+	// 0, which means that the live entities are packed, i.e. entityHighWaterMark equals
+	// currentNumEntities.
+	//
+	// A moved entity keeps its component mask and components, but gets a new id. The old id is
+	// freed and its generation incremented, so old handles become invalid. The moves are written
+	// to remapOut (which must have space for maxNumMoves entries) in the order they were made,
+	// game code storing Entity handles (or raw entity ids, e.g. in a SpatialHashGrid) must use them
+	// to fix those. Cached queries are updated, and change tracked component types record the
+	// move as a removal from the old id and an addition to the new one. With the LIFO allocation
+	// policy the free entity ids list is rebuilt with the lowest ids on top, so that new entities
+	// also fill the start of the id range.
+	//
+	// Returns the number of entities moved.
+	// Complexity: O(S * K + Q * M) where S is maxNumMoves, plus O(N) to find free ids and rebuild
+	// the free entity ids list with the LIFO allocation policy
+	uint32_t compactEntities(uint32_t maxNumMoves, EntityRemap* remapOut) noexcept;
+
 	// Returns pointer to the contiguous array of ComponentMask.
 	// Complexity: O(1)
 	ComponentMask* componentMasks() noexcept;
@@ -272,6 +682,10 @@ struct GameStateHeader {
 	// Returns pointer to the contiguous array of components of a given component type. Returns
 	// nullptr if the component type does not have associated data or does not exist. The second
 	// parameter returns the size of each component in bytes.
+	//
+	// For dense component types the array is indexed by entity id. For sparse component types it
+	// is instead the packed array of components, indexed by slot, see sparseEntityIds(). For
+	// structure-of-arrays component types it is the raw columns, see componentField().
 	// Complexity: O(1)
 	uint8_t* componentsUntyped(uint32_t componentType, uint32_t& componentSizeBytesOut) noexcept;
 	const uint8_t* componentsUntyped(uint32_t componentType, uint32_t& componentSizeBytesOut) const noexcept;
@@ -284,6 +698,7 @@ struct GameStateHeader {
 	{
 		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
 		static_assert(std::is_trivially_destructible<T>::value, "ECS components must be trivially destructible");
+		sfz_assert(!componentTypeIsSoA(componentType));
 		uint32_t componentSize = 0;
 		T* components = (T*)componentsUntyped(componentType, componentSize);
 		sfz_assert(sizeof(T) == componentSize);
@@ -294,13 +709,113 @@ struct GameStateHeader {
 	{
 		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
 		static_assert(std::is_trivially_destructible<T>::value, "ECS components must be trivially destructible");
+		sfz_assert(!componentTypeIsSoA(componentType));
 		uint32_t componentSize = 0;
 		const T* components = (const T*)componentsUntyped(componentType, componentSize);
 		sfz_assert(sizeof(T) == componentSize);
 		return components;
 	}
 
-	// Adds a component to an entity. Returns whether succesful or not.
+	// Returns whether the given component type is stored as a sparse set or not.
+	// Complexity: O(1)
+	bool componentTypeIsSparse(uint32_t componentType) const noexcept;
+
+	// Returns pointer to the dense array of entity ids for a sparse component type, the entity at
+	// index i owns the component in slot i of the components() array. Returns nullptr if the
+	// component type is not sparse. The second parameter returns the number of components (and
+	// entity ids) currently stored. The order changes when components are deleted.
+	// Complexity: O(1)
+	const uint32_t* sparseEntityIds(uint32_t componentType, uint32_t& numComponentsOut) const noexcept;
+
+	// Returns whether the given component type is stored as structure-of-arrays or not.
+	// Complexity: O(1)
+	bool componentTypeIsSoA(uint32_t componentType) const noexcept;
+
+	// Returns pointer to the fields of a structure-of-arrays component type, nullptr if the
+	// component type is not stored as structure-of-arrays. The second parameter returns the
+	// number of fields.
+	// Complexity: O(1)
+	const ComponentField* componentFields(uint32_t componentType, uint32_t& numFieldsOut) const noexcept;
+
+	// Returns pointer to the column of the given field of a structure-of-arrays component type,
+	// indexed by entity id. Columns are 32-byte aligned and padded with (always zero) elements
+	// to a multiple of GAME_STATE_SOA_COLUMN_ALIGNMENT entities, so a system can stream over
+	// [0, entityHighWaterMark) rounded up using aligned SIMD loads. Returns nullptr if the
+	// component type is not stored as structure-of-arrays or the field does not exist. The last
+	// parameter returns the size of each element in the column.
+	//
+	// Writing to a column directly does not update the dirty tracking, see markDirtyRange().
+	// Complexity: O(1)
+	uint8_t* componentFieldUntyped(
+		uint32_t componentType, uint32_t fieldIdx, uint32_t& fieldSizeBytesOut) noexcept;
+	const uint8_t* componentFieldUntyped(
+		uint32_t componentType, uint32_t fieldIdx, uint32_t& fieldSizeBytesOut) const noexcept;
+
+	// Returns typed pointer to the column of the given field, see componentFieldUntyped(). The
+	// requested type (T) must be of the correct size.
+	// Complexity: O(1)
+	template<typename T>
+	T* componentField(uint32_t componentType, uint32_t fieldIdx) noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+		uint32_t fieldSize = 0;
+		T* column = (T*)componentFieldUntyped(componentType, fieldIdx, fieldSize);
+		sfz_assert(column == nullptr || sizeof(T) == fieldSize);
+		return column;
+	}
+	template<typename T>
+	const T* componentField(uint32_t componentType, uint32_t fieldIdx) const noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+		uint32_t fieldSize = 0;
+		const T* column = (const T*)componentFieldUntyped(componentType, fieldIdx, fieldSize);
+		sfz_assert(column == nullptr || sizeof(T) == fieldSize);
+		return column;
+	}
+
+	// Copies the component of the given type for the given entity id to dst, regardless of which
+	// storage the component type uses. Structure-of-arrays components are gathered from their
+	// columns. Returns false if the entity does not have the component, if the component type
+	// does not have associated data or if dstSize does not match the component size. Use
+	// addComponent() to write a component back.
+	// Complexity: O(F) where F is the number of fields
+	bool readComponentUntyped(
+		uint32_t componentType, uint32_t entityId, uint8_t* dst, uint32_t dstSize) const noexcept;
+
+	template<typename T>
+	bool readComponent(uint32_t componentType, uint32_t entityId, T& componentOut) const noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+		return readComponentUntyped(componentType, entityId, (uint8_t*)&componentOut, sizeof(T));
+	}
+
+	// Returns pointer to the component of the given type for the given entity id, for dense and
+	// sparse storage. Returns nullptr if the entity does not have the component, if the component
+	// type does not have associated data, or if it is stored as structure-of-arrays (where the
+	// fields are not contiguous, see readComponentUntyped()). The pointer is invalidated when a
+	// component of the same type is deleted.
+	// Complexity: O(1)
+	uint8_t* componentUntyped(uint32_t componentType, uint32_t entityId) noexcept;
+	const uint8_t* componentUntyped(uint32_t componentType, uint32_t entityId) const noexcept;
+
+	template<typename T>
+	T* component(uint32_t componentType, uint32_t entityId) noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+		static_assert(std::is_trivially_destructible<T>::value, "ECS components must be trivially destructible");
+		return (T*)componentUntyped(componentType, entityId);
+	}
+	template<typename T>
+	const T* component(uint32_t componentType, uint32_t entityId) const noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "ECS components must be trivially copyable");
+		static_assert(std::is_trivially_destructible<T>::value, "ECS components must be trivially destructible");
+		return (const T*)componentUntyped(componentType, entityId);
+	}
+
+	// Adds a component to an entity. Returns whether succesful or not. If data is nullptr the
+	// component is zero initialized. Fails if the component type is sparse and all its slots are
+	// used (unless the entity already has the component).
 	// Complexity: O(1)
 	bool addComponentUntyped(
 		Entity entity, uint32_t componentType, const uint8_t* data, uint32_t dataSize) noexcept;
@@ -323,6 +838,279 @@ struct GameStateHeader {
 	// Complexity: O(1)
 	bool deleteComponent(Entity entity, uint32_t componentType) noexcept;
 
+	// Dirty tracking API
+	// --------------------------------------------------------------------------------------------
+
+	// Opt-in tracking of which parts of the state have been modified, enabled by specifying a
+	// dirty block size when creating the game state. Intended to be cleared at the start of each
+	// tick, after which consumers (snapshots, network replication, editors, etc) only need to look
+	// at the dirty parts of the state.
+	//
+	// Component data is tracked per component type and block of dirtyBlockSize entities. Component
+	// type 0 (the active bit, which has no data) is used for the entity bookkeeping, i.e. the
+	// component masks and the entity generations. Singletons are tracked individually.
+	//
+	// All the ECS API functions above mark what they modify. Writes made directly through pointers
+	// (components(), singleton(), etc) must be marked manually using markDirty(). Marking is thread
+	// safe and does nothing if dirty tracking is disabled.
+
+	bool dirtyTrackingEnabled() const noexcept { return dirtyBlockSize != 0; }
+
+	// The number of blocks (bits) per component type, 0 if dirty tracking is disabled.
+	uint32_t numDirtyBlocks() const noexcept;
+
+	// Marks the block(s) containing the given entity/entities as dirty for the given component type.
+	// Also stamps the entity/entities as written if the component type is change tracked.
+	// Complexity: O(1) / O(B) where B is number of blocks in range
+	void markDirty(uint32_t componentType, uint32_t entityId) noexcept;
+	void markDirtyRange(uint32_t componentType, uint32_t firstEntityId, uint32_t numEntities) noexcept;
+
+	// Marks the given singleton as dirty.
+	// Complexity: O(1)
+	void markSingletonDirty(uint32_t singletonIndex) noexcept;
+
+	// Returns whether the block containing the given entity is dirty for the given component type.
+	// Always returns true if dirty tracking is disabled.
+	// Complexity: O(1)
+	bool isDirty(uint32_t componentType, uint32_t entityId) const noexcept;
+
+	// Returns the bitset (numDirtyBlocks() bits) of dirty blocks for the given component type,
+	// bit i corresponds to entities [i * dirtyBlockSize, (i + 1) * dirtyBlockSize). Returns nullptr
+	// if dirty tracking is disabled.
+	uint64_t* dirtyBlocks(uint32_t componentType) noexcept;
+	const uint64_t* dirtyBlocks(uint32_t componentType) const noexcept;
+
+	// Clears all dirty bits, intended to be called at the start of each tick.
+	// Complexity: O(K * N / B) where B is dirtyBlockSize, a single small memset()
+	void clearDirty() noexcept;
+
+	// Change tracking API
+	// --------------------------------------------------------------------------------------------
+
+	// Opt-in tracking of which entities had a component type added, removed or written, enabled
+	// per component type when creating the game state. Each change is stamped with the current
+	// changeTick, so that downstream systems can process only the entities changed since they
+	// last ran instead of the whole population. Component type 0 (the active bit) records the
+	// creation (added) and deletion (removed) of entities.
+	//
+	// Added and removed are stamped by all ECS API functions modifying component masks, including
+	// componentMaskModified(). Written is stamped by markDirty() and markDirtyRange(), and by
+	// addComponent() if the entity already had the component, so writes made directly through
+	// pointers must be marked just like for the dirty tracking. The stamps belong to the entity id,
+	// not the entity, i.e. a deleted entity's id can report both the removal and the creation of
+	// a new entity reusing it. Stamping is thread safe for distinct entities. Change ticks are not
+	// part of the state hash.
+
+	bool changeTrackingEnabled() const noexcept { return changeTick != 0; }
+
+	// Returns whether changes to the given component type are tracked or not.
+	bool componentTypeIsChangeTracked(uint32_t componentType) const noexcept;
+
+	// Increments the change tick and returns the new one, intended to be called at the start of
+	// each tick. Does nothing and returns 0 if change tracking is disabled.
+	// Complexity: O(1)
+	uint32_t advanceChangeTick() noexcept;
+
+	// Returns the change ticks (one per entity id) of the given component type. Returns nullptr
+	// if the component type is not change tracked.
+	ComponentChangeTicks* componentChangeTicks(uint32_t componentType) noexcept;
+	const ComponentChangeTicks* componentChangeTicks(uint32_t componentType) const noexcept;
+
+	// Finds all entity ids which have had any of the selected kinds of changes (combination of
+	// COMPONENT_CHANGE_ADDED, _REMOVED and _WRITTEN) stamped at firstTick or later for the given
+	// component type. E.g. firstTick = changeTick gives the changes made this tick. The ids are
+	// written in ascending order to entityIdsOut, which must have space for maxNumEntities ids.
+	// Returns the number of changed entity ids, 0 if the component type is not change tracked.
+	// Blocks of GAME_STATE_CHANGE_BLOCK_SIZE entities without any change are skipped.
+	// Complexity: O(N / B + C * B) where C is the number of changed blocks
+	uint32_t changedEntities(uint32_t componentType, uint32_t firstTick, uint32_t changeKinds,
+		uint32_t* entityIdsOut) const noexcept;
+
+	// External id API
+	// --------------------------------------------------------------------------------------------
+
+	// Opt-in stable 64-bit ids for entities, enabled when creating the game state. Unlike an
+	// Entity an external id is not reused when the entity is deleted and survives
+	// compactEntities(), so it can be used to refer to entities from outside the state, e.g. from
+	// save files, level data or network messages. External id 0 means no external id.
+	//
+	// Every created entity (including clones and prefab instances) is given nextExternalId, which
+	// is then incremented. Ids already in use (see setExternalId()) are skipped. Deleting an
+	// entity removes its external id.
+	//
+	// The external id of each entity is stored in an entity indexed array, and the mapping back to
+	// entities in an open addressing hash table (the external id index). Both are stored inside
+	// the state, so they are cloned, snapshotted and rolled back along with everything else. The
+	// index is probed 16 slots at a time using SSE2, and kept at most 7/8 full. The external ids
+	// are entity bookkeeping, i.e. they are marked dirty as component type 0 and are part of its
+	// hash. The index is derived from them and is not hashed.
+
+	bool externalIdsEnabled() const noexcept { return nextExternalId != 0; }
+
+	// Returns the external id of the given entity, 0 if the entity is invalid, has no external id
+	// or if external ids are disabled.
+	// Complexity: O(1)
+	uint64_t externalId(Entity entity) const noexcept;
+
+	// Returns the entity with the given external id, Entity::invalid() if there is none.
+	// Complexity: O(1)
+	Entity findEntity(uint64_t externalId) const noexcept;
+
+	// Replaces the external id of the given entity, e.g. with an id loaded from a level file. 0
+	// removes the entity's external id. Returns false if the entity is invalid, if external ids
+	// are disabled or if another entity already has the external id.
+	// Complexity: O(1) amortized, O(H) if the index needs to be rebuilt to clear deleted slots
+	bool setExternalId(Entity entity, uint64_t externalId) noexcept;
+
+	// Returns pointer to the contiguous array of external ids (uint64_t), each entity is its own
+	// index into it. Returns nullptr if external ids are disabled. Use setExternalId() to modify.
+	// Complexity: O(1)
+	const uint64_t* externalIds() const noexcept;
+
+	// Event queue API
+	// --------------------------------------------------------------------------------------------
+
+	// Fixed capacity queues of trivially copyable events, registered when creating the game state
+	// (see EventQueueDesc). Intended for systems to communicate within a tick, e.g. weapon systems
+	// pushing damage events consumed by a health system, instead of through components that have
+	// to be scanned for. The events are stored inside the state, so they are cloned, snapshotted
+	// and rolled back along with everything else.
+	//
+	// Pushing is thread safe, each push atomically reserves a range at the end of the queue and
+	// then writes the events to it. Events which do not fit are dropped and counted. Pushing is
+	// NOT thread safe with reading or clearing the queue, see SystemDesc for how to declare event
+	// queue accesses to the SystemScheduler. The order of events pushed from multiple threads
+	// depends on timing, consumers which must be deterministic need to sort them. For the same
+	// reason event queues are not part of the state hash.
+
+	// Reserves up to numEvents events at the end of the given queue and returns pointer to the
+	// first one, the events must be written before the queue is read. The number of reserved
+	// events is returned in numReservedOut, fewer than requested if the queue ran out of space.
+	// Returns nullptr if no events could be reserved or if the queue does not exist.
+	// Complexity: O(1), a single atomic compare-and-swap unless contended
+	uint8_t* reserveEventsUntyped(
+		uint32_t queueIdx, uint32_t eventSize, uint32_t numEvents, uint32_t& numReservedOut) noexcept;
+
+	template<typename T>
+	T* reserveEvents(uint32_t queueIdx, uint32_t numEvents, uint32_t& numReservedOut) noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Events must be trivially copyable");
+		return (T*)reserveEventsUntyped(queueIdx, sizeof(T), numEvents, numReservedOut);
+	}
+
+	// Pushes up to numEvents events to the given queue, returns the number of events pushed.
+	// Complexity: O(N) where N is the number of events, plus one reservation
+	uint32_t pushEventsUntyped(
+		uint32_t queueIdx, const uint8_t* events, uint32_t eventSize, uint32_t numEvents) noexcept;
+
+	template<typename T>
+	uint32_t pushEvents(uint32_t queueIdx, const T* events, uint32_t numEvents) noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Events must be trivially copyable");
+		return pushEventsUntyped(queueIdx, (const uint8_t*)events, sizeof(T), numEvents);
+	}
+
+	template<typename T>
+	bool pushEvent(uint32_t queueIdx, const T& event) noexcept
+	{
+		return pushEvents(queueIdx, &event, 1) == 1;
+	}
+
+	// Returns pointer to the contiguous array of events currently in the given queue, in the order
+	// they were reserved. Returns nullptr if the queue does not exist. The second parameter
+	// returns the number of events, the third the size of each event in bytes.
+	// Complexity: O(1)
+	const uint8_t* eventsUntyped(
+		uint32_t queueIdx, uint32_t& numEventsOut, uint32_t& eventSizeBytesOut) const noexcept;
+
+	template<typename T>
+	const T* events(uint32_t queueIdx, uint32_t& numEventsOut) const noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Events must be trivially copyable");
+		uint32_t eventSize = 0;
+		const T* events = (const T*)eventsUntyped(queueIdx, numEventsOut, eventSize);
+		sfz_assert(events == nullptr || sizeof(T) == eventSize);
+		return events;
+	}
+
+	// Returns the number of events dropped because the given queue was full since it was last
+	// cleared.
+	// Complexity: O(1)
+	uint32_t numDroppedEvents(uint32_t queueIdx) const noexcept;
+
+	// Clears the given queue or all queues, the second version is intended to be called at the
+	// start of each tick. The events are zeroed, so that a cleared queue is identical to a newly
+	// created one.
+	// Complexity: O(size of the events in the queue(s))
+	void clearEvents(uint32_t queueIdx) noexcept;
+	void clearEvents() noexcept;
+
+	// State hash API
+	// --------------------------------------------------------------------------------------------
+
+	// A deterministic 64-bit hash of the state (see hashStateBytes()), e.g. for detecting desyncs
+	// in lockstep and rollback sessions. The hash of each part of the state, i.e. the entity
+	// bookkeeping (component masks and generations, selected by component type 0), each component
+	// array and each singleton, is computed separately and then combined in order. Only the
+	// committed entities (see committedNumEntities) of the entity indexed arrays are hashed.
+	//
+	// If dirty tracking is enabled the hash of each part is cached in the state, and only
+	// recomputed if the part has been marked dirty since. Writes made directly through pointers
+	// must thus be marked using markDirty() or the cached hashes become stale. Without dirty
+	// tracking everything selected is hashed every time.
+	//
+	// The raw bytes are hashed, so padding inside components and singletons must be deterministic
+	// (e.g. zeroed) for the hash to be.
+
+	// Hashes the selected component types and singletons (bit i set selects singleton i).
+	// Complexity: O(size of selected parts which are dirty or uncached)
+	uint64_t hash(ComponentMask componentTypes, uint64_t singletons) noexcept;
+
+	// Hashes the entire ECS state and all singletons.
+	uint64_t hash() noexcept
+	{
+		return this->hash(ComponentMask::all(), ~uint64_t(0));
+	}
+
+	// Returns the hash of a single component type or singleton, as used by hash() above. Never 0.
+	uint64_t componentTypeHash(uint32_t componentType) noexcept;
+	uint64_t singletonHash(uint32_t singletonIndex) noexcept;
+
+	// Query API
+	// --------------------------------------------------------------------------------------------
+
+	// Returns pointer to the dense array of ids of all entities currently matching the given
+	// query, sorted in ascending order. Returns nullptr if the query does not exist. The second
+	// parameter returns the number of matching entities.
+	// Complexity: O(1)
+	const uint32_t* queryEntities(uint32_t queryIdx, uint32_t& numEntitiesOut) const noexcept;
+
+	// Returns the registry entry (i.e. the required and excluded masks) for the given query.
+	// Complexity: O(1)
+	const QueryRegistryEntry& queryEntry(uint32_t queryIdx) const noexcept;
+
+	// Updates the entity id lists of all queries after the component mask of an entity has been
+	// modified. Called by all ECS API functions modifying masks, only needs to be called manually
+	// if a mask is modified directly through componentMasks(). Also marks the entity bookkeeping
+	// dirty and stamps the added and removed change tracked component types.
+	// Complexity: O(Q * log(M) + M) where M is the number of entities matching a query
+	void componentMaskModified(uint32_t entityId, ComponentMask oldMask) noexcept;
+
+	// Finds all entities fulfilling the required mask and having none of the components in the
+	// excluded mask without using a cached query. Useful for ad-hoc queries. The ids are written in
+	// ascending order to entityIdsOut, which must have space for maxNumEntities ids. Returns the
+	// number of matching entities. Only the ids below entityHighWaterMark are scanned. See
+	// scanComponentMasks().
+	// Complexity: O(H) where H is the entityHighWaterMark
+	uint32_t scanEntities(
+		ComponentMask required, ComponentMask excluded, uint32_t* entityIdsOut) const noexcept;
+
+	// Rebuilds the entity id lists of all queries from scratch by scanning all component masks.
+	// Only needed if component masks have been modified directly without calling
+	// componentMaskModified(). Scans the entire id range and recalculates the entityHighWaterMark.
+	// Complexity: O(Q * N) where N is the max number of entities
+	void rebuildQueries() noexcept;
+
 	// Accessing arrays
 	// --------------------------------------------------------------------------------------------
 
@@ -338,9 +1126,39 @@ struct GameStateHeader {
 	ArrayHeader* componentMasksArray() noexcept { return arrayAt(offsetComponentMasks); }
 	const ArrayHeader* componentMasksArray() const noexcept { return arrayAt(offsetComponentMasks); }
 
+	ArrayHeader* freeEntityIdsBitsetArray() noexcept { return arrayAt(offsetFreeEntityIdsBitset); }
+	const ArrayHeader* freeEntityIdsBitsetArray() const noexcept { return arrayAt(offsetFreeEntityIdsBitset); }
+
+	ArrayHeader* dirtyBitsetArray() noexcept { return arrayAt(offsetDirtyBitset); }
+	const ArrayHeader* dirtyBitsetArray() const noexcept { return arrayAt(offsetDirtyBitset); }
+
+	ArrayHeader* hashCacheArray() noexcept { return arrayAt(offsetHashCache); }
+	const ArrayHeader* hashCacheArray() const noexcept { return arrayAt(offsetHashCache); }
+
+	ArrayHeader* externalIdsArray() noexcept { return arrayAt(offsetExternalIds); }
+	const ArrayHeader* externalIdsArray() const noexcept { return arrayAt(offsetExternalIds); }
+
+	ArrayHeader* externalIdIndexArray() noexcept { return arrayAt(offsetExternalIdIndex); }
+	const ArrayHeader* externalIdIndexArray() const noexcept { return arrayAt(offsetExternalIdIndex); }
+
+	ArrayHeader* externalIdSlotsArray() noexcept
+	{
+		return reinterpret_cast<ArrayHeader*>(externalIdIndexArray()->firstByteAfterArray32Byte());
+	}
+	const ArrayHeader* externalIdSlotsArray() const noexcept
+	{
+		return reinterpret_cast<const ArrayHeader*>(externalIdIndexArray()->firstByteAfterArray32Byte());
+	}
+
+	ArrayHeader* eventQueueRegistryArray() noexcept { return arrayAt(offsetEventQueueRegistry); }
+	const ArrayHeader* eventQueueRegistryArray() const noexcept { return arrayAt(offsetEventQueueRegistry); }
+
 	ArrayHeader* entityGenerationsListArray() noexcept { return arrayAt(offsetEntityGenerationsList); }
 	const ArrayHeader* entityGenerationsListArray() const noexcept { return arrayAt(offsetEntityGenerationsList); }
 
+	ArrayHeader* queryRegistryArray() noexcept { return arrayAt(offsetQueryRegistry); }
+	const ArrayHeader* queryRegistryArray() const noexcept { return arrayAt(offsetQueryRegistry); }
+
 	// Helper methods
 	// --------------------------------------------------------------------------------------------
 
@@ -374,7 +1192,165 @@ struct GameStateHeader {
 	GameStateHeader(GameStateHeader&&) = delete;
 	GameStateHeader& operator=(GameStateHeader&&) = delete;
 };
-static_assert(sizeof(GameStateHeader) == 64, "GameStateHeader is padded");
+static_assert(sizeof(GameStateHeader) == 160, "GameStateHeader is padded");
+
+// ComponentFieldLayout struct
+// ------------------------------------------------------------------------------------------------
+
+// The fields of a component type stored as structure-of-arrays, see GameStateCreateInfo.
+struct ComponentFieldLayout final {
+
+	// The number of fields, 0 means that the component type is stored as array-of-structs.
+	uint32_t numFields = 0;
+
+	// The size in bytes of each field, in the order they are laid out in the component struct.
+	const uint32_t* fieldSizes = nullptr;
+};
+
+// EventQueueDesc struct
+// ------------------------------------------------------------------------------------------------
+
+// The size and capacity of an event queue, see GameStateCreateInfo.
+struct EventQueueDesc final {
+
+	// The size in bytes of each event, must not be 0.
+	uint32_t eventSize = 0;
+
+	// The max number of events the queue can hold between two clears.
+	uint32_t capacity = 0;
+};
+
+// GameStateCreateInfo struct
+// ------------------------------------------------------------------------------------------------
+
+// All the parameters necessary to create a game state, see createGameState().
+struct GameStateCreateInfo final {
+
+	// The number of singleton structs and the size in bytes of each of them.
+	uint32_t numSingletonStructs = 0;
+	const uint32_t* singletonStructSizes = nullptr;
+
+	// The maximum number of entities allowed in the ECS system.
+	uint32_t maxNumEntities = 0;
+
+	// The number of component types (excluding the active bit) and the size in bytes of each of
+	// them. Data-less component types (i.e. flags) should specify 0 as their size. At most
+	// COMPONENT_MASK_NUM_BITS - 1 component types, see PH_COMPONENT_MASK_NUM_BITS.
+	uint32_t numComponentTypes = 0;
+	const uint32_t* componentSizes = nullptr;
+
+	// The entity queries to keep cached entity id lists for, see EntityQuery. The query index is
+	// the index into this array.
+	uint32_t numQueries = 0;
+	const EntityQuery* queries = nullptr;
+
+	// The event queues to create, see the event queue API in GameStateHeader. The event queue
+	// index is the index into this array. At most 64 event queues.
+	uint32_t numEventQueues = 0;
+	const EventQueueDesc* eventQueues = nullptr;
+
+	// The policy used to pick which free entity id to use when creating entities.
+	EntityAllocationPolicy entityAllocationPolicy = EntityAllocationPolicy::LIFO;
+
+	// The number of entities per block in the dirty bitset, 0 disables dirty tracking. See the
+	// dirty tracking API in GameStateHeader.
+	uint32_t dirtyBlockSize = 0;
+
+	// Optional, the storage of each component type (same indexing as componentSizes). 0 means
+	// dense storage, i.e. one component per entity id. Any other value means that the component
+	// type is stored as a sparse set with that many slots, i.e. at most that many entities can
+	// have the component at the same time. Intended for large components that only few entities
+	// have. Ignored for data-less component types.
+	const uint32_t* componentSparseCapacities = nullptr;
+
+	// Optional, the fields of each component type (same indexing as componentSizes). A component
+	// type with a non-zero number of fields is stored as structure-of-arrays, i.e. with one
+	// column per field instead of one struct per entity. The sizes of the fields must add up to
+	// the component size, fields are assumed to be laid out in order without gaps (declare any
+	// padding as a field of its own). Intended for small components iterated by systems that only
+	// touch some of the fields, or that want to vectorize over them. Can't be combined with
+	// sparse storage. Ignored for data-less component types.
+	const ComponentFieldLayout* componentFieldLayouts = nullptr;
+
+	// The component types (bit i is component type i, including the active bit) to track changes
+	// of, see the change tracking API in GameStateHeader. Each tracked component type costs 16
+	// bytes per entity.
+	ComponentMask changeTrackedComponentTypes = ComponentMask::empty();
+
+	// Whether the game state is growable. A growable game state is created in reserved virtual
+	// memory (see GameStateContainer::createReserved()) instead of using the allocator, and its
+	// entity indexed arrays are only committed and initialized (see committedNumEntities) as the
+	// entityHighWaterMark grows. maxNumEntities then only reserves address space, and resident
+	// memory tracks the number of entities actually used. The layout is the same as for a fixed
+	// size game state, so nothing is ever relocated. Requires the LOWEST_ID_FIRST allocation
+	// policy (creation fails otherwise), which keeps the high-water mark as low as possible.
+	bool growable = false;
+
+	// Whether entities are given external ids, see the external id API in GameStateHeader. Costs
+	// 8 bytes per entity for the ids and between 20 and 40 bytes per entity for the index. The
+	// index is hashed, so in a growable game state most of its pages end up touched.
+	bool externalIds = false;
+};
+
+// GameStateByteRange struct
+// ------------------------------------------------------------------------------------------------
+
+// A range of bytes in a game state, relative to the start of its GameStateHeader.
+struct GameStateByteRange final {
+	uint32_t offsetBytes = 0;
+	uint32_t sizeBytes = 0;
+};
+
+// GameStateUncommittedRanges class
+// ------------------------------------------------------------------------------------------------
+
+// Iterates over the memory of a game state which may not be committed, i.e. the part of each
+// entity indexed array above committedNumEntities shrunk to whole pages (see
+// GAME_STATE_COMMIT_PAGE_SIZE). The memory in these ranges is always zero, but in a reserved
+// container (see GameStateContainer::createReserved()) it must not be accessed, on Windows
+// reserved pages are not committed on access. All other memory of a state is always committed.
+//
+// Functions operating on the entire state (hashing, deltas, snapshots, cloning, saving, etc) skip
+// these ranges and treat them as zero. A state with all entities committed has no ranges.
+class GameStateUncommittedRanges final {
+public:
+	explicit GameStateUncommittedRanges(const GameStateHeader* state) noexcept;
+
+	// Returns the next range in ascending order, false if there are no more.
+	bool next(GameStateByteRange& rangeOut) noexcept;
+
+	// Returns whether the byte at the given offset is in an uncommitted range. Moves past all
+	// ranges before the offset, so offsets must be given in ascending order and the ranges not
+	// also be iterated with next().
+	bool contains(uint32_t offsetBytes) noexcept;
+
+private:
+	const GameStateHeader* mState = nullptr; // nullptr when there are no more ranges
+	uint32_t mNumCommittedEntities = 0;
+	uint32_t mColumnIdx = 0;
+	uint32_t mFieldIdx = 0;
+	GameStateByteRange mLastRange;
+};
+
+// Calls func(GameStateByteRange range, bool committed) for consecutive ranges covering the entire
+// state in ascending order, alternating between committed memory and uncommitted ranges (see
+// GameStateUncommittedRanges).
+template<typename Func>
+void forEachGameStateRange(const GameStateHeader* state, Func&& func) noexcept
+{
+	GameStateUncommittedRanges uncommittedRanges(state);
+	const uint32_t stateSizeBytes = uint32_t(state->stateSizeBytes);
+	uint32_t cursor = 0;
+	GameStateByteRange range;
+	while (uncommittedRanges.next(range)) {
+		if (cursor < range.offsetBytes) {
+			func(GameStateByteRange{ cursor, range.offsetBytes - cursor }, true);
+		}
+		func(range, false);
+		cursor = range.offsetBytes + range.sizeBytes;
+	}
+	if (cursor < stateSizeBytes) func(GameStateByteRange{ cursor, stateSizeBytes - cursor }, true);
+}
 
 // Game state functions
 // ------------------------------------------------------------------------------------------------
@@ -384,6 +1360,16 @@ static_assert(sizeof(GameStateHeader) == 64, "GameStateHeader is padded");
 // The resulting state will contain numComponentTypes + 1 types of components. The first type (0)
 // is reserved to signify whether and entity is active or not. If you want data-less component
 // types, i.e. flags, you should specify 0 as the size in the "componentSizes" array.
+//
+// Growable game states only use the allocator for temporary memory. Returns an empty container
+// if the state would be larger than UINT32_MAX bytes (all offsets in the state are 32-bit), if a
+// growable game state does not use the LOWEST_ID_FIRST allocation policy or if its address space
+// could not be reserved.
+GameStateContainer createGameState(
+	const GameStateCreateInfo& createInfo,
+	Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+
+// Convenience overload for creating a game state without any queries, see above.
 GameStateContainer createGameState(
 	uint32_t numSingletonStructs,
 	const uint32_t* singletonStructSizes,
@@ -392,4 +1378,42 @@ GameStateContainer createGameState(
 	const uint32_t* componentSizes,
 	Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
 
+// Commits the memory of a newly reserved container (see GameStateContainer::createReserved())
+// which a copy of the given state needs, i.e. everything except its uncommitted ranges (see
+// GameStateUncommittedRanges). The memory must be as large as the state.
+void commitGameStateMemory(uint8_t* memory, const GameStateHeader* state) noexcept;
+
+// Raises or lowers the number of committed entities of a game state (see committedNumEntities)
+// ahead of it being overwritten by a state with the same layout that has numEntities committed.
+// Raising it commits the entity indexed arrays without initializing them, lowering it zeroes them
+// above numEntities. Afterwards all memory the other state has committed is committed in this
+// state, and everything else is zero in both.
+void setCommittedNumEntities(GameStateHeader* state, uint32_t numEntities) noexcept;
+
+// Game state file functions
+// ------------------------------------------------------------------------------------------------
+
+// Checks that a chunk of memory of numBytes bytes is a valid game state. I.e., that the magic
+// number and version matches, and that all offsets, registries and arrays are consistent with
+// each other and fit inside the chunk. Does not check the contents of the arrays.
+// Complexity: O(K + Q + S) where K, Q and S are the number of component types, queries and singletons
+bool validateGameState(const GameStateHeader* state, uint64_t numBytes) noexcept;
+
+// Checks whether two (valid) game states have the same layout, i.e. were created with the same
+// parameters, meaning that one can be memcpy():d onto the other.
+bool gameStateLayoutsMatch(const GameStateHeader* lhs, const GameStateHeader* rhs) noexcept;
+
+// Writes the game state to file as is, the resulting file is a raw dump of the memory chunk. The
+// uncommitted ranges of a growable game state are written as zeroes. Returns false on failure.
+bool saveGameState(const GameStateHeader* state, const char* path) noexcept;
+
+// Maps a game state written by saveGameState() into memory, see GameStateContainer::mapFile(). The
+// file is never read or parsed in its entirety, only the pages touched by the validation (header
+// and registries) are loaded before returning. If a layout is specified, the mapped state must
+// also match it (see gameStateLayoutsMatch()). Returns an empty container on failure.
+GameStateContainer mapGameState(
+	const char* path,
+	GameStateMapMode mode = GameStateMapMode::COPY_ON_WRITE,
+	const GameStateHeader* expectedLayout = nullptr) noexcept;
+
 } // namespace ph
@@ -33,6 +33,21 @@ using sfz::Allocator;
 
 struct GameStateHeader;
 
+// GameStateMapMode enum
+// ------------------------------------------------------------------------------------------------
+
+// How a game state file is mapped into memory, see GameStateContainer::mapFile().
+enum class GameStateMapMode : uint32_t {
+
+	// The mapped state may not be written to, attempting to do so crashes. Can be used for states
+	// that are only inspected or cloned, e.g. reference states or replays.
+	READ_ONLY = 0,
+
+	// The mapped state may be written to, but modifications are private to the process and are
+	// never written back to the file. Pages are copied by the OS the first time they are written.
+	COPY_ON_WRITE = 1
+};
+
 // GameStateContainer class
 // ------------------------------------------------------------------------------------------------
 
@@ -52,6 +67,19 @@ public:
 
 	static GameStateContainer createRaw(uint64_t numBytes, sfz::Allocator* allocator) noexcept;
 
+	// Maps the entire file into memory without reading it, pages are loaded lazily by the OS when
+	// accessed. The mapping is owned by the container and is unmapped when it is destroyed. Does
+	// not validate the contents of the file in any way, see mapGameState(). Returns an empty
+	// container if the file could not be mapped.
+	static GameStateContainer mapFile(const char* path, GameStateMapMode mode) noexcept;
+
+	// Reserves numBytes of virtual address space for the memory chunk without backing it with
+	// physical memory up front. The memory reads as zero. On Windows reserved pages must be
+	// committed with commitReservedMemory() before they are accessed, other platforms commit each
+	// page the first time it is touched. Used for growable game states, see GameStateCreateInfo.
+	// Returns an empty container if the address space could not be reserved.
+	static GameStateContainer createReserved(uint64_t numBytes) noexcept;
+
 	// State methods
 	// --------------------------------------------------------------------------------------------
 
@@ -66,12 +94,33 @@ public:
 	GameStateHeader* getHeader() noexcept;
 	const GameStateHeader* getHeader() const noexcept;
 
+	// The size in bytes of the memory chunk, 0 if the container is empty.
+	uint64_t numBytes() const noexcept { return mNumBytes; }
+
+	// Whether the memory chunk is a mapped file (see mapFile()) rather than allocated memory.
+	bool isMapped() const noexcept { return mIsMapped; }
+
+	// Whether the memory chunk is reserved virtual memory (see createReserved()) rather than
+	// allocated memory.
+	bool isReserved() const noexcept { return mIsReserved; }
+
 	// Private members
 	// --------------------------------------------------------------------------------------------
 private:
 	Allocator* mAllocator = nullptr;
 	uint8_t* mGameStateMemoryChunk = nullptr;
 	uint64_t mNumBytes = 0;
+	bool mIsMapped = false;
+	bool mIsReserved = false;
 };
 
+// Reserved memory functions
+// ------------------------------------------------------------------------------------------------
+
+// Commits the pages overlapping the given range of memory which are reserved but not committed,
+// see GameStateContainer::createReserved(). Memory which is already committed or which is not
+// reserved memory at all (e.g. allocated or a mapped file) is left as is. The only way reserved
+// memory is committed, a no-op on platforms other than Windows.
+void commitReservedMemory(uint8_t* ptr, uint64_t numBytes) noexcept;
+
 } // namespace ph
@@ -0,0 +1,117 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+
+#include <sfz/containers/DynArray.hpp>
+
+namespace ph {
+
+using sfz::DynArray;
+
+// Forward declarations
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHeader;
+
+// Constants
+// ------------------------------------------------------------------------------------------------
+
+// Magic number in beginning of all game state deltas, spells out "PHSDELTA".
+constexpr uint64_t GAME_STATE_DELTA_MAGIC_NUMBER =
+	uint64_t('P') << 0 |
+	uint64_t('H') << 8 |
+	uint64_t('S') << 16 |
+	uint64_t('D') << 24 |
+	uint64_t('E') << 32 |
+	uint64_t('L') << 40 |
+	uint64_t('T') << 48 |
+	uint64_t('A') << 56;
+
+// The granularity in bytes at which game states are compared, one cache line.
+constexpr uint32_t GAME_STATE_DELTA_BLOCK_SIZE = 64;
+
+// Delta format
+// ------------------------------------------------------------------------------------------------
+
+// A delta consists of a StateDeltaHeader followed by numRuns runs. Each run is a StateDeltaRun
+// followed by sizeBytes bytes which should be copied to offsetBytes in the game state.
+struct StateDeltaHeader final {
+	uint64_t magicNumber;
+	uint64_t stateSizeBytes; // Size of both the base and the current state
+	uint32_t blockSizeBytes;
+	uint32_t numRuns;
+	uint32_t numChangedBytes; // Sum of sizeBytes of all runs
+	uint32_t ___PADDING_UNUSED___;
+};
+static_assert(sizeof(StateDeltaHeader) == 32, "StateDeltaHeader is padded");
+
+struct StateDeltaRun final {
+	uint32_t offsetBytes;
+	uint32_t sizeBytes;
+};
+static_assert(sizeof(StateDeltaRun) == 8, "StateDeltaRun is padded");
+
+// Delta functions
+// ------------------------------------------------------------------------------------------------
+
+// Computes the delta needed to turn base into current and writes it to deltaOut (which is cleared
+// first). Both states must have the same layout, i.e. be created with the same parameters. The
+// states are compared one GAME_STATE_DELTA_BLOCK_SIZE block at a time using SIMD, consecutive
+// differing blocks are merged into a single run. The uncommitted ranges of growable game states
+// (see GameStateUncommittedRanges) are compared as zero without being read. Returns false (and
+// writes nothing) if the states have different sizes.
+// Complexity: O(S) where S is the size of the states
+bool computeStateDelta(
+	const GameStateHeader* base,
+	const GameStateHeader* current,
+	DynArray<uint8_t>& deltaOut) noexcept;
+
+// Applies a delta computed by computeStateDelta() to a state, which should be identical to the
+// base state used when computing the delta. The delta is validated before anything is written,
+// returns false without modifying the state if it is malformed or if the sizes do not match. A
+// growable game state first has its committed entities matched to the resulting state (see
+// setCommittedNumEntities()).
+// Complexity: O(D) where D is the size of the delta
+bool applyStateDelta(
+	GameStateHeader* state,
+	const uint8_t* delta,
+	uint32_t deltaSizeBytes) noexcept;
+
+// Makes dst identical to src by comparing them block by block (as in computeStateDelta()) and
+// copying only the blocks which differ. Cheaper than a full memcpy() when most of the state is
+// unchanged, as unchanged memory is only read and never written. Both states must have the same
+// layout. A growable dst first has its committed entities matched to src (see
+// setCommittedNumEntities()), the uncommitted ranges of src are skipped. Returns the number of
+// bytes copied.
+// Complexity: O(S) where S is the size of the states
+uint32_t copyDifferingBlocks(GameStateHeader* dst, const GameStateHeader* src) noexcept;
+
+// Same as above, but only for the given byte range of the states. dst must already have at least
+// as many committed entities as src.
+// Complexity: O(S) where S is the size of the range
+uint32_t copyDifferingBlocks(
+	GameStateHeader* dst,
+	const GameStateHeader* src,
+	uint32_t offsetBytes,
+	uint32_t sizeBytes) noexcept;
+
+} // namespace ph
@@ -21,6 +21,7 @@
 
 #include "ph/state/GameState.hpp"
 
+#include <sfz/containers/DynArray.hpp>
 #include <sfz/memory/SmartPointers.hpp>
 #include <sfz/strings/StackString.hpp>
 
@@ -114,13 +115,14 @@ private:
 
 	str80 mWindowName;
 	ReducedSingletonInfo mSingletonInfos[64] = {};
-	ReducedComponentInfo mComponentInfos[64] = {};
+	ReducedComponentInfo mComponentInfos[COMPONENT_MASK_NUM_BITS] = {};
 	uint32_t mNumSingletonInfos = 0;
 	uint32_t mNumComponentInfos = 0;
 	ComponentMask mFilterMask = ComponentMask::activeMask();
-	str32 mFilterMaskEditBuffers[8];
+	str32 mFilterMaskEditBuffers[COMPONENT_MASK_NUM_BYTES];
 	bool mCompactEntityList = false;
 	uint32_t mCurrentSelectedEntityId = 0;
+	sfz::DynArray<uint8_t> mComponentBuffer; // Gathered copy of a structure-of-arrays component
 };
 
 } // namespace ph
@@ -0,0 +1,114 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+
+#include <sfz/Context.hpp>
+#include <sfz/memory/Allocator.hpp>
+
+namespace ph {
+
+// Forward declarations
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHeader;
+
+// GameStateHistory class
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHistoryState;
+
+// A ring buffer of game state snapshots, one per tick, e.g. for rollback netcode.
+//
+// All slots are allocated up front when the history is initialized, snapshot() and restore() never
+// allocate. Instead of copying the entire state, only the blocks that differ from what is already
+// in the destination are written (see copyDifferingBlocks()). A slot is overwritten with a state
+// which is a fixed number of ticks newer, and restoring generally goes back only a few ticks, so
+// most of the state is typically already identical.
+//
+// If the game state has dirty tracking enabled (see GameStateHeader), the entity indexed arrays
+// (component masks, generations and component data) are not compared at all, only the blocks
+// marked dirty since the slot was last written are copied. For this to work every modification
+// must be marked and snapshot() must be called before each clearDirty(), otherwise the dirty bits
+// of the ticks in between are lost.
+class GameStateHistory final {
+public:
+	// Constructors & destructors
+	// --------------------------------------------------------------------------------------------
+
+	GameStateHistory() noexcept = default;
+	GameStateHistory(const GameStateHistory&) = delete;
+	GameStateHistory& operator= (const GameStateHistory&) = delete;
+	GameStateHistory(GameStateHistory&& o) noexcept { this->swap(o); }
+	GameStateHistory& operator= (GameStateHistory&& o) noexcept { this->swap(o); return *this; }
+	~GameStateHistory() noexcept { this->destroy(); }
+
+	// State methods
+	// --------------------------------------------------------------------------------------------
+
+	// Allocates numSlots snapshots with the same layout as the given state, which is used as their
+	// initial content. The history starts out empty.
+	void init(
+		const GameStateHeader* state,
+		uint32_t numSlots,
+		sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+	void swap(GameStateHistory& other) noexcept;
+	void destroy() noexcept;
+
+	// Methods
+	// --------------------------------------------------------------------------------------------
+
+	bool isValid() const noexcept { return mState != nullptr; }
+
+	// The number of slots, i.e. the max number of snapshots kept.
+	uint32_t capacity() const noexcept;
+
+	// The number of snapshots currently stored.
+	uint32_t numSnapshots() const noexcept;
+
+	// The oldest and newest tick currently stored. Undefined if there are no snapshots.
+	uint64_t oldestTick() const noexcept;
+	uint64_t newestTick() const noexcept;
+
+	// Stores a snapshot of the state for the given tick, overwriting the oldest snapshot if all
+	// slots are used. The tick must be newer than all currently stored snapshots. Returns the number
+	// of bytes copied.
+	uint32_t snapshot(const GameStateHeader* state, uint64_t tick) noexcept;
+
+	// Returns the snapshot for the given tick, nullptr if it is not stored.
+	const GameStateHeader* snapshotAt(uint64_t tick) const noexcept;
+
+	// Restores the given state to the snapshot of the given tick and discards all newer snapshots,
+	// so that the ticks after it can be simulated and snapshotted again. Returns false (without
+	// modifying anything) if the tick is not stored. With dirty tracking enabled everything restored
+	// is marked as dirty in the state.
+	bool restore(uint64_t tick, GameStateHeader* stateOut) noexcept;
+
+	// Discards all snapshots, the slots are kept allocated.
+	void clear() noexcept;
+
+	// Private members
+	// --------------------------------------------------------------------------------------------
+private:
+	GameStateHistoryState* mState = nullptr;
+};
+
+} // namespace ph
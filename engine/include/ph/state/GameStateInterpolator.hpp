@@ -0,0 +1,140 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+
+#include <sfz/Context.hpp>
+#include <sfz/math/Vector.hpp>
+#include <sfz/memory/Allocator.hpp>
+
+namespace ph {
+
+using sfz::vec3;
+using sfz::vec4;
+
+// Forward declarations
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHeader;
+
+// Helper structs
+// ------------------------------------------------------------------------------------------------
+
+// Describes an interpolated component type, i.e. where the transform is stored in the component.
+// The position is 3 consecutive floats and the rotation a quaternion stored as 4 consecutive
+// floats (x, y, z, w). Either can be omitted (~0u), in which case the interpolated position is
+// zero and the interpolated rotation is identity.
+struct InterpolatedComponentDesc final {
+	uint32_t componentType = ~0u;
+	uint32_t positionOffset = ~0u;
+	uint32_t rotationOffset = ~0u;
+};
+
+// A render-ready transform produced by GameStateInterpolator::interpolate().
+struct InterpolatedTransform final {
+	vec3 position;
+	float ___PADDING_UNUSED___;
+	vec4 rotation;
+};
+static_assert(sizeof(InterpolatedTransform) == 32, "InterpolatedTransform is padded");
+
+// GameStateInterpolator class
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateInterpolatorState;
+
+// Keeps the transforms of the previous tick for a few interpolated component types (e.g.
+// transforms), so that rendering can interpolate between the previous and the current tick (see
+// UpdateInfo::lagSeconds) without keeping a full copy of the previous game state.
+//
+// beginTick() must be called right before each tick is simulated, it copies the current
+// transforms to the shadow copies, which then hold the previous tick while the tick is
+// simulated. If the game state has dirty tracking enabled only the blocks marked dirty (for the
+// component type or for the entity bookkeeping, component type 0) are copied. These are the blocks
+// modified during the last tick, so every modification must be marked and clearDirty() may only
+// be called after beginTick() has copied them. A block cleared earlier keeps the transforms of an
+// older tick in its shadow copy and is interpolated from the wrong tick. Without dirty tracking
+// the transforms of all entities are copied each tick.
+//
+// Entities which did not have the component in the previous tick (e.g. newly created ones, or a
+// new entity reusing the id of a deleted one) are not interpolated, they get their current
+// transform.
+class GameStateInterpolator final {
+public:
+	// Constructors & destructors
+	// --------------------------------------------------------------------------------------------
+
+	GameStateInterpolator() noexcept = default;
+	GameStateInterpolator(const GameStateInterpolator&) = delete;
+	GameStateInterpolator& operator= (const GameStateInterpolator&) = delete;
+	GameStateInterpolator(GameStateInterpolator&& o) noexcept { this->swap(o); }
+	GameStateInterpolator& operator= (GameStateInterpolator&& o) noexcept { this->swap(o); return *this; }
+	~GameStateInterpolator() noexcept { this->destroy(); }
+
+	// State methods
+	// --------------------------------------------------------------------------------------------
+
+	// Creates shadow copies for the given interpolated component types, which must use dense
+	// array-of-structs storage. The shadow copies are initialized from the given state, i.e. the
+	// first frame is not interpolated. The shadow copies grow along with the entityHighWaterMark.
+	void init(
+		const GameStateHeader* state,
+		const InterpolatedComponentDesc* descs,
+		uint32_t numDescs,
+		sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+	void swap(GameStateInterpolator& other) noexcept;
+	void destroy() noexcept;
+
+	// Methods
+	// --------------------------------------------------------------------------------------------
+
+	bool isValid() const noexcept { return mState != nullptr; }
+
+	// The number of interpolated component types, the index of each is its index in the descs
+	// array given to init().
+	uint32_t numInterpolated() const noexcept;
+
+	// Copies the current transforms to the shadow copies, see above. Returns the number of entities
+	// copied.
+	uint32_t beginTick(const GameStateHeader* state) noexcept;
+
+	// Interpolates between the previous (shadow copy) and the current (state) transforms of the
+	// given interpolated component type. alpha is the fraction of a tick to interpolate, typically
+	// updateInfo.lagSeconds / updateInfo.tickTimeSeconds. Positions are linearly interpolated and
+	// rotations are spherically interpolated along the shortest path (using a fast approximation
+	// of slerp, accurate to about 0.1 degrees).
+	//
+	// Writes one transform per entity id in [0, entityHighWaterMark), i.e. transformsOut must have
+	// room for entityHighWaterMark transforms. The transforms of entities without the component
+	// have zero rotation.
+	void interpolate(
+		const GameStateHeader* state,
+		uint32_t interpolatedIdx,
+		float alpha,
+		InterpolatedTransform* transformsOut) const noexcept;
+
+	// Private members
+	// --------------------------------------------------------------------------------------------
+private:
+	GameStateInterpolatorState* mState = nullptr;
+};
+
+} // namespace ph
@@ -0,0 +1,382 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include "ph/state/GameState.hpp"
+
+namespace ph {
+
+// TypeList
+// ------------------------------------------------------------------------------------------------
+
+// A list of types, used to declare the singletons and component types of a GameStateSchema.
+template<typename... Types>
+struct TypeList final {
+	static constexpr uint32_t size = uint32_t(sizeof...(Types));
+};
+
+namespace detail {
+
+// The size in bytes a type occupies in a game state, empty types are data-less flags.
+template<typename T>
+constexpr uint32_t schemaTypeSize() noexcept
+{
+	return std::is_empty<T>::value ? 0 : uint32_t(sizeof(T));
+}
+
+// The index of T in Types, ~0u if T is not in Types.
+template<typename T, typename... Types>
+constexpr uint32_t schemaTypeIndex() noexcept
+{
+	constexpr bool isSame[] = { std::is_same<T, Types>::value..., false };
+	for (uint32_t i = 0; i < sizeof...(Types); i++) {
+		if (isSame[i]) return i;
+	}
+	return ~0u;
+}
+
+// Whether any type occurs more than once in Types.
+template<typename... Types>
+constexpr bool schemaHasDuplicates() noexcept
+{
+	constexpr uint32_t indices[] = { schemaTypeIndex<Types, Types...>()..., 0 };
+	for (uint32_t i = 0; i < sizeof...(Types); i++) {
+		if (indices[i] != i) return true;
+	}
+	return false;
+}
+
+// Whether all Types are trivially copyable and trivially destructible.
+template<typename... Types>
+constexpr bool schemaAllTrivial() noexcept
+{
+	constexpr bool isTrivial[] = { (std::is_trivially_copyable<Types>::value &&
+		std::is_trivially_destructible<Types>::value)..., true };
+	for (bool trivial : isTrivial) {
+		if (!trivial) return false;
+	}
+	return true;
+}
+
+// The number of bytes needed for an array plus its header, mirrors
+// ArrayHeader::numBytesNeededForArrayPlusHeader32Byte().
+constexpr uint64_t schemaArraySizeBytes(uint64_t capacity, uint64_t elementSize) noexcept
+{
+	return uint64_t(sizeof(ArrayHeader)) + ((capacity * elementSize + 31) & ~uint64_t(31));
+}
+
+} // namespace detail
+
+// GameStateSchema
+// ------------------------------------------------------------------------------------------------
+
+// A compile-time description of a game state, i.e. a list of singleton structs and a list of
+// component types. The schema computes the same chunk layout as createGameState(), so singletons
+// and components can be accessed through constexpr offsets instead of looking them up in the
+// registries at runtime.
+//
+// Singleton indices are the indices in the singleton list, component types are the indices in
+// the component list plus one (type 0 is the active bit). Empty types are data-less flags. All
+// component types use dense array-of-structs storage.
+//
+// E.g.:
+//     using Schema = GameStateSchema<
+//         TypeList<WorldSettings>, TypeList<Position, Velocity, IsPlayer>, 4096>;
+//     GameStateContainer container = createGameState(Schema::createInfo());
+//     sfz_assert(Schema::matches(container.getHeader()));
+//     Position* positions = Schema::components<Position>(container.getHeader());
+//
+// The create info returned by createInfo() may be extended with queries, dirty tracking, change
+// tracking, external ids, event queues or the growable flag, all of which are placed after the
+// components. It may NOT be given sparse capacities or field layouts, as those change the layout
+// of the components.
+//
+// The typed accessors are only valid for states created from the schema, or loaded from such a
+// state, check matches() once whenever a state enters the program from the outside.
+template<
+	typename SingletonList,
+	typename ComponentList,
+	uint32_t MaxNumEntities,
+	EntityAllocationPolicy Policy = EntityAllocationPolicy::LIFO>
+struct GameStateSchema;
+
+template<
+	typename... Singletons,
+	typename... Components,
+	uint32_t MaxNumEntities,
+	EntityAllocationPolicy Policy>
+struct GameStateSchema<TypeList<Singletons...>, TypeList<Components...>, MaxNumEntities, Policy> final {
+
+	// Constants
+	// --------------------------------------------------------------------------------------------
+
+	static constexpr uint32_t NUM_SINGLETONS = uint32_t(sizeof...(Singletons));
+	static constexpr uint32_t NUM_COMPONENT_TYPES = uint32_t(sizeof...(Components));
+	static constexpr uint32_t MAX_NUM_ENTITIES = MaxNumEntities;
+	static constexpr EntityAllocationPolicy ENTITY_ALLOCATION_POLICY = Policy;
+
+	static_assert(NUM_SINGLETONS <= 64, "Too many singletons");
+	static_assert(NUM_COMPONENT_TYPES < COMPONENT_MASK_NUM_BITS, "Too many component types");
+	static_assert(MaxNumEntities <= GAME_STATE_ECS_MAX_NUM_ENTITIES, "Too many entities");
+	static_assert(!detail::schemaHasDuplicates<Singletons...>(), "Duplicate singleton type");
+	static_assert(!detail::schemaHasDuplicates<Components...>(), "Duplicate component type");
+	static_assert(detail::schemaAllTrivial<Singletons...>(), "Singletons must be trivially copyable");
+	static_assert(detail::schemaAllTrivial<Components...>(), "Components must be trivially copyable");
+
+	// Indices
+	// --------------------------------------------------------------------------------------------
+
+	// The size in bytes of the singleton at the given index.
+	static constexpr uint32_t singletonSize(uint32_t singletonIndex) noexcept
+	{
+		constexpr uint32_t sizes[] = { uint32_t(sizeof(Singletons))..., 0 };
+		return sizes[singletonIndex];
+	}
+
+	// The size in bytes of the given component type, 0 for flags and the active bit.
+	static constexpr uint32_t componentSize(uint32_t componentType) noexcept
+	{
+		constexpr uint32_t sizes[] = { 0, detail::schemaTypeSize<Components>()... };
+		return sizes[componentType];
+	}
+
+	// The singleton index of T.
+	template<typename T>
+	static constexpr uint32_t singletonIndex() noexcept
+	{
+		static_assert(detail::schemaTypeIndex<T, Singletons...>() != ~0u, "T is not a singleton");
+		return detail::schemaTypeIndex<T, Singletons...>();
+	}
+
+	// The component type of T.
+	template<typename T>
+	static constexpr uint32_t componentType() noexcept
+	{
+		static_assert(detail::schemaTypeIndex<T, Components...>() != ~0u, "T is not a component");
+		return detail::schemaTypeIndex<T, Components...>() + 1;
+	}
+
+	// The mask with the bits of the given component types set. The active bit is not included.
+	template<typename... Ts>
+	static constexpr ComponentMask componentMask() noexcept
+	{
+		constexpr uint32_t types[] = { componentType<Ts>()..., 0 };
+		ComponentMask mask = ComponentMask::empty();
+		for (uint32_t i = 0; i < sizeof...(Ts); i++) {
+			mask = mask | ComponentMask::fromType(types[i]);
+		}
+		return mask;
+	}
+
+	// Layout
+	// --------------------------------------------------------------------------------------------
+
+	// The offsets in bytes to the ArrayHeaders of the registries and entity arrays, see
+	// GameStateHeader.
+	static constexpr uint32_t offsetSingletonRegistry() noexcept
+	{
+		return uint32_t(sizeof(GameStateHeader));
+	}
+
+	static constexpr uint32_t offsetSingleton(uint32_t singletonIndex) noexcept
+	{
+		uint64_t offset = offsetSingletonRegistry() +
+			detail::schemaArraySizeBytes(NUM_SINGLETONS, sizeof(SingletonRegistryEntry));
+		for (uint32_t i = 0; i < singletonIndex; i++) {
+			offset += (singletonSize(i) + 31) & ~uint32_t(31);
+		}
+		return uint32_t(offset);
+	}
+
+	static constexpr uint32_t offsetComponentRegistry() noexcept
+	{
+		return offsetSingleton(NUM_SINGLETONS);
+	}
+
+	static constexpr uint32_t offsetFreeEntityIdsList() noexcept
+	{
+		return uint32_t(offsetComponentRegistry() + detail::schemaArraySizeBytes(
+			NUM_COMPONENT_TYPES + 1, sizeof(ComponentRegistryEntry)));
+	}
+
+	static constexpr uint32_t offsetComponentMasks() noexcept
+	{
+		const uint32_t numFreeIds =
+			Policy == EntityAllocationPolicy::LOWEST_ID_FIRST ? 0 : MaxNumEntities;
+		return uint32_t(offsetFreeEntityIdsList() +
+			detail::schemaArraySizeBytes(numFreeIds, sizeof(uint32_t)));
+	}
+
+	static constexpr uint32_t offsetEntityGenerationsList() noexcept
+	{
+		return uint32_t(offsetComponentMasks() +
+			detail::schemaArraySizeBytes(MaxNumEntities, sizeof(ComponentMask)));
+	}
+
+	// The offset to the ArrayHeader of the given component type, ~0u for flags and the active bit
+	// (like ComponentRegistryEntry::offset).
+	static constexpr uint32_t offsetComponents(uint32_t componentType) noexcept
+	{
+		if (componentSize(componentType) == 0) return ~0u;
+		uint64_t offset = offsetEntityGenerationsList() +
+			detail::schemaArraySizeBytes(MaxNumEntities, sizeof(uint8_t));
+		for (uint32_t type = 1; type < componentType; type++) {
+			if (componentSize(type) == 0) continue;
+			offset += detail::schemaArraySizeBytes(MaxNumEntities, componentSize(type));
+		}
+		return uint32_t(offset);
+	}
+
+	// The number of bytes up to the end of the last component array, i.e. the part of the
+	// layout described by the schema.
+	static constexpr uint64_t schemaSizeBytes() noexcept
+	{
+		uint64_t offset = offsetEntityGenerationsList() +
+			detail::schemaArraySizeBytes(MaxNumEntities, sizeof(uint8_t));
+		for (uint32_t type = 1; type <= NUM_COMPONENT_TYPES; type++) {
+			if (componentSize(type) == 0) continue;
+			offset += detail::schemaArraySizeBytes(MaxNumEntities, componentSize(type));
+		}
+		return offset;
+	}
+
+	static_assert(schemaSizeBytes() <= uint64_t(UINT32_MAX), "Game state does not fit in 4 GiB");
+
+	// Creation and validation
+	// --------------------------------------------------------------------------------------------
+
+	// Returns the create info for a game state with this schema, see above for what may be
+	// changed before passing it to createGameState().
+	static GameStateCreateInfo createInfo() noexcept
+	{
+		static const uint32_t singletonSizes[] = { uint32_t(sizeof(Singletons))..., 0 };
+		static const uint32_t componentSizes[] = { detail::schemaTypeSize<Components>()..., 0 };
+		GameStateCreateInfo info;
+		info.numSingletonStructs = NUM_SINGLETONS;
+		info.singletonStructSizes = singletonSizes;
+		info.maxNumEntities = MaxNumEntities;
+		info.numComponentTypes = NUM_COMPONENT_TYPES;
+		info.componentSizes = componentSizes;
+		info.entityAllocationPolicy = Policy;
+		return info;
+	}
+
+	// Checks that the layout of the given state matches the schema, i.e. that the typed accessors
+	// may be used with it. Complexity: O(number of singletons and component types).
+	static bool matches(const GameStateHeader* state) noexcept
+	{
+		if (state == nullptr) return false;
+		if (state->magicNumber != GAME_STATE_MAGIC_NUMBER) return false;
+		if (state->gameStateVersion != GAME_STATE_VERSION) return false;
+		if (state->componentMaskNumBits != COMPONENT_MASK_NUM_BITS) return false;
+		if (state->stateSizeBytes < schemaSizeBytes()) return false;
+		if (state->numSingletons != NUM_SINGLETONS) return false;
+		if (state->numComponentTypes != NUM_COMPONENT_TYPES + 1) return false;
+		if (state->maxNumEntities != MaxNumEntities) return false;
+		if (state->entityAllocationPolicy != Policy) return false;
+		if (state->offsetSingletonRegistry != offsetSingletonRegistry()) return false;
+		if (state->offsetComponentRegistry != offsetComponentRegistry()) return false;
+		if (state->offsetFreeEntityIdsList != offsetFreeEntityIdsList()) return false;
+		if (state->offsetComponentMasks != offsetComponentMasks()) return false;
+		if (state->offsetEntityGenerationsList != offsetEntityGenerationsList()) return false;
+
+		const SingletonRegistryEntry* singletons =
+			state->arrayAt(offsetSingletonRegistry())->data<SingletonRegistryEntry>();
+		for (uint32_t i = 0; i < NUM_SINGLETONS; i++) {
+			if (singletons[i].offset != offsetSingleton(i)) return false;
+			if (singletons[i].sizeInBytes != singletonSize(i)) return false;
+		}
+
+		const ComponentRegistryEntry* components =
+			state->arrayAt(offsetComponentRegistry())->data<ComponentRegistryEntry>();
+		for (uint32_t type = 1; type <= NUM_COMPONENT_TYPES; type++) {
+			const ComponentRegistryEntry& entry = components[type];
+			if (entry.offset != offsetComponents(type)) return false;
+			if (entry.componentTypeIsSparse() || entry.componentTypeIsSoA()) return false;
+			if (entry.componentTypeHasData() &&
+				state->arrayAt(entry.offset)->elementSize != componentSize(type)) return false;
+		}
+		return true;
+	}
+
+	// Typed accessors
+	// --------------------------------------------------------------------------------------------
+
+	// Returns the singleton of type T. Equivalent to GameStateHeader::singleton(), but without
+	// looking up the singleton in the registry.
+	template<typename T>
+	static T& singleton(GameStateHeader* state) noexcept
+	{
+		return *reinterpret_cast<T*>(
+			reinterpret_cast<uint8_t*>(state) + offsetSingleton(singletonIndex<T>()));
+	}
+	template<typename T>
+	static const T& singleton(const GameStateHeader* state) noexcept
+	{
+		return *reinterpret_cast<const T*>(
+			reinterpret_cast<const uint8_t*>(state) + offsetSingleton(singletonIndex<T>()));
+	}
+
+	// Returns the contiguous array of components of type T. Equivalent to
+	// GameStateHeader::components(), but without looking up the component type in the registry.
+	template<typename T>
+	static T* components(GameStateHeader* state) noexcept
+	{
+		static_assert(componentSize(componentType<T>()) != 0, "Flags have no components");
+		return reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(state) +
+			offsetComponents(componentType<T>()) + sizeof(ArrayHeader));
+	}
+	template<typename T>
+	static const T* components(const GameStateHeader* state) noexcept
+	{
+		static_assert(componentSize(componentType<T>()) != 0, "Flags have no components");
+		return reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(state) +
+			offsetComponents(componentType<T>()) + sizeof(ArrayHeader));
+	}
+
+	// Returns the contiguous arrays of component masks and entity generations, see
+	// GameStateHeader::componentMasks() and GameStateHeader::entityGenerations().
+	static ComponentMask* componentMasks(GameStateHeader* state) noexcept
+	{
+		return reinterpret_cast<ComponentMask*>(
+			reinterpret_cast<uint8_t*>(state) + offsetComponentMasks() + sizeof(ArrayHeader));
+	}
+	static const ComponentMask* componentMasks(const GameStateHeader* state) noexcept
+	{
+		return reinterpret_cast<const ComponentMask*>(reinterpret_cast<const uint8_t*>(state) +
+			offsetComponentMasks() + sizeof(ArrayHeader));
+	}
+
+	static uint8_t* entityGenerations(GameStateHeader* state) noexcept
+	{
+		return reinterpret_cast<uint8_t*>(state) +
+			offsetEntityGenerationsList() + sizeof(ArrayHeader);
+	}
+	static const uint8_t* entityGenerations(const GameStateHeader* state) noexcept
+	{
+		return reinterpret_cast<const uint8_t*>(state) +
+			offsetEntityGenerationsList() + sizeof(ArrayHeader);
+	}
+};
+
+} // namespace ph
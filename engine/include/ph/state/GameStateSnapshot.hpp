@@ -0,0 +1,135 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+
+#include <sfz/containers/DynArray.hpp>
+#include <sfz/memory/Allocator.hpp>
+
+#include "ph/state/GameStateContainer.hpp"
+
+namespace ph {
+
+using sfz::DynArray;
+
+// Forward declarations
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHeader;
+class ThreadPool;
+
+// Constants
+// ------------------------------------------------------------------------------------------------
+
+// Magic number in beginning of all compressed game state snapshots, spells out "PHSNAPLZ".
+constexpr uint64_t GAME_STATE_SNAPSHOT_MAGIC_NUMBER =
+	uint64_t('P') << 0 |
+	uint64_t('H') << 8 |
+	uint64_t('S') << 16 |
+	uint64_t('N') << 24 |
+	uint64_t('A') << 32 |
+	uint64_t('P') << 40 |
+	uint64_t('L') << 48 |
+	uint64_t('Z') << 56;
+
+// The max number of bytes of the game state in a single chunk. Chunks are compressed
+// independently of each other, which is what allows them to be processed in parallel.
+constexpr uint32_t GAME_STATE_SNAPSHOT_CHUNK_SIZE = 256 * 1024;
+
+// The max component size which is byte plane shuffled, larger components are compressed as is.
+constexpr uint32_t GAME_STATE_SNAPSHOT_MAX_SHUFFLE_STRIDE = 256;
+
+// The granularity in bytes at which all-zero memory is eliminated before compression.
+constexpr uint32_t GAME_STATE_SNAPSHOT_ZERO_BLOCK_SIZE = 64;
+
+// Snapshot format
+// ------------------------------------------------------------------------------------------------
+
+// A snapshot consists of a SnapshotHeader, followed by numChunks SnapshotChunks, followed by the
+// compressed data of all chunks. The chunks cover the entire game state in order.
+//
+// Each chunk is first optionally byte plane shuffled, i.e. viewed as an array of components and
+// transposed so that byte i of all components are stored together in plane i. This puts the
+// slowly varying high bytes of floats (and constant fields) next to each other, which makes them
+// much more compressible. The compressed data of a chunk then starts with a bitset with one bit
+// per zero block, bit set if the block contains any non-zero bytes. All-zero blocks are dropped,
+// the remaining blocks are packed together and compressed using a LZ77 compressor in the spirit
+// of LZ4, which is what follows the bitset.
+struct SnapshotHeader final {
+	uint64_t magicNumber;
+	uint64_t stateSizeBytes;
+	uint64_t compressedSizeBytes; // Size of the compressed data after the chunk table
+	uint32_t numChunks;
+	uint32_t ___PADDING_UNUSED___;
+};
+static_assert(sizeof(SnapshotHeader) == 32, "SnapshotHeader is padded");
+
+struct SnapshotChunk final {
+	uint32_t offsetBytes; // Offset in the game state
+	uint32_t sizeBytes; // Uncompressed size, at most GAME_STATE_SNAPSHOT_CHUNK_SIZE
+	uint64_t compressedOffsetBytes; // Offset in the compressed data after the chunk table
+	uint32_t compressedSizeBytes;
+	uint32_t shuffleStride; // The component size if byte plane shuffled, 0 otherwise
+};
+static_assert(sizeof(SnapshotChunk) == 24, "SnapshotChunk is padded");
+
+// Snapshot functions
+// ------------------------------------------------------------------------------------------------
+
+// Compresses the game state into snapshotOut (which is cleared first), e.g. for save games and
+// replays. If shuffleComponents is true, the component arrays are byte plane shuffled, which
+// improves the ratio for components consisting of smoothly varying floats at the cost of
+// throughput (roughly 2-5x slower). The chunks are compressed in parallel if a thread pool is
+// specified. At most a few chunks per thread are kept in flight, so the temporary memory
+// (allocated from the given allocator) does not grow with the size of the state. The uncommitted
+// ranges of a growable game state (see GameStateUncommittedRanges) are compressed as zero without
+// being read.
+// Complexity: O(S) where S is the size of the state
+void compressGameState(
+	const GameStateHeader* state,
+	DynArray<uint8_t>& snapshotOut,
+	bool shuffleComponents = false,
+	ThreadPool* threadPool = nullptr,
+	sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+
+// Decompresses a snapshot created by compressGameState() into an existing state of the same size.
+// The snapshot is validated before anything is written, but a malformed chunk can still be
+// detected after other chunks have been written. Returns false if the snapshot is malformed, in
+// which case the contents of the state are undefined. A growable game state first has its
+// committed entities matched to the snapshot (see setCommittedNumEntities()).
+// Complexity: O(S) where S is the size of the state
+bool decompressGameState(
+	const uint8_t* snapshot,
+	uint64_t snapshotSizeBytes,
+	GameStateHeader* stateOut,
+	ThreadPool* threadPool = nullptr,
+	sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+
+// Decompresses a snapshot into a newly allocated game state, which is validated using
+// validateGameState(). The snapshot header, the chunk table and the GameStateHeader in the first
+// chunk are validated before the state is allocated. Returns an empty container on failure.
+GameStateContainer createGameStateFromSnapshot(
+	const uint8_t* snapshot,
+	uint64_t snapshotSizeBytes,
+	ThreadPool* threadPool = nullptr,
+	sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+
+} // namespace ph
@@ -0,0 +1,274 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+#include <new>
+#include <tuple>
+#include <utility>
+
+#include <sfz/Assert.hpp>
+#include <sfz/Context.hpp>
+#include <sfz/memory/Allocator.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/util/ThreadPool.hpp"
+
+namespace ph {
+
+// ComponentTypes
+// ------------------------------------------------------------------------------------------------
+
+// The component type indices of a list of typed components, used to get typed component pointers
+// in parallelForEntities() and parallelReduceEntities().
+//
+// E.g. "ComponentTypes<Position, Velocity>{ POSITION_TYPE, VELOCITY_TYPE }"
+template<typename... Components>
+struct ComponentTypes final {
+	uint32_t types[sizeof...(Components)];
+
+	ComponentMask mask() const noexcept
+	{
+		ComponentMask mask = ComponentMask::empty();
+		for (uint32_t type : types) mask = mask | ComponentMask::fromType(type);
+		return mask;
+	}
+};
+
+template<>
+struct ComponentTypes<> final {
+	ComponentMask mask() const noexcept { return ComponentMask::empty(); }
+};
+
+// Entity chunks
+// ------------------------------------------------------------------------------------------------
+
+// Chunk sizes are rounded up to a multiple of this, so that each chunk starts on its own cache
+// line in the component mask array and in all component arrays with power of two sized components.
+constexpr uint32_t ENTITY_CHUNK_SIZE_MULTIPLE = 64;
+
+// Returns the chunk size to use for the given requested chunk size, see above.
+inline uint32_t entityChunkSize(uint32_t requestedChunkSize) noexcept
+{
+	uint32_t chunkSize = requestedChunkSize == 0 ? ENTITY_CHUNK_SIZE_MULTIPLE : requestedChunkSize;
+	return ((chunkSize + ENTITY_CHUNK_SIZE_MULTIPLE - 1) / ENTITY_CHUNK_SIZE_MULTIPLE) *
+		ENTITY_CHUNK_SIZE_MULTIPLE;
+}
+
+// Returns the number of chunks the live entity id range (up to the entityHighWaterMark) of the
+// given state is split into.
+inline uint32_t numEntityChunks(const GameStateHeader* state, uint32_t chunkSize) noexcept
+{
+	return (state->entityHighWaterMark + chunkSize - 1) / chunkSize;
+}
+
+namespace detail {
+
+// Typed component pointers can only be given for dense array-of-structs component types
+inline void assertDenseComponentType(const GameStateHeader* state, uint32_t type) noexcept
+{
+	sfz_assert(!state->componentTypeIsSparse(type));
+	sfz_assert(!state->componentTypeIsSoA(type));
+	(void)state;
+	(void)type;
+}
+
+template<typename... Components, size_t... Indices>
+std::tuple<Components*...> componentArrays(
+	GameStateHeader* state,
+	const ComponentTypes<Components...>& types,
+	std::index_sequence<Indices...>) noexcept
+{
+	// Expanded over the indices, ComponentTypes<> has no types array
+	(void)types;
+	(assertDenseComponentType(state, types.types[Indices]), ...);
+	return std::tuple<Components*...>(state->components<Components>(types.types[Indices])...);
+}
+
+// Calls func(entityId, components...) for each entity in the chunk fulfilling the mask
+template<typename Func, typename... Components, size_t... Indices>
+void forEntitiesInChunk(
+	const GameStateHeader* state,
+	ComponentMask mask,
+	uint32_t chunkSize,
+	uint32_t chunkIdx,
+	const std::tuple<Components*...>& arrays,
+	std::index_sequence<Indices...>,
+	Func& func)
+{
+	const ComponentMask* masks = state->componentMasks();
+	const uint32_t firstEntityId = chunkIdx * chunkSize;
+	uint32_t lastEntityId = firstEntityId + chunkSize;
+	if (lastEntityId > state->entityHighWaterMark) lastEntityId = state->entityHighWaterMark;
+	for (uint32_t entityId = firstEntityId; entityId < lastEntityId; entityId++) {
+		if (!masks[entityId].fulfills(mask)) continue;
+		func(entityId, (std::get<Indices>(arrays) + entityId)...);
+	}
+}
+
+// The partial result of a chunk in parallelReduceEntities(). Each is on its own cache line(s), so
+// that threads reducing neighbouring chunks do not write to the same cache line.
+template<typename T>
+struct alignas(64) PaddedPartial final {
+	T value;
+};
+
+} // namespace detail
+
+// Parallel for over entities
+// ------------------------------------------------------------------------------------------------
+
+// Calls func for each active entity fulfilling the mask, in parallel on all threads of the pool.
+//
+// The entity id range is split into chunks of chunkSize (rounded up to a multiple of
+// ENTITY_CHUNK_SIZE_MULTIPLE) ids, each chunk is processed by a single thread in ascending id
+// order. The chunks are distributed over the work stealing ThreadPool. The bits of the requested
+// component types are implicitly added to the mask.
+//
+// func has the signature "void(uint32_t entityId, Components*... components)", where each
+// pointer points to the entity's component of the given type. func may only write to the
+// components of the entity it was called for, and may not make structural changes to the ECS.
+// The typed component types must use dense array-of-structs storage, sparse ones can be accessed
+// through GameStateHeader::component() and structure-of-arrays ones through componentField().
+template<typename... Components, typename Func>
+void parallelForEntities(
+	ThreadPool& pool,
+	GameStateHeader* state,
+	ComponentMask mask,
+	uint32_t chunkSize,
+	const ComponentTypes<Components...>& types,
+	Func&& func) noexcept
+{
+	const ComponentMask fullMask = mask | types.mask() | ComponentMask::activeMask();
+	const uint32_t roundedChunkSize = entityChunkSize(chunkSize);
+	const std::tuple<Components*...> arrays =
+		detail::componentArrays(state, types, std::index_sequence_for<Components...>());
+
+	auto chunkFunc = [&](uint32_t chunkIdx, uint32_t) {
+		detail::forEntitiesInChunk(state, fullMask, roundedChunkSize, chunkIdx, arrays,
+			std::index_sequence_for<Components...>(), func);
+	};
+	pool.runFunc(numEntityChunks(state, roundedChunkSize), chunkFunc);
+}
+
+// Variant of parallelForEntities() without typed component pointers, func has the signature
+// "void(uint32_t entityId)".
+template<typename Func>
+void parallelForEntities(
+	ThreadPool& pool,
+	GameStateHeader* state,
+	ComponentMask mask,
+	uint32_t chunkSize,
+	Func&& func) noexcept
+{
+	parallelForEntities(pool, state, mask, chunkSize, ComponentTypes<>(), func);
+}
+
+// Deterministic parallel reduction over entities
+// ------------------------------------------------------------------------------------------------
+
+// Maps each active entity fulfilling the mask to a value of type T and reduces them to a single
+// value, in parallel on all threads of the pool.
+//
+// map has the signature "T(uint32_t entityId, Components*... components)" and combine has the
+// signature "T(const T& lhs, const T& rhs)". identity must be the identity element of combine.
+//
+// Each chunk (see parallelForEntities()) is reduced in ascending id order to a partial result,
+// and the partial results are then combined in ascending chunk order on the calling thread. The
+// order of all combine() calls thus only depends on chunkSize, never on the number of threads or
+// how chunks were scheduled. This makes the result bit-exact reproducible even for non-associative
+// operations such as floating point addition.
+template<typename T, typename... Components, typename MapFunc, typename CombineFunc>
+T parallelReduceEntities(
+	ThreadPool& pool,
+	GameStateHeader* state,
+	ComponentMask mask,
+	uint32_t chunkSize,
+	const ComponentTypes<Components...>& types,
+	const T& identity,
+	MapFunc&& map,
+	CombineFunc&& combine,
+	sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept
+{
+	const ComponentMask fullMask = mask | types.mask() | ComponentMask::activeMask();
+	const uint32_t roundedChunkSize = entityChunkSize(chunkSize);
+	const uint32_t numChunks = numEntityChunks(state, roundedChunkSize);
+	const std::tuple<Components*...> arrays =
+		detail::componentArrays(state, types, std::index_sequence_for<Components...>());
+
+	// Allocate and initialize partial results
+	using Partial = detail::PaddedPartial<T>;
+	Partial* partials = static_cast<Partial*>(allocator->allocate(
+		sfz_dbg("parallelReduceEntities()"), sizeof(Partial) * numChunks, alignof(Partial)));
+	for (uint32_t i = 0; i < numChunks; i++) new (&partials[i].value) T(identity);
+
+	// Reduce each chunk
+	auto chunkFunc = [&](uint32_t chunkIdx, uint32_t) {
+		T& partial = partials[chunkIdx].value;
+		auto reduceFunc = [&](uint32_t entityId, Components*... components) {
+			partial = combine(partial, map(entityId, components...));
+		};
+		detail::forEntitiesInChunk(state, fullMask, roundedChunkSize, chunkIdx, arrays,
+			std::index_sequence_for<Components...>(), reduceFunc);
+	};
+	pool.runFunc(numChunks, chunkFunc);
+
+	// Combine partial results in chunk order
+	T result = identity;
+	for (uint32_t i = 0; i < numChunks; i++) {
+		result = combine(result, partials[i].value);
+		partials[i].value.~T();
+	}
+	allocator->deallocate(partials);
+	return result;
+}
+
+// Variant of parallelReduceEntities() without typed component pointers, map has the signature
+// "T(uint32_t entityId)".
+template<typename T, typename MapFunc, typename CombineFunc>
+T parallelReduceEntities(
+	ThreadPool& pool,
+	GameStateHeader* state,
+	ComponentMask mask,
+	uint32_t chunkSize,
+	const T& identity,
+	MapFunc&& map,
+	CombineFunc&& combine,
+	sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept
+{
+	return parallelReduceEntities(
+		pool, state, mask, chunkSize, ComponentTypes<>(), identity, map, combine, allocator);
+}
+
+// Deterministic sum of the values produced by map, see parallelReduceEntities().
+template<typename T, typename... Components, typename MapFunc>
+T parallelSumEntities(
+	ThreadPool& pool,
+	GameStateHeader* state,
+	ComponentMask mask,
+	uint32_t chunkSize,
+	const ComponentTypes<Components...>& types,
+	MapFunc&& map) noexcept
+{
+	return parallelReduceEntities(pool, state, mask, chunkSize, types, T(0), map,
+		[](const T& lhs, const T& rhs) { return lhs + rhs; });
+}
+
+} // namespace ph
@@ -0,0 +1,173 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+
+#include <sfz/Context.hpp>
+#include <sfz/math/Vector.hpp>
+#include <sfz/memory/Allocator.hpp>
+
+namespace ph {
+
+using sfz::vec3;
+
+// Forward declarations
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHeader;
+class ThreadPool;
+
+// SpatialHashGrid
+// ------------------------------------------------------------------------------------------------
+
+// An entry in a SpatialHashGrid, i.e. a copy of the position of an indexed entity.
+struct SpatialHashGridEntry final {
+	vec3 position;
+	uint32_t entityId;
+};
+static_assert(sizeof(SpatialHashGridEntry) == 16, "SpatialHashGridEntry is padded");
+
+// A spatial index over all entities with a given position component, used for proximity queries
+// (perception, collision broadphase, interest management) that would otherwise have to scan all
+// entities.
+//
+// Space is divided into a uniform grid of cubic cells, and each cell is hashed into one of
+// numBuckets buckets. The entries are stored sorted by bucket (and by entity id within each
+// bucket), bucketStarts[b] is the index of the first entry in bucket b. A query visits the cells
+// overlapping the query volume, so it takes time proportional to the number of entities nearby
+// rather than the total number of entities. Different cells can hash to the same bucket, entries
+// are always filtered against the actual cell and query volume.
+//
+// The grid lives in a singleton of the game state, like everything else it does not contain any
+// pointers, so it is snapshotted, cloned and rolled back together with the rest of the state. The
+// singleton consists of this header followed by the arrays, see spatialHashGridSizeBytes().
+//
+// The grid is not updated when entities move, it is intended to be rebuilt once per tick (after
+// movement) using rebuildSpatialHashGrid().
+struct SpatialHashGrid final {
+
+	// Members
+	// --------------------------------------------------------------------------------------------
+
+	// The component type containing the positions, and the offset in bytes to the position
+	// (3 consecutive floats) within the component.
+	uint32_t positionComponentType;
+	uint32_t positionOffset;
+
+	// The size of each cell, and its reciprocal.
+	float cellSize;
+	float invCellSize;
+
+	// The number of buckets (a power of two), and the max number of entries (i.e. the max number
+	// of entities in the game state).
+	uint32_t numBuckets;
+	uint32_t maxNumEntries;
+
+	// The number of entities indexed by the last rebuild.
+	uint32_t numEntries;
+
+	// Offsets in bytes (from the beginning of this header) to the arrays. bucketStarts has
+	// numBuckets + 1 elements, the last one is always numEntries.
+	uint32_t offsetBucketStarts;
+	uint32_t offsetEntries;
+
+	uint32_t ___PADDING_UNUSED___[7];
+
+	// Array accessors
+	// --------------------------------------------------------------------------------------------
+
+	uint32_t* bucketStarts() noexcept
+	{
+		return reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(this) + offsetBucketStarts);
+	}
+	const uint32_t* bucketStarts() const noexcept
+	{
+		return reinterpret_cast<const uint32_t*>(
+			reinterpret_cast<const uint8_t*>(this) + offsetBucketStarts);
+	}
+
+	SpatialHashGridEntry* entries() noexcept
+	{
+		return reinterpret_cast<SpatialHashGridEntry*>(
+			reinterpret_cast<uint8_t*>(this) + offsetEntries);
+	}
+	const SpatialHashGridEntry* entries() const noexcept
+	{
+		return reinterpret_cast<const SpatialHashGridEntry*>(
+			reinterpret_cast<const uint8_t*>(this) + offsetEntries);
+	}
+
+	// Query methods
+	// --------------------------------------------------------------------------------------------
+
+	// Writes the ids of all indexed entities within the sphere (inclusive) to entityIdsOut, at most
+	// maxNumOut ids are written. Returns the total number of entities found, which may be larger
+	// than maxNumOut. The order only depends on the contents of the grid.
+	// Complexity: O(C + K) where C is the number of cells overlapping the query volume and K the
+	// number of entities in them
+	uint32_t querySphere(
+		vec3 center, float radius, uint32_t* entityIdsOut, uint32_t maxNumOut) const noexcept;
+
+	// Same as querySphere(), but for the axis aligned box [min, max] (inclusive).
+	uint32_t queryAABB(
+		vec3 min, vec3 max, uint32_t* entityIdsOut, uint32_t maxNumOut) const noexcept;
+};
+static_assert(sizeof(SpatialHashGrid) == 64, "SpatialHashGrid is padded");
+
+// SpatialHashGrid functions
+// ------------------------------------------------------------------------------------------------
+
+// Returns the size in bytes of the singleton struct needed for a grid with the given number of
+// buckets (must be a power of two) in a game state with the given max number of entities. A good
+// default is the power of two closest to the expected number of indexed entities.
+uint32_t spatialHashGridSizeBytes(uint32_t numBuckets, uint32_t maxNumEntities) noexcept;
+
+// Initializes an empty grid in the given singleton, which must have been created with the size
+// returned by spatialHashGridSizeBytes(). The position component type must use dense or
+// structure-of-arrays storage (not sparse). cellSize should be roughly the typical query radius,
+// queries much larger than the cells visit a lot of cells. If the singleton is zero (as in a
+// newly created game state) or already contains a grid, only the entries in use are cleared, so
+// that a growable game state only touches memory for the entities actually indexed.
+void initSpatialHashGrid(
+	GameStateHeader* state,
+	uint32_t singletonIndex,
+	uint32_t numBuckets,
+	float cellSize,
+	uint32_t positionComponentType,
+	uint32_t positionOffset) noexcept;
+
+// Returns the grid stored in the given singleton, see initSpatialHashGrid().
+SpatialHashGrid* getSpatialHashGrid(GameStateHeader* state, uint32_t singletonIndex) noexcept;
+const SpatialHashGrid* getSpatialHashGrid(
+	const GameStateHeader* state, uint32_t singletonIndex) noexcept;
+
+// Rebuilds the grid from the current positions of all active entities with the position
+// component, and marks the singleton as dirty. Runs in parallel if a thread pool is specified.
+// The result is identical regardless of the number of threads, so the grid can be part of
+// deterministic (e.g. lockstep) state. Temporary memory is allocated from the given allocator.
+// Complexity: O(N + B) where N is the entityHighWaterMark and B the number of buckets
+void rebuildSpatialHashGrid(
+	GameStateHeader* state,
+	uint32_t singletonIndex,
+	ThreadPool* threadPool = nullptr,
+	sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+
+} // namespace ph
@@ -0,0 +1,43 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+
+namespace ph {
+
+// State hashing
+// ------------------------------------------------------------------------------------------------
+
+// A fast non-cryptographic 64-bit hash, used for detecting desyncs between game states.
+//
+// The hash is fully deterministic, i.e. the same bytes and seed gives the same hash on all
+// platforms. The input is processed in 64-byte stripes accumulated into 8 independent 64-bit
+// lanes (using only 32x32->64 bit multiplies), which maps directly onto SSE2 and AVX2. AVX2 is
+// selected at runtime if supported by the CPU, all implementations give identical results.
+uint64_t hashStateBytes(const uint8_t* data, uint64_t numBytes, uint64_t seed = 0) noexcept;
+
+// Combines two hashes into one, order dependent.
+uint64_t combineStateHashes(uint64_t lhs, uint64_t rhs) noexcept;
+
+// Returns the name of the hash implementation selected at runtime ("AVX2", "SSE2" or "Scalar").
+const char* stateHashImplName() noexcept;
+
+} // namespace ph
@@ -0,0 +1,135 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+
+#include <sfz/Context.hpp>
+#include <sfz/memory/Allocator.hpp>
+
+#include "ph/state/ComponentMask.hpp"
+
+namespace ph {
+
+// Forward declarations
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHeader;
+class ThreadPool;
+
+// SystemDesc struct
+// ------------------------------------------------------------------------------------------------
+
+// Signature of a system run by the SystemScheduler.
+using SystemFunc = void(*)(GameStateHeader* state, float tickTimeSeconds, void* userPtr);
+
+// Describes a system and the parts of the game state it accesses.
+//
+// The declared accesses are what allows the scheduler to run systems concurrently, it is up to the
+// system to not access anything it has not declared. Reading component masks (e.g. iterating over
+// entities or queries) is always allowed. Modifying masks or entity bookkeeping (createEntity(),
+// deleteEntity(), addComponent(), deleteComponent(), etc) is a structural change and must be
+// declared as such, structural systems never run concurrently with any other system. Systems can
+// avoid this by recording their structural changes into EntityCommandBuffers instead, and playing
+// them back after the tick.
+struct SystemDesc final {
+
+	// Name of the system, only used for debugging. Must outlive the scheduler.
+	const char* name = "";
+
+	// The component types the system reads and writes. Writes implies reads.
+	ComponentMask readComponents = ComponentMask::empty();
+	ComponentMask writeComponents = ComponentMask::empty();
+
+	// The singletons the system reads and writes, bit i represents singleton i.
+	uint64_t readSingletons = 0;
+	uint64_t writeSingletons = 0;
+
+	// The event queues the system pushes events to and reads events from, bit i represents event
+	// queue i. Systems pushing to the same queue may run concurrently, but not together with a
+	// system reading it. Clearing the queues is done between ticks, outside of runTick().
+	uint64_t pushEvents = 0;
+	uint64_t readEvents = 0;
+
+	// Whether the system makes structural changes to the ECS, see above.
+	bool structuralChanges = false;
+
+	// The function to run and a user pointer passed to it.
+	SystemFunc systemFunc = nullptr;
+	void* userPtr = nullptr;
+};
+
+// Returns whether two systems conflict, i.e. whether one writes something the other accesses.
+// Conflicting systems can not run concurrently.
+bool systemsConflict(const SystemDesc& a, const SystemDesc& b) noexcept;
+
+// SystemScheduler class
+// ------------------------------------------------------------------------------------------------
+
+struct SystemSchedulerState;
+
+// Runs a set of systems each tick, executing non-conflicting systems concurrently on a ThreadPool.
+//
+// Each tick a dependency graph is built from the enabled systems. A system depends on every
+// enabled system added before it that it conflicts with, so conflicting systems always execute in
+// the order they were added and the result does not depend on the number of threads.
+class SystemScheduler final {
+public:
+	// Constructors & destructors
+	// --------------------------------------------------------------------------------------------
+
+	SystemScheduler() noexcept = default;
+	SystemScheduler(const SystemScheduler&) = delete;
+	SystemScheduler& operator= (const SystemScheduler&) = delete;
+	SystemScheduler(SystemScheduler&& o) noexcept { this->swap(o); }
+	SystemScheduler& operator= (SystemScheduler&& o) noexcept { this->swap(o); return *this; }
+	~SystemScheduler() noexcept { this->destroy(); }
+
+	// State methods
+	// --------------------------------------------------------------------------------------------
+
+	void init(uint32_t maxNumSystems, sfz::Allocator* allocator = sfz::getDefaultAllocator()) noexcept;
+	void swap(SystemScheduler& other) noexcept;
+	void destroy() noexcept;
+
+	// Methods
+	// --------------------------------------------------------------------------------------------
+
+	// Adds a system, returns its index. Systems are enabled when added.
+	uint32_t addSystem(const SystemDesc& system) noexcept;
+
+	uint32_t numSystems() const noexcept;
+	const SystemDesc& system(uint32_t systemIdx) const noexcept;
+
+	void setSystemEnabled(uint32_t systemIdx, bool enabled) noexcept;
+	bool systemEnabled(uint32_t systemIdx) const noexcept;
+
+	// Runs all enabled systems for a single tick. Blocks until all systems have finished. Systems
+	// may use the same thread pool for data parallelism, e.g. through parallelForEntities(), the
+	// threads waiting for other systems to finish then help out.
+	void runTick(GameStateHeader* state, float tickTimeSeconds, ThreadPool& threadPool) noexcept;
+
+	// Private members
+	// --------------------------------------------------------------------------------------------
+private:
+	SystemSchedulerState* mState = nullptr;
+};
+
+} // namespace ph
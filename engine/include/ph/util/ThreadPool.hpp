@@ -0,0 +1,115 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+
+#include <sfz/memory/Allocator.hpp>
+
+namespace ph {
+
+// ThreadPool
+// ------------------------------------------------------------------------------------------------
+
+// Signature of a task function run by ThreadPool::run(). threadIdx is the index of the thread
+// running the task, in the range [0, numThreads()), see ThreadPool::currentThreadIdx(). No two
+// threads running tasks of the same run() have the same index.
+using ThreadPoolTaskFunc = void(*)(uint32_t taskIdx, uint32_t threadIdx, void* userPtr);
+
+struct ThreadPoolState;
+
+// A pool of persistent worker threads used to run tasks in parallel.
+//
+// The tasks of a run() are initially split into one contiguous range per thread. When a thread
+// runs out of tasks it steals half of the remaining range of another thread (work stealing), so
+// uneven task costs are balanced out while each thread still mostly processes neighbouring tasks.
+//
+// The thread calling run() also participates in executing tasks, so a pool with N worker threads
+// can execute N + 1 tasks concurrently.
+//
+// run() may be called from within a task, e.g. a system run by the SystemScheduler using
+// parallelForEntities(). The nested tasks are executed by the calling thread together with all
+// threads that are idle or waiting in helpUntil(). If too many runs are active at the same time
+// the tasks of further nested runs are executed on the calling thread only.
+class ThreadPool final {
+public:
+	// Constructors & destructors
+	// --------------------------------------------------------------------------------------------
+
+	ThreadPool() noexcept = default;
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator= (const ThreadPool&) = delete;
+	ThreadPool(ThreadPool&& o) noexcept { this->swap(o); }
+	ThreadPool& operator= (ThreadPool&& o) noexcept { this->swap(o); return *this; }
+	~ThreadPool() noexcept { this->destroy(); }
+
+	// State methods
+	// --------------------------------------------------------------------------------------------
+
+	// Starts numWorkerThreads worker threads. 0 is valid, in which case run() executes all tasks
+	// on the calling thread. ~0u starts one worker per hardware thread minus the calling thread.
+	void init(uint32_t numWorkerThreads, sfz::Allocator* allocator) noexcept;
+	void swap(ThreadPool& other) noexcept;
+	void destroy() noexcept;
+
+	// Methods
+	// --------------------------------------------------------------------------------------------
+
+	bool isValid() const noexcept { return mState != nullptr; }
+
+	// Returns the number of threads executing tasks, i.e. the number of worker threads + 1.
+	uint32_t numThreads() const noexcept;
+
+	// Returns the threadIdx of the calling thread, i.e. the same index as passed to task functions.
+	// Returns 0 for threads not owned by any pool, such as the thread calling the outermost run().
+	// Nested runs pass the index of the calling thread on to the tasks it executes. Useful for
+	// selecting per-thread data inside tasks where threadIdx is not passed along, e.g. inside the
+	// function given to parallelForEntities().
+	static uint32_t currentThreadIdx() noexcept;
+
+	// Runs taskFunc for each task index in [0, numTasks), distributed over all threads. Blocks
+	// until all tasks have finished.
+	void run(uint32_t numTasks, ThreadPoolTaskFunc taskFunc, void* userPtr) noexcept;
+
+	// Convenience wrapper around run() for lambdas and other callables with the signature
+	// "void(uint32_t taskIdx, uint32_t threadIdx)".
+	template<typename Func>
+	void runFunc(uint32_t numTasks, Func& func) noexcept
+	{
+		this->run(numTasks, [](uint32_t taskIdx, uint32_t threadIdx, void* userPtr) {
+			(*static_cast<Func*>(userPtr))(taskIdx, threadIdx);
+		}, &func);
+	}
+
+	// Blocks the calling task until doneFunc returns true, executing tasks of nested runs in the
+	// meantime. Used instead of blocking on a condition variable within a task, which would keep
+	// the thread from helping the nested runs of the tasks it waits for. doneFunc is called with
+	// the pool's lock held, so it may not call back into the pool. notifyHelpers() must be called
+	// whenever the result of doneFunc may have changed.
+	void helpUntil(bool(*doneFunc)(void* userPtr), void* userPtr) noexcept;
+	void notifyHelpers() noexcept;
+
+	// Private members
+	// --------------------------------------------------------------------------------------------
+private:
+	ThreadPoolState* mState = nullptr;
+};
+
+} // namespace ph
@@ -0,0 +1,322 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/ComponentMask.hpp"
+
+#include "ph/state/SimdSupport.hpp"
+
+namespace ph {
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+static uint32_t scanComponentMasksScalar(
+	const ComponentMask* masks,
+	uint32_t firstIdx,
+	uint32_t numMasks,
+	ComponentMask required,
+	ComponentMask excluded,
+	uint32_t* indicesOut) noexcept
+{
+	uint32_t numMatches = 0;
+	for (uint32_t i = firstIdx; i < numMasks; i++) {
+		if (masks[i].fulfills(required, excluded)) {
+			indicesOut[numMatches] = i;
+			numMatches += 1;
+		}
+	}
+	return numMatches;
+}
+
+#ifdef PH_SIMD_X86
+
+// Lookup table used to compact the indices of up to 4 matching masks into a contiguous run. Entry
+// "bits" contains the lane indices of the set bits in "bits", in ascending order.
+alignas(16) static const uint32_t COMPACT_LANES_LUT[16][4] = {
+	{ 0, 0, 0, 0 }, // 0000
+	{ 0, 0, 0, 0 }, // 0001
+	{ 1, 0, 0, 0 }, // 0010
+	{ 0, 1, 0, 0 }, // 0011
+	{ 2, 0, 0, 0 }, // 0100
+	{ 0, 2, 0, 0 }, // 0101
+	{ 1, 2, 0, 0 }, // 0110
+	{ 0, 1, 2, 0 }, // 0111
+	{ 3, 0, 0, 0 }, // 1000
+	{ 0, 3, 0, 0 }, // 1001
+	{ 1, 3, 0, 0 }, // 1010
+	{ 0, 1, 3, 0 }, // 1011
+	{ 2, 3, 0, 0 }, // 1100
+	{ 0, 2, 3, 0 }, // 1101
+	{ 1, 2, 3, 0 }, // 1110
+	{ 0, 1, 2, 3 }  // 1111
+};
+
+static const uint32_t POPCOUNT_4BIT_LUT[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+// Writes the indices of the (up to 4) matching lanes to indicesOut. Always writes 4 indices, but
+// only the first popcount(bits) are valid. Safe as long as the number of matches so far is not
+// larger than the index of the first mask in the block, which is always the case.
+static inline uint32_t writeMatchingIndices(
+	uint32_t* indicesOut, uint32_t blockFirstIdx, uint32_t bits) noexcept
+{
+	__m128i lanes = _mm_load_si128(reinterpret_cast<const __m128i*>(COMPACT_LANES_LUT[bits]));
+	__m128i indices = _mm_add_epi32(lanes, _mm_set1_epi32(int32_t(blockFirstIdx)));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(indicesOut), indices);
+	return POPCOUNT_4BIT_LUT[bits];
+}
+
+#if PH_COMPONENT_MASK_NUM_BITS == 64
+
+// SSE2 does not have 64-bit compares, so we compare the 32-bit halves and then AND each half with
+// its neighbour.
+static inline __m128i cmpeqEpi64Sse2(__m128i a, __m128i b) noexcept
+{
+	__m128i eq32 = _mm_cmpeq_epi32(a, b);
+	__m128i eq32Swapped = _mm_shuffle_epi32(eq32, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_and_si128(eq32, eq32Swapped);
+}
+
+static uint32_t scanComponentMasksSse2(
+	const ComponentMask* masks,
+	uint32_t numMasks,
+	ComponentMask required,
+	ComponentMask excluded,
+	uint32_t* indicesOut) noexcept
+{
+	const __m128i req = _mm_set1_epi64x(int64_t(required.words[0]));
+	const __m128i exc = _mm_set1_epi64x(int64_t(excluded.words[0]));
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i* masksPtr = reinterpret_cast<const __m128i*>(masks);
+
+	// Test 4 masks (2 registers) per iteration
+	uint32_t numMatches = 0;
+	const uint32_t numMasksBlocks = numMasks & ~3u;
+	for (uint32_t i = 0; i < numMasksBlocks; i += 4) {
+		__m128i m0 = _mm_loadu_si128(masksPtr + (i / 2));
+		__m128i m1 = _mm_loadu_si128(masksPtr + (i / 2) + 1);
+
+		__m128i ok0 = _mm_and_si128(
+			cmpeqEpi64Sse2(_mm_and_si128(m0, req), req),
+			cmpeqEpi64Sse2(_mm_and_si128(m0, exc), zero));
+		__m128i ok1 = _mm_and_si128(
+			cmpeqEpi64Sse2(_mm_and_si128(m1, req), req),
+			cmpeqEpi64Sse2(_mm_and_si128(m1, exc), zero));
+
+		uint32_t bits = uint32_t(_mm_movemask_pd(_mm_castsi128_pd(ok0))) |
+			(uint32_t(_mm_movemask_pd(_mm_castsi128_pd(ok1))) << 2);
+
+		// Fast path for the common case where no mask in the block matches
+		if (bits == 0) continue;
+
+		numMatches += writeMatchingIndices(indicesOut + numMatches, i, bits);
+	}
+
+	// Handle remaining masks
+	numMatches += scanComponentMasksScalar(
+		masks, numMasksBlocks, numMasks, required, excluded, indicesOut + numMatches);
+	return numMatches;
+}
+
+PH_TARGET_AVX2 static uint32_t scanComponentMasksAvx2(
+	const ComponentMask* masks,
+	uint32_t numMasks,
+	ComponentMask required,
+	ComponentMask excluded,
+	uint32_t* indicesOut) noexcept
+{
+	const __m256i req = _mm256_set1_epi64x(int64_t(required.words[0]));
+	const __m256i exc = _mm256_set1_epi64x(int64_t(excluded.words[0]));
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i* masksPtr = reinterpret_cast<const __m256i*>(masks);
+
+	// Test 8 masks (2 registers) per iteration
+	uint32_t numMatches = 0;
+	const uint32_t numMasksBlocks = numMasks & ~7u;
+	for (uint32_t i = 0; i < numMasksBlocks; i += 8) {
+		__m256i m0 = _mm256_loadu_si256(masksPtr + (i / 4));
+		__m256i m1 = _mm256_loadu_si256(masksPtr + (i / 4) + 1);
+
+		__m256i ok0 = _mm256_and_si256(
+			_mm256_cmpeq_epi64(_mm256_and_si256(m0, req), req),
+			_mm256_cmpeq_epi64(_mm256_and_si256(m0, exc), zero));
+		__m256i ok1 = _mm256_and_si256(
+			_mm256_cmpeq_epi64(_mm256_and_si256(m1, req), req),
+			_mm256_cmpeq_epi64(_mm256_and_si256(m1, exc), zero));
+
+		uint32_t bits0 = uint32_t(_mm256_movemask_pd(_mm256_castsi256_pd(ok0)));
+		uint32_t bits1 = uint32_t(_mm256_movemask_pd(_mm256_castsi256_pd(ok1)));
+
+		// Fast path for the common case where no mask in the block matches
+		if ((bits0 | bits1) == 0) continue;
+
+		numMatches += writeMatchingIndices(indicesOut + numMatches, i, bits0);
+		numMatches += writeMatchingIndices(indicesOut + numMatches, i + 4, bits1);
+	}
+
+	// Handle remaining masks
+	numMatches += scanComponentMasksScalar(
+		masks, numMasksBlocks, numMasks, required, excluded, indicesOut + numMatches);
+	return numMatches;
+}
+
+#else
+
+// Wide masks span multiple 64-bit words. A mask matches if no word has a required bit missing or
+// an excluded bit set, i.e. if (~mask & required) | (mask & excluded) is zero in all words.
+
+static uint32_t scanComponentMasksSse2(
+	const ComponentMask* masks,
+	uint32_t numMasks,
+	ComponentMask required,
+	ComponentMask excluded,
+	uint32_t* indicesOut) noexcept
+{
+	// Each mask is NUM_REGS registers
+	constexpr uint32_t NUM_REGS = ComponentMask::NUM_WORDS / 2;
+	__m128i req[NUM_REGS];
+	__m128i exc[NUM_REGS];
+	for (uint32_t r = 0; r < NUM_REGS; r++) {
+		req[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(required.words + r * 2));
+		exc[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(excluded.words + r * 2));
+	}
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i* masksPtr = reinterpret_cast<const __m128i*>(masks);
+
+	// Test 4 masks per iteration
+	uint32_t numMatches = 0;
+	const uint32_t numMasksBlocks = numMasks & ~3u;
+	for (uint32_t i = 0; i < numMasksBlocks; i += 4) {
+		uint32_t bits = 0;
+		for (uint32_t j = 0; j < 4; j++) {
+			__m128i failed = zero;
+			for (uint32_t r = 0; r < NUM_REGS; r++) {
+				__m128i m = _mm_loadu_si128(masksPtr + (i + j) * NUM_REGS + r);
+				failed = _mm_or_si128(failed,
+					_mm_or_si128(_mm_andnot_si128(m, req[r]), _mm_and_si128(m, exc[r])));
+			}
+			bits |= uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(failed, zero)) == 0xFFFF) << j;
+		}
+
+		// Fast path for the common case where no mask in the block matches
+		if (bits == 0) continue;
+
+		numMatches += writeMatchingIndices(indicesOut + numMatches, i, bits);
+	}
+
+	// Handle remaining masks
+	numMatches += scanComponentMasksScalar(
+		masks, numMasksBlocks, numMasks, required, excluded, indicesOut + numMatches);
+	return numMatches;
+}
+
+PH_TARGET_AVX2 static uint32_t scanComponentMasksAvx2(
+	const ComponentMask* masks,
+	uint32_t numMasks,
+	ComponentMask required,
+	ComponentMask excluded,
+	uint32_t* indicesOut) noexcept
+{
+	// A register holds 4 words, i.e. an entire number of masks (2 or 1), so required and excluded
+	// are repeated to fill a register and each register is tested against the same pattern
+	constexpr uint32_t NUM_WORDS = ComponentMask::NUM_WORDS;
+	alignas(32) uint64_t reqWords[4];
+	alignas(32) uint64_t excWords[4];
+	for (uint32_t k = 0; k < 4; k++) {
+		reqWords[k] = required.words[k % NUM_WORDS];
+		excWords[k] = excluded.words[k % NUM_WORDS];
+	}
+	const __m256i req = _mm256_load_si256(reinterpret_cast<const __m256i*>(reqWords));
+	const __m256i exc = _mm256_load_si256(reinterpret_cast<const __m256i*>(excWords));
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i* masksPtr = reinterpret_cast<const __m256i*>(masks);
+
+	// Test 4 masks (NUM_WORDS registers) per iteration
+	uint32_t numMatches = 0;
+	const uint32_t numMasksBlocks = numMasks & ~3u;
+	for (uint32_t i = 0; i < numMasksBlocks; i += 4) {
+		uint32_t bits = 0;
+		if (NUM_WORDS == 4) {
+			// One mask per register, matches if no bit in the register failed
+			for (uint32_t r = 0; r < 4; r++) {
+				__m256i m = _mm256_loadu_si256(masksPtr + i + r);
+				__m256i failed = _mm256_or_si256(_mm256_andnot_si256(m, req), _mm256_and_si256(m, exc));
+				bits |= uint32_t(_mm256_testz_si256(failed, failed)) << r;
+			}
+		}
+		else {
+			// Two masks per register, one bit per 64-bit word which passed. A mask matches if both
+			// its words passed, reduce each pair to one bit and gather them to the bottom.
+			uint32_t wordBits = 0;
+			for (uint32_t r = 0; r < 2; r++) {
+				__m256i m = _mm256_loadu_si256(masksPtr + (i / 2) + r);
+				__m256i failed = _mm256_or_si256(_mm256_andnot_si256(m, req), _mm256_and_si256(m, exc));
+				wordBits |= uint32_t(_mm256_movemask_pd(
+					_mm256_castsi256_pd(_mm256_cmpeq_epi64(failed, zero)))) << (r * 4);
+			}
+			bits = wordBits & (wordBits >> 1) & 0x55;
+			bits = (bits | (bits >> 1)) & 0x33;
+			bits = (bits | (bits >> 2)) & 0x0F;
+		}
+
+		// Fast path for the common case where no mask in the block matches
+		if (bits == 0) continue;
+
+		numMatches += writeMatchingIndices(indicesOut + numMatches, i, bits);
+	}
+
+	// Handle remaining masks
+	numMatches += scanComponentMasksScalar(
+		masks, numMasksBlocks, numMasks, required, excluded, indicesOut + numMatches);
+	return numMatches;
+}
+
+#endif
+
+#endif
+
+// Component mask scanning
+// ------------------------------------------------------------------------------------------------
+
+uint32_t scanComponentMasks(
+	const ComponentMask* masks,
+	uint32_t numMasks,
+	ComponentMask required,
+	ComponentMask excluded,
+	uint32_t* indicesOut) noexcept
+{
+#ifdef PH_SIMD_X86
+	if (cpuSupportsAvx2()) {
+		return scanComponentMasksAvx2(masks, numMasks, required, excluded, indicesOut);
+	}
+	return scanComponentMasksSse2(masks, numMasks, required, excluded, indicesOut);
+#else
+	return scanComponentMasksScalar(masks, 0, numMasks, required, excluded, indicesOut);
+#endif
+}
+
+const char* componentMaskScanImplName() noexcept
+{
+#ifdef PH_SIMD_X86
+	return cpuSupportsAvx2() ? "AVX2" : "SSE2";
+#else
+	return "Scalar";
+#endif
+}
+
+} // namespace ph
@@ -0,0 +1,367 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/EntityCommandBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility> // std::swap()
+
+#include <sfz/Assert.hpp>
+#include <sfz/containers/DynArray.hpp>
+
+#include "ph/state/GameState.hpp"
+
+namespace ph {
+
+using sfz::DynArray;
+
+// EntityCommand
+// ------------------------------------------------------------------------------------------------
+
+enum class EntityCommandType : uint8_t {
+	CREATE_ENTITY = 0,
+	CLONE_ENTITY,
+	DELETE_ENTITY,
+	ADD_COMPONENT,
+	SET_COMPONENT_UNSIZED,
+	DELETE_COMPONENT
+};
+
+// A recorded command, stored in the command stream followed by dataSize bytes of component data
+// (padded to a multiple of 4 bytes).
+struct EntityCommand final {
+	uint32_t sortKey = 0;
+	EntityCommandType type = EntityCommandType::CREATE_ENTITY;
+	uint8_t targetIsDeferred = 0;
+	uint8_t flagValue = 0;
+	uint8_t ___PADDING_UNUSED___ = 0;
+	uint32_t componentType = 0;
+	uint32_t target = ~0u; // Entity raw bits or DeferredEntity index depending on targetIsDeferred
+	uint32_t result = ~0u; // DeferredEntity index of the created entity, if any
+	uint32_t dataSize = 0;
+};
+static_assert(sizeof(EntityCommand) == 24, "EntityCommand is padded");
+
+// EntityCommandBufferState
+// ------------------------------------------------------------------------------------------------
+
+struct EntityCommandBufferState final {
+	sfz::Allocator* allocator = nullptr;
+	DynArray<uint8_t> commands;
+	uint32_t numCommands = 0;
+	uint32_t sortKey = 0;
+	uint32_t numDeferredEntities = 0;
+	DynArray<uint32_t> deferredSortKeys; // The sort key each deferred entity was created with
+	DynArray<Entity> resolvedEntities;
+};
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+// Records the command with the current sort key. Commands targeting a deferred entity get at least
+// the sort key the entity was created with, so that they are never played back before it exists.
+// If data is nullptr dataSize zero bytes are recorded.
+static void recordCommand(
+	EntityCommandBufferState& state, EntityCommand command, const uint8_t* data = nullptr) noexcept
+{
+	command.sortKey = state.sortKey;
+	if (command.targetIsDeferred) {
+		sfz_assert(command.target < state.deferredSortKeys.size());
+		const uint32_t createSortKey = state.deferredSortKeys[command.target];
+		sfz_assert(command.sortKey >= createSortKey);
+		if (command.sortKey < createSortKey) command.sortKey = createSortKey;
+	}
+	state.commands.add(reinterpret_cast<const uint8_t*>(&command), sizeof(EntityCommand));
+	if (command.dataSize != 0) {
+		if (data != nullptr) state.commands.add(data, command.dataSize);
+		else state.commands.add(uint8_t(0), command.dataSize);
+		uint32_t padding = (4 - (command.dataSize & 0x3)) & 0x3;
+		if (padding != 0) state.commands.add(uint8_t(0), padding);
+	}
+	state.numCommands += 1;
+}
+
+static EntityCommand targetCommand(EntityCommandType type, Entity entity) noexcept
+{
+	EntityCommand command;
+	command.type = type;
+	command.targetIsDeferred = 0;
+	command.target = entity.rawBits;
+	return command;
+}
+
+static EntityCommand targetCommand(EntityCommandType type, DeferredEntity entity) noexcept
+{
+	sfz_assert(entity != DeferredEntity());
+	EntityCommand command;
+	command.type = type;
+	command.targetIsDeferred = 1;
+	command.target = entity.idx;
+	return command;
+}
+
+static uint32_t commandSizeBytes(const EntityCommand& command) noexcept
+{
+	uint32_t padding = (4 - (command.dataSize & 0x3)) & 0x3;
+	return sizeof(EntityCommand) + command.dataSize + padding;
+}
+
+// EntityCommandBuffer: State methods
+// ------------------------------------------------------------------------------------------------
+
+void EntityCommandBuffer::init(uint32_t initialCapacityBytes, sfz::Allocator* allocator) noexcept
+{
+	this->destroy();
+	mState = allocator->newObject<EntityCommandBufferState>(sfz_dbg("EntityCommandBufferState"));
+	mState->allocator = allocator;
+	mState->commands.init(initialCapacityBytes, allocator, sfz_dbg("EntityCommandBuffer::commands"));
+	mState->deferredSortKeys.init(0, allocator, sfz_dbg("EntityCommandBuffer::deferredSortKeys"));
+	mState->resolvedEntities.init(0, allocator, sfz_dbg("EntityCommandBuffer::resolvedEntities"));
+}
+
+void EntityCommandBuffer::swap(EntityCommandBuffer& other) noexcept
+{
+	std::swap(this->mState, other.mState);
+}
+
+void EntityCommandBuffer::destroy() noexcept
+{
+	if (mState == nullptr) return;
+	sfz::Allocator* allocator = mState->allocator;
+	allocator->deleteObject(mState);
+	mState = nullptr;
+}
+
+// EntityCommandBuffer: Methods
+// ------------------------------------------------------------------------------------------------
+
+void EntityCommandBuffer::setSortKey(uint32_t sortKey) noexcept
+{
+	mState->sortKey = sortKey;
+}
+
+uint32_t EntityCommandBuffer::sortKey() const noexcept
+{
+	return mState->sortKey;
+}
+
+uint32_t EntityCommandBuffer::numCommands() const noexcept
+{
+	return mState->numCommands;
+}
+
+void EntityCommandBuffer::clear() noexcept
+{
+	mState->commands.clear();
+	mState->numCommands = 0;
+	mState->sortKey = 0;
+	mState->numDeferredEntities = 0;
+	mState->deferredSortKeys.clear();
+	mState->resolvedEntities.clear();
+}
+
+Entity EntityCommandBuffer::resolveEntity(DeferredEntity entity) const noexcept
+{
+	if (entity.idx >= mState->resolvedEntities.size()) return Entity::invalid();
+	return mState->resolvedEntities[entity.idx];
+}
+
+// EntityCommandBuffer: Recording commands
+// ------------------------------------------------------------------------------------------------
+
+DeferredEntity EntityCommandBuffer::createEntity() noexcept
+{
+	DeferredEntity deferred;
+	deferred.idx = mState->numDeferredEntities++;
+	mState->deferredSortKeys.add(mState->sortKey);
+	EntityCommand command;
+	command.type = EntityCommandType::CREATE_ENTITY;
+	command.result = deferred.idx;
+	recordCommand(*mState, command);
+	return deferred;
+}
+
+DeferredEntity EntityCommandBuffer::cloneEntity(Entity entity) noexcept
+{
+	DeferredEntity deferred;
+	deferred.idx = mState->numDeferredEntities++;
+	mState->deferredSortKeys.add(mState->sortKey);
+	EntityCommand command = targetCommand(EntityCommandType::CLONE_ENTITY, entity);
+	command.result = deferred.idx;
+	recordCommand(*mState, command);
+	return deferred;
+}
+
+void EntityCommandBuffer::deleteEntity(Entity entity) noexcept
+{
+	recordCommand(*mState, targetCommand(EntityCommandType::DELETE_ENTITY, entity));
+}
+
+void EntityCommandBuffer::deleteEntity(DeferredEntity entity) noexcept
+{
+	recordCommand(*mState, targetCommand(EntityCommandType::DELETE_ENTITY, entity));
+}
+
+void EntityCommandBuffer::addComponentUntyped(
+	Entity entity, uint32_t componentType, const uint8_t* data, uint32_t dataSize) noexcept
+{
+	EntityCommand command = targetCommand(EntityCommandType::ADD_COMPONENT, entity);
+	command.componentType = componentType;
+	command.dataSize = dataSize;
+	recordCommand(*mState, command, data);
+}
+
+void EntityCommandBuffer::addComponentUntyped(
+	DeferredEntity entity, uint32_t componentType, const uint8_t* data, uint32_t dataSize) noexcept
+{
+	EntityCommand command = targetCommand(EntityCommandType::ADD_COMPONENT, entity);
+	command.componentType = componentType;
+	command.dataSize = dataSize;
+	recordCommand(*mState, command, data);
+}
+
+void EntityCommandBuffer::setComponentUnsized(
+	Entity entity, uint32_t componentType, bool value) noexcept
+{
+	EntityCommand command = targetCommand(EntityCommandType::SET_COMPONENT_UNSIZED, entity);
+	command.componentType = componentType;
+	command.flagValue = value ? 1 : 0;
+	recordCommand(*mState, command);
+}
+
+void EntityCommandBuffer::setComponentUnsized(
+	DeferredEntity entity, uint32_t componentType, bool value) noexcept
+{
+	EntityCommand command = targetCommand(EntityCommandType::SET_COMPONENT_UNSIZED, entity);
+	command.componentType = componentType;
+	command.flagValue = value ? 1 : 0;
+	recordCommand(*mState, command);
+}
+
+void EntityCommandBuffer::deleteComponent(Entity entity, uint32_t componentType) noexcept
+{
+	EntityCommand command = targetCommand(EntityCommandType::DELETE_COMPONENT, entity);
+	command.componentType = componentType;
+	recordCommand(*mState, command);
+}
+
+void EntityCommandBuffer::deleteComponent(DeferredEntity entity, uint32_t componentType) noexcept
+{
+	EntityCommand command = targetCommand(EntityCommandType::DELETE_COMPONENT, entity);
+	command.componentType = componentType;
+	recordCommand(*mState, command);
+}
+
+// Playback functions
+// ------------------------------------------------------------------------------------------------
+
+struct CommandRef final {
+	uint32_t sortKey;
+	uint32_t bufferIdx;
+	uint32_t offset; // Offset into the buffer's command stream, increases with recording order
+
+	bool operator< (const CommandRef& o) const noexcept
+	{
+		if (sortKey != o.sortKey) return sortKey < o.sortKey;
+		if (bufferIdx != o.bufferIdx) return bufferIdx < o.bufferIdx;
+		return offset < o.offset;
+	}
+};
+
+uint32_t playbackEntityCommandBuffers(
+	GameStateHeader* state,
+	EntityCommandBuffer* buffers,
+	uint32_t numBuffers,
+	sfz::Allocator* allocator) noexcept
+{
+	// Gather references to all commands and reset the resolved deferred entities
+	uint32_t totalNumCommands = 0;
+	for (uint32_t i = 0; i < numBuffers; i++) totalNumCommands += buffers[i].numCommands();
+	DynArray<CommandRef> commandRefs;
+	commandRefs.init(totalNumCommands, allocator, sfz_dbg("playbackEntityCommandBuffers()"));
+	for (uint32_t i = 0; i < numBuffers; i++) {
+		EntityCommandBufferState& bufferState = *buffers[i].mState;
+		bufferState.resolvedEntities.clear();
+		bufferState.resolvedEntities.add(Entity::invalid(), bufferState.numDeferredEntities);
+
+		uint32_t offset = 0;
+		while (offset < bufferState.commands.size()) {
+			EntityCommand command;
+			memcpy(&command, bufferState.commands.data() + offset, sizeof(EntityCommand));
+			commandRefs.add(CommandRef{ command.sortKey, i, offset });
+			offset += commandSizeBytes(command);
+		}
+	}
+
+	// Sort commands into playback order, commonly already sorted if there is a single buffer
+	if (!std::is_sorted(commandRefs.begin(), commandRefs.end())) {
+		std::sort(commandRefs.begin(), commandRefs.end());
+	}
+
+	// Execute commands
+	uint32_t numFailed = 0;
+	for (const CommandRef& ref : commandRefs) {
+		EntityCommandBufferState& bufferState = *buffers[ref.bufferIdx].mState;
+		const uint8_t* commandPtr = bufferState.commands.data() + ref.offset;
+		EntityCommand command;
+		memcpy(&command, commandPtr, sizeof(EntityCommand));
+		const uint8_t* data = commandPtr + sizeof(EntityCommand);
+
+		// Resolve target entity
+		Entity target;
+		if (command.targetIsDeferred) {
+			sfz_assert(command.target < bufferState.numDeferredEntities);
+			target = bufferState.resolvedEntities[command.target];
+		}
+		else {
+			target.rawBits = command.target;
+		}
+
+		bool success = false;
+		switch (command.type) {
+		case EntityCommandType::CREATE_ENTITY:
+			bufferState.resolvedEntities[command.result] = state->createEntity();
+			success = bufferState.resolvedEntities[command.result] != Entity::invalid();
+			break;
+		case EntityCommandType::CLONE_ENTITY:
+			bufferState.resolvedEntities[command.result] = state->cloneEntity(target);
+			success = bufferState.resolvedEntities[command.result] != Entity::invalid();
+			break;
+		case EntityCommandType::DELETE_ENTITY:
+			success = state->checkEntityValid(target) && state->deleteEntity(target);
+			break;
+		case EntityCommandType::ADD_COMPONENT:
+			success = state->addComponentUntyped(target, command.componentType, data, command.dataSize);
+			break;
+		case EntityCommandType::SET_COMPONENT_UNSIZED:
+			success = state->setComponentUnsized(target, command.componentType, command.flagValue != 0);
+			break;
+		case EntityCommandType::DELETE_COMPONENT:
+			success = state->deleteComponent(target, command.componentType);
+			break;
+		}
+		if (!success) numFailed += 1;
+	}
+
+	commandRefs.destroy();
+	return numFailed;
+}
+
+} // namespace ph
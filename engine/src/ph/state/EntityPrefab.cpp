@@ -0,0 +1,116 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/EntityPrefab.hpp"
+
+#include <utility> // std::swap()
+
+#include "ph/state/GameState.hpp"
+
+namespace ph {
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+// The stored components are 16-byte aligned within the data buffer.
+static constexpr uint32_t PREFAB_COMPONENT_ALIGNMENT = 16;
+
+// EntityPrefab: State methods
+// ------------------------------------------------------------------------------------------------
+
+bool EntityPrefab::capture(
+	const GameStateHeader* state, Entity entity, sfz::Allocator* allocator) noexcept
+{
+	this->destroy();
+	if (!state->checkEntityValid(entity)) return false;
+	const ComponentMask mask = state->componentMasks()[entity.id()];
+
+	// Calculate the offsets of the components with data
+	mComponents.init(0, allocator, sfz_dbg("EntityPrefab::mComponents"));
+	uint32_t numBytes = 0;
+	for (uint32_t componentType = 1; componentType < state->numComponentTypes; componentType++) {
+		if (!mask.hasComponentType(componentType)) continue;
+		uint32_t componentSize = 0;
+		if (state->componentsUntyped(componentType, componentSize) == nullptr) continue;
+		PrefabComponent component;
+		component.componentType = componentType;
+		component.sizeInBytes = componentSize;
+		component.offset = numBytes;
+		mComponents.add(component);
+		numBytes += (componentSize + PREFAB_COMPONENT_ALIGNMENT - 1) &
+			~(PREFAB_COMPONENT_ALIGNMENT - 1);
+	}
+
+	// Copy the components, regardless of storage
+	mData.init(numBytes, allocator, sfz_dbg("EntityPrefab::mData"));
+	mData.add(uint8_t(0), numBytes);
+	for (const PrefabComponent& component : mComponents) {
+		bool success = state->readComponentUntyped(component.componentType, entity.id(),
+			mData.data() + component.offset, component.sizeInBytes);
+		sfz_assert(success);
+		(void)success;
+	}
+
+	mMask = mask;
+	mNumComponentTypes = state->numComponentTypes;
+	return true;
+}
+
+void EntityPrefab::swap(EntityPrefab& other) noexcept
+{
+	std::swap(this->mMask, other.mMask);
+	std::swap(this->mNumComponentTypes, other.mNumComponentTypes);
+	this->mComponents.swap(other.mComponents);
+	this->mData.swap(other.mData);
+}
+
+void EntityPrefab::destroy() noexcept
+{
+	mMask = ComponentMask::empty();
+	mNumComponentTypes = 0;
+	mComponents.destroy();
+	mData.destroy();
+}
+
+// EntityPrefab: Methods
+// ------------------------------------------------------------------------------------------------
+
+uint8_t* EntityPrefab::componentUntyped(
+	uint32_t componentType, uint32_t& componentSizeBytesOut) noexcept
+{
+	for (const PrefabComponent& component : mComponents) {
+		if (component.componentType != componentType) continue;
+		componentSizeBytesOut = component.sizeInBytes;
+		return mData.data() + component.offset;
+	}
+	return nullptr;
+}
+
+const uint8_t* EntityPrefab::componentUntyped(
+	uint32_t componentType, uint32_t& componentSizeBytesOut) const noexcept
+{
+	for (const PrefabComponent& component : mComponents) {
+		if (component.componentType != componentType) continue;
+		componentSizeBytesOut = component.sizeInBytes;
+		return mData.data() + component.offset;
+	}
+	return nullptr;
+}
+
+} // namespace ph
@@ -19,10 +19,1217 @@
 
 #include "ph/state/GameState.hpp"
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 
+#include <sfz/Logging.hpp>
+#include <sfz/containers/DynArray.hpp>
+#include <sfz/util/IO.hpp>
+
+#include "ph/state/EntityPrefab.hpp"
+#include "ph/state/SimdSupport.hpp"
+#include "ph/state/StateHash.hpp"
+
 namespace ph {
 
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+// Relaxed atomic loads, used to check whether an atomic write can be skipped without racing with
+// writes from other threads
+template<typename T>
+static T atomicLoadRelaxed(const T* word) noexcept
+{
+#ifdef _MSC_VER
+	return *reinterpret_cast<const volatile T*>(word);
+#else
+	return __atomic_load_n(word, __ATOMIC_RELAXED);
+#endif
+}
+
+// Atomically sets the given bits in the word, skips the atomic operation if already set
+static void atomicSetBits(uint64_t* word, uint64_t bits) noexcept
+{
+	if ((atomicLoadRelaxed(word) & bits) == bits) return;
+#ifdef _MSC_VER
+	_InterlockedOr64(reinterpret_cast<volatile int64_t*>(word), int64_t(bits));
+#else
+	__atomic_fetch_or(word, bits, __ATOMIC_RELAXED);
+#endif
+}
+
+// Atomically sets the word to 0, skips the atomic operation if already 0
+static void atomicClearWord(uint64_t* word) noexcept
+{
+	if (atomicLoadRelaxed(word) == 0) return;
+#ifdef _MSC_VER
+	_InterlockedExchange64(reinterpret_cast<volatile int64_t*>(word), 0);
+#else
+	__atomic_store_n(word, uint64_t(0), __ATOMIC_RELAXED);
+#endif
+}
+
+// Atomically sets the word to the given tick, skips the atomic operation if already set
+static void atomicSetTick(uint32_t* word, uint32_t tick) noexcept
+{
+	if (atomicLoadRelaxed(word) == tick) return;
+#ifdef _MSC_VER
+	_InterlockedExchange(reinterpret_cast<volatile long*>(word), long(tick));
+#else
+	__atomic_store_n(word, tick, __ATOMIC_RELAXED);
+#endif
+}
+
+// Atomically adds up to num to the counter without exceeding max, returns the previous value of
+// the counter. The number actually added is returned in numAddedOut.
+static uint32_t atomicAddClamped(
+	uint32_t* counter, uint32_t num, uint32_t max, uint32_t& numAddedOut) noexcept
+{
+#ifdef _MSC_VER
+	volatile long* word = reinterpret_cast<volatile long*>(counter);
+	uint32_t prev = uint32_t(*word);
+	while (true) {
+		uint32_t next = prev + std::min(num, max - std::min(prev, max));
+		if (next == prev) break;
+		uint32_t actual = uint32_t(_InterlockedCompareExchange(word, long(next), long(prev)));
+		if (actual == prev) break;
+		prev = actual;
+	}
+#else
+	uint32_t prev = __atomic_load_n(counter, __ATOMIC_RELAXED);
+	while (true) {
+		uint32_t next = prev + std::min(num, max - std::min(prev, max));
+		if (next == prev) break;
+		if (__atomic_compare_exchange_n(
+			counter, &prev, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+	}
+#endif
+	numAddedOut = std::min(num, max - std::min(prev, max));
+	return prev;
+}
+
+// Atomically adds num to the counter
+static void atomicAdd(uint32_t* counter, uint32_t num) noexcept
+{
+#ifdef _MSC_VER
+	_InterlockedExchangeAdd(reinterpret_cast<volatile long*>(counter), long(num));
+#else
+	__atomic_fetch_add(counter, num, __ATOMIC_RELAXED);
+#endif
+}
+
+// The size in bytes of the array and its header, padded to 32 bytes. Same as
+// ArrayHeader::numBytesNeededForArrayPlusHeader32Byte() but can't overflow, used when calculating
+// the size of a game state.
+static uint64_t arrayPlusHeaderSizeBytes(const ArrayHeader& header) noexcept
+{
+	const uint64_t arraySizeBytes = uint64_t(header.capacity) * header.elementSize;
+	return sizeof(ArrayHeader) + ((arraySizeBytes + 31) & ~uint64_t(31));
+}
+
+// Calls func(componentType) for each component type in the mask in ascending order, skipping
+// the active bit (which has no data)
+template<typename Func>
+static void forEachComponentType(ComponentMask mask, Func&& func) noexcept
+{
+	mask.setComponentType(0, false);
+	for (uint32_t wordIdx = 0; wordIdx < ComponentMask::NUM_WORDS; wordIdx++) {
+		uint64_t bits = mask.words[wordIdx];
+		while (bits != 0) {
+			uint32_t bitIdx = lowestSetBitIdx(bits);
+			bits &= bits - 1;
+			func(wordIdx * 64 + bitIdx);
+		}
+	}
+}
+
+// Returns the component registry entry for the given (existing) component type
+static ComponentRegistryEntry registryEntry(
+	const GameStateHeader* state, uint32_t componentType) noexcept
+{
+	sfz_assert(componentType < state->numComponentTypes);
+	return state->componentRegistryArray()->at<ComponentRegistryEntry>(componentType);
+}
+
+// Marks the block(s) containing the given entities as dirty for the given component type, without
+// stamping them as written. Used for internal bookkeeping which is not a write by the user.
+static void markDirtyBlocks(
+	GameStateHeader* state,
+	uint32_t componentType,
+	uint32_t firstEntityId,
+	uint32_t numEntities = 1) noexcept
+{
+	if (state->dirtyBlockSize == 0 || numEntities == 0) return;
+	sfz_assert((firstEntityId + numEntities) <= state->maxNumEntities);
+	uint32_t firstBlockIdx = firstEntityId / state->dirtyBlockSize;
+	uint32_t lastBlockIdx = (firstEntityId + numEntities - 1) / state->dirtyBlockSize;
+	uint64_t* bits = state->dirtyBlocks(componentType);
+	for (uint32_t blockIdx = firstBlockIdx; blockIdx <= lastBlockIdx; blockIdx++) {
+		atomicSetBits(bits + blockIdx / 64, uint64_t(1) << (blockIdx % 64));
+	}
+	atomicClearWord(state->hashCacheArray()->data<uint64_t>() + componentType);
+}
+
+// Stamps the given kinds of changes with the current change tick for the given range of entities,
+// does nothing if the component type is not change tracked. The blocks are also marked dirty for
+// the component type, so that the change ticks are covered by the dirty tracking.
+static void stampChanges(
+	GameStateHeader* state,
+	uint32_t componentType,
+	uint32_t firstEntityId,
+	uint32_t numEntities,
+	uint32_t changeKinds) noexcept
+{
+	if (state->changeTick == 0 || numEntities == 0) return;
+	const ComponentRegistryEntry entry = registryEntry(state, componentType);
+	if (!entry.componentTypeIsChangeTracked()) return;
+	sfz_assert((firstEntityId + numEntities) <= state->maxNumEntities);
+	const uint32_t tick = state->changeTick;
+	ComponentChangeTicks* ticks =
+		state->arrayAt(entry.offsetChangeTicks)->data<ComponentChangeTicks>() + firstEntityId;
+	for (uint32_t i = 0; i < numEntities; i++) {
+		if ((changeKinds & COMPONENT_CHANGE_ADDED) != 0) ticks[i].added = tick;
+		if ((changeKinds & COMPONENT_CHANGE_REMOVED) != 0) ticks[i].removed = tick;
+		if ((changeKinds & COMPONENT_CHANGE_WRITTEN) != 0) ticks[i].written = tick;
+	}
+	uint32_t* blockTicks = state->arrayAt(entry.offsetChangeBlockTicks)->data<uint32_t>();
+	const uint32_t lastEntityId = firstEntityId + numEntities - 1;
+	for (uint32_t blockIdx = firstEntityId / GAME_STATE_CHANGE_BLOCK_SIZE;
+		blockIdx <= lastEntityId / GAME_STATE_CHANGE_BLOCK_SIZE; blockIdx++) {
+		atomicSetTick(blockTicks + blockIdx, tick);
+	}
+	markDirtyBlocks(state, componentType, firstEntityId, numEntities);
+}
+
+// Stamps the component types added to and removed from the mask of the given entity. Component
+// type 0 (the active bit) records creation and deletion of the entity.
+static void stampMaskChanges(
+	GameStateHeader* state, uint32_t entityId, ComponentMask oldMask, ComponentMask newMask) noexcept
+{
+	if (state->changeTick == 0) return;
+	const ComponentMask added = newMask & ~oldMask;
+	const ComponentMask removed = oldMask & ~newMask;
+	if (added.active()) stampChanges(state, 0, entityId, 1, COMPONENT_CHANGE_ADDED);
+	if (removed.active()) stampChanges(state, 0, entityId, 1, COMPONENT_CHANGE_REMOVED);
+	forEachComponentType(added, [&](uint32_t componentType) {
+		stampChanges(state, componentType, entityId, 1, COMPONENT_CHANGE_ADDED);
+	});
+	forEachComponentType(removed, [&](uint32_t componentType) {
+		stampChanges(state, componentType, entityId, 1, COMPONENT_CHANGE_REMOVED);
+	});
+}
+
+// Returns the component of the given entity in a sparse component type, a zeroed slot is
+// allocated if the entity does not have one. Returns nullptr if all slots are used.
+static uint8_t* sparseAcquireSlot(
+	GameStateHeader* state, const ComponentRegistryEntry& entry, uint32_t entityId) noexcept
+{
+	ArrayHeader* components = state->arrayAt(entry.offset);
+	ArrayHeader* entityIds = state->arrayAt(entry.offsetSparseEntityIds);
+	uint32_t* slots = state->arrayAt(entry.offsetSparseSlots)->data<uint32_t>();
+	uint32_t slot = slots[entityId];
+	if (slot == ~0u) {
+		if (components->size >= components->capacity) return nullptr;
+		slot = components->size;
+		components->size += 1;
+		entityIds->size += 1;
+		entityIds->at<uint32_t>(slot) = entityId;
+		slots[entityId] = slot;
+	}
+	return components->atUntyped(slot);
+}
+
+// Removes the component of the given entity from a sparse component type, the last component is
+// moved into the freed slot to keep the components packed. Does nothing if the entity does not
+// have a slot.
+static void sparseReleaseSlot(
+	GameStateHeader* state, uint32_t componentType, uint32_t entityId) noexcept
+{
+	const ComponentRegistryEntry entry = registryEntry(state, componentType);
+	ArrayHeader* components = state->arrayAt(entry.offset);
+	ArrayHeader* entityIds = state->arrayAt(entry.offsetSparseEntityIds);
+	uint32_t* slots = state->arrayAt(entry.offsetSparseSlots)->data<uint32_t>();
+	uint32_t slot = slots[entityId];
+	if (slot == ~0u) return;
+
+	// Move last component into the freed slot
+	const uint32_t componentSize = components->elementSize;
+	const uint32_t lastSlot = components->size - 1;
+	if (slot != lastSlot) {
+		uint32_t movedEntityId = entityIds->at<uint32_t>(lastSlot);
+		memcpy(components->atUntyped(slot), components->atUntyped(lastSlot), componentSize);
+		entityIds->at<uint32_t>(slot) = movedEntityId;
+		slots[movedEntityId] = slot;
+		markDirtyBlocks(state, componentType, movedEntityId);
+	}
+
+	// Clear the last slot, so that unused slots are always zero
+	memset(components->atUntyped(lastSlot), 0, componentSize);
+	entityIds->at<uint32_t>(lastSlot) = 0;
+	components->size -= 1;
+	entityIds->size -= 1;
+	slots[entityId] = ~0u;
+	markDirtyBlocks(state, componentType, entityId);
+}
+
+// Returns the offset in bytes from the start of the columns to the element of the given entity id
+// in the column of the given field of a structure-of-arrays component type.
+static uint64_t soaElementOffset(
+	const ArrayHeader* components, const ComponentField& field, uint32_t entityId) noexcept
+{
+	return uint64_t(field.offset) * components->capacity + uint64_t(entityId) * field.sizeInBytes;
+}
+
+// Scatters the given component to the columns of a structure-of-arrays component type, the
+// component is cleared if src is nullptr.
+static void soaWrite(
+	GameStateHeader* state,
+	const ComponentRegistryEntry& entry,
+	uint32_t entityId,
+	const uint8_t* src) noexcept
+{
+	ArrayHeader* components = state->arrayAt(entry.offset);
+	const ArrayHeader* fields = state->arrayAt(entry.offsetFields);
+	uint8_t* columns = components->dataUntyped();
+	for (uint32_t i = 0; i < fields->size; i++) {
+		const ComponentField& field = fields->at<ComponentField>(i);
+		uint8_t* dst = columns + soaElementOffset(components, field, entityId);
+		if (src != nullptr) memcpy(dst, src + field.offset, field.sizeInBytes);
+		else memset(dst, 0, field.sizeInBytes);
+	}
+}
+
+// Gathers the component of the given entity from the columns of a structure-of-arrays component
+// type.
+static void soaRead(
+	const GameStateHeader* state,
+	const ComponentRegistryEntry& entry,
+	uint32_t entityId,
+	uint8_t* dst) noexcept
+{
+	const ArrayHeader* components = state->arrayAt(entry.offset);
+	const ArrayHeader* fields = state->arrayAt(entry.offsetFields);
+	const uint8_t* columns = components->dataUntyped();
+	for (uint32_t i = 0; i < fields->size; i++) {
+		const ComponentField& field = fields->at<ComponentField>(i);
+		memcpy(dst + field.offset,
+			columns + soaElementOffset(components, field, entityId), field.sizeInBytes);
+	}
+}
+
+// Copies the component of one entity to another in a structure-of-arrays component type.
+static void soaCopy(
+	GameStateHeader* state,
+	const ComponentRegistryEntry& entry,
+	uint32_t srcEntityId,
+	uint32_t dstEntityId) noexcept
+{
+	ArrayHeader* components = state->arrayAt(entry.offset);
+	const ArrayHeader* fields = state->arrayAt(entry.offsetFields);
+	uint8_t* columns = components->dataUntyped();
+	for (uint32_t i = 0; i < fields->size; i++) {
+		const ComponentField& field = fields->at<ComponentField>(i);
+		memcpy(columns + soaElementOffset(components, field, dstEntityId),
+			columns + soaElementOffset(components, field, srcEntityId), field.sizeInBytes);
+	}
+}
+
+// Returns the number of entities which can be given all the sparse component types in the mask,
+// i.e. the smallest number of free slots. UINT32_MAX if there are no sparse types in the mask.
+static uint32_t numFreeSparseSlots(const GameStateHeader* state, ComponentMask mask) noexcept
+{
+	uint32_t numFreeSlots = ~0u;
+	forEachComponentType(mask, [&](uint32_t componentType) {
+		const ComponentRegistryEntry entry = registryEntry(state, componentType);
+		if (!entry.componentTypeIsSparse()) return;
+		const ArrayHeader* components = state->arrayAt(entry.offset);
+		numFreeSlots = std::min(numFreeSlots, components->capacity - components->size);
+	});
+	return numFreeSlots;
+}
+
+// Clears the data of all components present in the given mask for the specified entity
+static void clearComponents(GameStateHeader* state, uint32_t entityId, ComponentMask mask) noexcept
+{
+	// Iterate over the set component bits only
+	forEachComponentType(mask, [&](uint32_t componentType) {
+
+		// Get components array for type, skip if it does not have data
+		uint32_t componentSize = 0;
+		uint8_t* components = state->componentsUntyped(componentType, componentSize);
+		if (components == nullptr) return;
+
+		// Clear component, sparse component types also free the slot
+		const ComponentRegistryEntry entry = registryEntry(state, componentType);
+		if (entry.componentTypeIsSparse()) {
+			sparseReleaseSlot(state, componentType, entityId);
+			return;
+		}
+		if (entry.componentTypeIsSoA()) soaWrite(state, entry, entityId, nullptr);
+		else memset(components + entityId * componentSize, 0, componentSize);
+		markDirtyBlocks(state, componentType, entityId);
+	});
+}
+
+// Copies the components of the given source entity to the given (new) entity, for all component
+// types in the mask. The sparse component types must have a free slot.
+static void copyComponents(
+	GameStateHeader* state, uint32_t srcEntityId, uint32_t dstEntityId, ComponentMask mask) noexcept
+{
+	forEachComponentType(mask, [&](uint32_t componentType) {
+
+		// Get components array for type, skip if it does not have data
+		uint32_t componentSize = 0;
+		uint8_t* components = state->componentsUntyped(componentType, componentSize);
+		if (components == nullptr) return;
+
+		// Copy component, acquiring a slot never moves existing sparse components
+		const ComponentRegistryEntry entry = registryEntry(state, componentType);
+		if (entry.componentTypeIsSoA()) {
+			soaCopy(state, entry, srcEntityId, dstEntityId);
+			markDirtyBlocks(state, componentType, dstEntityId);
+			return;
+		}
+		uint8_t* dst = nullptr;
+		const uint8_t* src = nullptr;
+		if (entry.componentTypeIsSparse()) {
+			dst = sparseAcquireSlot(state, entry, dstEntityId);
+			src = state->componentUntyped(componentType, srcEntityId);
+			sfz_assert(dst != nullptr && src != nullptr);
+		}
+		else {
+			dst = components + dstEntityId * componentSize;
+			src = components + srcEntityId * componentSize;
+		}
+		memcpy(dst, src, componentSize);
+		markDirtyBlocks(state, componentType, dstEntityId);
+	});
+}
+
+// Moves the components of the given source entity to the given (inactive) entity, for all
+// component types in the mask. The source entity's components are cleared, sparse component
+// types keep the component in the same slot.
+static void moveComponents(
+	GameStateHeader* state, uint32_t srcEntityId, uint32_t dstEntityId, ComponentMask mask) noexcept
+{
+	forEachComponentType(mask, [&](uint32_t componentType) {
+
+		// Get components array for type, skip if it does not have data
+		uint32_t componentSize = 0;
+		uint8_t* components = state->componentsUntyped(componentType, componentSize);
+		if (components == nullptr) return;
+
+		const ComponentRegistryEntry entry = registryEntry(state, componentType);
+		if (entry.componentTypeIsSparse()) {
+			uint32_t* slots = state->arrayAt(entry.offsetSparseSlots)->data<uint32_t>();
+			const uint32_t slot = slots[srcEntityId];
+			sfz_assert(slot != ~0u && slots[dstEntityId] == ~0u);
+			state->arrayAt(entry.offsetSparseEntityIds)->at<uint32_t>(slot) = dstEntityId;
+			slots[dstEntityId] = slot;
+			slots[srcEntityId] = ~0u;
+		}
+		else if (entry.componentTypeIsSoA()) {
+			soaCopy(state, entry, srcEntityId, dstEntityId);
+			soaWrite(state, entry, srcEntityId, nullptr);
+		}
+		else {
+			memcpy(components + dstEntityId * componentSize,
+				components + srcEntityId * componentSize, componentSize);
+			memset(components + srcEntityId * componentSize, 0, componentSize);
+		}
+		markDirtyBlocks(state, componentType, srcEntityId);
+		markDirtyBlocks(state, componentType, dstEntityId);
+	});
+}
+
+// Writes numCopies consecutive copies of the size bytes at src to dst, doubling the size of each
+// copy so that large fills become a few large memcpy() calls.
+static void fillRepeated(uint8_t* dst, const uint8_t* src, uint32_t size, uint32_t numCopies) noexcept
+{
+	if (numCopies == 0) return;
+	memcpy(dst, src, size);
+	uint64_t numFilled = 1;
+	while (numFilled < numCopies) {
+		uint64_t numToCopy = std::min(numFilled, uint64_t(numCopies) - numFilled);
+		memcpy(dst + numFilled * size, dst, numToCopy * size);
+		numFilled += numToCopy;
+	}
+}
+
+// Fills of at least this many bytes are written with streaming (non-temporal) stores, which go
+// straight to memory instead of evicting the rest of the working set with data that is not read
+// again until the next tick.
+constexpr uint64_t STREAMING_FILL_MIN_NUM_BYTES = 512 * 1024;
+
+#ifdef PH_SIMD_X86
+
+// Streams numBytes (multiple of 32) to dst (32 byte aligned), repeating the periodBytes (multiple
+// of 32) long pattern at pattern (32 byte aligned).
+using StreamPatternFunc = void(*)(
+	uint8_t* dst, const uint8_t* pattern, uint64_t periodBytes, uint64_t numBytes);
+
+static void streamPatternSse2(
+	uint8_t* dst, const uint8_t* pattern, uint64_t periodBytes, uint64_t numBytes) noexcept
+{
+	uint64_t patternOffset = 0;
+	for (uint64_t offset = 0; offset < numBytes; offset += 32) {
+		const __m128i* srcPtr = reinterpret_cast<const __m128i*>(pattern + patternOffset);
+		__m128i* dstPtr = reinterpret_cast<__m128i*>(dst + offset);
+		_mm_stream_si128(dstPtr + 0, _mm_load_si128(srcPtr + 0));
+		_mm_stream_si128(dstPtr + 1, _mm_load_si128(srcPtr + 1));
+		patternOffset += 32;
+		if (patternOffset == periodBytes) patternOffset = 0;
+	}
+}
+
+PH_TARGET_AVX2 static void streamPatternAvx2(
+	uint8_t* dst, const uint8_t* pattern, uint64_t periodBytes, uint64_t numBytes) noexcept
+{
+	uint64_t patternOffset = 0;
+	for (uint64_t offset = 0; offset < numBytes; offset += 32) {
+		_mm256_stream_si256(reinterpret_cast<__m256i*>(dst + offset),
+			_mm256_load_si256(reinterpret_cast<const __m256i*>(pattern + patternOffset)));
+		patternOffset += 32;
+		if (patternOffset == periodBytes) patternOffset = 0;
+	}
+}
+
+static StreamPatternFunc selectStreamPatternFunc() noexcept
+{
+	if (cpuSupportsAvx2()) return streamPatternAvx2;
+	return streamPatternSse2;
+}
+
+#endif
+
+// Same as fillRepeated(), but large fills are written with streaming stores. The head up to the
+// first 32 byte boundary and one period of the pattern (lcm(size, 32) bytes) are written normally,
+// the rest is streamed from that period and the remaining tail is written byte by byte.
+static void fillRepeatedStreaming(
+	uint8_t* dst, const uint8_t* src, uint32_t size, uint32_t numCopies) noexcept
+{
+	const uint64_t numBytes = uint64_t(size) * numCopies;
+#ifdef PH_SIMD_X86
+	const uint64_t headBytes = (32 - (uintptr_t(dst) & 31)) & 31;
+	const uint64_t periodBytes = uint64_t(size) * (32 / std::min(size & (0u - size), 32u));
+	if (numBytes < STREAMING_FILL_MIN_NUM_BYTES || (headBytes + periodBytes + 32) > numBytes) {
+		fillRepeated(dst, src, size, numCopies);
+		return;
+	}
+
+	const uint64_t numCachedBytes = headBytes + periodBytes;
+	const uint64_t numCachedCopies =
+		std::min(uint64_t(numCopies), (numCachedBytes + size - 1) / size);
+	fillRepeated(dst, src, size, uint32_t(numCachedCopies));
+
+	const uint64_t numStreamedBytes = (numBytes - numCachedBytes) & ~uint64_t(31);
+	selectStreamPatternFunc()(
+		dst + numCachedBytes, dst + headBytes, periodBytes, numStreamedBytes);
+	for (uint64_t offset = numCachedBytes + numStreamedBytes; offset < numBytes; offset++) {
+		dst[offset] = src[offset % size];
+	}
+	_mm_sfence();
+#else
+	(void)numBytes;
+	fillRepeated(dst, src, size, numCopies);
+#endif
+}
+
+// Merges the given (newly activated) entity ids into every query matching mask. The ids must be in
+// ascending order, getNewId(i) returns the i:th id. All the entities must have been inactive before
+// and must now have the given mask.
+template<typename GetIdFunc>
+static void insertIdsIntoQueries(
+	GameStateHeader* state, uint32_t numNewIds, ComponentMask mask, GetIdFunc getNewId) noexcept
+{
+	ArrayHeader* registry = state->queryRegistryArray();
+	for (uint32_t i = 0; i < registry->size; i++) {
+		const QueryRegistryEntry& entry = registry->at<QueryRegistryEntry>(i);
+		if (!entry.matches(mask)) continue;
+
+		ArrayHeader* entityIdsArray = state->arrayAt(entry.offset);
+		uint32_t* entityIds = entityIdsArray->data<uint32_t>();
+		sfz_assert((entityIdsArray->size + numNewIds) <= entityIdsArray->capacity);
+
+		// Merge from the back so that the existing ids can be shifted in place
+		int64_t oldIdx = int64_t(entityIdsArray->size) - 1;
+		int64_t newIdx = int64_t(numNewIds) - 1;
+		int64_t dstIdx = int64_t(entityIdsArray->size + numNewIds) - 1;
+		while (newIdx >= 0) {
+			uint32_t newId = getNewId(uint32_t(newIdx));
+			if (oldIdx >= 0 && entityIds[oldIdx] > newId) {
+				entityIds[dstIdx--] = entityIds[oldIdx--];
+			}
+			else {
+				sfz_assert(oldIdx < 0 || entityIds[oldIdx] != newId);
+				entityIds[dstIdx--] = newId;
+				newIdx -= 1;
+			}
+		}
+		entityIdsArray->size += numNewIds;
+	}
+}
+
+// Merges the new ids of the moved entities into every query they match, see compactEntities().
+// The new ids must be in ascending order.
+static void insertMovedIdsIntoQueries(
+	GameStateHeader* state, const EntityRemap* moves, uint32_t numMoves) noexcept
+{
+	const ComponentMask* masks = state->componentMasks();
+	ArrayHeader* registry = state->queryRegistryArray();
+	for (uint32_t i = 0; i < registry->size; i++) {
+		const QueryRegistryEntry& entry = registry->at<QueryRegistryEntry>(i);
+		uint32_t numNewIds = 0;
+		for (uint32_t j = 0; j < numMoves; j++) {
+			numNewIds += entry.matches(masks[moves[j].newEntity.id()]) ? 1 : 0;
+		}
+		if (numNewIds == 0) continue;
+
+		ArrayHeader* entityIdsArray = state->arrayAt(entry.offset);
+		uint32_t* entityIds = entityIdsArray->data<uint32_t>();
+		sfz_assert((entityIdsArray->size + numNewIds) <= entityIdsArray->capacity);
+
+		// Merge from the back so that the existing ids can be shifted in place
+		int64_t oldIdx = int64_t(entityIdsArray->size) - 1;
+		int64_t moveIdx = int64_t(numMoves) - 1;
+		int64_t dstIdx = int64_t(entityIdsArray->size + numNewIds) - 1;
+		while (moveIdx >= 0) {
+			uint32_t newId = moves[moveIdx].newEntity.id();
+			if (!entry.matches(masks[newId])) {
+				moveIdx -= 1;
+			}
+			else if (oldIdx >= 0 && entityIds[oldIdx] > newId) {
+				entityIds[dstIdx--] = entityIds[oldIdx--];
+			}
+			else {
+				sfz_assert(oldIdx < 0 || entityIds[oldIdx] != newId);
+				entityIds[dstIdx--] = newId;
+				moveIdx -= 1;
+			}
+		}
+		entityIdsArray->size += numNewIds;
+	}
+}
+
+// Removes all entity ids which no longer match from every query. Used after a batch of entities
+// has been deleted, one linear pass per query instead of one memmove() per deleted entity.
+static void removeUnmatchedIdsFromQueries(GameStateHeader* state) noexcept
+{
+	const ComponentMask* masks = state->componentMasks();
+	ArrayHeader* registry = state->queryRegistryArray();
+	for (uint32_t i = 0; i < registry->size; i++) {
+		const QueryRegistryEntry& entry = registry->at<QueryRegistryEntry>(i);
+
+		ArrayHeader* entityIdsArray = state->arrayAt(entry.offset);
+		uint32_t* entityIds = entityIdsArray->data<uint32_t>();
+		uint32_t numKept = 0;
+		for (uint32_t j = 0; j < entityIdsArray->size; j++) {
+			uint32_t entityId = entityIds[j];
+			entityIds[numKept] = entityId;
+			numKept += entry.matches(masks[entityId]) ? 1 : 0;
+		}
+
+		// Clear removed part of list
+		memset(entityIds + numKept, 0, (entityIdsArray->size - numKept) * sizeof(uint32_t));
+		entityIdsArray->size = numKept;
+	}
+}
+
+// Hierarchical free entity ids bitset
+// ------------------------------------------------------------------------------------------------
+
+// The levels of the bitset are stored after each other, starting with the bottom level which has
+// one bit per entity id. Each level above has one bit per word in the level below, set if any bit
+// in that word is set. The top level is always a single word. With at most 2^24 entities there are
+// at most 4 levels.
+constexpr uint32_t FREE_IDS_BITSET_MAX_NUM_LEVELS = 4;
+
+struct FreeIdsBitsetLayout final {
+	uint32_t numLevels = 0;
+	uint32_t numWords = 0;
+	uint32_t levelOffsets[FREE_IDS_BITSET_MAX_NUM_LEVELS] = {};
+	uint32_t levelNumBits[FREE_IDS_BITSET_MAX_NUM_LEVELS] = {};
+};
+
+static FreeIdsBitsetLayout freeIdsBitsetLayout(uint32_t maxNumEntities) noexcept
+{
+	FreeIdsBitsetLayout layout;
+	uint32_t numBits = maxNumEntities;
+	while (numBits != 0) {
+		sfz_assert(layout.numLevels < FREE_IDS_BITSET_MAX_NUM_LEVELS);
+		uint32_t numWordsInLevel = (numBits + 63) / 64;
+		layout.levelOffsets[layout.numLevels] = layout.numWords;
+		layout.levelNumBits[layout.numLevels] = numBits;
+		layout.numLevels += 1;
+		layout.numWords += numWordsInLevel;
+		if (numWordsInLevel == 1) break;
+		numBits = numWordsInLevel;
+	}
+	return layout;
+}
+
+// Marks all entity ids as free
+static void freeIdsBitsetSetAll(uint64_t* words, const FreeIdsBitsetLayout& layout) noexcept
+{
+	for (uint32_t level = 0; level < layout.numLevels; level++) {
+		uint64_t* levelWords = words + layout.levelOffsets[level];
+		uint32_t numBits = layout.levelNumBits[level];
+		for (uint32_t i = 0; i < numBits / 64; i++) levelWords[i] = ~uint64_t(0);
+		if ((numBits % 64) != 0) levelWords[numBits / 64] = (uint64_t(1) << (numBits % 64)) - 1;
+	}
+}
+
+// Marks the lowest free entity id as used and returns it, returns ~0 if there are no free ids.
+static uint32_t freeIdsBitsetPopLowest(uint64_t* words, const FreeIdsBitsetLayout& layout) noexcept
+{
+	if (layout.numLevels == 0) return ~0u;
+
+	// Descend from the top level, following the lowest set bit
+	uint32_t idx = 0;
+	for (int32_t level = int32_t(layout.numLevels) - 1; level >= 0; level--) {
+		uint64_t word = words[layout.levelOffsets[level] + idx];
+		if (word == 0) {
+			sfz_assert(uint32_t(level) == layout.numLevels - 1);
+			return ~0u;
+		}
+		idx = idx * 64 + lowestSetBitIdx(word);
+	}
+	const uint32_t entityId = idx;
+
+	// Clear bit, propagate upwards as long as words become empty
+	for (uint32_t level = 0; level < layout.numLevels; level++) {
+		uint64_t& word = words[layout.levelOffsets[level] + idx / 64];
+		word &= ~(uint64_t(1) << (idx % 64));
+		if (word != 0) break;
+		idx /= 64;
+	}
+
+	return entityId;
+}
+
+// Marks the given entity id as free
+static void freeIdsBitsetSet(
+	uint64_t* words, const FreeIdsBitsetLayout& layout, uint32_t entityId) noexcept
+{
+	// Set bit, propagate upwards as long as words were empty before
+	uint32_t idx = entityId;
+	for (uint32_t level = 0; level < layout.numLevels; level++) {
+		uint64_t& word = words[layout.levelOffsets[level] + idx / 64];
+		bool wasEmpty = word == 0;
+		word |= uint64_t(1) << (idx % 64);
+		if (!wasEmpty) break;
+		idx /= 64;
+	}
+}
+
+// External id index
+// ------------------------------------------------------------------------------------------------
+
+// The external id index is an open addressing hash table of ExternalIdSlot, probed in groups of 16
+// slots. Each slot has a control byte, stored in an array of their own so that a whole group can
+// be matched with a single SSE2 compare. The control byte is 0 if the slot is empty, 1 if it is
+// deleted and 0x80 | h2 if it is full, where h2 is 7 bits of the hash not used to pick the group.
+// Zero means empty so that the untouched pages of a growable game state are an empty index.
+//
+// The size of the control bytes array is the number of used (full or deleted) slots, the size of
+// the slots array the number of full slots. The capacity is picked so that maxNumEntities full
+// slots is at most 7/8 of it. The index is rebuilt in place if the used slots would exceed that,
+// which can thus only happen because of deleted slots.
+
+constexpr uint32_t EXTERNAL_ID_GROUP_SIZE = 16;
+constexpr uint8_t EXTERNAL_ID_CTRL_EMPTY = 0;
+constexpr uint8_t EXTERNAL_ID_CTRL_DELETED = 1;
+
+// Returns the number of slots in the external id index for the given max number of entities
+static uint32_t externalIdIndexCapacity(uint32_t maxNumEntities) noexcept
+{
+	const uint64_t minCapacity = (uint64_t(maxNumEntities) * 8 + 6) / 7;
+	uint32_t capacity = EXTERNAL_ID_GROUP_SIZE;
+	while (capacity < minCapacity) capacity *= 2;
+	return capacity;
+}
+
+// Returns the max number of used slots in an external id index with the given capacity
+static uint32_t externalIdIndexMaxNumUsed(uint32_t capacity) noexcept
+{
+	return (capacity / 8) * 7;
+}
+
+// Finalizer of MurmurHash3, spreads sequential external ids over all groups
+static uint64_t externalIdHash(uint64_t externalId) noexcept
+{
+	uint64_t hash = externalId;
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDull;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+// Returns a bitmask where bit i is set if control byte i of the group equals the given byte
+static uint32_t matchControlBytes(const uint8_t* group, uint8_t controlByte) noexcept
+{
+#ifdef PH_SIMD_X86
+	const __m128i bytes = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+	const __m128i eq = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(char(controlByte)));
+	return uint32_t(_mm_movemask_epi8(eq));
+#else
+	uint32_t bits = 0;
+	for (uint32_t i = 0; i < EXTERNAL_ID_GROUP_SIZE; i++) {
+		if (group[i] == controlByte) bits |= 1u << i;
+	}
+	return bits;
+#endif
+}
+
+// Returns a bitmask where bit i is set if slot i of the group is empty or deleted
+static uint32_t matchFreeControlBytes(const uint8_t* group) noexcept
+{
+#ifdef PH_SIMD_X86
+	const __m128i bytes = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+	return ~uint32_t(_mm_movemask_epi8(bytes)) & 0xFFFFu;
+#else
+	uint32_t bits = 0;
+	for (uint32_t i = 0; i < EXTERNAL_ID_GROUP_SIZE; i++) {
+		if ((group[i] & 0x80) == 0) bits |= 1u << i;
+	}
+	return bits;
+#endif
+}
+
+// Returns the index of the slot holding the given external id, ~0 if it is not in the index
+static uint32_t externalIdIndexFind(const GameStateHeader* state, uint64_t externalId) noexcept
+{
+	const ArrayHeader* controlBytesArray = state->externalIdIndexArray();
+	const uint8_t* controlBytes = controlBytesArray->data<uint8_t>();
+	const ExternalIdSlot* slots = state->externalIdSlotsArray()->data<ExternalIdSlot>();
+	const uint32_t numGroups = controlBytesArray->capacity / EXTERNAL_ID_GROUP_SIZE;
+	const uint64_t hash = externalIdHash(externalId);
+	const uint8_t controlByte = uint8_t(0x80 | (hash & 0x7F));
+
+	// Triangular probing over the groups, visits every group once since the number of groups is
+	// a power of two
+	uint32_t groupIdx = uint32_t(hash >> 7) & (numGroups - 1);
+	for (uint32_t probeIdx = 1; probeIdx <= numGroups; probeIdx++) {
+		const uint8_t* group = controlBytes + groupIdx * EXTERNAL_ID_GROUP_SIZE;
+		uint32_t matches = matchControlBytes(group, controlByte);
+		while (matches != 0) {
+			uint32_t slotIdx = groupIdx * EXTERNAL_ID_GROUP_SIZE + lowestSetBitIdx(matches);
+			matches &= matches - 1;
+			if (slots[slotIdx].externalId == externalId) return slotIdx;
+		}
+
+		// An id is only placed further along its probe sequence if this group had no free slot,
+		// and a group that has been full never gets an empty slot until the index is rebuilt
+		if (matchControlBytes(group, EXTERNAL_ID_CTRL_EMPTY) != 0) return ~0u;
+		groupIdx = (groupIdx + probeIdx) & (numGroups - 1);
+	}
+	return ~0u;
+}
+
+// Writes the given external id to the given (empty or deleted) slot
+static void externalIdIndexFillSlot(GameStateHeader* state,
+	uint32_t slotIdx, uint64_t hash, uint64_t externalId, Entity entity) noexcept
+{
+	ArrayHeader* controlBytesArray = state->externalIdIndexArray();
+	ArrayHeader* slotsArray = state->externalIdSlotsArray();
+	uint8_t& controlByte = controlBytesArray->at<uint8_t>(slotIdx);
+	sfz_assert((controlByte & 0x80) == 0);
+	if (controlByte == EXTERNAL_ID_CTRL_EMPTY) controlBytesArray->size += 1;
+	controlByte = uint8_t(0x80 | (hash & 0x7F));
+	ExternalIdSlot& slot = slotsArray->at<ExternalIdSlot>(slotIdx);
+	slot.externalId = externalId;
+	slot.entity = entity;
+	slotsArray->size += 1;
+}
+
+// Places the given external id (which must not be in the index) in the first free slot of its
+// probe sequence, without checking the load of the index
+static void externalIdIndexPlace(
+	GameStateHeader* state, uint64_t externalId, Entity entity) noexcept
+{
+	const ArrayHeader* controlBytesArray = state->externalIdIndexArray();
+	const uint8_t* controlBytes = controlBytesArray->data<uint8_t>();
+	const uint32_t numGroups = controlBytesArray->capacity / EXTERNAL_ID_GROUP_SIZE;
+	const uint64_t hash = externalIdHash(externalId);
+
+	uint32_t groupIdx = uint32_t(hash >> 7) & (numGroups - 1);
+	for (uint32_t probeIdx = 1; probeIdx <= numGroups; probeIdx++) {
+		const uint32_t freeSlots =
+			matchFreeControlBytes(controlBytes + groupIdx * EXTERNAL_ID_GROUP_SIZE);
+		if (freeSlots != 0) {
+			uint32_t slotIdx = groupIdx * EXTERNAL_ID_GROUP_SIZE + lowestSetBitIdx(freeSlots);
+			externalIdIndexFillSlot(state, slotIdx, hash, externalId, entity);
+			return;
+		}
+		groupIdx = (groupIdx + probeIdx) & (numGroups - 1);
+	}
+	sfz_assert(false);
+}
+
+// Clears the external id index and inserts the external ids of all entities again, which gets
+// rid of all deleted slots
+static void externalIdIndexRebuild(GameStateHeader* state) noexcept
+{
+	ArrayHeader* controlBytesArray = state->externalIdIndexArray();
+	ArrayHeader* slotsArray = state->externalIdSlotsArray();
+	uint8_t* controlBytes = controlBytesArray->data<uint8_t>();
+	ExternalIdSlot* slots = slotsArray->data<ExternalIdSlot>();
+	for (uint32_t i = 0; i < controlBytesArray->capacity; i++) {
+		if (controlBytes[i] == EXTERNAL_ID_CTRL_EMPTY) continue;
+		memset(reinterpret_cast<uint8_t*>(&slots[i]), 0, sizeof(ExternalIdSlot));
+	}
+	memset(controlBytes, 0, controlBytesArray->capacity);
+	controlBytesArray->size = 0;
+	slotsArray->size = 0;
+
+	const uint64_t* externalIds = state->externalIdsArray()->data<uint64_t>();
+	const uint8_t* generations = state->entityGenerations();
+	for (uint32_t entityId = 0; entityId < state->entityHighWaterMark; entityId++) {
+		if (externalIds[entityId] == 0) continue;
+		externalIdIndexPlace(
+			state, externalIds[entityId], Entity::create(entityId, generations[entityId]));
+	}
+}
+
+// Inserts the given external id for the given entity, unless the external id is already in the
+// index. Returns whether it was inserted. Looks for the external id and the first free slot of
+// its probe sequence in the same pass.
+static bool externalIdIndexTryInsert(
+	GameStateHeader* state, uint64_t externalId, Entity entity) noexcept
+{
+	const ArrayHeader* controlBytesArray = state->externalIdIndexArray();
+	if ((controlBytesArray->size + 1) > externalIdIndexMaxNumUsed(controlBytesArray->capacity)) {
+		externalIdIndexRebuild(state);
+	}
+	const uint8_t* controlBytes = controlBytesArray->data<uint8_t>();
+	const ExternalIdSlot* slots = state->externalIdSlotsArray()->data<ExternalIdSlot>();
+	const uint32_t numGroups = controlBytesArray->capacity / EXTERNAL_ID_GROUP_SIZE;
+	const uint64_t hash = externalIdHash(externalId);
+	const uint8_t controlByte = uint8_t(0x80 | (hash & 0x7F));
+
+	uint32_t freeSlotIdx = ~0u;
+	uint32_t groupIdx = uint32_t(hash >> 7) & (numGroups - 1);
+	for (uint32_t probeIdx = 1; probeIdx <= numGroups; probeIdx++) {
+		const uint8_t* group = controlBytes + groupIdx * EXTERNAL_ID_GROUP_SIZE;
+		uint32_t matches = matchControlBytes(group, controlByte);
+		while (matches != 0) {
+			uint32_t slotIdx = groupIdx * EXTERNAL_ID_GROUP_SIZE + lowestSetBitIdx(matches);
+			matches &= matches - 1;
+			if (slots[slotIdx].externalId == externalId) return false;
+		}
+		if (freeSlotIdx == ~0u) {
+			const uint32_t freeSlots = matchFreeControlBytes(group);
+			if (freeSlots != 0) {
+				freeSlotIdx = groupIdx * EXTERNAL_ID_GROUP_SIZE + lowestSetBitIdx(freeSlots);
+			}
+		}
+		if (matchControlBytes(group, EXTERNAL_ID_CTRL_EMPTY) != 0) break;
+		groupIdx = (groupIdx + probeIdx) & (numGroups - 1);
+	}
+	sfz_assert(freeSlotIdx != ~0u);
+	externalIdIndexFillSlot(state, freeSlotIdx, hash, externalId, entity);
+	return true;
+}
+
+// Removes the external id in the given (full) slot from the index. The slot only needs to be
+// marked as deleted if its group has no empty slot, otherwise a probe sequence passing through
+// the group would already have stopped there.
+static void externalIdIndexRemove(GameStateHeader* state, uint32_t slotIdx) noexcept
+{
+	ArrayHeader* controlBytesArray = state->externalIdIndexArray();
+	ArrayHeader* slotsArray = state->externalIdSlotsArray();
+	uint8_t* controlBytes = controlBytesArray->data<uint8_t>();
+	const uint8_t* group = controlBytes + (slotIdx & ~(EXTERNAL_ID_GROUP_SIZE - 1));
+	if (matchControlBytes(group, EXTERNAL_ID_CTRL_EMPTY) != 0) {
+		controlBytes[slotIdx] = EXTERNAL_ID_CTRL_EMPTY;
+		controlBytesArray->size -= 1;
+	}
+	else {
+		controlBytes[slotIdx] = EXTERNAL_ID_CTRL_DELETED;
+	}
+	memset(slotsArray->atUntyped(slotIdx), 0, sizeof(ExternalIdSlot));
+	slotsArray->size -= 1;
+}
+
+// Gives the given (newly created) entity the next free external id, if external ids are enabled.
+// The entity must be below the entityHighWaterMark.
+static void assignExternalId(GameStateHeader* state, uint32_t entityId) noexcept
+{
+	if (!state->externalIdsEnabled()) return;
+	uint64_t* externalIds = state->externalIdsArray()->data<uint64_t>();
+	sfz_assert(externalIds[entityId] == 0);
+	const Entity entity = Entity::create(entityId, state->entityGenerations()[entityId]);
+
+	// Inserted before being stored, a rebuild of the index would otherwise insert it twice
+	uint64_t externalId = state->nextExternalId;
+	while (externalId == 0 || !externalIdIndexTryInsert(state, externalId, entity)) {
+		externalId += 1;
+	}
+	state->nextExternalId = externalId + 1 != 0 ? externalId + 1 : 1;
+	externalIds[entityId] = externalId;
+}
+
+// Removes the external id of the given entity, if it has one
+static void releaseExternalId(GameStateHeader* state, uint32_t entityId) noexcept
+{
+	if (!state->externalIdsEnabled()) return;
+	uint64_t& externalId = state->externalIdsArray()->at<uint64_t>(entityId);
+	if (externalId == 0) return;
+	const uint32_t slotIdx = externalIdIndexFind(state, externalId);
+	sfz_assert(slotIdx != ~0u);
+	if (slotIdx != ~0u) externalIdIndexRemove(state, slotIdx);
+	externalId = 0;
+}
+
+// Moves the external id of an entity to its new id, see compactEntities()
+static void moveExternalId(
+	GameStateHeader* state, uint32_t srcEntityId, uint32_t dstEntityId) noexcept
+{
+	if (!state->externalIdsEnabled()) return;
+	uint64_t* externalIds = state->externalIdsArray()->data<uint64_t>();
+	const uint64_t externalId = externalIds[srcEntityId];
+	externalIds[dstEntityId] = externalId;
+	externalIds[srcEntityId] = 0;
+	if (externalId == 0) return;
+	const uint32_t slotIdx = externalIdIndexFind(state, externalId);
+	sfz_assert(slotIdx != ~0u);
+	if (slotIdx == ~0u) return;
+	state->externalIdSlotsArray()->at<ExternalIdSlot>(slotIdx).entity =
+		Entity::create(dstEntityId, state->entityGenerations()[dstEntityId]);
+}
+
+// Entity id allocation helpers
+// ------------------------------------------------------------------------------------------------
+
+// An entity indexed array, or a column of a structure-of-arrays component array. capacity
+// elements of elementSize bytes each, starting at offsetBytes.
+struct EntityColumn final {
+	uint32_t offsetBytes;
+	uint32_t elementSize;
+	uint32_t capacity;
+};
+
+// Walks the entity indexed arrays in the order they are laid out in memory, i.e. component masks,
+// generations, component types (dense data, each structure-of-arrays column or sparse slots),
+// query lists, change ticks and external ids. columnIdx and fieldIdx start at 0 and are advanced
+// past the returned column, returns false after the last one.
+static bool nextEntityColumn(
+	const GameStateHeader* state,
+	uint32_t& columnIdx,
+	uint32_t& fieldIdx,
+	EntityColumn& columnOut) noexcept
+{
+	const uint8_t* statePtr = reinterpret_cast<const uint8_t*>(state);
+	const uint32_t numComponentTypes = state->numComponentTypes;
+	const uint32_t firstQueryIdx = numComponentTypes + 1;
+	const uint32_t firstChangeTicksIdx = firstQueryIdx + state->numQueries;
+	const uint32_t externalIdsIdx = firstChangeTicksIdx + numComponentTypes;
+	auto arrayColumn = [&](const ArrayHeader* array, uint32_t offsetInData, uint32_t elementSize) {
+		columnOut.offsetBytes = uint32_t(array->dataUntyped() - statePtr) + offsetInData;
+		columnOut.elementSize = elementSize;
+		columnOut.capacity = array->capacity;
+	};
+
+	for (; columnIdx <= externalIdsIdx; columnIdx++) {
+		const ArrayHeader* array = nullptr;
+		if (columnIdx == 0) {
+			array = state->componentMasksArray();
+		}
+		else if (columnIdx == 1) {
+			array = state->entityGenerationsListArray();
+		}
+		else if (columnIdx < firstQueryIdx) {
+			const uint32_t componentType = columnIdx - 1;
+			const ComponentRegistryEntry entry = registryEntry(state, componentType);
+			if (entry.componentTypeIsSparse()) {
+				array = state->arrayAt(entry.offsetSparseSlots);
+			}
+			else if (entry.componentTypeIsSoA()) {
+				uint32_t numFields = 0;
+				const ComponentField* fields = state->componentFields(componentType, numFields);
+				if (fieldIdx < numFields) {
+					const ArrayHeader* components = state->arrayAt(entry.offset);
+					const ComponentField& field = fields[fieldIdx];
+					arrayColumn(components, field.offset * components->capacity, field.sizeInBytes);
+					fieldIdx += 1;
+					return true;
+				}
+				fieldIdx = 0;
+			}
+			else if (entry.componentTypeHasData()) {
+				array = state->arrayAt(entry.offset);
+			}
+		}
+		else if (columnIdx < firstChangeTicksIdx) {
+			const QueryRegistryEntry* queries =
+				state->queryRegistryArray()->data<QueryRegistryEntry>();
+			array = state->arrayAt(queries[columnIdx - firstQueryIdx].offset);
+		}
+		else if (columnIdx < externalIdsIdx) {
+			const ComponentRegistryEntry entry =
+				registryEntry(state, columnIdx - firstChangeTicksIdx);
+			if (entry.componentTypeIsChangeTracked()) array = state->arrayAt(entry.offsetChangeTicks);
+		}
+		else if (state->externalIdsEnabled()) {
+			array = state->externalIdsArray();
+		}
+		if (array == nullptr) continue;
+		arrayColumn(array, 0, array->elementSize);
+		columnIdx += 1;
+		return true;
+	}
+	return false;
+}
+
+// Commits the memory of all entity indexed arrays between the given entity ids, only needed in
+// growable game states, see commitReservedMemory().
+static void commitEntityIdRange(GameStateHeader* state, uint32_t firstId, uint32_t lastId) noexcept
+{
+	uint8_t* statePtr = reinterpret_cast<uint8_t*>(state);
+	uint32_t columnIdx = 0;
+	uint32_t fieldIdx = 0;
+	EntityColumn column;
+	while (nextEntityColumn(state, columnIdx, fieldIdx, column)) {
+		commitReservedMemory(statePtr + column.offsetBytes + uint64_t(firstId) * column.elementSize,
+			uint64_t(lastId - firstId) * column.elementSize);
+	}
+}
+
+// Zeroes all entity indexed arrays between the given entity ids.
+static void zeroEntityIdRange(GameStateHeader* state, uint32_t firstId, uint32_t lastId) noexcept
+{
+	uint8_t* statePtr = reinterpret_cast<uint8_t*>(state);
+	uint32_t columnIdx = 0;
+	uint32_t fieldIdx = 0;
+	EntityColumn column;
+	while (nextEntityColumn(state, columnIdx, fieldIdx, column)) {
+		memset(statePtr + column.offsetBytes + uint64_t(firstId) * column.elementSize, 0,
+			size_t(lastId - firstId) * column.elementSize);
+	}
+}
+
+// Raises the entity high-water mark to include the given entity id. Growable game states
+// commit and initialize the entity indexed arrays up to the new high-water mark first, rounded up
+// to GAME_STATE_GROW_BLOCK_SIZE. Everything is zero except for the sparse slots, which are ~0.
+static void growEntityHighWaterMark(GameStateHeader* state, uint32_t entityId) noexcept
+{
+	if (entityId < state->entityHighWaterMark) return;
+	state->entityHighWaterMark = entityId + 1;
+	if (state->entityHighWaterMark <= state->committedNumEntities) return;
+
+	const uint32_t oldNumCommitted = state->committedNumEntities;
+	const uint32_t newNumCommitted = std::min(state->maxNumEntities,
+		(state->entityHighWaterMark + GAME_STATE_GROW_BLOCK_SIZE - 1) &
+		~(GAME_STATE_GROW_BLOCK_SIZE - 1));
+	commitEntityIdRange(state, oldNumCommitted, newNumCommitted);
+	for (uint32_t i = 1; i < state->numComponentTypes; i++) {
+		const ComponentRegistryEntry entry = registryEntry(state, i);
+		if (!entry.componentTypeIsSparse()) continue;
+		uint32_t* slots = state->arrayAt(entry.offsetSparseSlots)->data<uint32_t>();
+		for (uint32_t j = oldNumCommitted; j < newNumCommitted; j++) slots[j] = ~0u;
+	}
+	state->committedNumEntities = newNumCommitted;
+
+	// The hashes of the entity indexed arrays cover the committed entities, see componentTypeHash()
+	uint64_t* cachedHashes = state->hashCacheArray()->data<uint64_t>();
+	for (uint32_t i = 0; i < state->numComponentTypes; i++) cachedHashes[i] = 0;
+}
+
+// Pops a free entity id according to the allocation policy, returns ~0 if there are none left.
+static uint32_t popFreeEntityId(GameStateHeader* state) noexcept
+{
+	uint32_t entityId = ~0u;
+	if (state->entityAllocationPolicy == EntityAllocationPolicy::LOWEST_ID_FIRST) {
+		entityId = freeIdsBitsetPopLowest(
+			state->freeEntityIdsBitsetArray()->data<uint64_t>(),
+			freeIdsBitsetLayout(state->maxNumEntities));
+	}
+	else {
+		state->freeEntityIdsListArray()->popGet(entityId);
+	}
+	if (entityId != ~0u) growEntityHighWaterMark(state, entityId);
+	return entityId;
+}
+
+// Lowers the entity high-water mark past all inactive entities at the end of the live range.
+static void shrinkEntityHighWaterMark(GameStateHeader* state) noexcept
+{
+	const ComponentMask* masks = state->componentMasks();
+	uint32_t highWaterMark = state->entityHighWaterMark;
+	while (highWaterMark != 0 && !masks[highWaterMark - 1].active()) highWaterMark -= 1;
+	state->entityHighWaterMark = highWaterMark;
+}
+
+// Creates up to numEntities entities with the given mask, see createEntities()
+static uint32_t createEntitiesWithMask(
+	GameStateHeader* state, uint32_t numEntities, Entity* entitiesOut, ComponentMask mask) noexcept
+{
+	ComponentMask* masks = state->componentMasks();
+	const uint8_t* generations = state->entityGenerations();
+
+	// Lowest id first, popped ids are in ascending order so they can be merged directly. The
+	// high-water mark is raised before each id is touched, a growable state commits and
+	// initializes the entity indexed arrays there first.
+	if (state->entityAllocationPolicy == EntityAllocationPolicy::LOWEST_ID_FIRST) {
+		uint64_t* freeIdsBitset = state->freeEntityIdsBitsetArray()->data<uint64_t>();
+		const FreeIdsBitsetLayout bitsetLayout = freeIdsBitsetLayout(state->maxNumEntities);
+		uint32_t numCreated = 0;
+		for (; numCreated < numEntities; numCreated++) {
+			uint32_t entityId = freeIdsBitsetPopLowest(freeIdsBitset, bitsetLayout);
+			if (entityId == ~0u) break;
+			growEntityHighWaterMark(state, entityId);
+			sfz_assert(masks[entityId] == ComponentMask::empty());
+			masks[entityId] = mask;
+			entitiesOut[numCreated] = Entity::create(entityId, generations[entityId]);
+			markDirtyBlocks(state, 0, entityId);
+			stampMaskChanges(state, entityId, ComponentMask::empty(), mask);
+		}
+		if (numCreated == 0) return 0;
+		state->currentNumEntities += numCreated;
+		for (uint32_t i = 0; i < numCreated; i++) assignExternalId(state, entitiesOut[i].id());
+
+		// Update queries
+		insertIdsIntoQueries(state, numCreated, mask, [&](uint32_t i) {
+			return entitiesOut[i].id();
+		});
+		return numCreated;
+	}
+
+	// Pop entity ids from the back of the free entity ids list
+	ArrayHeader* freeEntityIdsList = state->freeEntityIdsListArray();
+	uint32_t numCreated = std::min(numEntities, freeEntityIdsList->size);
+	if (numCreated == 0) return 0;
+	freeEntityIdsList->size -= numCreated;
+	uint32_t* poppedIds = freeEntityIdsList->data<uint32_t>() + freeEntityIdsList->size;
+
+	// Activate entities, in the same order as repeated createEntity() calls would
+	for (uint32_t i = 0; i < numCreated; i++) {
+		uint32_t entityId = poppedIds[numCreated - i - 1];
+		sfz_assert(masks[entityId] == ComponentMask::empty());
+		masks[entityId] = mask;
+		entitiesOut[i] = Entity::create(entityId, generations[entityId]);
+		growEntityHighWaterMark(state, entityId);
+		assignExternalId(state, entityId);
+		markDirtyBlocks(state, 0, entityId);
+		stampMaskChanges(state, entityId, ComponentMask::empty(), mask);
+	}
+	state->currentNumEntities += numCreated;
+
+	// Update queries, the popped part of the free entity ids list is used as scratch space
+	std::sort(poppedIds, poppedIds + numCreated);
+	insertIdsIntoQueries(state, numCreated, mask, [&](uint32_t i) {
+		return poppedIds[i];
+	});
+
+	// Clear popped part of free entity ids list
+	memset(poppedIds, 0, numCreated * sizeof(uint32_t));
+
+	return numCreated;
+}
+
 // GameState: Singleton state API
 // ------------------------------------------------------------------------------------------------
 
@@ -61,21 +1268,22 @@ const uint8_t* GameStateHeader::singletonUntyped(uint32_t singletonIndex, uint32
 
 Entity GameStateHeader::createEntity() noexcept
 {
-	// Get free entity from free entities list
-	ArrayHeader* freeEntitiesList = this->freeEntityIdsListArray();
-	uint32_t freeEntityId = ~0u;
-	bool freeEntityAvailable = freeEntitiesList->popGet(freeEntityId);
+	// Get free entity id according to allocation policy
+	uint32_t freeEntityId = popFreeEntityId(this);
 
 	// Return Entity::invalid() if no free entity id is available
-	if (!freeEntityAvailable) return Entity::invalid();
+	if (freeEntityId == ~0u) return Entity::invalid();
 
-	// Increment number of entities
+	// Increment number of entities and give the entity an external id
 	currentNumEntities += 1;
+	assignExternalId(this, freeEntityId);
 
 	// Set component mask
 	ArrayHeader* componentMasks = this->componentMasksArray();
 	ComponentMask& mask = componentMasks->at<ComponentMask>(freeEntityId);
+	ComponentMask oldMask = mask;
 	mask = ComponentMask::activeMask();
+	this->componentMaskModified(freeEntityId, oldMask);
 
 	// Get generation
 	uint8_t* generations = this->entityGenerations();
@@ -109,27 +1317,31 @@ bool GameStateHeader::deleteEntity(uint32_t entityId) noexcept
 	// Decrement number of entities
 	if (currentNumEntities != 0) currentNumEntities -= 1;
 
-	// Remove all associated components
-	for (uint32_t i = 0; i < this->numComponentTypes; i++) {
-
-		// Get components array for type i, skip if does not exist
-		uint32_t componentSize = 0;
-		uint8_t* components = componentsUntyped(i, componentSize);
-		if (components == nullptr) continue;
-
-		// Clear component
-		memset(components + entityId * componentSize, 0, componentSize);
-	}
+	// Remove all associated components and the external id
+	clearComponents(this, entityId, mask);
+	releaseExternalId(this, entityId);
 
 	// Clear mask
+	ComponentMask oldMask = mask;
 	mask = ComponentMask::empty();
+	this->componentMaskModified(entityId, oldMask);
 
 	// Increment generation
 	generation += 1;
 
-	// Add entity id back to free entities list
-	ArrayHeader* freeEntityIdsList = this->freeEntityIdsListArray();
-	freeEntityIdsList->add<uint32_t>(entityId);
+	// Add entity id back to free entity ids
+	if (this->entityAllocationPolicy == EntityAllocationPolicy::LOWEST_ID_FIRST) {
+		freeIdsBitsetSet(
+			this->freeEntityIdsBitsetArray()->data<uint64_t>(),
+			freeIdsBitsetLayout(this->maxNumEntities),
+			entityId);
+	}
+	else {
+		this->freeEntityIdsListArray()->add<uint32_t>(entityId);
+	}
+
+	// Lower high-water mark if this was the last entity
+	if ((entityId + 1) == this->entityHighWaterMark) shrinkEntityHighWaterMark(this);
 
 	return true;
 }
@@ -153,32 +1365,246 @@ Entity GameStateHeader::cloneEntity(Entity entity) noexcept
 	uint8_t expectedGeneration = generations[entityId];
 	if (entityGeneration != expectedGeneration) return Entity::invalid();
 
+	// Exit if any of the sparse component types is out of slots
+	if (numFreeSparseSlots(this, mask) == 0) return Entity::invalid();
+
 	// Create entity, exit out on failure
 	Entity newEntity = this->createEntity();
 	if (newEntity == Entity::invalid()) return Entity::invalid();
 
 	// Copy mask
 	uint32_t newEntityId = newEntity.id();
+	ComponentMask oldMask = masks[newEntityId];
 	masks[newEntityId] = mask;
+	this->componentMaskModified(newEntityId, oldMask);
 
 	// Copy components
-	for (uint32_t i = 1; i < this->numComponentTypes; i++) {
-		if (!mask.fulfills(ComponentMask::fromType(i))) continue;
+	copyComponents(this, entityId, newEntityId, mask);
 
-		// Get components array
-		uint32_t componentSize = 0;
-		uint8_t* components = this->componentsUntyped(i, componentSize);
+	return newEntity;
+}
 
-		// Skip if component type does not have data
-		if (components == nullptr) continue;
+uint32_t GameStateHeader::createEntities(uint32_t numEntities, Entity* entitiesOut) noexcept
+{
+	return createEntitiesWithMask(this, numEntities, entitiesOut, ComponentMask::activeMask());
+}
 
-		// Copy component
-		uint8_t* dst = components + newEntityId * componentSize;
-		const uint8_t* src = components + entityId * componentSize;
-		memcpy(dst, src, componentSize);
+uint32_t GameStateHeader::deleteEntities(const Entity* entities, uint32_t numEntities) noexcept
+{
+	ComponentMask* masks = this->componentMasks();
+	uint8_t* generations = this->entityGenerations();
+	const bool lowestIdFirst = this->entityAllocationPolicy == EntityAllocationPolicy::LOWEST_ID_FIRST;
+	ArrayHeader* freeEntityIdsList = this->freeEntityIdsListArray();
+	uint32_t* freeEntityIds = freeEntityIdsList->data<uint32_t>();
+	uint64_t* freeIdsBitset = this->freeEntityIdsBitsetArray()->data<uint64_t>();
+	const FreeIdsBitsetLayout bitsetLayout = freeIdsBitsetLayout(this->maxNumEntities);
+
+	uint32_t numDeleted = 0;
+	for (uint32_t i = 0; i < numEntities; i++) {
+		uint32_t entityId = entities[i].id();
+
+		// Skip entity if it is not valid, also handles duplicates since generation is incremented
+		if (entityId >= this->maxNumEntities) continue;
+		if (!masks[entityId].active()) continue;
+		if (generations[entityId] != entities[i].generation()) continue;
+
+		// Remove all associated components and the external id, clear mask and increment
+		// generation
+		const ComponentMask oldMask = masks[entityId];
+		clearComponents(this, entityId, oldMask);
+		releaseExternalId(this, entityId);
+		masks[entityId] = ComponentMask::empty();
+		generations[entityId] += 1;
+		markDirtyBlocks(this, 0, entityId);
+		stampMaskChanges(this, entityId, oldMask, ComponentMask::empty());
+
+		// Add entity id back to free entity ids, list size is updated once for the whole batch
+		if (lowestIdFirst) {
+			freeIdsBitsetSet(freeIdsBitset, bitsetLayout, entityId);
+		}
+		else {
+			sfz_assert((freeEntityIdsList->size + numDeleted) < freeEntityIdsList->capacity);
+			freeEntityIds[freeEntityIdsList->size + numDeleted] = entityId;
+		}
+		numDeleted += 1;
 	}
+	if (numDeleted == 0) return 0;
 
-	return newEntity;
+	if (!lowestIdFirst) freeEntityIdsList->size += numDeleted;
+	sfz_assert(numDeleted <= this->currentNumEntities);
+	this->currentNumEntities -= std::min(numDeleted, this->currentNumEntities);
+
+	// Update queries and high-water mark
+	removeUnmatchedIdsFromQueries(this);
+	shrinkEntityHighWaterMark(this);
+
+	return numDeleted;
+}
+
+uint32_t GameStateHeader::cloneEntityN(
+	Entity entity, uint32_t numClones, Entity* entitiesOut) noexcept
+{
+	// Exit if entity is not valid
+	if (!this->checkEntityValid(entity)) return 0;
+	uint32_t entityId = entity.id();
+	ComponentMask mask = this->componentMasks()[entityId];
+
+	// Create entities with the same mask as the source entity, limited by the free sparse slots
+	numClones = std::min(numClones, numFreeSparseSlots(this, mask));
+	uint32_t numCreated = createEntitiesWithMask(this, numClones, entitiesOut, mask);
+
+	// Copy components
+	for (uint32_t i = 0; i < numCreated; i++) {
+		copyComponents(this, entityId, entitiesOut[i].id(), mask);
+	}
+
+	return numCreated;
+}
+
+uint32_t GameStateHeader::instantiatePrefab(
+	const EntityPrefab& prefab, uint32_t numInstances, Entity* entitiesOut) noexcept
+{
+	// Exit if prefab is empty or was captured from a state with different component types
+	if (!prefab.isValid()) return 0;
+	sfz_assert(prefab.numComponentTypes() == this->numComponentTypes);
+	if (prefab.numComponentTypes() != this->numComponentTypes) return 0;
+	const ComponentMask mask = prefab.mask();
+
+	// Create entities with the prefab's mask, limited by the free sparse slots
+	numInstances = std::min(numInstances, numFreeSparseSlots(this, mask));
+	uint32_t numCreated = createEntitiesWithMask(this, numInstances, entitiesOut, mask);
+	if (numCreated == 0) return 0;
+
+	// Write components, one component type at a time
+	for (uint32_t i = 0; i < prefab.numComponents(); i++) {
+		const PrefabComponent& prefabComponent = prefab.components()[i];
+		const uint32_t componentType = prefabComponent.componentType;
+		const uint8_t* src = prefab.data() + prefabComponent.offset;
+		const ComponentRegistryEntry entry = registryEntry(this, componentType);
+		ArrayHeader* components = this->arrayAt(entry.offset);
+		const uint32_t componentSize = components->elementSize;
+		sfz_assert(componentSize == prefabComponent.sizeInBytes);
+
+		// Sparse component types acquire one slot per entity
+		if (entry.componentTypeIsSparse()) {
+			for (uint32_t j = 0; j < numCreated; j++) {
+				uint8_t* dst = sparseAcquireSlot(this, entry, entitiesOut[j].id());
+				sfz_assert(dst != nullptr);
+				memcpy(dst, src, componentSize);
+				markDirtyBlocks(this, componentType, entitiesOut[j].id());
+			}
+			continue;
+		}
+
+		// Dense component types are filled in runs of consecutive entity ids, which is usually
+		// the whole batch when spawning into a compact state
+		const ArrayHeader* fields =
+			entry.componentTypeIsSoA() ? this->arrayAt(entry.offsetFields) : nullptr;
+		uint32_t runStart = 0;
+		while (runStart < numCreated) {
+			const uint32_t firstEntityId = entitiesOut[runStart].id();
+			uint32_t runLength = 1;
+			while ((runStart + runLength) < numCreated &&
+				entitiesOut[runStart + runLength].id() == (firstEntityId + runLength)) {
+				runLength += 1;
+			}
+
+			if (fields != nullptr) {
+				for (uint32_t j = 0; j < fields->size; j++) {
+					const ComponentField& field = fields->at<ComponentField>(j);
+					fillRepeatedStreaming(
+						components->dataUntyped() + soaElementOffset(components, field, firstEntityId),
+						src + field.offset, field.sizeInBytes, runLength);
+				}
+			}
+			else {
+				fillRepeatedStreaming(
+					components->dataUntyped() + uint64_t(firstEntityId) * componentSize,
+					src, componentSize, runLength);
+			}
+			markDirtyBlocks(this, componentType, firstEntityId, runLength);
+			runStart += runLength;
+		}
+	}
+
+	return numCreated;
+}
+
+uint32_t GameStateHeader::compactEntities(uint32_t maxNumMoves, EntityRemap* remapOut) noexcept
+{
+	ComponentMask* masks = this->componentMasks();
+	uint8_t* generations = this->entityGenerations();
+	const bool lowestIdFirst = this->entityAllocationPolicy == EntityAllocationPolicy::LOWEST_ID_FIRST;
+	uint64_t* freeIdsBitset = this->freeEntityIdsBitsetArray()->data<uint64_t>();
+	const FreeIdsBitsetLayout bitsetLayout = freeIdsBitsetLayout(this->maxNumEntities);
+
+	// Move the highest live entity to the lowest free id until they meet
+	uint32_t numMoves = 0;
+	uint32_t srcEnd = this->entityHighWaterMark;
+	uint32_t nextFreeId = 0;
+	while (numMoves < maxNumMoves) {
+
+		// Find highest live entity
+		while (srcEnd != 0 && !masks[srcEnd - 1].active()) srcEnd -= 1;
+		if (srcEnd == 0) break;
+		const uint32_t srcEntityId = srcEnd - 1;
+
+		// Find lowest free id, the bitset of the lowest id first policy has it directly
+		uint32_t dstEntityId = ~0u;
+		if (lowestIdFirst) {
+			dstEntityId = freeIdsBitsetPopLowest(freeIdsBitset, bitsetLayout);
+			if (dstEntityId == ~0u) break;
+			if (dstEntityId > srcEntityId) {
+				freeIdsBitsetSet(freeIdsBitset, bitsetLayout, dstEntityId);
+				break;
+			}
+		}
+		else {
+			while (nextFreeId < srcEntityId && masks[nextFreeId].active()) nextFreeId += 1;
+			if (nextFreeId >= srcEntityId) break;
+			dstEntityId = nextFreeId;
+		}
+		sfz_assert(masks[dstEntityId] == ComponentMask::empty());
+
+		// Move mask, components and external id, and free the old id
+		const ComponentMask mask = masks[srcEntityId];
+		moveComponents(this, srcEntityId, dstEntityId, mask);
+		moveExternalId(this, srcEntityId, dstEntityId);
+		masks[dstEntityId] = mask;
+		masks[srcEntityId] = ComponentMask::empty();
+		remapOut[numMoves].oldEntity = Entity::create(srcEntityId, generations[srcEntityId]);
+		remapOut[numMoves].newEntity = Entity::create(dstEntityId, generations[dstEntityId]);
+		generations[srcEntityId] += 1;
+		markDirtyBlocks(this, 0, srcEntityId);
+		markDirtyBlocks(this, 0, dstEntityId);
+		stampMaskChanges(this, srcEntityId, mask, ComponentMask::empty());
+		stampMaskChanges(this, dstEntityId, ComponentMask::empty(), mask);
+		if (lowestIdFirst) freeIdsBitsetSet(freeIdsBitset, bitsetLayout, srcEntityId);
+		numMoves += 1;
+		srcEnd = srcEntityId;
+	}
+	if (numMoves == 0) return 0;
+
+	// Rebuild the free entity ids list, lowest id on top so that it is popped first
+	if (!lowestIdFirst) {
+		ArrayHeader* freeEntityIdsList = this->freeEntityIdsListArray();
+		uint32_t* freeEntityIds = freeEntityIdsList->data<uint32_t>();
+		uint32_t numFreeIds = 0;
+		for (int64_t entityId = int64_t(this->maxNumEntities) - 1; entityId >= 0; entityId--) {
+			if (masks[entityId].active()) continue;
+			sfz_assert(numFreeIds < freeEntityIdsList->size);
+			freeEntityIds[numFreeIds] = uint32_t(entityId);
+			numFreeIds += 1;
+		}
+		sfz_assert(numFreeIds == freeEntityIdsList->size);
+	}
+
+	// Update queries and high-water mark, the new ids were picked in ascending order
+	removeUnmatchedIdsFromQueries(this);
+	insertMovedIdsIntoQueries(this, remapOut, numMoves);
+	shrinkEntityHighWaterMark(this);
+
+	return numMoves;
 }
 
 ComponentMask* GameStateHeader::componentMasks() noexcept
@@ -255,14 +1681,116 @@ const uint8_t* GameStateHeader::componentsUntyped(
 	const ArrayHeader* registry = this->componentRegistryArray();
 	if (registry->size <= componentType) return nullptr;
 
-	// Get registry entry, return nullptr if component type has no data
-	ComponentRegistryEntry entry = registry->at<ComponentRegistryEntry>(componentType);
-	if (!entry.componentTypeHasData()) return nullptr;
+	// Get registry entry, return nullptr if component type has no data
+	ComponentRegistryEntry entry = registry->at<ComponentRegistryEntry>(componentType);
+	if (!entry.componentTypeHasData()) return nullptr;
+
+	// Return component size and data pointer
+	const ArrayHeader* components = this->arrayAt(entry.offset);
+	componentSizeBytesOut = components->elementSize;
+	return components->dataUntyped();
+}
+
+bool GameStateHeader::componentTypeIsSparse(uint32_t componentType) const noexcept
+{
+	if (componentType >= this->numComponentTypes) return false;
+	return registryEntry(this, componentType).componentTypeIsSparse();
+}
+
+const uint32_t* GameStateHeader::sparseEntityIds(
+	uint32_t componentType, uint32_t& numComponentsOut) const noexcept
+{
+	numComponentsOut = 0;
+	if (!this->componentTypeIsSparse(componentType)) return nullptr;
+	const ArrayHeader* entityIds =
+		this->arrayAt(registryEntry(this, componentType).offsetSparseEntityIds);
+	numComponentsOut = entityIds->size;
+	return entityIds->data<uint32_t>();
+}
+
+uint8_t* GameStateHeader::componentUntyped(uint32_t componentType, uint32_t entityId) noexcept
+{
+	const GameStateHeader* constThis = this;
+	return const_cast<uint8_t*>(constThis->componentUntyped(componentType, entityId));
+}
+
+const uint8_t* GameStateHeader::componentUntyped(
+	uint32_t componentType, uint32_t entityId) const noexcept
+{
+	if (componentType >= this->numComponentTypes) return nullptr;
+	if (entityId >= this->maxNumEntities) return nullptr;
+	if (!this->componentMasks()[entityId].hasComponentType(componentType)) return nullptr;
+
+	// Get registry entry, return nullptr if component type has no data or is not contiguous
+	const ComponentRegistryEntry entry = registryEntry(this, componentType);
+	if (!entry.componentTypeHasData()) return nullptr;
+	if (entry.componentTypeIsSoA()) return nullptr;
+
+	// Look up slot if sparse, otherwise entity id is the index
+	const ArrayHeader* components = this->arrayAt(entry.offset);
+	if (entry.componentTypeIsSparse()) {
+		uint32_t slot = this->arrayAt(entry.offsetSparseSlots)->at<uint32_t>(entityId);
+		if (slot == ~0u) return nullptr;
+		return components->atUntyped(slot);
+	}
+	return components->atUntyped(entityId);
+}
+
+bool GameStateHeader::componentTypeIsSoA(uint32_t componentType) const noexcept
+{
+	if (componentType >= this->numComponentTypes) return false;
+	return registryEntry(this, componentType).componentTypeIsSoA();
+}
+
+const ComponentField* GameStateHeader::componentFields(
+	uint32_t componentType, uint32_t& numFieldsOut) const noexcept
+{
+	numFieldsOut = 0;
+	if (!this->componentTypeIsSoA(componentType)) return nullptr;
+	const ArrayHeader* fields = this->arrayAt(registryEntry(this, componentType).offsetFields);
+	numFieldsOut = fields->size;
+	return fields->data<ComponentField>();
+}
+
+uint8_t* GameStateHeader::componentFieldUntyped(
+	uint32_t componentType, uint32_t fieldIdx, uint32_t& fieldSizeBytesOut) noexcept
+{
+	const GameStateHeader* constThis = this;
+	return const_cast<uint8_t*>(
+		constThis->componentFieldUntyped(componentType, fieldIdx, fieldSizeBytesOut));
+}
+
+const uint8_t* GameStateHeader::componentFieldUntyped(
+	uint32_t componentType, uint32_t fieldIdx, uint32_t& fieldSizeBytesOut) const noexcept
+{
+	uint32_t numFields = 0;
+	const ComponentField* fields = this->componentFields(componentType, numFields);
+	if (fieldIdx >= numFields) return nullptr;
+	const ArrayHeader* components = this->arrayAt(registryEntry(this, componentType).offset);
+	fieldSizeBytesOut = fields[fieldIdx].sizeInBytes;
+	return components->dataUntyped() + soaElementOffset(components, fields[fieldIdx], 0);
+}
+
+bool GameStateHeader::readComponentUntyped(
+	uint32_t componentType, uint32_t entityId, uint8_t* dst, uint32_t dstSize) const noexcept
+{
+	if (componentType >= this->numComponentTypes) return false;
+	if (entityId >= this->maxNumEntities) return false;
+	if (!this->componentMasks()[entityId].hasComponentType(componentType)) return false;
+
+	// Return false if component type has no data or dstSize does not match component size
+	const ComponentRegistryEntry entry = registryEntry(this, componentType);
+	if (!entry.componentTypeHasData()) return false;
+	if (this->arrayAt(entry.offset)->elementSize != dstSize) return false;
 
-	// Return component size and data pointer
-	const ArrayHeader* components = this->arrayAt(entry.offset);
-	componentSizeBytesOut = components->elementSize;
-	return components->dataUntyped();
+	if (entry.componentTypeIsSoA()) {
+		soaRead(this, entry, entityId, dst);
+		return true;
+	}
+	const uint8_t* src = this->componentUntyped(componentType, entityId);
+	if (src == nullptr) return false;
+	memcpy(dst, src, dstSize);
+	return true;
 }
 
 bool GameStateHeader::addComponentUntyped(
@@ -285,11 +1813,27 @@ bool GameStateHeader::addComponentUntyped(
 	// Return false if dataSize does not match componentSize
 	if (dataSize != componentSize) return false;
 
-	// Copy component into ECS system
-	memcpy(components + entityId * componentSize, data, dataSize);
+	// Get the entity's component, return false if a sparse component type is out of slots
+	uint8_t* dst = components + entityId * componentSize;
+	const ComponentRegistryEntry entry = registryEntry(this, componentType);
+	if (entry.componentTypeIsSparse()) {
+		dst = sparseAcquireSlot(this, entry, entityId);
+		if (dst == nullptr) return false;
+	}
+
+	// Copy component into ECS system, structure-of-arrays components are scattered to columns
+	if (entry.componentTypeIsSoA()) soaWrite(this, entry, entityId, data);
+	else if (data != nullptr) memcpy(dst, data, dataSize);
+	else memset(dst, 0, dataSize);
+	markDirtyBlocks(this, componentType, entityId);
 
-	// Ensure bit is set in mask
+	// Ensure bit is set in mask, overwriting an existing component counts as a write
+	ComponentMask oldMask = mask;
+	if (oldMask.hasComponentType(componentType)) {
+		stampChanges(this, componentType, entityId, 1, COMPONENT_CHANGE_WRITTEN);
+	}
 	mask.setComponentType(componentType, true);
+	if (mask != oldMask) this->componentMaskModified(entityId, oldMask);
 
 	return true;
 }
@@ -312,7 +1856,9 @@ bool GameStateHeader::setComponentUnsized(
 	if (components != nullptr) return false;
 
 	// Set bit in mask
+	ComponentMask oldMask = mask;
 	mask.setComponentType(componentType, value);
+	if (mask != oldMask) this->componentMaskModified(entityId, oldMask);
 
 	return true;
 }
@@ -332,31 +1878,569 @@ bool GameStateHeader::deleteComponent(Entity entity, uint32_t componentType) noe
 	uint8_t* components = componentsUntyped(componentType, componentSize);
 	if (components == nullptr) return this->setComponentUnsized(entity, componentType, false);
 
-	// Clear component
-	memset(components + entityId * componentSize, 0, componentSize);
+	// Clear component, sparse component types also free the slot
+	const ComponentRegistryEntry entry = registryEntry(this, componentType);
+	if (entry.componentTypeIsSparse()) {
+		sparseReleaseSlot(this, componentType, entityId);
+	}
+	else {
+		if (entry.componentTypeIsSoA()) soaWrite(this, entry, entityId, nullptr);
+		else memset(components + entityId * componentSize, 0, componentSize);
+		markDirtyBlocks(this, componentType, entityId);
+	}
 
 	// Clear bit in mask
+	ComponentMask oldMask = mask;
 	mask.setComponentType(componentType, false);
+	if (mask != oldMask) this->componentMaskModified(entityId, oldMask);
+
+	return true;
+}
+
+// GameState: Dirty tracking API
+// ------------------------------------------------------------------------------------------------
+
+uint32_t GameStateHeader::numDirtyBlocks() const noexcept
+{
+	if (this->dirtyBlockSize == 0) return 0;
+	return (this->maxNumEntities + this->dirtyBlockSize - 1) / this->dirtyBlockSize;
+}
+
+void GameStateHeader::markDirty(uint32_t componentType, uint32_t entityId) noexcept
+{
+	markDirtyBlocks(this, componentType, entityId);
+	stampChanges(this, componentType, entityId, 1, COMPONENT_CHANGE_WRITTEN);
+}
+
+void GameStateHeader::markDirtyRange(
+	uint32_t componentType, uint32_t firstEntityId, uint32_t numEntities) noexcept
+{
+	markDirtyBlocks(this, componentType, firstEntityId, numEntities);
+	stampChanges(this, componentType, firstEntityId, numEntities, COMPONENT_CHANGE_WRITTEN);
+}
+
+void GameStateHeader::markSingletonDirty(uint32_t singletonIndex) noexcept
+{
+	if (this->dirtyBlockSize == 0) return;
+	sfz_assert(singletonIndex < this->numSingletons);
+	atomicSetBits(&this->dirtySingletons, uint64_t(1) << singletonIndex);
+	atomicClearWord(
+		this->hashCacheArray()->data<uint64_t>() + this->numComponentTypes + singletonIndex);
+}
+
+bool GameStateHeader::isDirty(uint32_t componentType, uint32_t entityId) const noexcept
+{
+	if (this->dirtyBlockSize == 0) return true;
+	sfz_assert(entityId < this->maxNumEntities);
+	uint32_t blockIdx = entityId / this->dirtyBlockSize;
+	const uint64_t* bits = this->dirtyBlocks(componentType);
+	return (bits[blockIdx / 64] & (uint64_t(1) << (blockIdx % 64))) != 0;
+}
+
+uint64_t* GameStateHeader::dirtyBlocks(uint32_t componentType) noexcept
+{
+	if (this->dirtyBlockSize == 0) return nullptr;
+	sfz_assert(componentType < this->numComponentTypes);
+	uint32_t numWordsPerType = (this->numDirtyBlocks() + 63) / 64;
+	return this->dirtyBitsetArray()->data<uint64_t>() + componentType * numWordsPerType;
+}
+
+const uint64_t* GameStateHeader::dirtyBlocks(uint32_t componentType) const noexcept
+{
+	if (this->dirtyBlockSize == 0) return nullptr;
+	sfz_assert(componentType < this->numComponentTypes);
+	uint32_t numWordsPerType = (this->numDirtyBlocks() + 63) / 64;
+	return this->dirtyBitsetArray()->data<uint64_t>() + componentType * numWordsPerType;
+}
+
+void GameStateHeader::clearDirty() noexcept
+{
+	if (this->dirtyBlockSize == 0) return;
+	ArrayHeader* dirtyBitset = this->dirtyBitsetArray();
+	memset(dirtyBitset->data<uint64_t>(), 0, dirtyBitset->size * sizeof(uint64_t));
+	this->dirtySingletons = 0;
+}
+
+// GameState: Change tracking API
+// ------------------------------------------------------------------------------------------------
+
+bool GameStateHeader::componentTypeIsChangeTracked(uint32_t componentType) const noexcept
+{
+	if (componentType >= this->numComponentTypes) return false;
+	return registryEntry(this, componentType).componentTypeIsChangeTracked();
+}
+
+uint32_t GameStateHeader::advanceChangeTick() noexcept
+{
+	if (this->changeTick == 0) return 0;
+	sfz_assert(this->changeTick != ~0u);
+	this->changeTick += 1;
+	return this->changeTick;
+}
+
+ComponentChangeTicks* GameStateHeader::componentChangeTicks(uint32_t componentType) noexcept
+{
+	if (!this->componentTypeIsChangeTracked(componentType)) return nullptr;
+	const ComponentRegistryEntry entry = registryEntry(this, componentType);
+	return this->arrayAt(entry.offsetChangeTicks)->data<ComponentChangeTicks>();
+}
+
+const ComponentChangeTicks* GameStateHeader::componentChangeTicks(
+	uint32_t componentType) const noexcept
+{
+	if (!this->componentTypeIsChangeTracked(componentType)) return nullptr;
+	const ComponentRegistryEntry entry = registryEntry(this, componentType);
+	return this->arrayAt(entry.offsetChangeTicks)->data<ComponentChangeTicks>();
+}
+
+uint32_t GameStateHeader::changedEntities(uint32_t componentType, uint32_t firstTick,
+	uint32_t changeKinds, uint32_t* entityIdsOut) const noexcept
+{
+	if (!this->componentTypeIsChangeTracked(componentType)) return 0;
+	const ComponentRegistryEntry entry = registryEntry(this, componentType);
+	const ComponentChangeTicks* ticks =
+		this->arrayAt(entry.offsetChangeTicks)->data<ComponentChangeTicks>();
+	const ArrayHeader* blockTicksArray = this->arrayAt(entry.offsetChangeBlockTicks);
+	const uint32_t* blockTicks = blockTicksArray->data<uint32_t>();
+
+	// Ticks of unselected kinds of changes are masked to 0 (never), which is before any firstTick
+	if (firstTick == 0) firstTick = 1;
+	const uint32_t addedMask = (changeKinds & COMPONENT_CHANGE_ADDED) != 0 ? ~0u : 0u;
+	const uint32_t removedMask = (changeKinds & COMPONENT_CHANGE_REMOVED) != 0 ? ~0u : 0u;
+	const uint32_t writtenMask = (changeKinds & COMPONENT_CHANGE_WRITTEN) != 0 ? ~0u : 0u;
+
+	// Only look at the entities in blocks with a change at firstTick or later, the id is always
+	// written and the count only incremented if the entity has changed
+	uint32_t numChanged = 0;
+	for (uint32_t blockIdx = 0; blockIdx < blockTicksArray->size; blockIdx++) {
+		if (blockTicks[blockIdx] < firstTick) continue;
+		const uint32_t firstEntityId = blockIdx * GAME_STATE_CHANGE_BLOCK_SIZE;
+		const uint32_t endEntityId =
+			std::min(firstEntityId + GAME_STATE_CHANGE_BLOCK_SIZE, this->maxNumEntities);
+		for (uint32_t entityId = firstEntityId; entityId < endEntityId; entityId++) {
+			const ComponentChangeTicks& entityTicks = ticks[entityId];
+			const uint32_t latestTick = std::max(std::max(
+				entityTicks.added & addedMask,
+				entityTicks.removed & removedMask),
+				entityTicks.written & writtenMask);
+			entityIdsOut[numChanged] = entityId;
+			numChanged += latestTick >= firstTick ? 1 : 0;
+		}
+	}
+	return numChanged;
+}
 
+// GameState: External id API
+// ------------------------------------------------------------------------------------------------
+
+uint64_t GameStateHeader::externalId(Entity entity) const noexcept
+{
+	if (!this->externalIdsEnabled()) return 0;
+	if (!this->checkEntityValid(entity)) return 0;
+	return this->externalIdsArray()->at<uint64_t>(entity.id());
+}
+
+Entity GameStateHeader::findEntity(uint64_t externalId) const noexcept
+{
+	if (!this->externalIdsEnabled() || externalId == 0) return Entity::invalid();
+	const uint32_t slotIdx = externalIdIndexFind(this, externalId);
+	if (slotIdx == ~0u) return Entity::invalid();
+	return this->externalIdSlotsArray()->at<ExternalIdSlot>(slotIdx).entity;
+}
+
+bool GameStateHeader::setExternalId(Entity entity, uint64_t externalId) noexcept
+{
+	if (!this->externalIdsEnabled()) return false;
+	if (!this->checkEntityValid(entity)) return false;
+	const uint32_t entityId = entity.id();
+	if (this->externalIdsArray()->at<uint64_t>(entityId) == externalId) return true;
+	if (externalId != 0 && externalIdIndexFind(this, externalId) != ~0u) return false;
+
+	releaseExternalId(this, entityId);
+	if (externalId != 0) {
+		// Inserted before being stored, a rebuild of the index would otherwise insert it twice
+		bool inserted = externalIdIndexTryInsert(this, externalId, entity);
+		sfz_assert(inserted);
+		(void)inserted;
+		this->externalIdsArray()->at<uint64_t>(entityId) = externalId;
+	}
+	markDirtyBlocks(this, 0, entityId);
 	return true;
 }
 
+const uint64_t* GameStateHeader::externalIds() const noexcept
+{
+	if (!this->externalIdsEnabled()) return nullptr;
+	return this->externalIdsArray()->data<uint64_t>();
+}
+
+// GameState: Event queue API
+// ------------------------------------------------------------------------------------------------
+
+uint8_t* GameStateHeader::reserveEventsUntyped(
+	uint32_t queueIdx, uint32_t eventSize, uint32_t numEvents, uint32_t& numReservedOut) noexcept
+{
+	numReservedOut = 0;
+	if (queueIdx >= this->numEventQueues) return nullptr;
+	EventQueueRegistryEntry& entry =
+		this->eventQueueRegistryArray()->at<EventQueueRegistryEntry>(queueIdx);
+	ArrayHeader* events = this->arrayAt(entry.offset);
+	sfz_assert(events->elementSize == eventSize);
+	if (events->elementSize != eventSize) return nullptr;
+	if (numEvents == 0) return nullptr;
+
+	const uint32_t firstIdx =
+		atomicAddClamped(&events->size, numEvents, events->capacity, numReservedOut);
+	if (numReservedOut < numEvents) {
+		atomicAdd(&entry.numDroppedEvents, numEvents - numReservedOut);
+	}
+	if (numReservedOut == 0) return nullptr;
+	return events->atUntyped(firstIdx);
+}
+
+uint32_t GameStateHeader::pushEventsUntyped(
+	uint32_t queueIdx, const uint8_t* events, uint32_t eventSize, uint32_t numEvents) noexcept
+{
+	uint32_t numReserved = 0;
+	uint8_t* dst = this->reserveEventsUntyped(queueIdx, eventSize, numEvents, numReserved);
+	if (dst != nullptr) memcpy(dst, events, size_t(numReserved) * eventSize);
+	return numReserved;
+}
+
+const uint8_t* GameStateHeader::eventsUntyped(
+	uint32_t queueIdx, uint32_t& numEventsOut, uint32_t& eventSizeBytesOut) const noexcept
+{
+	numEventsOut = 0;
+	eventSizeBytesOut = 0;
+	if (queueIdx >= this->numEventQueues) return nullptr;
+	const ArrayHeader* events = this->arrayAt(
+		this->eventQueueRegistryArray()->at<EventQueueRegistryEntry>(queueIdx).offset);
+	numEventsOut = events->size;
+	eventSizeBytesOut = events->elementSize;
+	return events->dataUntyped();
+}
+
+uint32_t GameStateHeader::numDroppedEvents(uint32_t queueIdx) const noexcept
+{
+	if (queueIdx >= this->numEventQueues) return 0;
+	return this->eventQueueRegistryArray()->at<EventQueueRegistryEntry>(queueIdx).numDroppedEvents;
+}
+
+void GameStateHeader::clearEvents(uint32_t queueIdx) noexcept
+{
+	if (queueIdx >= this->numEventQueues) return;
+	EventQueueRegistryEntry& entry =
+		this->eventQueueRegistryArray()->at<EventQueueRegistryEntry>(queueIdx);
+	ArrayHeader* events = this->arrayAt(entry.offset);
+	memset(events->dataUntyped(), 0, size_t(events->size) * events->elementSize);
+	events->size = 0;
+	entry.numDroppedEvents = 0;
+}
+
+void GameStateHeader::clearEvents() noexcept
+{
+	for (uint32_t i = 0; i < this->numEventQueues; i++) {
+		this->clearEvents(i);
+	}
+}
+
+// GameState: State hash API
+// ------------------------------------------------------------------------------------------------
+
+uint64_t GameStateHeader::hash(ComponentMask componentTypes, uint64_t singletons) noexcept
+{
+	uint64_t stateHash = 0;
+	for (uint32_t i = 0; i < this->numComponentTypes; i++) {
+		if (!componentTypes.hasComponentType(i)) continue;
+		stateHash = combineStateHashes(stateHash, this->componentTypeHash(i));
+	}
+	for (uint32_t i = 0; i < this->numSingletons; i++) {
+		if ((singletons & (uint64_t(1) << i)) == 0) continue;
+		stateHash = combineStateHashes(stateHash, this->singletonHash(i));
+	}
+	return stateHash;
+}
+
+uint64_t GameStateHeader::componentTypeHash(uint32_t componentType) noexcept
+{
+	sfz_assert(componentType < this->numComponentTypes);
+	uint64_t* cachedHashes = this->hashCacheArray()->data<uint64_t>();
+	if (this->dirtyTrackingEnabled() && cachedHashes[componentType] != 0) {
+		return cachedHashes[componentType];
+	}
+
+	// Component type 0 is the entity bookkeeping, i.e. masks, generations and external ids. Only
+	// the committed entities are hashed, in a growable game state the rest is uncommitted.
+	const uint32_t numCommitted = this->committedNumEntities;
+	uint64_t componentHash = 0;
+	if (componentType == 0) {
+		componentHash = hashStateBytes(
+			this->componentMasksArray()->dataUntyped(),
+			uint64_t(numCommitted) * sizeof(ComponentMask));
+		componentHash = hashStateBytes(
+			this->entityGenerationsListArray()->dataUntyped(),
+			uint64_t(numCommitted) * sizeof(uint8_t),
+			componentHash);
+		if (this->externalIdsEnabled()) {
+			componentHash = hashStateBytes(
+				this->externalIdsArray()->dataUntyped(),
+				uint64_t(numCommitted) * sizeof(uint64_t),
+				componentHash);
+			componentHash = hashStateBytes(
+				reinterpret_cast<const uint8_t*>(&this->nextExternalId), sizeof(uint64_t),
+				componentHash);
+		}
+	}
+	else {
+		const ComponentRegistryEntry entry = registryEntry(this, componentType);
+		uint32_t numFields = 0;
+		const ComponentField* fields = this->componentFields(componentType, numFields);
+		if (fields != nullptr && numCommitted != this->maxNumEntities) {
+			// The committed part of each structure-of-arrays column in a growable game state
+			const ArrayHeader* components = this->arrayAt(entry.offset);
+			componentHash = hashStateBytes(nullptr, 0, componentType);
+			for (uint32_t i = 0; i < numFields; i++) {
+				componentHash = hashStateBytes(
+					components->dataUntyped() + fields[i].offset * components->capacity,
+					uint64_t(numCommitted) * fields[i].sizeInBytes, componentHash);
+			}
+		}
+		else if (entry.componentTypeHasData()) {
+			// Sparse and structure-of-arrays component arrays are hashed in their entirety, dense
+			// ones up to the committed entities
+			const ArrayHeader* components = this->arrayAt(entry.offset);
+			const uint32_t numComponents =
+				entry.componentTypeIsSparse() || fields != nullptr ? components->size : numCommitted;
+			componentHash = hashStateBytes(components->dataUntyped(),
+				uint64_t(numComponents) * components->elementSize, componentType);
+		}
+		else {
+			componentHash = hashStateBytes(nullptr, 0, componentType);
+		}
+
+		// The order of a sparse set depends on the order of operations, so it is part of the hash
+		if (entry.componentTypeIsSparse()) {
+			const ArrayHeader* entityIds = this->arrayAt(entry.offsetSparseEntityIds);
+			componentHash = hashStateBytes(entityIds->dataUntyped(),
+				uint64_t(entityIds->size) * sizeof(uint32_t), componentHash);
+		}
+	}
+
+	// 0 means "not cached" in the hash cache, so it is never a valid hash
+	if (componentHash == 0) componentHash = 1;
+	if (this->dirtyTrackingEnabled()) cachedHashes[componentType] = componentHash;
+	return componentHash;
+}
+
+uint64_t GameStateHeader::singletonHash(uint32_t singletonIndex) noexcept
+{
+	sfz_assert(singletonIndex < this->numSingletons);
+	uint64_t* cachedHashes = this->hashCacheArray()->data<uint64_t>() + this->numComponentTypes;
+	if (this->dirtyTrackingEnabled() && cachedHashes[singletonIndex] != 0) {
+		return cachedHashes[singletonIndex];
+	}
+
+	uint32_t singletonSize = 0;
+	const uint8_t* singleton = this->singletonUntyped(singletonIndex, singletonSize);
+	uint64_t singletonHash = hashStateBytes(singleton, singletonSize, singletonIndex);
+	if (singletonHash == 0) singletonHash = 1;
+
+	if (this->dirtyTrackingEnabled()) cachedHashes[singletonIndex] = singletonHash;
+	return singletonHash;
+}
+
+// GameState: Query API
+// ------------------------------------------------------------------------------------------------
+
+const uint32_t* GameStateHeader::queryEntities(
+	uint32_t queryIdx, uint32_t& numEntitiesOut) const noexcept
+{
+	// Get registry, return nullptr if query is not in registry
+	const ArrayHeader* registry = this->queryRegistryArray();
+	if (registry->size <= queryIdx) return nullptr;
+
+	// Return number of matching entities and pointer to their ids
+	const QueryRegistryEntry& entry = registry->at<QueryRegistryEntry>(queryIdx);
+	const ArrayHeader* entityIds = this->arrayAt(entry.offset);
+	numEntitiesOut = entityIds->size;
+	return entityIds->data<uint32_t>();
+}
+
+const QueryRegistryEntry& GameStateHeader::queryEntry(uint32_t queryIdx) const noexcept
+{
+	const ArrayHeader* registry = this->queryRegistryArray();
+	sfz_assert(queryIdx < registry->size);
+	return registry->at<QueryRegistryEntry>(queryIdx);
+}
+
+void GameStateHeader::componentMaskModified(uint32_t entityId, ComponentMask oldMask) noexcept
+{
+	sfz_assert(entityId < this->maxNumEntities);
+	const ComponentMask newMask = this->componentMasks()[entityId];
+	markDirtyBlocks(this, 0, entityId);
+	stampMaskChanges(this, entityId, oldMask, newMask);
+
+	ArrayHeader* registry = this->queryRegistryArray();
+	for (uint32_t i = 0; i < registry->size; i++) {
+		const QueryRegistryEntry& entry = registry->at<QueryRegistryEntry>(i);
+
+		// Skip query if entity's membership has not changed
+		bool matchedBefore = entry.matches(oldMask);
+		bool matchesNow = entry.matches(newMask);
+		if (matchedBefore == matchesNow) continue;
+
+		// Find position of entity id in the sorted list of ids
+		ArrayHeader* entityIdsArray = this->arrayAt(entry.offset);
+		uint32_t* entityIds = entityIdsArray->data<uint32_t>();
+		uint32_t* idPtr = std::lower_bound(entityIds, entityIds + entityIdsArray->size, entityId);
+		uint32_t idPos = uint32_t(idPtr - entityIds);
+		uint32_t numIdsAfter = entityIdsArray->size - idPos;
+
+		// Insert entity id, shifting all larger ids one step up
+		if (matchesNow) {
+			sfz_assert(entityIdsArray->size < entityIdsArray->capacity);
+			sfz_assert(numIdsAfter == 0 || *idPtr != entityId);
+			memmove(idPtr + 1, idPtr, numIdsAfter * sizeof(uint32_t));
+			*idPtr = entityId;
+			entityIdsArray->size += 1;
+		}
+
+		// Remove entity id, shifting all larger ids one step down
+		else {
+			sfz_assert(numIdsAfter != 0 && *idPtr == entityId);
+			memmove(idPtr, idPtr + 1, (numIdsAfter - 1) * sizeof(uint32_t));
+			entityIdsArray->size -= 1;
+			entityIds[entityIdsArray->size] = 0;
+		}
+	}
+}
+
+uint32_t GameStateHeader::scanEntities(
+	ComponentMask required, ComponentMask excluded, uint32_t* entityIdsOut) const noexcept
+{
+	return scanComponentMasks(
+		this->componentMasks(),
+		this->entityHighWaterMark,
+		required | ComponentMask::activeMask(),
+		excluded,
+		entityIdsOut);
+}
+
+void GameStateHeader::rebuildQueries() noexcept
+{
+	// Masks may have been modified directly, so high-water mark is recalculated from scratch. The
+	// masks above the committed entities are never set.
+	this->entityHighWaterMark = this->committedNumEntities;
+	shrinkEntityHighWaterMark(this);
+
+	ArrayHeader* registry = this->queryRegistryArray();
+	for (uint32_t i = 0; i < registry->size; i++) {
+		const QueryRegistryEntry& entry = registry->at<QueryRegistryEntry>(i);
+
+		// Scan for all matching entities, ids are written in sorted order
+		ArrayHeader* entityIdsArray = this->arrayAt(entry.offset);
+		uint32_t* entityIds = entityIdsArray->data<uint32_t>();
+		const uint32_t oldSize = entityIdsArray->size;
+		entityIdsArray->size = this->scanEntities(entry.required, entry.excluded, entityIds);
+
+		// Clear rest of list. The scan may leave garbage after the last matching id, but never
+		// past the high-water mark, and everything past the old size is already zero. Clearing
+		// the entire capacity would touch (and on a growable state, require) memory for every
+		// entity.
+		const uint32_t clearEnd = std::max(oldSize, this->entityHighWaterMark);
+		if (clearEnd > entityIdsArray->size) {
+			memset(entityIds + entityIdsArray->size, 0,
+				(clearEnd - entityIdsArray->size) * sizeof(uint32_t));
+		}
+	}
+}
+
+// GameStateUncommittedRanges
+// ------------------------------------------------------------------------------------------------
+
+GameStateUncommittedRanges::GameStateUncommittedRanges(const GameStateHeader* state) noexcept
+{
+	if (state->committedNumEntities == state->maxNumEntities) return;
+	mState = state;
+	mNumCommittedEntities = state->committedNumEntities;
+}
+
+bool GameStateUncommittedRanges::next(GameStateByteRange& rangeOut) noexcept
+{
+	if (mState == nullptr) return false;
+	const uint64_t stateSizeBytes = mState->stateSizeBytes;
+	const uint64_t lastEnd = uint64_t(mLastRange.offsetBytes) + mLastRange.sizeBytes;
+	EntityColumn column;
+	while (nextEntityColumn(mState, mColumnIdx, mFieldIdx, column)) {
+
+		// The uncommitted part of the column, shrunk to whole pages since the pages at the ends
+		// are shared with committed memory
+		uint64_t begin = column.offsetBytes + uint64_t(mNumCommittedEntities) * column.elementSize;
+		uint64_t end = column.offsetBytes + uint64_t(column.capacity) * column.elementSize;
+		begin = (begin + GAME_STATE_COMMIT_PAGE_SIZE - 1) & ~uint64_t(GAME_STATE_COMMIT_PAGE_SIZE - 1);
+		end = std::min(end, stateSizeBytes) & ~uint64_t(GAME_STATE_COMMIT_PAGE_SIZE - 1);
+		if (begin >= end || begin < lastEnd) continue;
+
+		mLastRange.offsetBytes = uint32_t(begin);
+		mLastRange.sizeBytes = uint32_t(end - begin);
+		rangeOut = mLastRange;
+		return true;
+	}
+	mState = nullptr;
+	return false;
+}
+
+bool GameStateUncommittedRanges::contains(uint32_t offsetBytes) noexcept
+{
+	GameStateByteRange range = mLastRange;
+	while ((uint64_t(range.offsetBytes) + range.sizeBytes) <= offsetBytes) {
+		if (!this->next(range)) return false;
+	}
+	return range.offsetBytes <= offsetBytes;
+}
+
 // Game state functions
 // ------------------------------------------------------------------------------------------------
 
 GameStateContainer createGameState(
-	uint32_t numSingletonStructs,
-	const uint32_t* singletonStructSizes,
-	uint32_t maxNumEntities,
-	uint32_t numComponentTypes,
-	const uint32_t* componentSizes,
+	const GameStateCreateInfo& createInfo,
 	Allocator* allocator) noexcept
 {
+	const uint32_t numSingletonStructs = createInfo.numSingletonStructs;
+	const uint32_t* singletonStructSizes = createInfo.singletonStructSizes;
+	const uint32_t maxNumEntities = createInfo.maxNumEntities;
+	const uint32_t numComponentTypes = createInfo.numComponentTypes;
+	const uint32_t* componentSizes = createInfo.componentSizes;
+	const uint32_t numQueries = createInfo.numQueries;
+	const uint32_t numEventQueues = createInfo.numEventQueues;
+	const bool lowestIdFirst =
+		createInfo.entityAllocationPolicy == EntityAllocationPolicy::LOWEST_ID_FIRST;
+	const bool growable = createInfo.growable;
+
 	sfz_assert(numSingletonStructs <= 64);
 	sfz_assert(maxNumEntities <= GAME_STATE_ECS_MAX_NUM_ENTITIES);
-	sfz_assert(numComponentTypes <= 63); // Not 64 because one is reserved for active bit
-
-	uint32_t totalSizeBytes = 0;
+	sfz_assert(!growable || lowestIdFirst);
+	if (growable && !lowestIdFirst) return GameStateContainer();
+	// One less than the mask width because one bit is reserved for the active bit
+	sfz_assert(numComponentTypes < COMPONENT_MASK_NUM_BITS);
+	sfz_assert(numQueries <= 64);
+	sfz_assert(numEventQueues <= 64);
+
+	// Accumulated in 64 bits so that too large states can be detected, see below
+	uint64_t totalSizeBytes = 0;
+
+	// The entity indexed arrays in the order they are laid out (see nextEntityColumn()), which a
+	// growable game state does not commit up front. Added when totalSizeBytes is at their header.
+	sfz::DynArray<EntityColumn> entityColumns;
+	if (growable) entityColumns.init(64, allocator, sfz_dbg("createGameState::entityColumns"));
+	auto addEntityColumn = [&](const ArrayHeader& header, uint32_t offsetInData, uint32_t elementSize) {
+		if (!growable) return;
+		EntityColumn column;
+		column.offsetBytes = uint32_t(totalSizeBytes + sizeof(ArrayHeader) + offsetInData);
+		column.elementSize = elementSize;
+		column.capacity = header.capacity;
+		entityColumns.add(column);
+	};
 
 	// GameState Header
 	totalSizeBytes += sizeof(GameStateHeader);
@@ -364,7 +2448,7 @@ GameStateContainer createGameState(
 	// Singleton registry
 	ArrayHeader singletonRegistryHeader;
 	singletonRegistryHeader.create<SingletonRegistryEntry>(numSingletonStructs);
-	uint32_t singletonRegistrySizeBytes = singletonRegistryHeader.numBytesNeededForArrayPlusHeader32Byte();
+	uint64_t singletonRegistrySizeBytes = arrayPlusHeaderSizeBytes(singletonRegistryHeader);
 	totalSizeBytes += singletonRegistrySizeBytes;
 
 	// Singleton structs
@@ -373,7 +2457,7 @@ GameStateContainer createGameState(
 		sfz_assert(singletonStructSizes[i] != 0);
 
 		// Fill singleton registry
-		singleRegistryEntries[i].offset = totalSizeBytes;
+		singleRegistryEntries[i].offset = uint32_t(totalSizeBytes);
 		singleRegistryEntries[i].sizeInBytes = singletonStructSizes[i];
 
 		// Calculate next 32-byte aligned offset and update totalSizeBytes
@@ -385,56 +2469,251 @@ GameStateContainer createGameState(
 	}
 
 	// Components registry (+ 1 for active bit)
-	uint32_t offsetComponentRegistryHeader = totalSizeBytes;
+	uint32_t offsetComponentRegistryHeader = uint32_t(totalSizeBytes);
 	ArrayHeader componentRegistryHeader;
 	componentRegistryHeader.create<ComponentRegistryEntry>(numComponentTypes + 1);
-	uint32_t componentRegistrySizeBytes = componentRegistryHeader.numBytesNeededForArrayPlusHeader32Byte();
+	uint64_t componentRegistrySizeBytes = arrayPlusHeaderSizeBytes(componentRegistryHeader);
 	totalSizeBytes += componentRegistrySizeBytes;
 
-	// Free entity ids list
+	// Free entity ids list (only used with LIFO allocation policy)
 	ArrayHeader freeEntityIdsHeader;
-	freeEntityIdsHeader.create<uint32_t>(maxNumEntities);
-	uint32_t freeEntityIdsSizeBytes = freeEntityIdsHeader.numBytesNeededForArrayPlusHeader32Byte();
+	freeEntityIdsHeader.create<uint32_t>(lowestIdFirst ? 0 : maxNumEntities);
+	uint64_t freeEntityIdsSizeBytes = arrayPlusHeaderSizeBytes(freeEntityIdsHeader);
 	totalSizeBytes += freeEntityIdsSizeBytes;
 
 	// Entity masks
 	ArrayHeader masksHeader;
 	masksHeader.create<ComponentMask>(maxNumEntities);
-	uint32_t masksSizeBytes = masksHeader.numBytesNeededForArrayPlusHeader32Byte();
+	uint64_t masksSizeBytes = arrayPlusHeaderSizeBytes(masksHeader);
+	addEntityColumn(masksHeader, 0, masksHeader.elementSize);
 	totalSizeBytes += masksSizeBytes;
 
 	// Entity generations list
 	ArrayHeader generationsHeader;
 	generationsHeader.create<uint8_t>(maxNumEntities);
-	uint32_t generationsSizeBytes = generationsHeader.numBytesNeededForArrayPlusHeader32Byte();
+	uint64_t generationsSizeBytes = arrayPlusHeaderSizeBytes(generationsHeader);
+	addEntityColumn(generationsHeader, 0, generationsHeader.elementSize);
 	totalSizeBytes += generationsSizeBytes;
 
 	// Component arrays
-	ComponentRegistryEntry componentRegistryEntries[64];
-	ArrayHeader componentsArrayHeaders[64];
+	ComponentRegistryEntry componentRegistryEntries[COMPONENT_MASK_NUM_BITS];
+	ArrayHeader componentsArrayHeaders[COMPONENT_MASK_NUM_BITS];
 	for (auto& entry : componentRegistryEntries) entry = ComponentRegistryEntry::createUnsized();
+	ArrayHeader sparseSlotsHeader;
+	sparseSlotsHeader.create<uint32_t>(maxNumEntities);
+	sparseSlotsHeader.size = sparseSlotsHeader.capacity;
+	ArrayHeader sparseEntityIdsHeaders[COMPONENT_MASK_NUM_BITS];
+	ArrayHeader fieldsHeaders[COMPONENT_MASK_NUM_BITS];
 	for (uint32_t i = 0; i < numComponentTypes; i++) {
 
 		// If the component size is 0, don't create ArrayHeader and don't increment total size
 		if (componentSizes[i] == 0) continue;
 
-		// Create ArrayHeader
+		// Dense components have one component per entity, sparse ones the requested number of slots
+		const uint32_t sparseCapacity = createInfo.componentSparseCapacities != nullptr ?
+			createInfo.componentSparseCapacities[i] : 0;
+		sfz_assert(sparseCapacity <= maxNumEntities);
+		const uint32_t numFields = createInfo.componentFieldLayouts != nullptr ?
+			createInfo.componentFieldLayouts[i].numFields : 0;
+		sfz_assert(sparseCapacity == 0 || numFields == 0);
+
+		// Create ArrayHeader, sparse components arrays start out empty. Structure-of-arrays
+		// columns are padded so that all of them are 32-byte aligned.
 		ArrayHeader& componentsHeader = componentsArrayHeaders[i + 1];
-		componentsHeader.createUntyped(maxNumEntities, componentSizes[i]);
-		componentsHeader.size = componentsHeader.capacity;
+		if (numFields != 0) {
+			const uint32_t paddedNumEntities =
+				(maxNumEntities + GAME_STATE_SOA_COLUMN_ALIGNMENT - 1) &
+				~(GAME_STATE_SOA_COLUMN_ALIGNMENT - 1);
+			componentsHeader.createUntyped(paddedNumEntities, componentSizes[i]);
+			componentsHeader.size = componentsHeader.capacity;
+		}
+		else if (sparseCapacity == 0) {
+			componentsHeader.createUntyped(maxNumEntities, componentSizes[i]);
+			componentsHeader.size = componentsHeader.capacity;
+		}
+		else {
+			componentsHeader.createUntyped(sparseCapacity, componentSizes[i]);
+		}
 
 		// Create component registry entry
-		componentRegistryEntries[i + 1] = ComponentRegistryEntry::createSized(totalSizeBytes);
+		const uint32_t offsetComponentsHeader = uint32_t(totalSizeBytes);
+		componentRegistryEntries[i + 1] = ComponentRegistryEntry::createSized(uint32_t(totalSizeBytes));
 
 		// Increment total size of ecs system
-		uint32_t componentsSizeBytes = componentsHeader.numBytesNeededForArrayPlusHeader32Byte();
+		uint64_t componentsSizeBytes = arrayPlusHeaderSizeBytes(componentsHeader);
+		if (numFields != 0) {
+			uint32_t fieldOffset = 0;
+			for (uint32_t j = 0; j < numFields; j++) {
+				const uint32_t fieldSize = createInfo.componentFieldLayouts[i].fieldSizes[j];
+				addEntityColumn(componentsHeader, fieldOffset * componentsHeader.capacity, fieldSize);
+				fieldOffset += fieldSize;
+			}
+		}
+		else if (sparseCapacity == 0) {
+			addEntityColumn(componentsHeader, 0, componentsHeader.elementSize);
+		}
 		totalSizeBytes += componentsSizeBytes;
+
+		// Sparse slots and entity ids arrays
+		if (sparseCapacity != 0) {
+			const uint32_t offsetSlotsHeader = uint32_t(totalSizeBytes);
+			addEntityColumn(sparseSlotsHeader, 0, sparseSlotsHeader.elementSize);
+			totalSizeBytes += arrayPlusHeaderSizeBytes(sparseSlotsHeader);
+			ArrayHeader& entityIdsHeader = sparseEntityIdsHeaders[i + 1];
+			entityIdsHeader.create<uint32_t>(sparseCapacity);
+			const uint32_t offsetEntityIdsHeader = uint32_t(totalSizeBytes);
+			totalSizeBytes += arrayPlusHeaderSizeBytes(entityIdsHeader);
+			componentRegistryEntries[i + 1] = ComponentRegistryEntry::createSparse(
+				offsetComponentsHeader, offsetSlotsHeader, offsetEntityIdsHeader);
+		}
+
+		// Structure-of-arrays fields array
+		if (numFields != 0) {
+			fieldsHeaders[i + 1].create<ComponentField>(numFields);
+			const uint32_t offsetFieldsHeader = uint32_t(totalSizeBytes);
+			totalSizeBytes += arrayPlusHeaderSizeBytes(fieldsHeaders[i + 1]);
+			componentRegistryEntries[i + 1] = ComponentRegistryEntry::createSoA(
+				offsetComponentsHeader, offsetFieldsHeader);
+		}
+	}
+
+	// Query registry
+	uint32_t offsetQueryRegistryHeader = uint32_t(totalSizeBytes);
+	ArrayHeader queryRegistryHeader;
+	queryRegistryHeader.create<QueryRegistryEntry>(numQueries);
+	uint64_t queryRegistrySizeBytes = arrayPlusHeaderSizeBytes(queryRegistryHeader);
+	totalSizeBytes += queryRegistrySizeBytes;
+
+	// Query entity id arrays
+	QueryRegistryEntry queryRegistryEntries[64] = {};
+	ArrayHeader queryEntityIdsHeader;
+	queryEntityIdsHeader.create<uint32_t>(maxNumEntities);
+	for (uint32_t i = 0; i < numQueries; i++) {
+
+		// Active bit is always required, an inactive entity can't match a query
+		QueryRegistryEntry& entry = queryRegistryEntries[i];
+		entry.required = createInfo.queries[i].required | ComponentMask::activeMask();
+		entry.excluded = createInfo.queries[i].excluded;
+		sfz_assert((entry.required & entry.excluded) == ComponentMask::empty());
+		entry.offset = uint32_t(totalSizeBytes);
+
+		addEntityColumn(queryEntityIdsHeader, 0, queryEntityIdsHeader.elementSize);
+		totalSizeBytes += arrayPlusHeaderSizeBytes(queryEntityIdsHeader);
+	}
+
+	// Free entity ids bitset (only used with lowest id first allocation policy)
+	uint32_t offsetFreeEntityIdsBitsetHeader = uint32_t(totalSizeBytes);
+	const FreeIdsBitsetLayout bitsetLayout = freeIdsBitsetLayout(maxNumEntities);
+	ArrayHeader freeEntityIdsBitsetHeader;
+	freeEntityIdsBitsetHeader.create<uint64_t>(lowestIdFirst ? bitsetLayout.numWords : 0);
+	freeEntityIdsBitsetHeader.size = freeEntityIdsBitsetHeader.capacity;
+	totalSizeBytes += arrayPlusHeaderSizeBytes(freeEntityIdsBitsetHeader);
+
+	// Dirty bitset (+ 1 for active bit, used for entity bookkeeping)
+	uint32_t offsetDirtyBitsetHeader = uint32_t(totalSizeBytes);
+	const uint32_t dirtyBlockSize = createInfo.dirtyBlockSize;
+	uint32_t numDirtyWordsPerType = 0;
+	if (dirtyBlockSize != 0) {
+		uint32_t numDirtyBlocks = (maxNumEntities + dirtyBlockSize - 1) / dirtyBlockSize;
+		numDirtyWordsPerType = (numDirtyBlocks + 63) / 64;
+	}
+	ArrayHeader dirtyBitsetHeader;
+	dirtyBitsetHeader.create<uint64_t>(numDirtyWordsPerType * (numComponentTypes + 1));
+	dirtyBitsetHeader.size = dirtyBitsetHeader.capacity;
+	totalSizeBytes += arrayPlusHeaderSizeBytes(dirtyBitsetHeader);
+
+	// Change ticks and change block ticks arrays of the change tracked component types
+	const ComponentMask changeTrackedTypes = createInfo.changeTrackedComponentTypes;
+	ArrayHeader changeTicksHeader;
+	changeTicksHeader.create<ComponentChangeTicks>(maxNumEntities);
+	changeTicksHeader.size = changeTicksHeader.capacity;
+	ArrayHeader changeBlockTicksHeader;
+	changeBlockTicksHeader.create<uint32_t>(
+		(maxNumEntities + GAME_STATE_CHANGE_BLOCK_SIZE - 1) / GAME_STATE_CHANGE_BLOCK_SIZE);
+	changeBlockTicksHeader.size = changeBlockTicksHeader.capacity;
+	bool anyChangeTracked = false;
+	for (uint32_t i = 0; i < COMPONENT_MASK_NUM_BITS; i++) {
+		if (!changeTrackedTypes.hasComponentType(i)) continue;
+		sfz_assert(i <= numComponentTypes);
+		if (i > numComponentTypes) continue;
+		componentRegistryEntries[i].offsetChangeTicks = uint32_t(totalSizeBytes);
+		addEntityColumn(changeTicksHeader, 0, changeTicksHeader.elementSize);
+		totalSizeBytes += arrayPlusHeaderSizeBytes(changeTicksHeader);
+		componentRegistryEntries[i].offsetChangeBlockTicks = uint32_t(totalSizeBytes);
+		totalSizeBytes += arrayPlusHeaderSizeBytes(changeBlockTicksHeader);
+		anyChangeTracked = true;
 	}
 
-	// Allocate memory
-	GameStateContainer container = GameStateContainer::createRaw(totalSizeBytes, allocator);
+	// Hash cache (+ 1 for active bit, used for entity bookkeeping)
+	uint32_t offsetHashCacheHeader = uint32_t(totalSizeBytes);
+	ArrayHeader hashCacheHeader;
+	hashCacheHeader.create<uint64_t>(numComponentTypes + 1 + numSingletonStructs);
+	hashCacheHeader.size = hashCacheHeader.capacity;
+	totalSizeBytes += arrayPlusHeaderSizeBytes(hashCacheHeader);
+
+	// External ids and the external id index, the slots array directly follows the control bytes
+	const bool externalIdsEnabled = createInfo.externalIds;
+	uint32_t offsetExternalIdsHeader = uint32_t(totalSizeBytes);
+	ArrayHeader externalIdsHeader;
+	externalIdsHeader.create<uint64_t>(externalIdsEnabled ? maxNumEntities : 0);
+	externalIdsHeader.size = externalIdsHeader.capacity;
+	addEntityColumn(externalIdsHeader, 0, externalIdsHeader.elementSize);
+	totalSizeBytes += arrayPlusHeaderSizeBytes(externalIdsHeader);
+	uint32_t offsetExternalIdIndexHeader = uint32_t(totalSizeBytes);
+	const uint32_t numExternalIdSlots =
+		externalIdsEnabled ? externalIdIndexCapacity(maxNumEntities) : 0;
+	ArrayHeader externalIdControlBytesHeader;
+	externalIdControlBytesHeader.create<uint8_t>(numExternalIdSlots);
+	totalSizeBytes += arrayPlusHeaderSizeBytes(externalIdControlBytesHeader);
+	ArrayHeader externalIdSlotsHeader;
+	externalIdSlotsHeader.create<ExternalIdSlot>(numExternalIdSlots);
+	totalSizeBytes += arrayPlusHeaderSizeBytes(externalIdSlotsHeader);
+
+	// Event queue registry
+	uint32_t offsetEventQueueRegistryHeader = uint32_t(totalSizeBytes);
+	ArrayHeader eventQueueRegistryHeader;
+	eventQueueRegistryHeader.create<EventQueueRegistryEntry>(numEventQueues);
+	totalSizeBytes += arrayPlusHeaderSizeBytes(eventQueueRegistryHeader);
+
+	// Event queue events arrays
+	EventQueueRegistryEntry eventQueueRegistryEntries[64] = {};
+	ArrayHeader eventQueueHeaders[64] = {};
+	for (uint32_t i = 0; i < numEventQueues; i++) {
+		const EventQueueDesc& desc = createInfo.eventQueues[i];
+		sfz_assert(desc.eventSize != 0);
+		eventQueueHeaders[i].createUntyped(desc.capacity, desc.eventSize);
+		eventQueueRegistryEntries[i].offset = uint32_t(totalSizeBytes);
+		totalSizeBytes += arrayPlusHeaderSizeBytes(eventQueueHeaders[i]);
+	}
+
+	// All offsets in the state are 32-bit
+	if (totalSizeBytes > uint64_t(UINT32_MAX)) return GameStateContainer();
+
+	// Allocate memory, growable game states only reserve it
+	GameStateContainer container = growable ?
+		GameStateContainer::createReserved(totalSizeBytes) :
+		GameStateContainer::createRaw(totalSizeBytes, allocator);
+	if (container.getHeader() == nullptr) return container;
 	GameStateHeader* state = container.getHeader();
 
+	// Commit everything in a growable game state except the uncommitted ranges of the entity
+	// indexed arrays, which are the entire arrays to begin with (see GameStateUncommittedRanges).
+	// The entity indexed arrays are committed as the entity high-water mark grows.
+	if (growable) {
+		uint8_t* memory = reinterpret_cast<uint8_t*>(state);
+		uint64_t commitCursor = 0;
+		for (const EntityColumn& column : entityColumns) {
+			const uint64_t begin = (uint64_t(column.offsetBytes) + GAME_STATE_COMMIT_PAGE_SIZE - 1) &
+				~uint64_t(GAME_STATE_COMMIT_PAGE_SIZE - 1);
+			const uint64_t end = (column.offsetBytes + uint64_t(column.capacity) * column.elementSize) &
+				~uint64_t(GAME_STATE_COMMIT_PAGE_SIZE - 1);
+			if (begin >= end) continue;
+			commitReservedMemory(memory + commitCursor, begin - commitCursor);
+			commitCursor = end;
+		}
+		commitReservedMemory(memory + commitCursor, totalSizeBytes - commitCursor);
+	}
+
 	// Set game state header
 	state->magicNumber = GAME_STATE_MAGIC_NUMBER;
 	state->gameStateVersion = GAME_STATE_VERSION;
@@ -445,9 +2724,26 @@ GameStateContainer createGameState(
 	state->currentNumEntities = 0;
 	state->offsetSingletonRegistry = sizeof(GameStateHeader);
 	state->offsetComponentRegistry = offsetComponentRegistryHeader;
-	state->offsetFreeEntityIdsList = state->offsetComponentRegistry + componentRegistrySizeBytes;
-	state->offsetComponentMasks = state->offsetFreeEntityIdsList + freeEntityIdsSizeBytes;
-	state->offsetEntityGenerationsList = state->offsetComponentMasks + masksSizeBytes;
+	state->offsetFreeEntityIdsList = state->offsetComponentRegistry + uint32_t(componentRegistrySizeBytes);
+	state->offsetComponentMasks = state->offsetFreeEntityIdsList + uint32_t(freeEntityIdsSizeBytes);
+	state->offsetEntityGenerationsList = state->offsetComponentMasks + uint32_t(masksSizeBytes);
+	state->numQueries = numQueries;
+	state->offsetQueryRegistry = offsetQueryRegistryHeader;
+	state->entityAllocationPolicy = createInfo.entityAllocationPolicy;
+	state->offsetFreeEntityIdsBitset = offsetFreeEntityIdsBitsetHeader;
+	state->entityHighWaterMark = 0;
+	state->dirtyBlockSize = dirtyBlockSize;
+	state->offsetDirtyBitset = offsetDirtyBitsetHeader;
+	state->dirtySingletons = 0;
+	state->offsetHashCache = offsetHashCacheHeader;
+	state->componentMaskNumBits = COMPONENT_MASK_NUM_BITS;
+	state->changeTick = anyChangeTracked ? 1 : 0;
+	state->committedNumEntities = growable ? 0 : maxNumEntities;
+	state->offsetExternalIds = offsetExternalIdsHeader;
+	state->offsetExternalIdIndex = offsetExternalIdIndexHeader;
+	state->nextExternalId = externalIdsEnabled ? 1 : 0;
+	state->numEventQueues = numEventQueues;
+	state->offsetEventQueueRegistry = offsetEventQueueRegistryHeader;
 
 	// Set singleton registry array header
 	state->singletonRegistryArray()->createCopy(singletonRegistryHeader);
@@ -474,10 +2770,38 @@ GameStateContainer createGameState(
 	// Set free entity ids header and fill list with free entity ids
 	ArrayHeader* freeEntityIds = state->freeEntityIdsListArray();
 	freeEntityIds->createCopy(freeEntityIdsHeader);
-	for (int64_t entityId = int64_t(maxNumEntities - 1); entityId >= 0; entityId--) {
+	for (int64_t entityId = int64_t(freeEntityIds->capacity) - 1; entityId >= 0; entityId--) {
 		freeEntityIds->add<uint32_t>(uint32_t(entityId));
 	}
 
+	// Set free entity ids bitset header and mark all entity ids as free
+	ArrayHeader* freeEntityIdsBitset = state->freeEntityIdsBitsetArray();
+	freeEntityIdsBitset->createCopy(freeEntityIdsBitsetHeader);
+	if (lowestIdFirst) freeIdsBitsetSetAll(freeEntityIdsBitset->data<uint64_t>(), bitsetLayout);
+
+	// Set dirty bitset header, everything starts out clean
+	state->dirtyBitsetArray()->createCopy(dirtyBitsetHeader);
+	state->dirtyBitsetArray()->size = dirtyBitsetHeader.capacity;
+
+	// Set hash cache header, nothing is cached to begin with
+	state->hashCacheArray()->createCopy(hashCacheHeader);
+	state->hashCacheArray()->size = hashCacheHeader.capacity;
+
+	// Set external ids and external id index headers, no entity has an external id yet
+	state->externalIdsArray()->createCopy(externalIdsHeader);
+	state->externalIdsArray()->size = externalIdsHeader.capacity;
+	state->externalIdIndexArray()->createCopy(externalIdControlBytesHeader);
+	state->externalIdSlotsArray()->createCopy(externalIdSlotsHeader);
+
+	// Set event queue registry and event queue headers, all queues start out empty
+	state->eventQueueRegistryArray()->createCopy(eventQueueRegistryHeader);
+	state->eventQueueRegistryArray()->size = eventQueueRegistryHeader.capacity;
+	for (uint32_t i = 0; i < numEventQueues; i++) {
+		state->eventQueueRegistryArray()->at<EventQueueRegistryEntry>(i) =
+			eventQueueRegistryEntries[i];
+		state->arrayAt(eventQueueRegistryEntries[i].offset)->createCopy(eventQueueHeaders[i]);
+	}
+
 	// Set component masks header
 	state->componentMasksArray()->createCopy(masksHeader);
 	state->componentMasksArray()->size = masksHeader.capacity;
@@ -495,6 +2819,455 @@ GameStateContainer createGameState(
 		if (!componentsRegistry[i].componentTypeHasData()) continue;
 		ArrayHeader* header = state->arrayAt(componentsRegistry[i].offset);
 		header->createCopy(componentsArrayHeaders[i]);
+		header->size = componentsArrayHeaders[i].size;
+
+		// Set fields array header and fill it with the field offsets
+		if (componentsRegistry[i].componentTypeIsSoA()) {
+			ArrayHeader* fields = state->arrayAt(componentsRegistry[i].offsetFields);
+			fields->createCopy(fieldsHeaders[i]);
+			const ComponentFieldLayout& layout = createInfo.componentFieldLayouts[i - 1];
+			uint32_t fieldOffset = 0;
+			for (uint32_t j = 0; j < layout.numFields; j++) {
+				sfz_assert(layout.fieldSizes[j] != 0);
+				fields->add(ComponentField{ fieldOffset, layout.fieldSizes[j] });
+				fieldOffset += layout.fieldSizes[j];
+			}
+			sfz_assert(fieldOffset == header->elementSize);
+		}
+
+		// Set sparse arrays headers, no entity has a slot to begin with
+		if (!componentsRegistry[i].componentTypeIsSparse()) continue;
+		ArrayHeader* slots = state->arrayAt(componentsRegistry[i].offsetSparseSlots);
+		slots->createCopy(sparseSlotsHeader);
+		slots->size = sparseSlotsHeader.capacity;
+		for (uint32_t j = 0; j < state->committedNumEntities; j++) slots->at<uint32_t>(j) = ~0u;
+		state->arrayAt(componentsRegistry[i].offsetSparseEntityIds)
+			->createCopy(sparseEntityIdsHeaders[i]);
+	}
+
+	// Set change ticks array headers, nothing has changed yet (tick 0)
+	for (uint32_t i = 0; i < state->numComponentTypes; i++) {
+		if (!componentsRegistry[i].componentTypeIsChangeTracked()) continue;
+		ArrayHeader* changeTicks = state->arrayAt(componentsRegistry[i].offsetChangeTicks);
+		changeTicks->createCopy(changeTicksHeader);
+		changeTicks->size = changeTicksHeader.size;
+		ArrayHeader* changeBlockTicks = state->arrayAt(componentsRegistry[i].offsetChangeBlockTicks);
+		changeBlockTicks->createCopy(changeBlockTicksHeader);
+		changeBlockTicks->size = changeBlockTicksHeader.size;
+	}
+
+	// Set query registry array header
+	state->queryRegistryArray()->createCopy(queryRegistryHeader);
+	state->queryRegistryArray()->size = queryRegistryHeader.capacity;
+
+	// Fill query registry and set query entity id array headers. No entities exist yet, so all
+	// lists of matching entities start out empty.
+	QueryRegistryEntry* queryRegistry = state->queryRegistryArray()->data<QueryRegistryEntry>();
+	for (uint32_t i = 0; i < state->numQueries; i++) {
+		queryRegistry[i] = queryRegistryEntries[i];
+		state->arrayAt(queryRegistry[i].offset)->createCopy(queryEntityIdsHeader);
+	}
+
+	return container;
+}
+
+GameStateContainer createGameState(
+	uint32_t numSingletonStructs,
+	const uint32_t* singletonStructSizes,
+	uint32_t maxNumEntities,
+	uint32_t numComponentTypes,
+	const uint32_t* componentSizes,
+	Allocator* allocator) noexcept
+{
+	GameStateCreateInfo createInfo;
+	createInfo.numSingletonStructs = numSingletonStructs;
+	createInfo.singletonStructSizes = singletonStructSizes;
+	createInfo.maxNumEntities = maxNumEntities;
+	createInfo.numComponentTypes = numComponentTypes;
+	createInfo.componentSizes = componentSizes;
+	return createGameState(createInfo, allocator);
+}
+
+void commitGameStateMemory(uint8_t* memory, const GameStateHeader* state) noexcept
+{
+	forEachGameStateRange(state, [&](GameStateByteRange range, bool committed) {
+		if (committed) commitReservedMemory(memory + range.offsetBytes, range.sizeBytes);
+	});
+}
+
+void setCommittedNumEntities(GameStateHeader* state, uint32_t numEntities) noexcept
+{
+	sfz_assert(numEntities <= state->maxNumEntities);
+	const uint32_t numCommitted = state->committedNumEntities;
+	if (numEntities > numCommitted) commitEntityIdRange(state, numCommitted, numEntities);
+	else if (numEntities < numCommitted) zeroEntityIdRange(state, numEntities, numCommitted);
+	state->committedNumEntities = numEntities;
+}
+
+// Game state file functions
+// ------------------------------------------------------------------------------------------------
+
+// Checks that an ArrayHeader at the given offset is 32-byte aligned and fits inside the state, i.e.
+// that it is safe to read the header itself
+static bool arrayHeaderInBounds(uint64_t numBytes, uint32_t offset) noexcept
+{
+	if ((offset & 0x1F) != 0) return false;
+	return (uint64_t(offset) + sizeof(ArrayHeader)) <= numBytes;
+}
+
+// Checks that the ArrayHeader at the given offset is 32-byte aligned, has the expected element
+// size and fits inside the state
+static bool arrayIsValid(
+	const GameStateHeader* state,
+	uint64_t numBytes,
+	uint32_t offset,
+	uint32_t expectedElementSize) noexcept
+{
+	if (!arrayHeaderInBounds(numBytes, offset)) return false;
+	const ArrayHeader* array = state->arrayAt(offset);
+	if (array->elementSize != expectedElementSize) return false;
+	if (array->size > array->capacity) return false;
+	uint64_t end =
+		uint64_t(offset) + sizeof(ArrayHeader) + uint64_t(array->capacity) * array->elementSize;
+	return end <= numBytes;
+}
+
+bool validateGameState(const GameStateHeader* state, uint64_t numBytes) noexcept
+{
+	if (state == nullptr || numBytes < sizeof(GameStateHeader)) return false;
+	if (state->magicNumber != GAME_STATE_MAGIC_NUMBER) return false;
+	if (state->gameStateVersion != GAME_STATE_VERSION) return false;
+	if (state->stateSizeBytes != numBytes) return false;
+
+	// Counts
+	const uint32_t maxNumEntities = state->maxNumEntities;
+	if (state->numSingletons > 64) return false;
+	if (state->componentMaskNumBits != COMPONENT_MASK_NUM_BITS) return false;
+	if (state->numComponentTypes == 0) return false;
+	if (state->numComponentTypes > COMPONENT_MASK_NUM_BITS) return false;
+	if (maxNumEntities > GAME_STATE_ECS_MAX_NUM_ENTITIES) return false;
+	if (state->currentNumEntities > maxNumEntities) return false;
+	if (state->entityHighWaterMark > maxNumEntities) return false;
+	if (state->committedNumEntities > maxNumEntities) return false;
+	if (state->entityHighWaterMark > state->committedNumEntities) return false;
+	if (state->numQueries > 64) return false;
+	const bool lowestIdFirst =
+		state->entityAllocationPolicy == EntityAllocationPolicy::LOWEST_ID_FIRST;
+	if (!lowestIdFirst && state->entityAllocationPolicy != EntityAllocationPolicy::LIFO) return false;
+
+	// Singleton registry
+	if (!arrayIsValid(state, numBytes, state->offsetSingletonRegistry,
+		sizeof(SingletonRegistryEntry))) return false;
+	const ArrayHeader* singletonRegistry = state->singletonRegistryArray();
+	if (singletonRegistry->size != state->numSingletons) return false;
+	for (uint32_t i = 0; i < state->numSingletons; i++) {
+		const SingletonRegistryEntry& entry = singletonRegistry->at<SingletonRegistryEntry>(i);
+		if ((uint64_t(entry.offset) + entry.sizeInBytes) > numBytes) return false;
+	}
+
+	// Component registry
+	if (!arrayIsValid(state, numBytes, state->offsetComponentRegistry,
+		sizeof(ComponentRegistryEntry))) return false;
+	const ArrayHeader* componentRegistry = state->componentRegistryArray();
+	if (componentRegistry->size != state->numComponentTypes) return false;
+	const ComponentRegistryEntry* componentEntries =
+		componentRegistry->data<ComponentRegistryEntry>();
+	if (componentEntries[0].componentTypeHasData()) return false;
+	if (componentEntries[0].componentTypeIsSparse()) return false;
+	if (componentEntries[0].componentTypeIsSoA()) return false;
+	for (uint32_t i = 1; i < state->numComponentTypes; i++) {
+		const ComponentRegistryEntry& entry = componentEntries[i];
+		if (!entry.componentTypeHasData()) {
+			if (entry.componentTypeIsSparse()) return false;
+			if (entry.componentTypeIsSoA()) return false;
+			continue;
+		}
+		uint32_t offset = entry.offset;
+		if (!arrayHeaderInBounds(numBytes, offset)) return false;
+		uint32_t componentSize = state->arrayAt(offset)->elementSize;
+		if (componentSize == 0) return false;
+		if (!arrayIsValid(state, numBytes, offset, componentSize)) return false;
+		const ArrayHeader* components = state->arrayAt(offset);
+
+		// Structure-of-arrays, the fields must partition the component
+		if (entry.componentTypeIsSoA()) {
+			if (entry.componentTypeIsSparse()) return false;
+			if ((components->capacity % GAME_STATE_SOA_COLUMN_ALIGNMENT) != 0) return false;
+			if (components->capacity < maxNumEntities) return false;
+			if ((components->capacity - maxNumEntities) >= GAME_STATE_SOA_COLUMN_ALIGNMENT) {
+				return false;
+			}
+			if (!arrayIsValid(state, numBytes, entry.offsetFields, sizeof(ComponentField))) {
+				return false;
+			}
+			const ArrayHeader* fields = state->arrayAt(entry.offsetFields);
+			if (fields->size == 0) return false;
+			uint32_t fieldOffset = 0;
+			for (uint32_t j = 0; j < fields->size; j++) {
+				const ComponentField& field = fields->at<ComponentField>(j);
+				if (field.offset != fieldOffset || field.sizeInBytes == 0) return false;
+				if (field.sizeInBytes > componentSize - fieldOffset) return false;
+				fieldOffset += field.sizeInBytes;
+			}
+			if (fieldOffset != componentSize) return false;
+			continue;
+		}
+
+		if (!entry.componentTypeIsSparse()) {
+			if (components->capacity != maxNumEntities) return false;
+			continue;
+		}
+
+		// Sparse set
+		if (components->capacity > maxNumEntities) return false;
+		if (!arrayIsValid(state, numBytes, entry.offsetSparseSlots, sizeof(uint32_t))) return false;
+		if (!arrayIsValid(state, numBytes, entry.offsetSparseEntityIds, sizeof(uint32_t))) {
+			return false;
+		}
+		const ArrayHeader* slots = state->arrayAt(entry.offsetSparseSlots);
+		const ArrayHeader* entityIds = state->arrayAt(entry.offsetSparseEntityIds);
+		if (slots->capacity != maxNumEntities) return false;
+		if (entityIds->capacity != components->capacity) return false;
+		if (entityIds->size != components->size) return false;
+	}
+
+	// Entity bookkeeping
+	if (!arrayIsValid(state, numBytes, state->offsetComponentMasks, sizeof(ComponentMask))) {
+		return false;
+	}
+	if (!arrayIsValid(state, numBytes, state->offsetEntityGenerationsList, sizeof(uint8_t))) {
+		return false;
+	}
+	if (state->componentMasksArray()->capacity != maxNumEntities) return false;
+	if (state->entityGenerationsListArray()->capacity != maxNumEntities) return false;
+	if (!arrayIsValid(state, numBytes, state->offsetFreeEntityIdsList, sizeof(uint32_t))) {
+		return false;
+	}
+	if (!arrayIsValid(state, numBytes, state->offsetFreeEntityIdsBitset, sizeof(uint64_t))) {
+		return false;
+	}
+	const uint32_t expectedFreeListCapacity = lowestIdFirst ? 0 : maxNumEntities;
+	const uint32_t expectedBitsetCapacity =
+		lowestIdFirst ? freeIdsBitsetLayout(maxNumEntities).numWords : 0;
+	if (state->freeEntityIdsListArray()->capacity != expectedFreeListCapacity) return false;
+	if (state->freeEntityIdsBitsetArray()->capacity != expectedBitsetCapacity) return false;
+
+	// Queries
+	if (!arrayIsValid(state, numBytes, state->offsetQueryRegistry, sizeof(QueryRegistryEntry))) {
+		return false;
+	}
+	const ArrayHeader* queryRegistry = state->queryRegistryArray();
+	if (queryRegistry->size != state->numQueries) return false;
+	for (uint32_t i = 0; i < state->numQueries; i++) {
+		const QueryRegistryEntry& entry = queryRegistry->at<QueryRegistryEntry>(i);
+		if (!arrayIsValid(state, numBytes, entry.offset, sizeof(uint32_t))) return false;
+		if (state->arrayAt(entry.offset)->capacity != maxNumEntities) return false;
+	}
+
+	// Dirty bitset
+	if (!arrayIsValid(state, numBytes, state->offsetDirtyBitset, sizeof(uint64_t))) return false;
+	const uint32_t numDirtyWordsPerType = (state->numDirtyBlocks() + 63) / 64;
+	const uint32_t expectedDirtyCapacity = numDirtyWordsPerType * state->numComponentTypes;
+	if (state->dirtyBitsetArray()->capacity != expectedDirtyCapacity) return false;
+
+	// Change tracking
+	bool anyChangeTracked = false;
+	for (uint32_t i = 0; i < state->numComponentTypes; i++) {
+		const ComponentRegistryEntry& entry = componentEntries[i];
+		if (!entry.componentTypeIsChangeTracked()) {
+			if (entry.offsetChangeBlockTicks != ~0u) return false;
+			continue;
+		}
+		if (!arrayIsValid(state, numBytes, entry.offsetChangeTicks, sizeof(ComponentChangeTicks))) {
+			return false;
+		}
+		if (!arrayIsValid(state, numBytes, entry.offsetChangeBlockTicks, sizeof(uint32_t))) {
+			return false;
+		}
+		const ArrayHeader* changeTicks = state->arrayAt(entry.offsetChangeTicks);
+		const ArrayHeader* changeBlockTicks = state->arrayAt(entry.offsetChangeBlockTicks);
+		if (changeTicks->capacity != maxNumEntities) return false;
+		if (changeTicks->size != maxNumEntities) return false;
+		const uint32_t expectedNumBlocks =
+			(maxNumEntities + GAME_STATE_CHANGE_BLOCK_SIZE - 1) / GAME_STATE_CHANGE_BLOCK_SIZE;
+		if (changeBlockTicks->capacity != expectedNumBlocks) return false;
+		if (changeBlockTicks->size != expectedNumBlocks) return false;
+		anyChangeTracked = true;
+	}
+	if (anyChangeTracked != (state->changeTick != 0)) return false;
+
+	// Hash cache
+	if (!arrayIsValid(state, numBytes, state->offsetHashCache, sizeof(uint64_t))) return false;
+	const uint32_t expectedHashCacheCapacity = state->numComponentTypes + state->numSingletons;
+	if (state->hashCacheArray()->capacity != expectedHashCacheCapacity) return false;
+
+	// External ids and external id index
+	const bool externalIdsEnabled = state->externalIdsEnabled();
+	if (!arrayIsValid(state, numBytes, state->offsetExternalIds, sizeof(uint64_t))) return false;
+	const ArrayHeader* externalIds = state->externalIdsArray();
+	if (externalIds->capacity != (externalIdsEnabled ? maxNumEntities : 0)) return false;
+	if (externalIds->size != externalIds->capacity) return false;
+	if (!arrayIsValid(state, numBytes, state->offsetExternalIdIndex, sizeof(uint8_t))) return false;
+	const ArrayHeader* externalIdControlBytes = state->externalIdIndexArray();
+	const uint32_t expectedNumExternalIdSlots =
+		externalIdsEnabled ? externalIdIndexCapacity(maxNumEntities) : 0;
+	if (externalIdControlBytes->capacity != expectedNumExternalIdSlots) return false;
+	const uint32_t offsetExternalIdSlots = state->offsetExternalIdIndex +
+		externalIdControlBytes->numBytesNeededForArrayPlusHeader32Byte();
+	if (!arrayIsValid(state, numBytes, offsetExternalIdSlots, sizeof(ExternalIdSlot))) return false;
+	const ArrayHeader* externalIdSlots = state->externalIdSlotsArray();
+	if (externalIdSlots->capacity != expectedNumExternalIdSlots) return false;
+	if (externalIdSlots->size > externalIdControlBytes->size) return false;
+	if (externalIdControlBytes->size > externalIdIndexMaxNumUsed(expectedNumExternalIdSlots)) {
+		return false;
+	}
+
+	// Event queues
+	if (state->numEventQueues > 64) return false;
+	if (!arrayIsValid(state, numBytes, state->offsetEventQueueRegistry,
+		sizeof(EventQueueRegistryEntry))) {
+		return false;
+	}
+	const ArrayHeader* eventQueueRegistry = state->eventQueueRegistryArray();
+	if (eventQueueRegistry->size != state->numEventQueues) return false;
+	for (uint32_t i = 0; i < state->numEventQueues; i++) {
+		const uint32_t offset = eventQueueRegistry->at<EventQueueRegistryEntry>(i).offset;
+		if (!arrayHeaderInBounds(numBytes, offset)) return false;
+		const uint32_t eventSize = state->arrayAt(offset)->elementSize;
+		if (eventSize == 0) return false;
+		if (!arrayIsValid(state, numBytes, offset, eventSize)) return false;
+	}
+
+	return true;
+}
+
+bool gameStateLayoutsMatch(const GameStateHeader* lhs, const GameStateHeader* rhs) noexcept
+{
+	// Header fields determining the layout
+	if (lhs->stateSizeBytes != rhs->stateSizeBytes) return false;
+	if (lhs->numSingletons != rhs->numSingletons) return false;
+	if (lhs->numComponentTypes != rhs->numComponentTypes) return false;
+	if (lhs->maxNumEntities != rhs->maxNumEntities) return false;
+	if (lhs->offsetSingletonRegistry != rhs->offsetSingletonRegistry) return false;
+	if (lhs->offsetComponentRegistry != rhs->offsetComponentRegistry) return false;
+	if (lhs->offsetFreeEntityIdsList != rhs->offsetFreeEntityIdsList) return false;
+	if (lhs->offsetComponentMasks != rhs->offsetComponentMasks) return false;
+	if (lhs->offsetEntityGenerationsList != rhs->offsetEntityGenerationsList) return false;
+	if (lhs->numQueries != rhs->numQueries) return false;
+	if (lhs->offsetQueryRegistry != rhs->offsetQueryRegistry) return false;
+	if (lhs->entityAllocationPolicy != rhs->entityAllocationPolicy) return false;
+	if (lhs->offsetFreeEntityIdsBitset != rhs->offsetFreeEntityIdsBitset) return false;
+	if (lhs->dirtyBlockSize != rhs->dirtyBlockSize) return false;
+	if (lhs->offsetDirtyBitset != rhs->offsetDirtyBitset) return false;
+	if (lhs->offsetHashCache != rhs->offsetHashCache) return false;
+	if (lhs->componentMaskNumBits != rhs->componentMaskNumBits) return false;
+	if (lhs->offsetExternalIds != rhs->offsetExternalIds) return false;
+	if (lhs->offsetExternalIdIndex != rhs->offsetExternalIdIndex) return false;
+	if (lhs->externalIdsEnabled() != rhs->externalIdsEnabled()) return false;
+	if (lhs->numEventQueues != rhs->numEventQueues) return false;
+	if (lhs->offsetEventQueueRegistry != rhs->offsetEventQueueRegistry) return false;
+
+	// Registries, which contain the sizes of all singletons and components and the queries
+	auto registriesMatch = [](const ArrayHeader* lhsArray, const ArrayHeader* rhsArray) {
+		if (lhsArray->size != rhsArray->size) return false;
+		uint32_t numBytes = lhsArray->size * lhsArray->elementSize;
+		return memcmp(lhsArray->dataUntyped(), rhsArray->dataUntyped(), numBytes) == 0;
+	};
+	if (!registriesMatch(lhs->singletonRegistryArray(), rhs->singletonRegistryArray())) {
+		return false;
+	}
+	if (!registriesMatch(lhs->componentRegistryArray(), rhs->componentRegistryArray())) {
+		return false;
+	}
+	if (!registriesMatch(lhs->queryRegistryArray(), rhs->queryRegistryArray())) return false;
+	for (uint32_t i = 1; i < lhs->numComponentTypes; i++) {
+		uint32_t componentSizeLhs = 0;
+		uint32_t componentSizeRhs = 0;
+		lhs->componentsUntyped(i, componentSizeLhs);
+		rhs->componentsUntyped(i, componentSizeRhs);
+		if (componentSizeLhs != componentSizeRhs) return false;
+		if (componentSizeLhs == 0) continue;
+		const ComponentRegistryEntry entry = registryEntry(lhs, i);
+		if (lhs->arrayAt(entry.offset)->capacity != rhs->arrayAt(entry.offset)->capacity) {
+			return false;
+		}
+		if (entry.componentTypeIsSoA() &&
+			!registriesMatch(lhs->arrayAt(entry.offsetFields), rhs->arrayAt(entry.offsetFields))) {
+			return false;
+		}
+	}
+
+	// Event queues, the registries can't be compared directly since they contain the number of
+	// dropped events
+	for (uint32_t i = 0; i < lhs->numEventQueues; i++) {
+		const uint32_t offsetLhs =
+			lhs->eventQueueRegistryArray()->at<EventQueueRegistryEntry>(i).offset;
+		const uint32_t offsetRhs =
+			rhs->eventQueueRegistryArray()->at<EventQueueRegistryEntry>(i).offset;
+		if (offsetLhs != offsetRhs) return false;
+		const ArrayHeader* eventsLhs = lhs->arrayAt(offsetLhs);
+		const ArrayHeader* eventsRhs = rhs->arrayAt(offsetRhs);
+		if (eventsLhs->elementSize != eventsRhs->elementSize) return false;
+		if (eventsLhs->capacity != eventsRhs->capacity) return false;
+	}
+	return true;
+}
+
+bool saveGameState(const GameStateHeader* state, const char* path) noexcept
+{
+	sfz_assert(state != nullptr);
+	sfz_assert(path != nullptr);
+	const uint8_t* statePtr = reinterpret_cast<const uint8_t*>(state);
+	if (state->committedNumEntities == state->maxNumEntities) {
+		return sfz::writeBinaryFile(path, statePtr, size_t(state->stateSizeBytes));
+	}
+
+	// The uncommitted ranges of a growable game state are written as zeroes without reading them
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr) return false;
+	static const uint8_t ZERO_PAGE[GAME_STATE_COMMIT_PAGE_SIZE] = {};
+	bool success = true;
+	forEachGameStateRange(state, [&](GameStateByteRange range, bool committed) {
+		if (committed) {
+			success = success &&
+				fwrite(statePtr + range.offsetBytes, 1, range.sizeBytes, file) == range.sizeBytes;
+			return;
+		}
+		for (uint32_t i = 0; i < range.sizeBytes; i += GAME_STATE_COMMIT_PAGE_SIZE) {
+			success = success &&
+				fwrite(ZERO_PAGE, 1, GAME_STATE_COMMIT_PAGE_SIZE, file) == GAME_STATE_COMMIT_PAGE_SIZE;
+		}
+	});
+	success = fclose(file) == 0 && success;
+	return success;
+}
+
+GameStateContainer mapGameState(
+	const char* path,
+	GameStateMapMode mode,
+	const GameStateHeader* expectedLayout) noexcept
+{
+	GameStateContainer container = GameStateContainer::mapFile(path, mode);
+	if (container.getHeader() == nullptr) {
+		SFZ_ERROR("PhantasyEngine", "Could not map game state file \"%s\"", path);
+		return GameStateContainer();
+	}
+
+	const GameStateHeader* state = container.getHeader();
+	if (container.numBytes() >= sizeof(GameStateHeader) &&
+		state->magicNumber == GAME_STATE_MAGIC_NUMBER &&
+		state->gameStateVersion != GAME_STATE_VERSION) {
+		SFZ_ERROR("PhantasyEngine", "Game state \"%s\" has version %llu, expected %llu", path,
+			(unsigned long long)state->gameStateVersion, (unsigned long long)GAME_STATE_VERSION);
+		return GameStateContainer();
+	}
+	if (!validateGameState(state, container.numBytes())) {
+		SFZ_ERROR("PhantasyEngine", "\"%s\" is not a valid game state", path);
+		return GameStateContainer();
+	}
+	if (expectedLayout != nullptr && !gameStateLayoutsMatch(state, expectedLayout)) {
+		SFZ_ERROR("PhantasyEngine", "Game state \"%s\" does not have the expected layout", path);
+		return GameStateContainer();
 	}
 
 	return container;
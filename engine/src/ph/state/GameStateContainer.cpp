@@ -24,8 +24,112 @@
 
 #include <sfz/Assert.hpp>
 
+#include "ph/state/GameState.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace ph {
 
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+// Maps the entire file into memory, returns nullptr on failure
+static uint8_t* mapFileToMemory(
+	const char* path, GameStateMapMode mode, uint64_t& numBytesOut) noexcept
+{
+	numBytesOut = 0;
+	const bool readOnly = mode == GameStateMapMode::READ_ONLY;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+	LARGE_INTEGER fileSize = {};
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0) {
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	// A read-only file mapping can still be mapped as a copy-on-write view. The view keeps the
+	// mapping and the file open, so the handles can be closed immediately.
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void* ptr = nullptr;
+	if (mapping != nullptr) {
+		ptr = MapViewOfFile(mapping, readOnly ? FILE_MAP_READ : FILE_MAP_COPY, 0, 0, 0);
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+	if (ptr == nullptr) return nullptr;
+
+	numBytesOut = uint64_t(fileSize.QuadPart);
+	return static_cast<uint8_t*>(ptr);
+
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return nullptr;
+
+	struct stat fileStat = {};
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	// The mapping keeps its own reference to the file, so it can be closed immediately
+	const int prot = readOnly ? PROT_READ : (PROT_READ | PROT_WRITE);
+	void* ptr = mmap(nullptr, size_t(fileStat.st_size), prot, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED) return nullptr;
+
+	numBytesOut = uint64_t(fileStat.st_size);
+	return static_cast<uint8_t*>(ptr);
+#endif
+}
+
+static void unmapFileFromMemory(uint8_t* ptr, uint64_t numBytes) noexcept
+{
+#ifdef _WIN32
+	(void)numBytes;
+	UnmapViewOfFile(ptr);
+#else
+	munmap(ptr, size_t(numBytes));
+#endif
+}
+
+// Reserves zero initialized virtual memory, returns nullptr on failure. On Windows the pages must
+// be committed with commitReservedMemory() before they are accessed.
+static uint8_t* reserveMemory(uint64_t numBytes) noexcept
+{
+#ifdef _WIN32
+	void* ptr = VirtualAlloc(nullptr, size_t(numBytes), MEM_RESERVE, PAGE_READWRITE);
+	return static_cast<uint8_t*>(ptr);
+#else
+	void* ptr = mmap(nullptr, size_t(numBytes), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (ptr == MAP_FAILED) return nullptr;
+	return static_cast<uint8_t*>(ptr);
+#endif
+}
+
+static void releaseMemory(uint8_t* ptr, uint64_t numBytes) noexcept
+{
+#ifdef _WIN32
+	(void)numBytes;
+	VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+	munmap(ptr, size_t(numBytes));
+#endif
+}
+
 // GameStateContainer: Constructors & destructors
 // ------------------------------------------------------------------------------------------------
 
@@ -38,11 +142,33 @@ namespace ph {
 	GameStateContainer container;
 	container.mAllocator = allocator;
 	container.mNumBytes = numBytes;
-	container.mGameStateMemoryChunk = static_cast<uint8_t*>(allocator->allocate(sfz_dbg(""), numBytes, 16));
+	container.mGameStateMemoryChunk = static_cast<uint8_t*>(allocator->allocate(sfz_dbg(""), numBytes, 32));
 	memset(container.mGameStateMemoryChunk, 0, numBytes);
 	return container;
 }
 
+GameStateContainer GameStateContainer::mapFile(const char* path, GameStateMapMode mode) noexcept
+{
+	sfz_assert(path != nullptr);
+
+	GameStateContainer container;
+	container.mGameStateMemoryChunk = mapFileToMemory(path, mode, container.mNumBytes);
+	container.mIsMapped = container.mGameStateMemoryChunk != nullptr;
+	return container;
+}
+
+GameStateContainer GameStateContainer::createReserved(uint64_t numBytes) noexcept
+{
+	sfz_assert(0 < numBytes);
+
+	GameStateContainer container;
+	container.mGameStateMemoryChunk = reserveMemory(numBytes);
+	if (container.mGameStateMemoryChunk == nullptr) return container;
+	container.mNumBytes = numBytes;
+	container.mIsReserved = true;
+	return container;
+}
+
 // GameStateContainer: State methods
 // ------------------------------------------------------------------------------------------------
 
@@ -51,7 +177,21 @@ void GameStateContainer::cloneTo(GameStateContainer& state) noexcept
 	sfz_assert(state.mGameStateMemoryChunk != nullptr);
 	sfz_assert(this->mNumBytes == state.mNumBytes);
 
-	std::memcpy(state.mGameStateMemoryChunk, this->mGameStateMemoryChunk, this->mNumBytes);
+	// Only the committed memory of a growable game state is copied (see
+	// GameStateUncommittedRanges), the rest is zero. A reserved target first commits what it needs
+	// and zeroes what it has beyond that, any other target is zeroed directly.
+	const GameStateHeader* src = this->getHeader();
+	if (state.mIsReserved) setCommittedNumEntities(state.getHeader(), src->committedNumEntities);
+	uint8_t* dstPtr = state.mGameStateMemoryChunk;
+	const uint8_t* srcPtr = this->mGameStateMemoryChunk;
+	forEachGameStateRange(src, [&](GameStateByteRange range, bool committed) {
+		if (committed) {
+			std::memcpy(dstPtr + range.offsetBytes, srcPtr + range.offsetBytes, range.sizeBytes);
+		}
+		else if (!state.mIsReserved) {
+			std::memset(dstPtr + range.offsetBytes, 0, range.sizeBytes);
+		}
+	});
 }
 
 GameStateContainer GameStateContainer::clone(Allocator* allocator) noexcept
@@ -73,16 +213,26 @@ void GameStateContainer::swap(GameStateContainer& other) noexcept
 	std::swap(this->mAllocator, other.mAllocator);
 	std::swap(this->mGameStateMemoryChunk, other.mGameStateMemoryChunk);
 	std::swap(this->mNumBytes, other.mNumBytes);
+	std::swap(this->mIsMapped, other.mIsMapped);
+	std::swap(this->mIsReserved, other.mIsReserved);
 }
 
 void GameStateContainer::destroy() noexcept
 {
-	if (this->mGameStateMemoryChunk != nullptr) {
+	if (this->mIsMapped) {
+		unmapFileFromMemory(this->mGameStateMemoryChunk, this->mNumBytes);
+	}
+	else if (this->mIsReserved) {
+		releaseMemory(this->mGameStateMemoryChunk, this->mNumBytes);
+	}
+	else if (this->mGameStateMemoryChunk != nullptr) {
 		this->mAllocator->deallocate(this->mGameStateMemoryChunk);
 	}
 	this->mAllocator = nullptr;
 	this->mGameStateMemoryChunk = nullptr;
 	this->mNumBytes = 0;
+	this->mIsMapped = false;
+	this->mIsReserved = false;
 }
 
 // GameStateContainer: Methods
@@ -98,4 +248,30 @@ const GameStateHeader* GameStateContainer::getHeader() const noexcept
 	return reinterpret_cast<const GameStateHeader*>(mGameStateMemoryChunk);
 }
 
+// Reserved memory functions
+// ------------------------------------------------------------------------------------------------
+
+void commitReservedMemory(uint8_t* ptr, uint64_t numBytes) noexcept
+{
+#ifdef _WIN32
+	// Walk the regions of pages with the same state, only the reserved ones are committed
+	uint8_t* end = ptr + numBytes;
+	while (ptr < end) {
+		MEMORY_BASIC_INFORMATION info = {};
+		if (VirtualQuery(ptr, &info, sizeof(MEMORY_BASIC_INFORMATION)) == 0) break;
+		uint8_t* regionEnd = static_cast<uint8_t*>(info.BaseAddress) + info.RegionSize;
+		if (info.State == MEM_RESERVE) {
+			uint8_t* commitEnd = std::min(regionEnd, end);
+			void* committed = VirtualAlloc(ptr, size_t(commitEnd - ptr), MEM_COMMIT, PAGE_READWRITE);
+			sfz_assert(committed != nullptr);
+			(void)committed;
+		}
+		ptr = regionEnd;
+	}
+#else
+	(void)ptr;
+	(void)numBytes;
+#endif
+}
+
 } // namespace ph
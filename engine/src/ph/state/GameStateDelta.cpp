@@ -0,0 +1,378 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/GameStateDelta.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include <sfz/Assert.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/SimdSupport.hpp"
+
+namespace ph {
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+static_assert(GAME_STATE_DELTA_BLOCK_SIZE == 64, "Block comparison kernels assume 64 byte blocks");
+static_assert(64 * GAME_STATE_DELTA_BLOCK_SIZE == GAME_STATE_COMMIT_PAGE_SIZE,
+	"A group of 64 blocks must be exactly one page, see GameStateUncommittedRanges");
+
+// Read in place of the uncommitted pages of a state, which are always zero
+static const uint8_t ZERO_PAGE[GAME_STATE_COMMIT_PAGE_SIZE] = {};
+
+// Compares up to 64 consecutive blocks, returns a mask with bit i set if block i differs.
+using DiffBlocksFunc = uint64_t(*)(const uint8_t* a, const uint8_t* b, uint32_t numBlocks);
+
+#ifndef PH_SIMD_X86
+
+static uint64_t diffBlocksScalar(const uint8_t* a, const uint8_t* b, uint32_t numBlocks) noexcept
+{
+	uint64_t diffMask = 0;
+	for (uint32_t i = 0; i < numBlocks; i++) {
+		uint64_t diff = 0;
+		for (uint32_t j = 0; j < 8; j++) {
+			uint64_t aVal, bVal;
+			memcpy(&aVal, a + i * 64 + j * 8, sizeof(uint64_t));
+			memcpy(&bVal, b + i * 64 + j * 8, sizeof(uint64_t));
+			diff |= aVal ^ bVal;
+		}
+		if (diff != 0) diffMask |= uint64_t(1) << i;
+	}
+	return diffMask;
+}
+
+#else
+
+static uint64_t diffBlocksSse2(const uint8_t* a, const uint8_t* b, uint32_t numBlocks) noexcept
+{
+	uint64_t diffMask = 0;
+	for (uint32_t i = 0; i < numBlocks; i++) {
+		const __m128i* aPtr = reinterpret_cast<const __m128i*>(a + i * 64);
+		const __m128i* bPtr = reinterpret_cast<const __m128i*>(b + i * 64);
+		__m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128(aPtr + 0), _mm_loadu_si128(bPtr + 0));
+		__m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128(aPtr + 1), _mm_loadu_si128(bPtr + 1));
+		__m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128(aPtr + 2), _mm_loadu_si128(bPtr + 2));
+		__m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128(aPtr + 3), _mm_loadu_si128(bPtr + 3));
+		__m128i eq = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+		if (_mm_movemask_epi8(eq) != 0xFFFF) diffMask |= uint64_t(1) << i;
+	}
+	return diffMask;
+}
+
+PH_TARGET_AVX2 static uint64_t diffBlocksAvx2(
+	const uint8_t* a, const uint8_t* b, uint32_t numBlocks) noexcept
+{
+	uint64_t diffMask = 0;
+	for (uint32_t i = 0; i < numBlocks; i++) {
+		const __m256i* aPtr = reinterpret_cast<const __m256i*>(a + i * 64);
+		const __m256i* bPtr = reinterpret_cast<const __m256i*>(b + i * 64);
+		__m256i diff0 = _mm256_xor_si256(_mm256_loadu_si256(aPtr + 0), _mm256_loadu_si256(bPtr + 0));
+		__m256i diff1 = _mm256_xor_si256(_mm256_loadu_si256(aPtr + 1), _mm256_loadu_si256(bPtr + 1));
+		__m256i diff = _mm256_or_si256(diff0, diff1);
+		if (!_mm256_testz_si256(diff, diff)) diffMask |= uint64_t(1) << i;
+	}
+	return diffMask;
+}
+
+#endif
+
+static DiffBlocksFunc selectDiffBlocksFunc() noexcept
+{
+#ifdef PH_SIMD_X86
+	if (cpuSupportsAvx2()) return diffBlocksAvx2;
+	return diffBlocksSse2;
+#else
+	return diffBlocksScalar;
+#endif
+}
+
+// Calls func(offset, size, uncommitted) for each part of the given range of a state, split at page
+// boundaries. Ranges must be given in ascending order, see GameStateUncommittedRanges::contains().
+template<typename Func>
+static void forEachPage(
+	GameStateUncommittedRanges& uncommittedRanges,
+	uint32_t offsetBytes,
+	uint32_t sizeBytes,
+	Func&& func) noexcept
+{
+	const uint32_t end = offsetBytes + sizeBytes;
+	uint32_t offset = offsetBytes;
+	while (offset < end) {
+		uint32_t pageEnd = (offset / GAME_STATE_COMMIT_PAGE_SIZE + 1) * GAME_STATE_COMMIT_PAGE_SIZE;
+		if (pageEnd > end) pageEnd = end;
+		func(offset, pageEnd - offset, uncommittedRanges.contains(offset));
+		offset = pageEnd;
+	}
+}
+
+static void writeRun(
+	DynArray<uint8_t>& deltaOut,
+	const uint8_t* current,
+	GameStateUncommittedRanges& currentUncommittedRanges,
+	uint32_t offsetBytes,
+	uint32_t sizeBytes) noexcept
+{
+	StateDeltaRun run;
+	run.offsetBytes = offsetBytes;
+	run.sizeBytes = sizeBytes;
+	deltaOut.add(reinterpret_cast<const uint8_t*>(&run), sizeof(StateDeltaRun));
+	forEachPage(currentUncommittedRanges, offsetBytes, sizeBytes,
+		[&](uint32_t offset, uint32_t size, bool uncommitted) {
+		if (uncommitted) deltaOut.add(uint8_t(0), size);
+		else deltaOut.add(current + offset, size);
+	});
+}
+
+// Makes the given range of dst identical to src, comparing them block by block. Returns the number
+// of bytes copied.
+static uint32_t copyDifferingBytes(
+	uint8_t* dstPtr, const uint8_t* srcPtr, uint32_t sizeBytes, DiffBlocksFunc diffBlocks) noexcept
+{
+	// Compare 64 blocks at a time, copy each run of consecutive differing blocks
+	const uint32_t numFullBlocks = sizeBytes / GAME_STATE_DELTA_BLOCK_SIZE;
+	uint32_t numBytesCopied = 0;
+	for (uint32_t groupBlockIdx = 0; groupBlockIdx < numFullBlocks; groupBlockIdx += 64) {
+		uint32_t numBlocks = numFullBlocks - groupBlockIdx;
+		if (numBlocks > 64) numBlocks = 64;
+		uint32_t groupOffset = groupBlockIdx * GAME_STATE_DELTA_BLOCK_SIZE;
+		uint64_t diffMask = diffBlocks(dstPtr + groupOffset, srcPtr + groupOffset, numBlocks);
+		while (diffMask != 0) {
+			uint32_t runBegin = lowestSetBitIdx(diffMask);
+			uint64_t maskFromRunBegin = diffMask >> runBegin;
+			uint32_t runLength = ~maskFromRunBegin == 0 ? 64 : lowestSetBitIdx(~maskFromRunBegin);
+			uint32_t offset = groupOffset + runBegin * GAME_STATE_DELTA_BLOCK_SIZE;
+			uint32_t size = runLength * GAME_STATE_DELTA_BLOCK_SIZE;
+			memcpy(dstPtr + offset, srcPtr + offset, size);
+			numBytesCopied += size;
+			if ((runBegin + runLength) >= 64) break;
+			diffMask &= ~((uint64_t(1) << (runBegin + runLength)) - 1);
+		}
+	}
+
+	// Partial block at the end
+	const uint32_t tailOffset = numFullBlocks * GAME_STATE_DELTA_BLOCK_SIZE;
+	const uint32_t tailSize = sizeBytes - tailOffset;
+	if (tailSize != 0 && memcmp(dstPtr + tailOffset, srcPtr + tailOffset, tailSize) != 0) {
+		memcpy(dstPtr + tailOffset, srcPtr + tailOffset, tailSize);
+		numBytesCopied += tailSize;
+	}
+
+	return numBytesCopied;
+}
+
+// Delta functions
+// ------------------------------------------------------------------------------------------------
+
+bool computeStateDelta(
+	const GameStateHeader* base,
+	const GameStateHeader* current,
+	DynArray<uint8_t>& deltaOut) noexcept
+{
+	deltaOut.clear();
+	if (base->stateSizeBytes != current->stateSizeBytes) return false;
+	const uint32_t stateSizeBytes = uint32_t(current->stateSizeBytes);
+	const uint8_t* basePtr = reinterpret_cast<const uint8_t*>(base);
+	const uint8_t* currentPtr = reinterpret_cast<const uint8_t*>(current);
+
+	// Write header, numRuns and numChangedBytes are patched at the end
+	StateDeltaHeader header = {};
+	header.magicNumber = GAME_STATE_DELTA_MAGIC_NUMBER;
+	header.stateSizeBytes = stateSizeBytes;
+	header.blockSizeBytes = GAME_STATE_DELTA_BLOCK_SIZE;
+	deltaOut.add(reinterpret_cast<const uint8_t*>(&header), sizeof(StateDeltaHeader));
+
+	// Compare 64 blocks at a time, keeping track of the current run of differing blocks. Each group
+	// of blocks is a page, uncommitted pages are compared as zero (see GameStateUncommittedRanges).
+	const DiffBlocksFunc diffBlocks = selectDiffBlocksFunc();
+	GameStateUncommittedRanges baseUncommittedRanges(base);
+	GameStateUncommittedRanges currentUncommittedRanges(current);
+	GameStateUncommittedRanges runUncommittedRanges(current);
+	const uint32_t numFullBlocks = stateSizeBytes / GAME_STATE_DELTA_BLOCK_SIZE;
+	uint32_t runBegin = 0;
+	uint32_t runEnd = 0; // Empty run if runBegin == runEnd
+	auto addDifferingBlock = [&](uint32_t blockIdx) {
+		if (blockIdx == runEnd && runBegin != runEnd) {
+			runEnd += 1;
+			return;
+		}
+		if (runBegin != runEnd) {
+			uint32_t runSize = (runEnd - runBegin) * GAME_STATE_DELTA_BLOCK_SIZE;
+			writeRun(deltaOut, currentPtr, runUncommittedRanges,
+				runBegin * GAME_STATE_DELTA_BLOCK_SIZE, runSize);
+			header.numRuns += 1;
+			header.numChangedBytes += runSize;
+		}
+		runBegin = blockIdx;
+		runEnd = blockIdx + 1;
+	};
+
+	for (uint32_t groupBlockIdx = 0; groupBlockIdx < numFullBlocks; groupBlockIdx += 64) {
+		uint32_t numBlocks = numFullBlocks - groupBlockIdx;
+		if (numBlocks > 64) numBlocks = 64;
+		uint32_t groupOffset = groupBlockIdx * GAME_STATE_DELTA_BLOCK_SIZE;
+		const bool baseUncommitted = baseUncommittedRanges.contains(groupOffset);
+		const bool currentUncommitted = currentUncommittedRanges.contains(groupOffset);
+		if (baseUncommitted && currentUncommitted) continue;
+		uint64_t diffMask = diffBlocks(
+			baseUncommitted ? ZERO_PAGE : basePtr + groupOffset,
+			currentUncommitted ? ZERO_PAGE : currentPtr + groupOffset,
+			numBlocks);
+		while (diffMask != 0) {
+			addDifferingBlock(groupBlockIdx + lowestSetBitIdx(diffMask));
+			diffMask &= diffMask - 1;
+		}
+	}
+
+	// Compare the partial block at the end (if any), it is treated as a full block when merging
+	// runs and clamped to the size of the state when written.
+	const uint32_t tailOffset = numFullBlocks * GAME_STATE_DELTA_BLOCK_SIZE;
+	const uint32_t tailSize = stateSizeBytes - tailOffset;
+	bool tailDiffers =
+		tailSize != 0 && memcmp(basePtr + tailOffset, currentPtr + tailOffset, tailSize) != 0;
+	if (tailDiffers) addDifferingBlock(numFullBlocks);
+
+	// Write last run
+	if (runBegin != runEnd) {
+		uint32_t runOffset = runBegin * GAME_STATE_DELTA_BLOCK_SIZE;
+		uint32_t runSize = runEnd * GAME_STATE_DELTA_BLOCK_SIZE - runOffset;
+		if ((runOffset + runSize) > stateSizeBytes) runSize = stateSizeBytes - runOffset;
+		writeRun(deltaOut, currentPtr, runUncommittedRanges, runOffset, runSize);
+		header.numRuns += 1;
+		header.numChangedBytes += runSize;
+	}
+
+	// Patch header
+	memcpy(deltaOut.data(), &header, sizeof(StateDeltaHeader));
+	return true;
+}
+
+bool applyStateDelta(
+	GameStateHeader* state,
+	const uint8_t* delta,
+	uint32_t deltaSizeBytes) noexcept
+{
+	// Validate header
+	if (deltaSizeBytes < sizeof(StateDeltaHeader)) return false;
+	StateDeltaHeader header;
+	memcpy(&header, delta, sizeof(StateDeltaHeader));
+	if (header.magicNumber != GAME_STATE_DELTA_MAGIC_NUMBER) return false;
+	if (header.stateSizeBytes != state->stateSizeBytes) return false;
+
+	// Validate all runs before writing anything, they must be in ascending order
+	uint32_t offset = sizeof(StateDeltaHeader);
+	uint64_t prevRunEnd = 0;
+	for (uint32_t i = 0; i < header.numRuns; i++) {
+		if ((deltaSizeBytes - offset) < sizeof(StateDeltaRun)) return false;
+		StateDeltaRun run;
+		memcpy(&run, delta + offset, sizeof(StateDeltaRun));
+		offset += sizeof(StateDeltaRun);
+		if ((deltaSizeBytes - offset) < run.sizeBytes) return false;
+		if (run.offsetBytes > header.stateSizeBytes) return false;
+		if (run.sizeBytes > (header.stateSizeBytes - run.offsetBytes)) return false;
+		if (run.offsetBytes < prevRunEnd) return false;
+		prevRunEnd = uint64_t(run.offsetBytes) + run.sizeBytes;
+		offset += run.sizeBytes;
+	}
+	if (offset != deltaSizeBytes) return false;
+
+	// Find the number of committed entities of the resulting state, if it changes
+	constexpr uint32_t committedOffset = uint32_t(offsetof(GameStateHeader, committedNumEntities));
+	uint32_t numCommittedEntities = state->committedNumEntities;
+	offset = sizeof(StateDeltaHeader);
+	for (uint32_t i = 0; i < header.numRuns; i++) {
+		StateDeltaRun run;
+		memcpy(&run, delta + offset, sizeof(StateDeltaRun));
+		offset += sizeof(StateDeltaRun);
+		if (run.offsetBytes <= committedOffset &&
+			(committedOffset + sizeof(uint32_t)) <= (run.offsetBytes + run.sizeBytes)) {
+			memcpy(&numCommittedEntities, delta + offset + (committedOffset - run.offsetBytes),
+				sizeof(uint32_t));
+		}
+		offset += run.sizeBytes;
+	}
+	if (numCommittedEntities > state->maxNumEntities) return false;
+
+	// Apply runs, after committing or zeroing the entities of a growable game state to match the
+	// resulting one. The uncommitted pages are zero in the resulting state and are skipped.
+	setCommittedNumEntities(state, numCommittedEntities);
+	GameStateUncommittedRanges uncommittedRanges(state);
+	uint8_t* statePtr = reinterpret_cast<uint8_t*>(state);
+	offset = sizeof(StateDeltaHeader);
+	for (uint32_t i = 0; i < header.numRuns; i++) {
+		StateDeltaRun run;
+		memcpy(&run, delta + offset, sizeof(StateDeltaRun));
+		offset += sizeof(StateDeltaRun);
+		const uint8_t* runData = delta + offset - run.offsetBytes;
+		forEachPage(uncommittedRanges, run.offsetBytes, run.sizeBytes,
+			[&](uint32_t pageOffset, uint32_t size, bool uncommitted) {
+			if (!uncommitted) memcpy(statePtr + pageOffset, runData + pageOffset, size);
+		});
+		offset += run.sizeBytes;
+	}
+
+	return true;
+}
+
+uint32_t copyDifferingBlocks(GameStateHeader* dst, const GameStateHeader* src) noexcept
+{
+	sfz_assert(dst->stateSizeBytes == src->stateSizeBytes);
+	setCommittedNumEntities(dst, src->committedNumEntities);
+	return copyDifferingBlocks(dst, src, 0, uint32_t(src->stateSizeBytes));
+}
+
+uint32_t copyDifferingBlocks(
+	GameStateHeader* dst,
+	const GameStateHeader* src,
+	uint32_t offsetBytes,
+	uint32_t sizeBytes) noexcept
+{
+	sfz_assert(dst->stateSizeBytes == src->stateSizeBytes);
+	sfz_assert((uint64_t(offsetBytes) + sizeBytes) <= src->stateSizeBytes);
+	sfz_assert(dst->committedNumEntities >= src->committedNumEntities);
+	uint8_t* dstPtr = reinterpret_cast<uint8_t*>(dst);
+	const uint8_t* srcPtr = reinterpret_cast<const uint8_t*>(src);
+
+	// Only the parts of the range src has committed are compared, the rest is zero in both
+	const DiffBlocksFunc diffBlocks = selectDiffBlocksFunc();
+	GameStateUncommittedRanges uncommittedRanges(src);
+	const uint32_t end = offsetBytes + sizeBytes;
+	uint32_t cursor = offsetBytes;
+	uint32_t numBytesCopied = 0;
+	GameStateByteRange range;
+	while (cursor < end && uncommittedRanges.next(range)) {
+		const uint32_t rangeEnd = range.offsetBytes + range.sizeBytes;
+		if (rangeEnd <= cursor) continue;
+		const uint32_t committedEnd = std::min(range.offsetBytes, end);
+		if (cursor < committedEnd) {
+			numBytesCopied += copyDifferingBytes(
+				dstPtr + cursor, srcPtr + cursor, committedEnd - cursor, diffBlocks);
+		}
+		cursor = std::max(cursor, std::min(rangeEnd, end));
+	}
+	if (cursor < end) {
+		numBytesCopied += copyDifferingBytes(dstPtr + cursor, srcPtr + cursor, end - cursor, diffBlocks);
+	}
+	return numBytesCopied;
+}
+
+} // namespace ph
@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <cinttypes>
+#include <cstring>
 
 #include <imgui.h>
 #include <imgui_internal.h>
@@ -33,7 +34,9 @@
 #include <sfz/strings/StringHashers.hpp>
 #include <sfz/Logging.hpp>
 #include <sfz/strings/StackString.hpp>
-#include <sfz/util/IO.hpp>
+
+#include "ph/state/GameStateDelta.hpp"
+#include "ph/state/StateHash.hpp"
 
 namespace ph {
 
@@ -315,10 +318,11 @@ static uint8_t binaryStringToByte(const char* binaryStr) noexcept
 	return *bytePtr;
 }
 
-static void initializeComponentMaskEditor(str32 buffers[8], ComponentMask initialMask) noexcept
+static void initializeComponentMaskEditor(
+	str32 buffers[COMPONENT_MASK_NUM_BYTES], ComponentMask initialMask) noexcept
 {
-	for (uint64_t i = 0; i < 8; i++) {
-		uint8_t byte = uint8_t((initialMask.rawMask >> (i * 8)) & uint64_t(0xFF));
+	for (uint32_t i = 0; i < COMPONENT_MASK_NUM_BYTES; i++) {
+		uint8_t byte = initialMask.byteAt(i);
 		const char* byteBinaryStr = byteToBinaryString(byte);
 		buffers[i].printf("%s", byteBinaryStr);
 	}
@@ -334,46 +338,35 @@ static void componentMaskVisualizer(ComponentMask mask) noexcept
 {
 	const int32_t NUM_BITS_PER_FIELD = 8;
 	const int32_t NUM_FIELDS = 4;
-	const int32_t NUM_ROWS = 2;
-	static_assert(NUM_BITS_PER_FIELD * NUM_FIELDS * NUM_ROWS == 64, "Think again");
+	const int32_t NUM_ROWS = int32_t(COMPONENT_MASK_NUM_BYTES) / NUM_FIELDS;
+	static_assert(NUM_BITS_PER_FIELD * NUM_FIELDS * NUM_ROWS == COMPONENT_MASK_NUM_BITS, "Think again");
 
 	for (int32_t rowIdx = 0; rowIdx < NUM_ROWS; rowIdx++) {
 		for (int32_t fieldIdx = NUM_FIELDS - 1; fieldIdx >= 0; fieldIdx--) {
 
 			int32_t byteIdx = rowIdx * NUM_FIELDS + fieldIdx;
-			uint8_t byte = uint8_t((mask.rawMask >> (byteIdx * 8)) & uint64_t(0xFF));
-			const char* byteBinaryStr = byteToBinaryString(byte);
+			const char* byteBinaryStr = byteToBinaryString(mask.byteAt(uint32_t(byteIdx)));
 
 			ImGui::Text("%s", byteBinaryStr);
 			ImGui::SameLine();
 		}
 
-		if(rowIdx == 0) {
-			uint32_t byte0 = uint32_t(mask.rawMask & 0xFF);
-			uint32_t byte1 = uint32_t((mask.rawMask >> 8) & 0xFF);
-			uint32_t byte2 = uint32_t((mask.rawMask >> 16) & 0xFF);
-			uint32_t byte3 = uint32_t((mask.rawMask >> 24) & 0xFF);
-			ImGui::Text("[%02X %02X %02X %02X]", byte3, byte2, byte1, byte0);
-		}
-		else {
-			uint32_t byte4 = uint32_t((mask.rawMask >> 32) & 0xFF);
-			uint32_t byte5 = uint32_t((mask.rawMask >> 40) & 0xFF);
-			uint32_t byte6 = uint32_t((mask.rawMask >> 48) & 0xFF);
-			uint32_t byte7 = uint32_t((mask.rawMask >> 56) & 0xFF);
-			ImGui::Text("[%02X %02X %02X %02X]", byte7, byte6, byte5, byte4);
-		}
+		uint32_t firstByteIdx = uint32_t(rowIdx * NUM_FIELDS);
+		ImGui::Text("[%02X %02X %02X %02X]",
+			mask.byteAt(firstByteIdx + 3), mask.byteAt(firstByteIdx + 2),
+			mask.byteAt(firstByteIdx + 1), mask.byteAt(firstByteIdx));
 	}
 }
 
 static bool componentMaskEditor(
 	const char* identifier,
-	str32 buffers[8],
+	str32 buffers[COMPONENT_MASK_NUM_BYTES],
 	ComponentMask& mask) noexcept
 {
 	const int32_t NUM_BITS_PER_FIELD = 8;
 	const int32_t NUM_FIELDS = 4;
-	const int32_t NUM_ROWS = 2;
-	static_assert(NUM_BITS_PER_FIELD * NUM_FIELDS * NUM_ROWS == 64, "Think again");
+	const int32_t NUM_ROWS = int32_t(COMPONENT_MASK_NUM_BYTES) / NUM_FIELDS;
+	static_assert(NUM_BITS_PER_FIELD * NUM_FIELDS * NUM_ROWS == COMPONENT_MASK_NUM_BITS, "Think again");
 
 	bool bitsModified = false;
 
@@ -381,7 +374,6 @@ static bool componentMaskEditor(
 		for (int32_t fieldIdx = NUM_FIELDS - 1; fieldIdx >= 0; fieldIdx--) {
 
 			int32_t byteIdx = rowIdx * NUM_FIELDS + fieldIdx;
-			uint64_t shiftOffset = 8 * byteIdx;
 
 			ImGuiInputTextFlags inputFlags = 0;
 			inputFlags |= ImGuiInputTextFlags_EnterReturnsTrue;
@@ -398,30 +390,17 @@ static bool componentMaskEditor(
 
 			if (modified) {
 				const uint8_t modifiedByte = binaryStringToByte(buffers[byteIdx]);
-				const uint64_t keepMask = ~(uint64_t(0xFF) << shiftOffset);
-				const uint64_t insertByte = uint64_t(modifiedByte) << shiftOffset;
-				const uint64_t modifiedMask = (mask.rawMask & keepMask) | insertByte;
-				mask.rawMask = modifiedMask;
+				mask.setByte(uint32_t(byteIdx), modifiedByte);
 				bitsModified = true;
 			}
 
 			ImGui::SameLine();
 		}
 
-		if(rowIdx == 0) {
-			uint32_t byte0 = uint32_t(mask.rawMask & 0xFF);
-			uint32_t byte1 = uint32_t((mask.rawMask >> 8) & 0xFF);
-			uint32_t byte2 = uint32_t((mask.rawMask >> 16) & 0xFF);
-			uint32_t byte3 = uint32_t((mask.rawMask >> 24) & 0xFF);
-			ImGui::Text("[%02X %02X %02X %02X]", byte3, byte2, byte1, byte0);
-		}
-		else {
-			uint32_t byte4 = uint32_t((mask.rawMask >> 32) & 0xFF);
-			uint32_t byte5 = uint32_t((mask.rawMask >> 40) & 0xFF);
-			uint32_t byte6 = uint32_t((mask.rawMask >> 48) & 0xFF);
-			uint32_t byte7 = uint32_t((mask.rawMask >> 56) & 0xFF);
-			ImGui::Text("[%02X %02X %02X %02X]", byte7, byte6, byte5, byte4);
-		}
+		uint32_t firstByteIdx = uint32_t(rowIdx * NUM_FIELDS);
+		ImGui::Text("[%02X %02X %02X %02X]",
+			mask.byteAt(firstByteIdx + 3), mask.byteAt(firstByteIdx + 2),
+			mask.byteAt(firstByteIdx + 1), mask.byteAt(firstByteIdx));
 	}
 
 	return bitsModified;
@@ -436,7 +415,7 @@ static void saveDialog(const GameStateHeader* state) noexcept
 
 	// Write game state to file if file dialog was succesful
 	if (result == NFD_OKAY) {
-		bool success =  sfz::writeBinaryFile(path, (const uint8_t*)state, state->stateSizeBytes);
+		bool success = saveGameState(state, path);
 		if (success) {
 			SFZ_INFO("PhantasyEngine", "Wrote game state to \"%s\"", path);
 		}
@@ -459,16 +438,9 @@ static void loadDialog(GameStateHeader* state) noexcept
 
 	// Load game state from file if file dialog was succesful
 	if (result == NFD_OKAY) {
-		sfz::DynArray<uint8_t> binary = sfz::readBinaryFile(path);
-		if (binary.size() == 0) {
-			SFZ_ERROR("PhantasyEngine", "Could not read game state from \"%s\"", path);
-		}
-		else if (binary.size() != state->stateSizeBytes) {
-			SFZ_ERROR("PhantasyEngine", "Game state from \"%s\" is wrong size", path);
-		}
-		else {
-			// TODO: Check if header matches
-			std::memcpy(state, binary.data(), state->stateSizeBytes);
+		GameStateContainer loaded = mapGameState(path, GameStateMapMode::READ_ONLY, state);
+		if (loaded.getHeader() != nullptr) {
+			copyDifferingBlocks(state, loaded.getHeader());
 			SFZ_INFO("PhantasyEngine", "Loaded game state from \"%s\"", path);
 		}
 		free(path);
@@ -507,6 +479,7 @@ void GameStateEditor::init(
 	// Initialize some state
 	mWindowName.printf("%s", windowName);
 	initializeComponentMaskEditor(mFilterMaskEditBuffers, mFilterMask);
+	mComponentBuffer.init(0, allocator, sfz_dbg("GameStateEditor::mComponentBuffer"));
 
 	// Temp variable to ensure all necesary singleton infos are set
 	bool singletonInfoSet[64] = {};
@@ -534,7 +507,7 @@ void GameStateEditor::init(
 	}
 
 	// Temp variable to ensure all necessary component infos are set
-	bool componentInfoSet[64] = {};
+	bool componentInfoSet[COMPONENT_MASK_NUM_BITS] = {};
 
 	// Set active bit component info
 	componentInfoSet[0] = true;
@@ -544,7 +517,7 @@ void GameStateEditor::init(
 	for (uint32_t i = 0; i < numComponentInfos; i++) {
 		ComponentInfo& info = componentInfos[i];
 		sfz_assert(info.componentType != 0);
-		sfz_assert(info.componentType < 64);
+		sfz_assert(info.componentType < COMPONENT_MASK_NUM_BITS);
 
 		ReducedComponentInfo& target = mComponentInfos[info.componentType];
 		bool& set = componentInfoSet[info.componentType];
@@ -570,16 +543,19 @@ void GameStateEditor::swap(GameStateEditor& other) noexcept
 	std::swap(this->mWindowName, other.mWindowName);
 	for (uint32_t i = 0; i < 64; i++) {
 		std::swap(this->mSingletonInfos[i], other.mSingletonInfos[i]);
+	}
+	for (uint32_t i = 0; i < COMPONENT_MASK_NUM_BITS; i++) {
 		std::swap(this->mComponentInfos[i], other.mComponentInfos[i]);
 	}
 	std::swap(this->mNumSingletonInfos, other.mNumSingletonInfos);
 	std::swap(this->mNumComponentInfos, other.mNumComponentInfos);
 	std::swap(this->mFilterMask, other.mFilterMask);
-	for (uint32_t i = 0; i < 8; i++) {
+	for (uint32_t i = 0; i < COMPONENT_MASK_NUM_BYTES; i++) {
 		std::swap(this->mFilterMaskEditBuffers[i], other.mFilterMaskEditBuffers[i]);
 	}
 	std::swap(this->mCompactEntityList, other.mCompactEntityList);
 	std::swap(this->mCurrentSelectedEntityId, other.mCurrentSelectedEntityId);
+	this->mComponentBuffer.swap(other.mComponentBuffer);
 }
 
 void GameStateEditor::destroy() noexcept
@@ -587,16 +563,19 @@ void GameStateEditor::destroy() noexcept
 	mWindowName.printf("");
 	for (uint32_t i = 0; i < 64; i++) {
 		this->mSingletonInfos[i] = ReducedSingletonInfo();
+	}
+	for (uint32_t i = 0; i < COMPONENT_MASK_NUM_BITS; i++) {
 		this->mComponentInfos[i] = ReducedComponentInfo();
 	}
 	mNumSingletonInfos = 0;
 	mNumComponentInfos = 0;
 	mFilterMask = ComponentMask::activeMask();
-	for (uint32_t i = 0; i < 8; i++) {
+	for (uint32_t i = 0; i < COMPONENT_MASK_NUM_BYTES; i++) {
 		mFilterMaskEditBuffers[i].printf("");
 	}
 	mCompactEntityList = false;
 	mCurrentSelectedEntityId = 0;
+	mComponentBuffer.destroy();
 
 	// TODO: Not perfect, probable race condition if multiple game state viewers.
 	if (binaryStringToByteLookupMap != nullptr) {
@@ -700,6 +679,9 @@ void GameStateEditor::renderSingletonEditor(GameStateHeader* state) noexcept
 					info.userPtr.get(),
 					state->singletonUntyped(i, singletonSizeOut),
 					state);
+
+				// Editors do not report whether they modified anything, assume they did
+				state->markSingletonDirty(i);
 			}
 			ImGui::Unindent(28.0f);
 		}
@@ -733,7 +715,13 @@ void GameStateEditor::renderEcsEditor(GameStateHeader* state) noexcept
 
 	// Entities list
 	if (ImGui::ListBoxHeader("##Entities", vec2(136.0f, ImGui::GetWindowHeight() - 320.0f))) {
-		for (uint32_t entityId = 0; entityId < state->maxNumEntities; entityId++) {
+		// A compact list filtered on the active bit only shows active entities, so it can stop at
+		// the high-water mark. Entities above the committed ones are never listed, they are not
+		// accessible in a growable game state.
+		bool onlyActiveListed = mCompactEntityList && mFilterMask.active();
+		uint32_t numListedIds =
+			onlyActiveListed ? state->entityHighWaterMark : state->committedNumEntities;
+		for (uint32_t entityId = 0; entityId < numListedIds; entityId++) {
 
 			// Check if entity fulfills filter mask
 			bool fulfillsFilter = masks[entityId].fulfills(mFilterMask);
@@ -794,12 +782,15 @@ void GameStateEditor::renderEcsEditor(GameStateHeader* state) noexcept
 	ImGui::BeginGroup();
 
 	// Only show entity edit menu if an active entity exists
-	bool selectedEntityExists = mCurrentSelectedEntityId < state->maxNumEntities;
+	bool selectedEntityExists = mCurrentSelectedEntityId < state->committedNumEntities;
 	if (selectedEntityExists) {
 
 		// Currently selected entities component mask
 		ComponentMask& mask = masks[mCurrentSelectedEntityId];
 		componentMaskVisualizer(mask);
+		if (state->externalIdsEnabled() && mask.active()) {
+			ImGui::Text("External id: %" PRIu64, state->externalIds()[mCurrentSelectedEntityId]);
+		}
 
 		ImGui::Spacing();
 		ImGui::Separator();
@@ -848,12 +839,12 @@ void GameStateEditor::renderEcsEditor(GameStateHeader* state) noexcept
 
 				if (ImGui::Checkbox(
 					sfz::str96("##%s_checkbox", info.componentName.str), &checkboxBool)) {
+					uint8_t entityGen = state->getGeneration(mCurrentSelectedEntityId);
+					Entity entity = Entity::create(mCurrentSelectedEntityId, entityGen);
 					if (checkboxBool) {
-						mask.setComponentType(i, checkboxBool);
+						state->addComponentUntyped(entity, i, nullptr, componentSize);
 					}
 					else {
-						uint8_t entityGen = state->getGeneration(mCurrentSelectedEntityId);
-						Entity entity = Entity::create(mCurrentSelectedEntityId, entityGen);
 						state->deleteComponent(entity, i);
 					}
 				}
@@ -868,15 +859,44 @@ void GameStateEditor::renderEcsEditor(GameStateHeader* state) noexcept
 
 					// Run editor
 					ImGui::Indent(39.0f);
-					if(info.componentEditor == nullptr) {
+					uint8_t* component = entityHasComponent ?
+						state->componentUntyped(i, mCurrentSelectedEntityId) : nullptr;
+					const bool soaComponent = state->componentTypeIsSoA(i);
+					if (component == nullptr && state->componentTypeIsSparse(i)) {
+						ImGui::Text("<No slot allocated>");
+					}
+					else if (info.componentEditor == nullptr) {
 						ImGui::Text("<No editor specified>");
 					}
+					else if (soaComponent) {
+						// Fields are not contiguous, edit a gathered copy and scatter it back
+						mComponentBuffer.ensureCapacity(componentSize);
+						mComponentBuffer.hackSetSize(componentSize);
+						memset(mComponentBuffer.data(), 0, componentSize);
+						state->readComponentUntyped(
+							i, mCurrentSelectedEntityId, mComponentBuffer.data(), componentSize);
+						info.componentEditor(
+							info.userPtr.get(),
+							mComponentBuffer.data(),
+							state,
+							mCurrentSelectedEntityId);
+						if (entityHasComponent) {
+							uint8_t entityGen = state->getGeneration(mCurrentSelectedEntityId);
+							Entity entity = Entity::create(mCurrentSelectedEntityId, entityGen);
+							state->addComponentUntyped(
+								entity, i, mComponentBuffer.data(), componentSize);
+						}
+					}
 					else {
+						if (component == nullptr) {
+							component = components + mCurrentSelectedEntityId * componentSize;
+						}
 						info.componentEditor(
 							info.userPtr.get(),
-							components + mCurrentSelectedEntityId * componentSize,
+							component,
 							state,
 							mCurrentSelectedEntityId);
+						if (entityHasComponent) state->markDirty(i, mCurrentSelectedEntityId);
 					}
 					ImGui::Unindent(39.0f);
 
@@ -924,8 +944,77 @@ void GameStateEditor::renderInfoViewer(GameStateHeader* state) noexcept
 	ImGui::Text("numComponentTypes:"); ImGui::SameLine(valueXOffset); ImGui::Text("%u", state->numComponentTypes);
 	ImGui::Text("maxNumEntities:"); ImGui::SameLine(valueXOffset); ImGui::Text("%u", state->maxNumEntities);
 	ImGui::Text("currentNumEntities:"); ImGui::SameLine(valueXOffset); ImGui::Text("%u", state->currentNumEntities);
+	ImGui::Text("entityHighWaterMark:"); ImGui::SameLine(valueXOffset); ImGui::Text("%u", state->entityHighWaterMark);
+	ImGui::Text("committedNumEntities:"); ImGui::SameLine(valueXOffset); ImGui::Text("%u", state->committedNumEntities);
+	ImGui::Text("entityAllocationPolicy:"); ImGui::SameLine(valueXOffset);
+	ImGui::Text("%s", state->entityAllocationPolicy == EntityAllocationPolicy::LOWEST_ID_FIRST ?
+		"LOWEST_ID_FIRST" : "LIFO");
+	ImGui::Text("dirtyBlockSize:"); ImGui::SameLine(valueXOffset);
+	if (state->dirtyTrackingEnabled()) ImGui::Text("%u", state->dirtyBlockSize);
+	else ImGui::Text("<disabled>");
+	ImGui::Text("changeTick:"); ImGui::SameLine(valueXOffset);
+	if (state->changeTrackingEnabled()) ImGui::Text("%u", state->changeTick);
+	else ImGui::Text("<disabled>");
+	ImGui::Text("nextExternalId:"); ImGui::SameLine(valueXOffset);
+	if (state->externalIdsEnabled()) {
+		ImGui::Text("%" PRIu64 " (index: %u / %u slots used)", state->nextExternalId,
+			state->externalIdIndexArray()->size, state->externalIdIndexArray()->capacity);
+	}
+	else ImGui::Text("<disabled>");
+	ImGui::Text("componentMaskNumBits:"); ImGui::SameLine(valueXOffset); ImGui::Text("%u", state->componentMaskNumBits);
+	ImGui::Text("numQueries:"); ImGui::SameLine(valueXOffset); ImGui::Text("%u", state->numQueries);
+	ImGui::Text("numEventQueues:"); ImGui::SameLine(valueXOffset); ImGui::Text("%u", state->numEventQueues);
+	ImGui::Text("Mask scan kernel:"); ImGui::SameLine(valueXOffset); ImGui::Text("%s", componentMaskScanImplName());
+	ImGui::Text("State hash:"); ImGui::SameLine(valueXOffset); ImGui::Text("%016" PRIx64, state->hash());
+	ImGui::Text("Hash kernel:"); ImGui::SameLine(valueXOffset); ImGui::Text("%s", stateHashImplName());
 	ImGui::Spacing();
 
+	// Query viewer
+	if (state->numQueries != 0) {
+		ImGui::Separator();
+		ImGui::Text("Queries");
+		ImGui::Spacing();
+
+		for (uint32_t i = 0; i < state->numQueries; i++) {
+			const QueryRegistryEntry& entry = state->queryEntry(i);
+			uint32_t numMatchingEntities = 0;
+			state->queryEntities(i, numMatchingEntities);
+			ImGui::Text("Query %02u:", i); ImGui::SameLine(valueXOffset);
+
+			// Words are printed most significant first, same order as the bits in a single word
+			ImGui::Text("required:");
+			for (uint32_t w = ComponentMask::NUM_WORDS; w > 0; w--) {
+				ImGui::SameLine();
+				ImGui::Text("%016" PRIX64, entry.required.words[w - 1]);
+			}
+			ImGui::SameLine();
+			ImGui::Text(", excluded:");
+			for (uint32_t w = ComponentMask::NUM_WORDS; w > 0; w--) {
+				ImGui::SameLine();
+				ImGui::Text("%016" PRIX64, entry.excluded.words[w - 1]);
+			}
+			ImGui::SameLine();
+			ImGui::Text(", matches: %u", numMatchingEntities);
+		}
+		ImGui::Spacing();
+	}
+
+	// Event queue viewer
+	if (state->numEventQueues != 0) {
+		ImGui::Separator();
+		ImGui::Text("Event queues");
+		ImGui::Spacing();
+
+		for (uint32_t i = 0; i < state->numEventQueues; i++) {
+			const ArrayHeader* events = state->arrayAt(
+				state->eventQueueRegistryArray()->at<EventQueueRegistryEntry>(i).offset);
+			ImGui::Text("Event queue %02u:", i); ImGui::SameLine(valueXOffset);
+			ImGui::Text("%u / %u events (%u bytes each), %u dropped", events->size,
+				events->capacity, events->elementSize, state->numDroppedEvents(i));
+		}
+		ImGui::Spacing();
+	}
+
 
 #if !defined(__EMSCRIPTEN__) && !defined(SFZ_IOS)
 	// Saving/loading to file options
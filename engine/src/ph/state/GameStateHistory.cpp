@@ -0,0 +1,335 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/GameStateHistory.hpp"
+
+#include <cstring>
+#include <utility> // std::swap()
+
+#include <sfz/Assert.hpp>
+#include <sfz/containers/DynArray.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/GameStateDelta.hpp"
+#include "ph/state/SimdSupport.hpp"
+
+namespace ph {
+
+using sfz::DynArray;
+
+// GameStateHistoryState
+// ------------------------------------------------------------------------------------------------
+
+struct GameStateHistoryState final {
+	sfz::Allocator* allocator = nullptr;
+	DynArray<GameStateContainer> slots;
+	DynArray<uint64_t> slotTicks;
+	uint32_t oldestSlotIdx = 0;
+	uint32_t numSnapshots = 0;
+
+	// Dirty tracking, only used if the game state has it enabled. For each slot, the blocks which
+	// may differ between the slot and the game state, accumulated from the game state's dirty
+	// bitset. numDirtyWords words per slot.
+	uint32_t numDirtyWords = 0;
+	DynArray<uint64_t> pendingDirty;
+};
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+// Returns the slot index of the given tick, ~0 if it is not stored
+static uint32_t findSlot(const GameStateHistoryState& state, uint64_t tick) noexcept
+{
+	const uint32_t numSlots = state.slots.size();
+	for (uint32_t i = 0; i < state.numSnapshots; i++) {
+		uint32_t slotIdx = (state.oldestSlotIdx + i) % numSlots;
+		if (state.slotTicks[slotIdx] == tick) return slotIdx;
+	}
+	return ~0u;
+}
+
+// Ors the dirty bitset of the game state into the given bitset
+static void accumulateDirty(uint64_t* dst, const GameStateHeader* state, uint32_t numWords) noexcept
+{
+	const uint64_t* dirty = state->dirtyBitsetArray()->data<uint64_t>();
+	for (uint32_t i = 0; i < numWords; i++) dst[i] |= dirty[i];
+}
+
+// Makes dst identical to src, assuming that the entity indexed arrays (component masks,
+// generations, component data, change ticks and external ids) only differ in the blocks set in
+// dirtyBits. Everything else is compared block by block using copyDifferingBlocks(). The
+// committed entities of dst are first matched to src, the dirty blocks are only copied up to
+// them. Returns the number of bytes copied.
+static uint32_t copyDirtyBlocks(
+	GameStateHeader* dst, const GameStateHeader* src, const uint64_t* dirtyBits) noexcept
+{
+	uint8_t* dstPtr = reinterpret_cast<uint8_t*>(dst);
+	const uint8_t* srcPtr = reinterpret_cast<const uint8_t*>(src);
+	const uint32_t dirtyBlockSize = src->dirtyBlockSize;
+	const uint32_t numDirtyBlocks = src->numDirtyBlocks();
+	const uint32_t numWordsPerType = (numDirtyBlocks + 63) / 64;
+	const uint32_t numCommittedEntities = src->committedNumEntities;
+	uint32_t numBytesCopied = 0;
+	uint32_t cursor = 0;
+	setCommittedNumEntities(dst, numCommittedEntities);
+
+	// Copies the dirty blocks of an entity indexed array, and everything before it not yet copied.
+	// Structure-of-arrays component arrays (fields != nullptr) copy the blocks of each column.
+	auto copyArray = [&](const ArrayHeader* array, const uint64_t* bits,
+		const ComponentField* fields = nullptr, uint32_t numFields = 0) {
+		const uint32_t elementSize = array->elementSize;
+		const uint32_t dataOffset =
+			uint32_t(reinterpret_cast<const uint8_t*>(array->dataUntyped()) - srcPtr);
+		sfz_assert(dataOffset >= cursor);
+		numBytesCopied += copyDifferingBlocks(dst, src, cursor, dataOffset - cursor);
+
+		const ComponentField wholeElement = { 0, elementSize };
+		if (fields == nullptr) {
+			fields = &wholeElement;
+			numFields = 1;
+		}
+		for (uint32_t wordIdx = 0; wordIdx < numWordsPerType; wordIdx++) {
+			uint64_t word = bits[wordIdx];
+			while (word != 0) {
+				uint32_t bitIdx = lowestSetBitIdx(word);
+				word &= word - 1;
+				uint32_t blockIdx = wordIdx * 64 + bitIdx;
+				uint32_t firstEntityId = blockIdx * dirtyBlockSize;
+				if (firstEntityId >= numCommittedEntities) continue;
+				uint32_t numEntities = dirtyBlockSize;
+				if ((firstEntityId + numEntities) > numCommittedEntities) {
+					numEntities = numCommittedEntities - firstEntityId;
+				}
+				for (uint32_t i = 0; i < numFields; i++) {
+					const ComponentField& field = fields[i];
+					uint32_t offset = dataOffset + field.offset * array->capacity +
+						firstEntityId * field.sizeInBytes;
+					uint32_t size = numEntities * field.sizeInBytes;
+					memcpy(dstPtr + offset, srcPtr + offset, size);
+					numBytesCopied += size;
+				}
+			}
+		}
+		cursor = dataOffset + array->capacity * elementSize;
+	};
+
+	// Entity indexed arrays in the order they are laid out in memory, row 0 of the dirty bitset
+	// covers both the component masks and the generations. Sparse component types are not entity
+	// indexed, they are compared along with the rest of the state.
+	copyArray(src->componentMasksArray(), dirtyBits);
+	copyArray(src->entityGenerationsListArray(), dirtyBits);
+	const ComponentRegistryEntry* registry =
+		src->componentRegistryArray()->data<ComponentRegistryEntry>();
+	for (uint32_t i = 1; i < src->numComponentTypes; i++) {
+		if (!registry[i].componentTypeHasData()) continue;
+		if (registry[i].componentTypeIsSparse()) continue;
+		uint32_t numFields = 0;
+		const ComponentField* fields = src->componentFields(i, numFields);
+		copyArray(src->arrayAt(registry[i].offset), dirtyBits + i * numWordsPerType,
+			fields, numFields);
+	}
+
+	// Change ticks of change tracked component types, stamping a change also marks the block as
+	// dirty for the component type
+	for (uint32_t i = 0; i < src->numComponentTypes; i++) {
+		if (!registry[i].componentTypeIsChangeTracked()) continue;
+		copyArray(src->arrayAt(registry[i].offsetChangeTicks), dirtyBits + i * numWordsPerType);
+	}
+
+	// External ids, part of the entity bookkeeping in row 0. The external id index is compared
+	// along with the rest of the state.
+	if (src->externalIdsEnabled()) copyArray(src->externalIdsArray(), dirtyBits);
+
+	// Rest of state
+	numBytesCopied +=
+		copyDifferingBlocks(dst, src, cursor, uint32_t(src->stateSizeBytes) - cursor);
+	return numBytesCopied;
+}
+
+// GameStateHistory: State methods
+// ------------------------------------------------------------------------------------------------
+
+void GameStateHistory::init(
+	const GameStateHeader* state, uint32_t numSlots, sfz::Allocator* allocator) noexcept
+{
+	sfz_assert(numSlots > 0);
+	this->destroy();
+	mState = allocator->newObject<GameStateHistoryState>(sfz_dbg("GameStateHistoryState"));
+	mState->allocator = allocator;
+	mState->slots.init(numSlots, allocator, sfz_dbg("GameStateHistory::slots"));
+	mState->slotTicks.init(numSlots, allocator, sfz_dbg("GameStateHistory::slotTicks"));
+
+	// Allocate all slots up front, initialized to the given state. Slots for a growable state are
+	// reserved as well and only commit what the state has committed, only the differing (i.e.
+	// non-zero) blocks are written so that the slots do not become resident beyond what the state
+	// uses.
+	const bool growable = state->committedNumEntities != state->maxNumEntities;
+	for (uint32_t i = 0; i < numSlots; i++) {
+		GameStateContainer slot = growable ?
+			GameStateContainer::createReserved(state->stateSizeBytes) :
+			GameStateContainer::createRaw(state->stateSizeBytes, allocator);
+		sfz_assert(slot.getHeader() != nullptr);
+		if (growable) {
+			commitGameStateMemory(reinterpret_cast<uint8_t*>(slot.getHeader()), state);
+			memcpy(reinterpret_cast<uint8_t*>(slot.getHeader()), state, sizeof(GameStateHeader));
+			copyDifferingBlocks(slot.getHeader(), state);
+		}
+		else {
+			memcpy(reinterpret_cast<uint8_t*>(slot.getHeader()), state, state->stateSizeBytes);
+		}
+		mState->slots.add(std::move(slot));
+		mState->slotTicks.add(~uint64_t(0));
+	}
+
+	// All slots are identical to the state, so nothing is pending to begin with
+	if (state->dirtyTrackingEnabled()) {
+		mState->numDirtyWords = state->dirtyBitsetArray()->size;
+		mState->pendingDirty.init(
+			numSlots * mState->numDirtyWords, allocator, sfz_dbg("GameStateHistory::pendingDirty"));
+		mState->pendingDirty.add(uint64_t(0), numSlots * mState->numDirtyWords);
+	}
+}
+
+void GameStateHistory::swap(GameStateHistory& other) noexcept
+{
+	std::swap(this->mState, other.mState);
+}
+
+void GameStateHistory::destroy() noexcept
+{
+	if (mState == nullptr) return;
+	sfz::Allocator* allocator = mState->allocator;
+	allocator->deleteObject(mState);
+	mState = nullptr;
+}
+
+// GameStateHistory: Methods
+// ------------------------------------------------------------------------------------------------
+
+uint32_t GameStateHistory::capacity() const noexcept
+{
+	return mState->slots.size();
+}
+
+uint32_t GameStateHistory::numSnapshots() const noexcept
+{
+	return mState->numSnapshots;
+}
+
+uint64_t GameStateHistory::oldestTick() const noexcept
+{
+	sfz_assert(mState->numSnapshots > 0);
+	return mState->slotTicks[mState->oldestSlotIdx];
+}
+
+uint64_t GameStateHistory::newestTick() const noexcept
+{
+	sfz_assert(mState->numSnapshots > 0);
+	uint32_t newestSlotIdx =
+		(mState->oldestSlotIdx + mState->numSnapshots - 1) % mState->slots.size();
+	return mState->slotTicks[newestSlotIdx];
+}
+
+uint32_t GameStateHistory::snapshot(const GameStateHeader* state, uint64_t tick) noexcept
+{
+	sfz_assert(mState->numSnapshots == 0 || tick > this->newestTick());
+	const uint32_t numSlots = mState->slots.size();
+
+	// Pick next slot, overwrite oldest snapshot if full
+	uint32_t slotIdx = (mState->oldestSlotIdx + mState->numSnapshots) % numSlots;
+	if (mState->numSnapshots == numSlots) {
+		mState->oldestSlotIdx = (mState->oldestSlotIdx + 1) % numSlots;
+	}
+	else {
+		mState->numSnapshots += 1;
+	}
+
+	// Copy state into slot
+	GameStateHeader* slotState = mState->slots[slotIdx].getHeader();
+	sfz_assert(slotState->stateSizeBytes == state->stateSizeBytes);
+	mState->slotTicks[slotIdx] = tick;
+	if (mState->numDirtyWords == 0) return copyDifferingBlocks(slotState, state);
+
+	// Accumulate the state's dirty blocks into all slots, then only copy the ones pending for
+	// this slot
+	const uint32_t numDirtyWords = mState->numDirtyWords;
+	for (uint32_t i = 0; i < numSlots; i++) {
+		accumulateDirty(mState->pendingDirty.data() + i * numDirtyWords, state, numDirtyWords);
+	}
+	uint64_t* pending = mState->pendingDirty.data() + slotIdx * numDirtyWords;
+	uint32_t numBytesCopied = copyDirtyBlocks(slotState, state, pending);
+	memset(pending, 0, numDirtyWords * sizeof(uint64_t));
+	return numBytesCopied;
+}
+
+const GameStateHeader* GameStateHistory::snapshotAt(uint64_t tick) const noexcept
+{
+	uint32_t slotIdx = findSlot(*mState, tick);
+	if (slotIdx == ~0u) return nullptr;
+	return mState->slots[slotIdx].getHeader();
+}
+
+bool GameStateHistory::restore(uint64_t tick, GameStateHeader* stateOut) noexcept
+{
+	uint32_t slotIdx = findSlot(*mState, tick);
+	if (slotIdx == ~0u) return false;
+
+	// Restore state
+	const GameStateHeader* slotState = mState->slots[slotIdx].getHeader();
+	sfz_assert(slotState->stateSizeBytes == stateOut->stateSizeBytes);
+	const uint32_t numSlots = mState->slots.size();
+	if (mState->numDirtyWords == 0) {
+		copyDifferingBlocks(stateOut, slotState);
+	}
+	else {
+		// The blocks which may differ are the ones pending for the slot plus the ones currently
+		// dirty in the state. Afterwards all other slots may differ from the state in those blocks.
+		const uint32_t numDirtyWords = mState->numDirtyWords;
+		uint64_t* pending = mState->pendingDirty.data() + slotIdx * numDirtyWords;
+		accumulateDirty(pending, stateOut, numDirtyWords);
+		copyDirtyBlocks(stateOut, slotState, pending);
+		for (uint32_t i = 0; i < numSlots; i++) {
+			if (i == slotIdx) continue;
+			uint64_t* otherPending = mState->pendingDirty.data() + i * numDirtyWords;
+			for (uint32_t j = 0; j < numDirtyWords; j++) otherPending[j] |= pending[j];
+		}
+
+		// Mark everything restored as dirty in the state, so that other consumers of the dirty
+		// bits see it. The state's dirty bits were overwritten by the ones in the snapshot.
+		uint64_t* stateDirty = stateOut->dirtyBitsetArray()->data<uint64_t>();
+		for (uint32_t j = 0; j < numDirtyWords; j++) stateDirty[j] |= pending[j];
+		stateOut->dirtySingletons = stateOut->numSingletons >= 64 ?
+			~uint64_t(0) : (uint64_t(1) << stateOut->numSingletons) - 1;
+		memset(pending, 0, numDirtyWords * sizeof(uint64_t));
+	}
+
+	// Discard all newer snapshots, their slots keep their content so that the next snapshots
+	// written to them are likely to be similar
+	mState->numSnapshots = ((slotIdx + numSlots - mState->oldestSlotIdx) % numSlots) + 1;
+
+	return true;
+}
+
+void GameStateHistory::clear() noexcept
+{
+	mState->oldestSlotIdx = 0;
+	mState->numSnapshots = 0;
+}
+
+} // namespace ph
@@ -0,0 +1,414 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/GameStateInterpolator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <utility> // std::swap()
+
+#include <sfz/Assert.hpp>
+#include <sfz/containers/DynArray.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/SimdSupport.hpp"
+
+namespace ph {
+
+using sfz::DynArray;
+
+// GameStateInterpolatorState
+// ------------------------------------------------------------------------------------------------
+
+// The transform of an entity in the previous tick. The tag identifies the entity which had the
+// transform, 0x100 | generation if the entity had the component, 0 otherwise.
+struct ShadowTransform final {
+	vec3 position;
+	uint32_t tag;
+	vec4 rotation;
+};
+static_assert(sizeof(ShadowTransform) == 32, "ShadowTransform is padded");
+
+struct InterpolatedType final {
+	InterpolatedComponentDesc desc;
+	uint32_t componentSize = 0;
+	DynArray<ShadowTransform> shadow; // One per entity id, up to the entityHighWaterMark
+};
+
+struct GameStateInterpolatorState final {
+	sfz::Allocator* allocator = nullptr;
+	DynArray<InterpolatedType> types;
+};
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+static uint32_t entityTag(
+	const ComponentMask* masks,
+	const uint8_t* generations,
+	uint32_t componentType,
+	uint32_t entityId) noexcept
+{
+	if (!masks[entityId].hasComponentType(componentType)) return 0;
+	return 0x100 | generations[entityId];
+}
+
+static void loadTransform(
+	const uint8_t* component,
+	const InterpolatedComponentDesc& desc,
+	vec3& positionOut,
+	vec4& rotationOut) noexcept
+{
+	positionOut = vec3(0.0f, 0.0f, 0.0f);
+	rotationOut = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	if (desc.positionOffset != ~0u) {
+		memcpy(&positionOut, component + desc.positionOffset, sizeof(vec3));
+	}
+	if (desc.rotationOffset != ~0u) {
+		memcpy(&rotationOut, component + desc.rotationOffset, sizeof(vec4));
+	}
+}
+
+// Copies the current transforms of the entities in [firstEntityId, endEntityId) to the shadow copy
+static void copyTransforms(
+	const GameStateHeader* state,
+	InterpolatedType& type,
+	uint32_t firstEntityId,
+	uint32_t endEntityId) noexcept
+{
+	const ComponentMask* masks = state->componentMasks();
+	const uint8_t* generations = state->entityGenerations();
+	uint32_t componentSize = 0;
+	const uint8_t* components = state->componentsUntyped(type.desc.componentType, componentSize);
+	ShadowTransform* shadow = type.shadow.data();
+	for (uint32_t entityId = firstEntityId; entityId < endEntityId; entityId++) {
+		ShadowTransform& dst = shadow[entityId];
+		loadTransform(components + uint64_t(entityId) * componentSize, type.desc,
+			dst.position, dst.rotation);
+		dst.tag = entityTag(masks, generations, type.desc.componentType, entityId);
+	}
+}
+
+// The interpolation parameter to use for slerp approximated as normalized lerp, given the
+// absolute cosine of the angle between the quaternions. See "Approximating slerp" by Arseny
+// Kapoulkine (zeux.io, 2015).
+static float correctedT(float t, float absCosAngle) noexcept
+{
+	const float d = absCosAngle;
+	const float a = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+	const float b = 0.848013f + d * (-1.06021f + d * 0.215638f);
+	const float k = a * (t - 0.5f) * (t - 0.5f) + b;
+	return t + t * (t - 0.5f) * (t - 1.0f) * k;
+}
+
+// Entity ids at or above numPrev (created since the last beginTick()) have no previous transform
+static void interpolateScalar(
+	const ShadowTransform* prev,
+	uint32_t numPrev,
+	const uint8_t* components,
+	uint32_t componentSize,
+	const InterpolatedComponentDesc& desc,
+	const ComponentMask* masks,
+	const uint8_t* generations,
+	float alpha,
+	uint32_t firstEntityId,
+	uint32_t endEntityId,
+	InterpolatedTransform* transformsOut) noexcept
+{
+	for (uint32_t entityId = firstEntityId; entityId < endEntityId; entityId++) {
+		const ShadowTransform a = entityId < numPrev ? prev[entityId] : ShadowTransform{};
+		vec3 bPos;
+		vec4 bRot;
+		loadTransform(components + uint64_t(entityId) * componentSize, desc, bPos, bRot);
+		const uint32_t tag = entityTag(masks, generations, desc.componentType, entityId);
+		const float t = (tag != 0 && tag == a.tag) ? alpha : 1.0f;
+
+		InterpolatedTransform& out = transformsOut[entityId];
+		out.position.x = a.position.x + (bPos.x - a.position.x) * t;
+		out.position.y = a.position.y + (bPos.y - a.position.y) * t;
+		out.position.z = a.position.z + (bPos.z - a.position.z) * t;
+		out.___PADDING_UNUSED___ = 0.0f;
+
+		// Shortest path, i.e. flip b if the quaternions are in different hemispheres
+		float cosAngle = a.rotation.x * bRot.x + a.rotation.y * bRot.y +
+			a.rotation.z * bRot.z + a.rotation.w * bRot.w;
+		if (cosAngle < 0.0f) {
+			bRot = vec4(-bRot.x, -bRot.y, -bRot.z, -bRot.w);
+			cosAngle = -cosAngle;
+		}
+		const float tc = correctedT(t, cosAngle);
+		vec4 r;
+		r.x = a.rotation.x + (bRot.x - a.rotation.x) * tc;
+		r.y = a.rotation.y + (bRot.y - a.rotation.y) * tc;
+		r.z = a.rotation.z + (bRot.z - a.rotation.z) * tc;
+		r.w = a.rotation.w + (bRot.w - a.rotation.w) * tc;
+		const float lengthSquared = r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w;
+		const float invLength = lengthSquared > 0.0f ? 1.0f / std::sqrt(lengthSquared) : 0.0f;
+		out.rotation = vec4(r.x * invLength, r.y * invLength, r.z * invLength, r.w * invLength);
+	}
+}
+
+#ifdef PH_SIMD_X86
+
+// Interpolates 4 entities at a time. Positions are interpolated one entity per register, the
+// quaternions are transposed so that the dot products and normalization are done 4 at a time.
+static void interpolateSse2(
+	const ShadowTransform* prev,
+	const uint8_t* components,
+	uint32_t componentSize,
+	const InterpolatedComponentDesc& desc,
+	const ComponentMask* masks,
+	const uint8_t* generations,
+	float alpha,
+	uint32_t numEntities,
+	InterpolatedTransform* transformsOut) noexcept
+{
+	const bool hasPosition = desc.positionOffset != ~0u;
+	const bool hasRotation = desc.rotationOffset != ~0u;
+	const __m128 identity = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+	const __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	const uint32_t numEntitiesBlocks = numEntities & ~3u;
+	for (uint32_t i = 0; i < numEntitiesBlocks; i += 4) {
+
+		// Interpolation parameter per entity, entities which did not have the component in the
+		// previous tick are not interpolated
+		alignas(16) float tLanes[4];
+		for (uint32_t j = 0; j < 4; j++) {
+			const uint32_t tag = entityTag(masks, generations, desc.componentType, i + j);
+			tLanes[j] = (tag != 0 && tag == prev[i + j].tag) ? alpha : 1.0f;
+		}
+		const __m128 t = _mm_load_ps(tLanes);
+
+		// Positions
+		for (uint32_t j = 0; j < 4; j++) {
+			const float* a = &prev[i + j].position.x;
+			__m128 aPos = _mm_and_ps(_mm_loadu_ps(a), xyzMask);
+			__m128 bPos = _mm_setzero_ps();
+			if (hasPosition) {
+				const float* b = reinterpret_cast<const float*>(
+					components + uint64_t(i + j) * componentSize + desc.positionOffset);
+				bPos = _mm_movelh_ps(
+					_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(b)),
+					_mm_load_ss(b + 2));
+			}
+			__m128 tj = _mm_set1_ps(tLanes[j]);
+			__m128 pos = _mm_add_ps(aPos, _mm_mul_ps(_mm_sub_ps(bPos, aPos), tj));
+			_mm_storeu_ps(&transformsOut[i + j].position.x, pos);
+		}
+
+		// Rotations, transposed to (x, y, z, w) of 4 entities
+		__m128 ax = _mm_loadu_ps(&prev[i + 0].rotation.x);
+		__m128 ay = _mm_loadu_ps(&prev[i + 1].rotation.x);
+		__m128 az = _mm_loadu_ps(&prev[i + 2].rotation.x);
+		__m128 aw = _mm_loadu_ps(&prev[i + 3].rotation.x);
+		_MM_TRANSPOSE4_PS(ax, ay, az, aw);
+		__m128 bx = identity, by = identity, bz = identity, bw = identity;
+		if (hasRotation) {
+			const uint8_t* b = components + uint64_t(i) * componentSize + desc.rotationOffset;
+			bx = _mm_loadu_ps(reinterpret_cast<const float*>(b));
+			by = _mm_loadu_ps(reinterpret_cast<const float*>(b + componentSize));
+			bz = _mm_loadu_ps(reinterpret_cast<const float*>(b + 2 * componentSize));
+			bw = _mm_loadu_ps(reinterpret_cast<const float*>(b + 3 * componentSize));
+		}
+		_MM_TRANSPOSE4_PS(bx, by, bz, bw);
+
+		// Shortest path, flip b where the dot product is negative
+		__m128 cosAngle = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+			_mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+		const __m128 flip = _mm_and_ps(cosAngle, signMask);
+		bx = _mm_xor_ps(bx, flip);
+		by = _mm_xor_ps(by, flip);
+		bz = _mm_xor_ps(bz, flip);
+		bw = _mm_xor_ps(bw, flip);
+		const __m128 d = _mm_andnot_ps(signMask, cosAngle);
+
+		// Corrected interpolation parameter, see correctedT()
+		__m128 ca = _mm_add_ps(_mm_set1_ps(-3.2452f),
+			_mm_mul_ps(d, _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)))));
+		ca = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, ca));
+		__m128 cb = _mm_add_ps(_mm_set1_ps(-1.06021f), _mm_mul_ps(d, _mm_set1_ps(0.215638f)));
+		cb = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, cb));
+		const __m128 tMinusHalf = _mm_sub_ps(t, half);
+		const __m128 k = _mm_add_ps(_mm_mul_ps(ca, _mm_mul_ps(tMinusHalf, tMinusHalf)), cb);
+		const __m128 tc = _mm_add_ps(t,
+			_mm_mul_ps(_mm_mul_ps(t, tMinusHalf), _mm_mul_ps(_mm_sub_ps(t, one), k)));
+
+		// Lerp and normalize, zero quaternions (entities without the component) stay zero
+		__m128 rx = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), tc));
+		__m128 ry = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), tc));
+		__m128 rz = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), tc));
+		__m128 rw = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), tc));
+		const __m128 lengthSquared = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)),
+			_mm_add_ps(_mm_mul_ps(rz, rz), _mm_mul_ps(rw, rw)));
+		const __m128 invLength = _mm_and_ps(
+			_mm_div_ps(one, _mm_sqrt_ps(lengthSquared)),
+			_mm_cmpgt_ps(lengthSquared, _mm_setzero_ps()));
+		rx = _mm_mul_ps(rx, invLength);
+		ry = _mm_mul_ps(ry, invLength);
+		rz = _mm_mul_ps(rz, invLength);
+		rw = _mm_mul_ps(rw, invLength);
+		_MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+		_mm_storeu_ps(&transformsOut[i + 0].rotation.x, rx);
+		_mm_storeu_ps(&transformsOut[i + 1].rotation.x, ry);
+		_mm_storeu_ps(&transformsOut[i + 2].rotation.x, rz);
+		_mm_storeu_ps(&transformsOut[i + 3].rotation.x, rw);
+	}
+
+	// Handle remaining entities
+	interpolateScalar(prev, numEntities, components, componentSize, desc, masks, generations, alpha,
+		numEntitiesBlocks, numEntities, transformsOut);
+}
+
+#endif
+
+// GameStateInterpolator: State methods
+// ------------------------------------------------------------------------------------------------
+
+void GameStateInterpolator::init(
+	const GameStateHeader* state,
+	const InterpolatedComponentDesc* descs,
+	uint32_t numDescs,
+	sfz::Allocator* allocator) noexcept
+{
+	this->destroy();
+	mState = allocator->newObject<GameStateInterpolatorState>(sfz_dbg("GameStateInterpolatorState"));
+	mState->allocator = allocator;
+	mState->types.init(numDescs, allocator, sfz_dbg("GameStateInterpolator::types"));
+
+	for (uint32_t i = 0; i < numDescs; i++) {
+		const InterpolatedComponentDesc& desc = descs[i];
+		sfz_assert(desc.componentType != 0 && desc.componentType < state->numComponentTypes);
+		sfz_assert(!state->componentTypeIsSparse(desc.componentType));
+		sfz_assert(!state->componentTypeIsSoA(desc.componentType));
+		InterpolatedType type;
+		type.desc = desc;
+		state->componentsUntyped(desc.componentType, type.componentSize);
+		sfz_assert(desc.positionOffset == ~0u ||
+			(desc.positionOffset + sizeof(vec3)) <= type.componentSize);
+		sfz_assert(desc.rotationOffset == ~0u ||
+			(desc.rotationOffset + sizeof(vec4)) <= type.componentSize);
+
+		// Initialize the shadow copy to the current state
+		type.shadow.init(state->entityHighWaterMark, allocator,
+			sfz_dbg("GameStateInterpolator::shadow"));
+		type.shadow.add(ShadowTransform{}, state->entityHighWaterMark);
+		copyTransforms(state, type, 0, state->entityHighWaterMark);
+		mState->types.add(std::move(type));
+	}
+}
+
+void GameStateInterpolator::swap(GameStateInterpolator& other) noexcept
+{
+	std::swap(this->mState, other.mState);
+}
+
+void GameStateInterpolator::destroy() noexcept
+{
+	if (mState == nullptr) return;
+	sfz::Allocator* allocator = mState->allocator;
+	allocator->deleteObject(mState);
+	mState = nullptr;
+}
+
+// GameStateInterpolator: Methods
+// ------------------------------------------------------------------------------------------------
+
+uint32_t GameStateInterpolator::numInterpolated() const noexcept
+{
+	return mState->types.size();
+}
+
+uint32_t GameStateInterpolator::beginTick(const GameStateHeader* state) noexcept
+{
+	const uint32_t highWaterMark = state->entityHighWaterMark;
+	uint32_t numCopied = 0;
+	for (InterpolatedType& type : mState->types) {
+
+		// Grow the shadow copy, new entity ids have no previous transform
+		if (type.shadow.size() < highWaterMark) {
+			type.shadow.add(ShadowTransform{}, highWaterMark - type.shadow.size());
+		}
+
+		// Without dirty tracking everything is copied
+		if (!state->dirtyTrackingEnabled()) {
+			copyTransforms(state, type, 0, highWaterMark);
+			numCopied += highWaterMark;
+			continue;
+		}
+
+		// Copy the blocks dirty for either the entity bookkeeping or the component type. Ids above
+		// the high-water mark are skipped, their entities have a new generation if they are ever
+		// created again.
+		const uint64_t* dirtyBookkeeping = state->dirtyBlocks(0);
+		const uint64_t* dirtyComponents = state->dirtyBlocks(type.desc.componentType);
+		const uint32_t blockSize = state->dirtyBlockSize;
+		const uint32_t numBlocks = (highWaterMark + blockSize - 1) / blockSize;
+		for (uint32_t wordIdx = 0; wordIdx < (numBlocks + 63) / 64; wordIdx++) {
+			uint64_t bits = dirtyBookkeeping[wordIdx] | dirtyComponents[wordIdx];
+			while (bits != 0) {
+				const uint32_t blockIdx = wordIdx * 64 + lowestSetBitIdx(bits);
+				bits &= bits - 1;
+				if (blockIdx >= numBlocks) break;
+				const uint32_t firstEntityId = blockIdx * blockSize;
+				uint32_t endEntityId = firstEntityId + blockSize;
+				if (endEntityId > highWaterMark) endEntityId = highWaterMark;
+				copyTransforms(state, type, firstEntityId, endEntityId);
+				numCopied += endEntityId - firstEntityId;
+			}
+		}
+	}
+	return numCopied;
+}
+
+void GameStateInterpolator::interpolate(
+	const GameStateHeader* state,
+	uint32_t interpolatedIdx,
+	float alpha,
+	InterpolatedTransform* transformsOut) const noexcept
+{
+	sfz_assert(interpolatedIdx < mState->types.size());
+	const InterpolatedType& type = mState->types[interpolatedIdx];
+	const uint32_t numEntities = state->entityHighWaterMark;
+	const uint32_t numPrev = std::min(numEntities, type.shadow.size());
+	uint32_t componentSize = 0;
+	const uint8_t* components = state->componentsUntyped(type.desc.componentType, componentSize);
+	sfz_assert(componentSize == type.componentSize);
+	const ComponentMask* masks = state->componentMasks();
+	const uint8_t* generations = state->entityGenerations();
+
+	// Entities created since the last beginTick() are past the end of the shadow copy
+#ifdef PH_SIMD_X86
+	interpolateSse2(type.shadow.data(), components, componentSize, type.desc, masks, generations,
+		alpha, numPrev, transformsOut);
+#else
+	interpolateScalar(type.shadow.data(), numPrev, components, componentSize, type.desc, masks,
+		generations, alpha, 0, numPrev, transformsOut);
+#endif
+	interpolateScalar(type.shadow.data(), numPrev, components, componentSize, type.desc, masks,
+		generations, alpha, numPrev, numEntities, transformsOut);
+}
+
+} // namespace ph
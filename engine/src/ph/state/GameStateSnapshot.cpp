@@ -0,0 +1,753 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/GameStateSnapshot.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sfz/Assert.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/SimdSupport.hpp"
+#include "ph/util/ThreadPool.hpp"
+
+namespace ph {
+
+// Statics: LZ codec
+// ------------------------------------------------------------------------------------------------
+
+// A byte oriented LZ77 codec using the same sequence format as LZ4. Each sequence is a token
+// (4 bits literal length, 4 bits match length - 4), optional extra literal length bytes, the
+// literals, a 16-bit little endian match offset and optional extra match length bytes. The last
+// sequence only contains literals. Lengths of 15 or more continue in extra bytes, each adding up
+// to 255.
+
+constexpr uint32_t LZ_MIN_MATCH = 4;
+constexpr uint32_t LZ_LAST_LITERALS = 8; // Matches never extend into the last bytes
+constexpr uint32_t LZ_MAX_OFFSET = 65535;
+constexpr uint32_t LZ_HASH_BITS = 13;
+
+static uint32_t lzCompressBound(uint32_t srcSize) noexcept
+{
+	return srcSize + srcSize / 255 + 16;
+}
+
+static uint32_t read32(const uint8_t* ptr) noexcept
+{
+	uint32_t val;
+	memcpy(&val, ptr, sizeof(uint32_t));
+	return val;
+}
+
+static uint64_t read64(const uint8_t* ptr) noexcept
+{
+	uint64_t val;
+	memcpy(&val, ptr, sizeof(uint64_t));
+	return val;
+}
+
+static uint32_t lzHash(uint32_t sequence) noexcept
+{
+	return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t* lzWriteLength(uint8_t* op, uint32_t length) noexcept
+{
+	while (length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = uint8_t(length);
+	return op;
+}
+
+// Writes a sequence, a matchLength of 0 means that it is the last sequence (only literals)
+static uint8_t* lzWriteSequence(
+	uint8_t* op,
+	const uint8_t* literals,
+	uint32_t numLiterals,
+	uint32_t offset,
+	uint32_t matchLength) noexcept
+{
+	uint8_t* token = op++;
+	const uint32_t literalsToken = std::min(numLiterals, 15u);
+	if (numLiterals >= 15) op = lzWriteLength(op, numLiterals - 15);
+	memcpy(op, literals, numLiterals);
+	op += numLiterals;
+	if (matchLength == 0) {
+		*token = uint8_t(literalsToken << 4);
+		return op;
+	}
+
+	*op++ = uint8_t(offset & 0xFF);
+	*op++ = uint8_t(offset >> 8);
+	const uint32_t matchLengthMinusMin = matchLength - LZ_MIN_MATCH;
+	const uint32_t matchToken = std::min(matchLengthMinusMin, 15u);
+	if (matchLengthMinusMin >= 15) op = lzWriteLength(op, matchLengthMinusMin - 15);
+	*token = uint8_t((literalsToken << 4) | matchToken);
+	return op;
+}
+
+// Compresses src into dst, which must have room for lzCompressBound(srcSize) bytes. Returns the
+// compressed size.
+static uint32_t lzCompress(const uint8_t* src, uint32_t srcSize, uint8_t* dst) noexcept
+{
+	uint32_t hashTable[1 << LZ_HASH_BITS];
+	memset(hashTable, 0xFF, sizeof(hashTable));
+
+	uint8_t* op = dst;
+	uint32_t anchor = 0;
+	uint32_t ip = 0;
+	const uint32_t matchLimit = srcSize > LZ_LAST_LITERALS ? srcSize - LZ_LAST_LITERALS : 0;
+	while ((ip + LZ_MIN_MATCH) <= matchLimit) {
+
+		// Look for match, skip ahead faster the longer it has been since the last match so that
+		// incompressible data is passed through quickly
+		const uint32_t sequence = read32(src + ip);
+		const uint32_t hash = lzHash(sequence);
+		uint32_t candidate = hashTable[hash];
+		hashTable[hash] = ip;
+		if (candidate >= ip || (ip - candidate) > LZ_MAX_OFFSET || read32(src + candidate) != sequence) {
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+
+		// Extend match backwards into the pending literals
+		uint32_t matchLength = LZ_MIN_MATCH;
+		while (ip > anchor && candidate > 0 && src[ip - 1] == src[candidate - 1]) {
+			ip -= 1;
+			candidate -= 1;
+			matchLength += 1;
+		}
+
+		// Extend match forwards, 8 bytes at a time
+		bool mismatchFound = false;
+		while ((ip + matchLength + 8) <= matchLimit) {
+			uint64_t diff = read64(src + ip + matchLength) ^ read64(src + candidate + matchLength);
+			if (diff != 0) {
+				matchLength += lowestSetBitIdx(diff) / 8;
+				mismatchFound = true;
+				break;
+			}
+			matchLength += 8;
+		}
+		if (!mismatchFound) {
+			while ((ip + matchLength) < matchLimit &&
+				src[ip + matchLength] == src[candidate + matchLength]) {
+				matchLength += 1;
+			}
+		}
+
+		op = lzWriteSequence(op, src + anchor, ip - anchor, ip - candidate, matchLength);
+		ip += matchLength;
+		anchor = ip;
+	}
+
+	op = lzWriteSequence(op, src + anchor, srcSize - anchor, 0, 0);
+	return uint32_t(op - dst);
+}
+
+// Decompresses src into dst, which must decompress to exactly dstSize bytes. Returns false if the
+// compressed data is malformed, never reads or writes out of bounds.
+static bool lzDecompress(
+	const uint8_t* src, uint32_t srcSize, uint8_t* dst, uint32_t dstSize) noexcept
+{
+	const uint8_t* ip = src;
+	const uint8_t* const ipEnd = src + srcSize;
+	uint8_t* op = dst;
+	uint8_t* const opEnd = dst + dstSize;
+
+	auto readLength = [&](uint32_t& length) {
+		uint8_t byte = 255;
+		while (byte == 255) {
+			if (ip >= ipEnd) return false;
+			byte = *ip++;
+			length += byte;
+			if (length > dstSize) return false;
+		}
+		return true;
+	};
+
+	while (true) {
+		if (ip >= ipEnd) return false;
+		const uint32_t token = *ip++;
+
+		// Literals
+		uint32_t numLiterals = token >> 4;
+		if (numLiterals == 15 && !readLength(numLiterals)) return false;
+		if (numLiterals > uint32_t(ipEnd - ip)) return false;
+		if (numLiterals > uint32_t(opEnd - op)) return false;
+		memcpy(op, ip, numLiterals);
+		ip += numLiterals;
+		op += numLiterals;
+
+		// Last sequence has no match
+		if (ip == ipEnd) return op == opEnd;
+
+		// Match
+		if ((ipEnd - ip) < 2) return false;
+		const uint32_t offset = uint32_t(ip[0]) | (uint32_t(ip[1]) << 8);
+		ip += 2;
+		if (offset == 0 || offset > uint32_t(op - dst)) return false;
+		uint32_t matchLength = token & 0xF;
+		if (matchLength == 15 && !readLength(matchLength)) return false;
+		matchLength += LZ_MIN_MATCH;
+		if (matchLength > uint32_t(opEnd - op)) return false;
+		const uint8_t* match = op - offset;
+		if (offset >= matchLength) {
+			memcpy(op, match, matchLength);
+		}
+		else {
+			// Overlapping match, i.e. a repeating pattern
+			for (uint32_t i = 0; i < matchLength; i++) op[i] = match[i];
+		}
+		op += matchLength;
+	}
+}
+
+// Statics: Chunk codec
+// ------------------------------------------------------------------------------------------------
+
+constexpr uint32_t ZERO_BLOCK_SIZE = GAME_STATE_SNAPSHOT_ZERO_BLOCK_SIZE;
+constexpr uint32_t CHUNK_SIZE = GAME_STATE_SNAPSHOT_CHUNK_SIZE;
+static_assert(ZERO_BLOCK_SIZE == 64, "Zero block test assumes 64 byte blocks");
+static_assert((CHUNK_SIZE % ZERO_BLOCK_SIZE) == 0, "Chunks must consist of whole zero blocks");
+
+static uint32_t numZeroBlocksBitsetBytes(uint32_t chunkSize) noexcept
+{
+	uint32_t numBlocks = (chunkSize + ZERO_BLOCK_SIZE - 1) / ZERO_BLOCK_SIZE;
+	return ((numBlocks + 63) / 64) * sizeof(uint64_t);
+}
+
+static uint32_t chunkCompressBound(uint32_t chunkSize) noexcept
+{
+	return numZeroBlocksBitsetBytes(chunkSize) + lzCompressBound(chunkSize);
+}
+
+static bool blockIsZero(const uint8_t* block, uint32_t blockSize) noexcept
+{
+	if (blockSize == ZERO_BLOCK_SIZE) {
+		uint64_t bits = 0;
+		for (uint32_t i = 0; i < ZERO_BLOCK_SIZE; i += 8) bits |= read64(block + i);
+		return bits == 0;
+	}
+	for (uint32_t i = 0; i < blockSize; i++) {
+		if (block[i] != 0) return false;
+	}
+	return true;
+}
+
+// Transposes the chunk, viewed as an array of elements of the given stride, so that byte i of all
+// elements are stored together in plane i. Any partial element at the end is copied as is.
+static void shuffleBytePlanes(
+	const uint8_t* src, uint32_t size, uint32_t stride, uint8_t* dst) noexcept
+{
+	const uint32_t numElements = size / stride;
+	for (uint32_t planeIdx = 0; planeIdx < stride; planeIdx++) {
+		uint8_t* plane = dst + planeIdx * numElements;
+		const uint8_t* srcPtr = src + planeIdx;
+		for (uint32_t i = 0; i < numElements; i++) {
+			plane[i] = srcPtr[i * stride];
+		}
+	}
+	memcpy(dst + numElements * stride, src + numElements * stride, size - numElements * stride);
+}
+
+static void unshuffleBytePlanes(
+	const uint8_t* src, uint32_t size, uint32_t stride, uint8_t* dst) noexcept
+{
+	const uint32_t numElements = size / stride;
+	for (uint32_t planeIdx = 0; planeIdx < stride; planeIdx++) {
+		const uint8_t* plane = src + planeIdx * numElements;
+		uint8_t* dstPtr = dst + planeIdx;
+		for (uint32_t i = 0; i < numElements; i++) {
+			dstPtr[i * stride] = plane[i];
+		}
+	}
+	memcpy(dst + numElements * stride, src + numElements * stride, size - numElements * stride);
+}
+
+// Compresses a chunk into dst, which must have room for chunkCompressBound() bytes. tmp must have
+// room for 2 * CHUNK_SIZE bytes. Returns the compressed size.
+static uint32_t compressChunk(
+	const uint8_t* src,
+	uint32_t size,
+	uint32_t shuffleStride,
+	uint8_t* dst,
+	uint8_t* tmp) noexcept
+{
+	sfz_assert(size <= CHUNK_SIZE);
+
+	// Shuffle, all-zero elements stay all-zero in each plane
+	if (shuffleStride != 0) {
+		shuffleBytePlanes(src, size, shuffleStride, tmp + CHUNK_SIZE);
+		src = tmp + CHUNK_SIZE;
+	}
+
+	// Pack all non-zero blocks and write the bitset of which blocks they are
+	const uint32_t numBlocks = (size + ZERO_BLOCK_SIZE - 1) / ZERO_BLOCK_SIZE;
+	const uint32_t bitsetBytes = numZeroBlocksBitsetBytes(size);
+	uint8_t* packed = tmp;
+	uint32_t packedSize = 0;
+	for (uint32_t wordIdx = 0; wordIdx < bitsetBytes / 8; wordIdx++) {
+		uint64_t word = 0;
+		const uint32_t firstBlockIdx = wordIdx * 64;
+		const uint32_t numBlocksInWord = std::min(numBlocks - firstBlockIdx, 64u);
+		for (uint32_t i = 0; i < numBlocksInWord; i++) {
+			const uint32_t blockOffset = (firstBlockIdx + i) * ZERO_BLOCK_SIZE;
+			const uint32_t blockSize = std::min(size - blockOffset, ZERO_BLOCK_SIZE);
+			if (blockIsZero(src + blockOffset, blockSize)) continue;
+			word |= uint64_t(1) << i;
+			memcpy(packed + packedSize, src + blockOffset, blockSize);
+			packedSize += blockSize;
+		}
+		memcpy(dst + wordIdx * 8, &word, sizeof(uint64_t));
+	}
+
+	return bitsetBytes + lzCompress(packed, packedSize, dst + bitsetBytes);
+}
+
+// Decompresses a chunk compressed by compressChunk() into dst. tmp must have room for
+// 2 * CHUNK_SIZE bytes. Returns false if the compressed chunk is malformed.
+static bool decompressChunk(
+	const uint8_t* src,
+	uint32_t srcSize,
+	uint32_t shuffleStride,
+	uint8_t* dst,
+	uint32_t size,
+	uint8_t* tmp) noexcept
+{
+	sfz_assert(size <= CHUNK_SIZE);
+	const uint32_t numBlocks = (size + ZERO_BLOCK_SIZE - 1) / ZERO_BLOCK_SIZE;
+	const uint32_t bitsetBytes = numZeroBlocksBitsetBytes(size);
+	if (srcSize < bitsetBytes) return false;
+
+	// Calculate size of packed non-zero blocks
+	uint32_t packedSize = 0;
+	for (uint32_t blockIdx = 0; blockIdx < numBlocks; blockIdx++) {
+		uint64_t word = read64(src + (blockIdx / 64) * 8);
+		if ((word & (uint64_t(1) << (blockIdx % 64))) == 0) continue;
+		packedSize += std::min(size - blockIdx * ZERO_BLOCK_SIZE, ZERO_BLOCK_SIZE);
+	}
+
+	// Decompress packed blocks
+	if (!lzDecompress(src + bitsetBytes, srcSize - bitsetBytes, tmp, packedSize)) return false;
+
+	// Scatter non-zero blocks and zero the rest, into temporary memory if it needs to be unshuffled
+	uint8_t* unpacked = shuffleStride != 0 ? tmp + CHUNK_SIZE : dst;
+	uint32_t packedOffset = 0;
+	for (uint32_t blockIdx = 0; blockIdx < numBlocks; blockIdx++) {
+		const uint32_t blockOffset = blockIdx * ZERO_BLOCK_SIZE;
+		const uint32_t blockSize = std::min(size - blockOffset, ZERO_BLOCK_SIZE);
+		uint64_t word = read64(src + (blockIdx / 64) * 8);
+		if ((word & (uint64_t(1) << (blockIdx % 64))) != 0) {
+			memcpy(unpacked + blockOffset, tmp + packedOffset, blockSize);
+			packedOffset += blockSize;
+		}
+		else {
+			memset(unpacked + blockOffset, 0, blockSize);
+		}
+	}
+
+	if (shuffleStride != 0) unshuffleBytePlanes(unpacked, size, shuffleStride, dst);
+	return true;
+}
+
+// Statics: Snapshot
+// ------------------------------------------------------------------------------------------------
+
+// Splits the state into chunks, component arrays to shuffle get their own chunks consisting of
+// whole components. Structure-of-arrays component arrays get chunks per column instead, shuffled
+// with the size of the field.
+static void createChunks(
+	const GameStateHeader* state, bool shuffleComponents, DynArray<SnapshotChunk>& chunksOut) noexcept
+{
+	const uint32_t stateSizeBytes = uint32_t(state->stateSizeBytes);
+	uint32_t cursor = 0;
+	auto addChunks = [&](uint32_t end, uint32_t shuffleStride) {
+		end = std::min(end, stateSizeBytes);
+		const uint32_t maxChunkSize =
+			shuffleStride != 0 ? (CHUNK_SIZE / shuffleStride) * shuffleStride : CHUNK_SIZE;
+		while (cursor < end) {
+			SnapshotChunk chunk = {};
+			chunk.offsetBytes = cursor;
+			chunk.sizeBytes = std::min(end - cursor, maxChunkSize);
+			chunk.shuffleStride = shuffleStride;
+			chunksOut.add(chunk);
+			cursor += chunk.sizeBytes;
+		}
+	};
+
+	if (shuffleComponents) {
+		const uint8_t* statePtr = reinterpret_cast<const uint8_t*>(state);
+		for (uint32_t i = 1; i < state->numComponentTypes; i++) {
+			uint32_t componentSize = 0;
+			const uint8_t* components = state->componentsUntyped(i, componentSize);
+			if (components == nullptr || componentSize > GAME_STATE_SNAPSHOT_MAX_SHUFFLE_STRIDE) {
+				continue;
+			}
+			uint32_t offset = uint32_t(components - statePtr);
+			if (offset < cursor) continue;
+			const ArrayHeader* componentsArray = state->arrayAt(offset - sizeof(ArrayHeader));
+			uint32_t numFields = 0;
+			const ComponentField* fields = state->componentFields(i, numFields);
+			if (fields == nullptr) {
+				addChunks(offset, 0);
+				addChunks(offset + componentsArray->capacity * componentSize, componentSize);
+				continue;
+			}
+			for (uint32_t j = 0; j < numFields; j++) {
+				const uint32_t columnOffset = offset + fields[j].offset * componentsArray->capacity;
+				addChunks(columnOffset, 0);
+				addChunks(columnOffset + componentsArray->capacity * fields[j].sizeInBytes,
+					fields[j].sizeInBytes);
+			}
+		}
+	}
+	addChunks(stateSizeBytes, 0);
+}
+
+// Returns the index of the first of the uncommitted ranges of a state (sorted, see
+// GameStateUncommittedRanges) overlapping the given part of the state, ~0 if there is none.
+static uint32_t firstOverlappingRange(
+	const DynArray<GameStateByteRange>& uncommittedRanges, uint32_t offset, uint32_t size) noexcept
+{
+	const GameStateByteRange* ranges = uncommittedRanges.data();
+	const GameStateByteRange* rangesEnd = ranges + uncommittedRanges.size();
+	const GameStateByteRange* range = std::upper_bound(ranges, rangesEnd, offset,
+		[](uint32_t offset, const GameStateByteRange& range) {
+		return offset < (range.offsetBytes + range.sizeBytes);
+	});
+	if (range == rangesEnd || range->offsetBytes >= (offset + size)) return ~0u;
+	return uint32_t(range - ranges);
+}
+
+// Calls func(offset, size, committed) for consecutive parts of the given part of a state,
+// alternating between committed memory and the uncommitted ranges overlapping it. rangeIdx is the
+// first overlapping range, see firstOverlappingRange().
+template<typename Func>
+static void forEachCommittedPart(
+	const DynArray<GameStateByteRange>& uncommittedRanges,
+	uint32_t rangeIdx,
+	uint32_t offset,
+	uint32_t size,
+	Func&& func) noexcept
+{
+	const uint32_t end = offset + size;
+	uint32_t cursor = offset;
+	for (; rangeIdx < uncommittedRanges.size(); rangeIdx++) {
+		const GameStateByteRange& range = uncommittedRanges[rangeIdx];
+		if (range.offsetBytes >= end) break;
+		const uint32_t rangeBegin = std::max(range.offsetBytes, cursor);
+		const uint32_t rangeEnd = std::min(range.offsetBytes + range.sizeBytes, end);
+		if (cursor < rangeBegin) func(cursor, rangeBegin - cursor, true);
+		func(rangeBegin, rangeEnd - rangeBegin, false);
+		cursor = rangeEnd;
+	}
+	if (cursor < end) func(cursor, end - cursor, true);
+}
+
+// Reads and validates the header and chunk table of a snapshot, without allocating anything. The
+// chunks must cover the entire state in order and their compressed data must lie inside the
+// snapshot.
+static bool readSnapshotHeader(
+	const uint8_t* snapshot, uint64_t snapshotSizeBytes, SnapshotHeader& headerOut) noexcept
+{
+	if (snapshotSizeBytes < sizeof(SnapshotHeader)) return false;
+	SnapshotHeader header;
+	memcpy(&header, snapshot, sizeof(SnapshotHeader));
+	if (header.magicNumber != GAME_STATE_SNAPSHOT_MAGIC_NUMBER) return false;
+	if (header.stateSizeBytes > UINT32_MAX) return false;
+	const uint64_t dataOffset = sizeof(SnapshotHeader) + uint64_t(header.numChunks) * sizeof(SnapshotChunk);
+	if (dataOffset > snapshotSizeBytes) return false;
+	if (header.compressedSizeBytes != (snapshotSizeBytes - dataOffset)) return false;
+
+	uint64_t expectedOffset = 0;
+	for (uint32_t i = 0; i < header.numChunks; i++) {
+		SnapshotChunk chunk;
+		memcpy(&chunk, snapshot + sizeof(SnapshotHeader) + i * sizeof(SnapshotChunk),
+			sizeof(SnapshotChunk));
+		if (chunk.offsetBytes != expectedOffset) return false;
+		if (chunk.sizeBytes == 0 || chunk.sizeBytes > CHUNK_SIZE) return false;
+		if (chunk.shuffleStride > GAME_STATE_SNAPSHOT_MAX_SHUFFLE_STRIDE) return false;
+		if (chunk.compressedOffsetBytes > header.compressedSizeBytes) return false;
+		if (chunk.compressedSizeBytes > (header.compressedSizeBytes - chunk.compressedOffsetBytes)) {
+			return false;
+		}
+		if (chunk.compressedSizeBytes < numZeroBlocksBitsetBytes(chunk.sizeBytes)) return false;
+		expectedOffset += chunk.sizeBytes;
+	}
+	if (expectedOffset != header.stateSizeBytes) return false;
+
+	headerOut = header;
+	return true;
+}
+
+// Decompresses the GameStateHeader in the first chunk of a snapshot (validated with
+// readSnapshotHeader()) and checks that it agrees with the snapshot header. Returns the number of
+// committed entities of the state.
+static bool decompressStateHeader(
+	const uint8_t* snapshot,
+	const SnapshotHeader& header,
+	uint32_t& committedNumEntitiesOut,
+	sfz::Allocator* allocator) noexcept
+{
+	if (header.numChunks == 0) return false;
+	SnapshotChunk firstChunk;
+	memcpy(&firstChunk, snapshot + sizeof(SnapshotHeader), sizeof(SnapshotChunk));
+	if (firstChunk.sizeBytes < sizeof(GameStateHeader)) return false;
+	const uint64_t dataOffset = sizeof(SnapshotHeader) + uint64_t(header.numChunks) * sizeof(SnapshotChunk);
+	DynArray<uint8_t> tmp;
+	tmp.init(3 * CHUNK_SIZE, allocator, sfz_dbg("decompressStateHeader::tmp"));
+	tmp.hackSetSize(tmp.capacity());
+	uint8_t* firstChunkData = tmp.data() + 2 * CHUNK_SIZE;
+	bool firstChunkSuccess = decompressChunk(
+		snapshot + dataOffset + firstChunk.compressedOffsetBytes,
+		firstChunk.compressedSizeBytes,
+		firstChunk.shuffleStride,
+		firstChunkData,
+		firstChunk.sizeBytes,
+		tmp.data());
+	if (!firstChunkSuccess) return false;
+	const GameStateHeader* stateHeader = reinterpret_cast<const GameStateHeader*>(firstChunkData);
+	if (stateHeader->magicNumber != GAME_STATE_MAGIC_NUMBER) return false;
+	if (stateHeader->gameStateVersion != GAME_STATE_VERSION) return false;
+	if (stateHeader->stateSizeBytes != header.stateSizeBytes) return false;
+	committedNumEntitiesOut = stateHeader->committedNumEntities;
+	return true;
+}
+
+// Runs func(chunkIdx, threadIdx) for all chunks in [firstChunkIdx, firstChunkIdx + numChunks)
+template<typename Func>
+static void runChunkTasks(
+	ThreadPool* threadPool, uint32_t firstChunkIdx, uint32_t numChunks, Func& func) noexcept
+{
+	auto task = [&](uint32_t taskIdx, uint32_t threadIdx) {
+		func(firstChunkIdx + taskIdx, threadIdx);
+	};
+	if (threadPool != nullptr) {
+		threadPool->runFunc(numChunks, task);
+	}
+	else {
+		for (uint32_t i = 0; i < numChunks; i++) task(i, 0);
+	}
+}
+
+// Snapshot functions
+// ------------------------------------------------------------------------------------------------
+
+void compressGameState(
+	const GameStateHeader* state,
+	DynArray<uint8_t>& snapshotOut,
+	bool shuffleComponents,
+	ThreadPool* threadPool,
+	sfz::Allocator* allocator) noexcept
+{
+	const uint8_t* statePtr = reinterpret_cast<const uint8_t*>(state);
+	const uint32_t numThreads = threadPool != nullptr ? threadPool->numThreads() : 1;
+
+	// Create chunk table
+	DynArray<SnapshotChunk> chunks;
+	chunks.init(uint32_t(state->stateSizeBytes / CHUNK_SIZE) + 2 * state->numComponentTypes + 1,
+		allocator, sfz_dbg("compressGameState::chunks"));
+	createChunks(state, shuffleComponents, chunks);
+
+	// The uncommitted ranges of a growable game state, which are compressed as zero without being
+	// read (see GameStateUncommittedRanges)
+	DynArray<GameStateByteRange> uncommittedRanges;
+	uncommittedRanges.init(0, allocator, sfz_dbg("compressGameState::uncommittedRanges"));
+	GameStateUncommittedRanges uncommittedRangesIt(state);
+	GameStateByteRange uncommittedRange;
+	while (uncommittedRangesIt.next(uncommittedRange)) uncommittedRanges.add(uncommittedRange);
+
+	// Write header and chunk table, compressed offsets and sizes are patched in as chunks are done
+	snapshotOut.clear();
+	SnapshotHeader header = {};
+	header.magicNumber = GAME_STATE_SNAPSHOT_MAGIC_NUMBER;
+	header.stateSizeBytes = state->stateSizeBytes;
+	header.numChunks = chunks.size();
+	snapshotOut.add(reinterpret_cast<const uint8_t*>(&header), sizeof(SnapshotHeader));
+	snapshotOut.add(uint8_t(0), chunks.size() * sizeof(SnapshotChunk));
+	const uint32_t dataOffset = snapshotOut.size();
+
+	// Temporary memory, each batch compresses a few chunks per thread into their own slots. Each
+	// thread also has room for a copy of a chunk with its uncommitted ranges zeroed.
+	const uint32_t numChunksPerBatch = numThreads * 4;
+	const uint32_t slotSize = chunkCompressBound(CHUNK_SIZE);
+	DynArray<uint8_t> tmp;
+	tmp.init(numThreads * 3 * CHUNK_SIZE + numChunksPerBatch * slotSize,
+		allocator, sfz_dbg("compressGameState::tmp"));
+	tmp.hackSetSize(tmp.capacity());
+	uint8_t* slots = tmp.data() + numThreads * 3 * CHUNK_SIZE;
+
+	for (uint32_t batchBegin = 0; batchBegin < chunks.size(); batchBegin += numChunksPerBatch) {
+		const uint32_t numChunksInBatch = std::min(chunks.size() - batchBegin, numChunksPerBatch);
+
+		// Compress batch in parallel
+		auto compressTask = [&](uint32_t chunkIdx, uint32_t threadIdx) {
+			SnapshotChunk& chunk = chunks[chunkIdx];
+			uint8_t* threadTmp = tmp.data() + threadIdx * 3 * CHUNK_SIZE;
+			const uint8_t* src = statePtr + chunk.offsetBytes;
+			const uint32_t rangeIdx =
+				firstOverlappingRange(uncommittedRanges, chunk.offsetBytes, chunk.sizeBytes);
+			if (rangeIdx != ~0u) {
+				uint8_t* copy = threadTmp + 2 * CHUNK_SIZE;
+				forEachCommittedPart(uncommittedRanges, rangeIdx, chunk.offsetBytes, chunk.sizeBytes,
+					[&](uint32_t offset, uint32_t size, bool committed) {
+					uint8_t* copyPart = copy + (offset - chunk.offsetBytes);
+					if (committed) memcpy(copyPart, statePtr + offset, size);
+					else memset(copyPart, 0, size);
+				});
+				src = copy;
+			}
+			chunk.compressedSizeBytes = compressChunk(
+				src,
+				chunk.sizeBytes,
+				chunk.shuffleStride,
+				slots + (chunkIdx - batchBegin) * slotSize,
+				threadTmp);
+		};
+		runChunkTasks(threadPool, batchBegin, numChunksInBatch, compressTask);
+
+		// Append compressed chunks in order
+		for (uint32_t i = batchBegin; i < (batchBegin + numChunksInBatch); i++) {
+			SnapshotChunk& chunk = chunks[i];
+			chunk.compressedOffsetBytes = snapshotOut.size() - dataOffset;
+			snapshotOut.add(slots + (i - batchBegin) * slotSize, chunk.compressedSizeBytes);
+		}
+	}
+
+	// Patch header and chunk table
+	header.compressedSizeBytes = snapshotOut.size() - dataOffset;
+	memcpy(snapshotOut.data(), &header, sizeof(SnapshotHeader));
+	memcpy(snapshotOut.data() + sizeof(SnapshotHeader), chunks.data(),
+		chunks.size() * sizeof(SnapshotChunk));
+}
+
+// Decompresses the chunks of a snapshot (validated with readSnapshotHeader()) into the memory of a
+// state. Chunks overlapping the given uncommitted ranges of the state are decompressed into
+// temporary memory, and only their committed parts are copied.
+static bool decompressChunks(
+	const uint8_t* snapshot,
+	const SnapshotHeader& header,
+	uint8_t* statePtr,
+	const DynArray<GameStateByteRange>& uncommittedRanges,
+	ThreadPool* threadPool,
+	sfz::Allocator* allocator) noexcept
+{
+	const uint64_t dataOffset = sizeof(SnapshotHeader) + uint64_t(header.numChunks) * sizeof(SnapshotChunk);
+	DynArray<SnapshotChunk> chunks;
+	chunks.init(header.numChunks, allocator, sfz_dbg("decompressChunks::chunks"));
+	chunks.add(SnapshotChunk{}, header.numChunks);
+	memcpy(chunks.data(), snapshot + sizeof(SnapshotHeader), header.numChunks * sizeof(SnapshotChunk));
+
+	// Decompress chunks in parallel
+	const uint32_t numThreads = threadPool != nullptr ? threadPool->numThreads() : 1;
+	DynArray<uint8_t> tmp;
+	tmp.init(numThreads * 3 * CHUNK_SIZE, allocator, sfz_dbg("decompressChunks::tmp"));
+	tmp.hackSetSize(tmp.capacity());
+	DynArray<uint8_t> chunkSucceeded;
+	chunkSucceeded.init(chunks.size(), allocator, sfz_dbg("decompressChunks::chunkSucceeded"));
+	chunkSucceeded.add(uint8_t(0), chunks.size());
+
+	const uint8_t* data = snapshot + dataOffset;
+	auto decompressTask = [&](uint32_t chunkIdx, uint32_t threadIdx) {
+		const SnapshotChunk& chunk = chunks[chunkIdx];
+		uint8_t* threadTmp = tmp.data() + threadIdx * 3 * CHUNK_SIZE;
+		const uint32_t rangeIdx =
+			firstOverlappingRange(uncommittedRanges, chunk.offsetBytes, chunk.sizeBytes);
+		uint8_t* dst = rangeIdx != ~0u ? threadTmp + 2 * CHUNK_SIZE : statePtr + chunk.offsetBytes;
+		chunkSucceeded[chunkIdx] = decompressChunk(
+			data + chunk.compressedOffsetBytes,
+			chunk.compressedSizeBytes,
+			chunk.shuffleStride,
+			dst,
+			chunk.sizeBytes,
+			threadTmp) ? 1 : 0;
+		if (rangeIdx == ~0u) return;
+		forEachCommittedPart(uncommittedRanges, rangeIdx, chunk.offsetBytes, chunk.sizeBytes,
+			[&](uint32_t offset, uint32_t size, bool committed) {
+			if (committed) memcpy(statePtr + offset, dst + (offset - chunk.offsetBytes), size);
+		});
+	};
+	runChunkTasks(threadPool, 0, chunks.size(), decompressTask);
+
+	for (uint8_t succeeded : chunkSucceeded) {
+		if (succeeded == 0) return false;
+	}
+	return true;
+}
+
+bool decompressGameState(
+	const uint8_t* snapshot,
+	uint64_t snapshotSizeBytes,
+	GameStateHeader* stateOut,
+	ThreadPool* threadPool,
+	sfz::Allocator* allocator) noexcept
+{
+	// Validate header and chunk table
+	SnapshotHeader header;
+	if (!readSnapshotHeader(snapshot, snapshotSizeBytes, header)) return false;
+	if (header.stateSizeBytes != stateOut->stateSizeBytes) return false;
+
+	// Match the committed entities of a growable game state to the snapshot's first, its
+	// remaining uncommitted ranges are zero in the snapshot and are skipped
+	uint32_t committedNumEntities = 0;
+	if (!decompressStateHeader(snapshot, header, committedNumEntities, allocator)) return false;
+	if (committedNumEntities > stateOut->maxNumEntities) return false;
+	setCommittedNumEntities(stateOut, committedNumEntities);
+	DynArray<GameStateByteRange> uncommittedRanges;
+	uncommittedRanges.init(0, allocator, sfz_dbg("decompressGameState::uncommittedRanges"));
+	GameStateUncommittedRanges uncommittedRangesIt(stateOut);
+	GameStateByteRange uncommittedRange;
+	while (uncommittedRangesIt.next(uncommittedRange)) uncommittedRanges.add(uncommittedRange);
+
+	return decompressChunks(snapshot, header, reinterpret_cast<uint8_t*>(stateOut),
+		uncommittedRanges, threadPool, allocator);
+}
+
+GameStateContainer createGameStateFromSnapshot(
+	const uint8_t* snapshot,
+	uint64_t snapshotSizeBytes,
+	ThreadPool* threadPool,
+	sfz::Allocator* allocator) noexcept
+{
+	// Validate the snapshot before allocating the state, the size in the header is untrusted. The
+	// GameStateHeader is always in the first chunk, it is decompressed on its own and checked
+	// against the snapshot header.
+	SnapshotHeader header;
+	if (!readSnapshotHeader(snapshot, snapshotSizeBytes, header)) return GameStateContainer();
+	if (header.stateSizeBytes < sizeof(GameStateHeader)) return GameStateContainer();
+	uint32_t committedNumEntities = 0;
+	if (!decompressStateHeader(snapshot, header, committedNumEntities, allocator)) {
+		return GameStateContainer();
+	}
+
+	// The state is allocated, so all of it is committed
+	GameStateContainer container = GameStateContainer::createRaw(header.stateSizeBytes, allocator);
+	GameStateHeader* state = container.getHeader();
+	DynArray<GameStateByteRange> noUncommittedRanges;
+	bool success = decompressChunks(snapshot, header, reinterpret_cast<uint8_t*>(state),
+		noUncommittedRanges, threadPool, allocator);
+	if (!success || !validateGameState(state, container.numBytes())) return GameStateContainer();
+	return container;
+}
+
+} // namespace ph
@@ -0,0 +1,100 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// SIMD support macros
+// ------------------------------------------------------------------------------------------------
+
+// PH_SIMD_X86: Defined if compiling for x86/x64, in which case SSE2 is always available and AVX2
+//              code paths can be compiled (but must be selected at runtime, see cpuSupportsAvx2()).
+//
+// PH_TARGET_AVX2: Attribute that must be put on functions using AVX2 intrinsics. Empty on MSVC,
+//                 which allows any intrinsics regardless of /arch flag.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PH_SIMD_X86
+#endif
+
+#ifdef PH_SIMD_X86
+
+#ifdef _MSC_VER
+#define PH_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define PH_TARGET_AVX2 __attribute__((target("avx2,bmi,popcnt")))
+#endif
+
+#include <immintrin.h>
+
+#endif
+
+namespace ph {
+
+// CPU feature detection
+// ------------------------------------------------------------------------------------------------
+
+// Returns whether the CPU (and OS) running the program supports AVX2. Result is cached after the
+// first call.
+inline bool cpuSupportsAvx2() noexcept
+{
+#ifdef PH_SIMD_X86
+	static const bool supported = []() {
+#ifdef _MSC_VER
+		int info[4] = {};
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx) return false;
+		if ((_xgetbv(0) & 0x6) != 0x6) return false; // OS saves XMM and YMM registers
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+// Bit helpers
+// ------------------------------------------------------------------------------------------------
+
+// Returns the index of the lowest set bit, undefined if no bit is set.
+inline uint32_t lowestSetBitIdx(uint64_t bits) noexcept
+{
+#ifdef _MSC_VER
+	unsigned long idx = 0;
+	_BitScanForward64(&idx, bits);
+	return uint32_t(idx);
+#else
+	return uint32_t(__builtin_ctzll(bits));
+#endif
+}
+
+} // namespace ph
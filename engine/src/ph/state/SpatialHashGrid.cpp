@@ -0,0 +1,439 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/SpatialHashGrid.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sfz/Assert.hpp>
+#include <sfz/containers/DynArray.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/util/ThreadPool.hpp"
+
+namespace ph {
+
+using sfz::DynArray;
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+// The number of entity ids processed by each task when rebuilding
+constexpr uint32_t REBUILD_TASK_SIZE = 16384;
+
+// The max number of partitions in the first pass of the rebuild sort, see rebuildSpatialHashGrid()
+constexpr uint32_t MAX_NUM_PARTITIONS = 256;
+
+// Cell coordinates are clamped to this range, so that positions far away (or NaN) can't overflow
+constexpr float CELL_COORD_LIMIT = 1073741824.0f; // 2^30
+
+static int32_t cellCoord(float val, float invCellSize) noexcept
+{
+	// Branchless floor, std::floor() is not inlined unless SSE4.1 is enabled and the branch on
+	// the sign of the coordinate is unpredictable
+	float scaled = val * invCellSize;
+	scaled = std::min(std::max(-CELL_COORD_LIMIT, scaled), CELL_COORD_LIMIT); // NaN -> -limit
+	const int32_t truncated = int32_t(scaled);
+	return truncated - int32_t(float(truncated) > scaled);
+}
+
+static uint32_t cellBucket(int32_t x, int32_t y, int32_t z, uint32_t numBuckets) noexcept
+{
+	uint32_t h = (uint32_t(x) * 0x8DA6B343u) ^ (uint32_t(y) * 0xD8163841u) ^
+		(uint32_t(z) * 0xCB1AB31Fu);
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	return h & (numBuckets - 1);
+}
+
+static uint32_t positionBucket(vec3 pos, float invCellSize, uint32_t numBuckets) noexcept
+{
+	return cellBucket(
+		cellCoord(pos.x, invCellSize),
+		cellCoord(pos.y, invCellSize),
+		cellCoord(pos.z, invCellSize),
+		numBuckets);
+}
+
+static uint32_t roundUp16(uint32_t val) noexcept
+{
+	return (val + 15) & ~uint32_t(15);
+}
+
+// Where to read the x, y and z coordinates of each entity's position from. The coordinate of
+// entity i is the float at base[k] + i * stride[k].
+struct PositionSource final {
+	const uint8_t* base[3];
+	uint32_t stride[3];
+
+	vec3 read(uint32_t entityId) const noexcept
+	{
+		vec3 pos;
+		memcpy(&pos.x, base[0] + size_t(entityId) * stride[0], sizeof(float));
+		memcpy(&pos.y, base[1] + size_t(entityId) * stride[1], sizeof(float));
+		memcpy(&pos.z, base[2] + size_t(entityId) * stride[2], sizeof(float));
+		return pos;
+	}
+};
+
+static PositionSource positionSource(
+	const GameStateHeader* state, const SpatialHashGrid* grid) noexcept
+{
+	const uint32_t type = grid->positionComponentType;
+	sfz_assert(!state->componentTypeIsSparse(type));
+	PositionSource src = {};
+
+	// Dense array-of-structs, all coordinates in the same array
+	if (!state->componentTypeIsSoA(type)) {
+		uint32_t componentSize = 0;
+		const uint8_t* components = state->componentsUntyped(type, componentSize);
+		sfz_assert(components != nullptr);
+		for (uint32_t k = 0; k < 3; k++) {
+			src.base[k] = components + grid->positionOffset + k * sizeof(float);
+			src.stride[k] = componentSize;
+		}
+		return src;
+	}
+
+	// Structure-of-arrays, find the column (and the offset within its elements) of each coordinate
+	uint32_t numFields = 0;
+	const ComponentField* fields = state->componentFields(type, numFields);
+	for (uint32_t k = 0; k < 3; k++) {
+		const uint32_t offset = grid->positionOffset + k * sizeof(float);
+		for (uint32_t fieldIdx = 0; fieldIdx < numFields; fieldIdx++) {
+			const ComponentField& field = fields[fieldIdx];
+			if (offset < field.offset || (field.offset + field.sizeInBytes) <= offset) continue;
+			uint32_t fieldSize = 0;
+			src.base[k] = state->componentFieldUntyped(type, fieldIdx, fieldSize) +
+				(offset - field.offset);
+			src.stride[k] = fieldSize;
+			break;
+		}
+		sfz_assert(src.base[k] != nullptr);
+	}
+	return src;
+}
+
+// Runs func(taskIdx, threadIdx) for all tasks, on the thread pool if one is specified
+template<typename Func>
+static void runTasks(ThreadPool* threadPool, uint32_t numTasks, Func& func) noexcept
+{
+	if (threadPool != nullptr && threadPool->isValid()) {
+		threadPool->runFunc(numTasks, func);
+	}
+	else {
+		for (uint32_t taskIdx = 0; taskIdx < numTasks; taskIdx++) func(taskIdx, 0);
+	}
+}
+
+// Calls func(entryIdx) for each entry in the cells overlapping [min, max] that is located in
+// the cell being visited. Falls back to visiting all entries if the volume overlaps more cells
+// than there are buckets or entries.
+template<typename Func>
+static void forEachEntryInCells(
+	const SpatialHashGrid* grid, vec3 min, vec3 max, Func&& func) noexcept
+{
+	if (grid->numEntries == 0) return;
+	const float invCellSize = grid->invCellSize;
+	const int32_t minX = cellCoord(min.x, invCellSize);
+	const int32_t minY = cellCoord(min.y, invCellSize);
+	const int32_t minZ = cellCoord(min.z, invCellSize);
+	const int32_t maxX = cellCoord(max.x, invCellSize);
+	const int32_t maxY = cellCoord(max.y, invCellSize);
+	const int32_t maxZ = cellCoord(max.z, invCellSize);
+	if (maxX < minX || maxY < minY || maxZ < minZ) return;
+
+	const uint64_t numCells =
+		uint64_t(int64_t(maxX) - minX + 1) *
+		uint64_t(int64_t(maxY) - minY + 1) *
+		uint64_t(int64_t(maxZ) - minZ + 1);
+	if (numCells >= grid->numBuckets || numCells >= grid->numEntries) {
+		for (uint32_t i = 0; i < grid->numEntries; i++) func(i);
+		return;
+	}
+
+	const uint32_t* bucketStarts = grid->bucketStarts();
+	const SpatialHashGridEntry* entries = grid->entries();
+	for (int32_t z = minZ; z <= maxZ; z++) {
+		for (int32_t y = minY; y <= maxY; y++) {
+			for (int32_t x = minX; x <= maxX; x++) {
+				const uint32_t bucket = cellBucket(x, y, z, grid->numBuckets);
+				const uint32_t end = bucketStarts[bucket + 1];
+				for (uint32_t i = bucketStarts[bucket]; i < end; i++) {
+					// Other cells can hash to the same bucket, only visit entries in this cell
+					const vec3 pos = entries[i].position;
+					if (cellCoord(pos.x, invCellSize) != x) continue;
+					if (cellCoord(pos.y, invCellSize) != y) continue;
+					if (cellCoord(pos.z, invCellSize) != z) continue;
+					func(i);
+				}
+			}
+		}
+	}
+}
+
+// SpatialHashGrid: Query methods
+// ------------------------------------------------------------------------------------------------
+
+uint32_t SpatialHashGrid::querySphere(
+	vec3 center, float radius, uint32_t* entityIdsOut, uint32_t maxNumOut) const noexcept
+{
+	const vec3 min = vec3(center.x - radius, center.y - radius, center.z - radius);
+	const vec3 max = vec3(center.x + radius, center.y + radius, center.z + radius);
+	const float radiusSquared = radius * radius;
+	const SpatialHashGridEntry* entries = this->entries();
+	uint32_t numFound = 0;
+	forEachEntryInCells(this, min, max, [&](uint32_t entryIdx) {
+		const SpatialHashGridEntry& entry = entries[entryIdx];
+		const float dx = entry.position.x - center.x;
+		const float dy = entry.position.y - center.y;
+		const float dz = entry.position.z - center.z;
+		if ((dx * dx + dy * dy + dz * dz) > radiusSquared) return;
+		if (numFound < maxNumOut) entityIdsOut[numFound] = entry.entityId;
+		numFound += 1;
+	});
+	return numFound;
+}
+
+uint32_t SpatialHashGrid::queryAABB(
+	vec3 min, vec3 max, uint32_t* entityIdsOut, uint32_t maxNumOut) const noexcept
+{
+	const SpatialHashGridEntry* entries = this->entries();
+	uint32_t numFound = 0;
+	forEachEntryInCells(this, min, max, [&](uint32_t entryIdx) {
+		const SpatialHashGridEntry& entry = entries[entryIdx];
+		const vec3 p = entry.position;
+		if (p.x < min.x || p.y < min.y || p.z < min.z) return;
+		if (p.x > max.x || p.y > max.y || p.z > max.z) return;
+		if (numFound < maxNumOut) entityIdsOut[numFound] = entry.entityId;
+		numFound += 1;
+	});
+	return numFound;
+}
+
+// SpatialHashGrid functions
+// ------------------------------------------------------------------------------------------------
+
+uint32_t spatialHashGridSizeBytes(uint32_t numBuckets, uint32_t maxNumEntities) noexcept
+{
+	sfz_assert(numBuckets != 0 && (numBuckets & (numBuckets - 1)) == 0);
+	uint64_t sizeBytes = sizeof(SpatialHashGrid);
+	sizeBytes += roundUp16((numBuckets + 1) * sizeof(uint32_t));
+	sizeBytes += uint64_t(maxNumEntities) * sizeof(SpatialHashGridEntry);
+	sfz_assert(sizeBytes <= uint64_t(UINT32_MAX));
+	return uint32_t(sizeBytes);
+}
+
+void initSpatialHashGrid(
+	GameStateHeader* state,
+	uint32_t singletonIndex,
+	uint32_t numBuckets,
+	float cellSize,
+	uint32_t positionComponentType,
+	uint32_t positionOffset) noexcept
+{
+	sfz_assert(cellSize > 0.0f);
+	uint32_t componentSize = 0;
+	const bool hasData = state->componentsUntyped(positionComponentType, componentSize) != nullptr;
+	sfz_assert(hasData && (positionOffset + 3 * sizeof(float)) <= componentSize);
+	sfz_assert(!state->componentTypeIsSparse(positionComponentType));
+	(void)hasData;
+
+	uint32_t singletonSize = 0;
+	uint8_t* singleton = state->singletonUntyped(singletonIndex, singletonSize);
+	sfz_assert(singleton != nullptr);
+	sfz_assert(singletonSize == spatialHashGridSizeBytes(numBuckets, state->maxNumEntities));
+	const uint32_t offsetEntries =
+		sizeof(SpatialHashGrid) + roundUp16((numBuckets + 1) * sizeof(uint32_t));
+
+	// The entries are sized for maxNumEntities, but only the first numEntries are ever written and
+	// the rest are kept zero (see the end of rebuildSpatialHashGrid()). Only the entries of a
+	// previous grid need to be cleared, anything else in the singleton clears all of it.
+	SpatialHashGrid& grid = *reinterpret_cast<SpatialHashGrid*>(singleton);
+	if (grid.offsetEntries == offsetEntries && grid.numEntries <= state->maxNumEntities) {
+		memset(singleton + offsetEntries, 0, grid.numEntries * sizeof(SpatialHashGridEntry));
+	}
+	else if (grid.offsetEntries != 0) {
+		memset(singleton + offsetEntries, 0, singletonSize - offsetEntries);
+	}
+	memset(singleton, 0, offsetEntries);
+
+	grid.positionComponentType = positionComponentType;
+	grid.positionOffset = positionOffset;
+	grid.cellSize = cellSize;
+	grid.invCellSize = 1.0f / cellSize;
+	grid.numBuckets = numBuckets;
+	grid.maxNumEntries = state->maxNumEntities;
+	grid.numEntries = 0;
+	grid.offsetBucketStarts = sizeof(SpatialHashGrid);
+	grid.offsetEntries = offsetEntries;
+
+	state->markSingletonDirty(singletonIndex);
+}
+
+SpatialHashGrid* getSpatialHashGrid(GameStateHeader* state, uint32_t singletonIndex) noexcept
+{
+	uint32_t singletonSize = 0;
+	uint8_t* singleton = state->singletonUntyped(singletonIndex, singletonSize);
+	sfz_assert(singletonSize >= sizeof(SpatialHashGrid));
+	return reinterpret_cast<SpatialHashGrid*>(singleton);
+}
+
+const SpatialHashGrid* getSpatialHashGrid(
+	const GameStateHeader* state, uint32_t singletonIndex) noexcept
+{
+	uint32_t singletonSize = 0;
+	const uint8_t* singleton = state->singletonUntyped(singletonIndex, singletonSize);
+	sfz_assert(singletonSize >= sizeof(SpatialHashGrid));
+	return reinterpret_cast<const SpatialHashGrid*>(singleton);
+}
+
+void rebuildSpatialHashGrid(
+	GameStateHeader* state,
+	uint32_t singletonIndex,
+	ThreadPool* threadPool,
+	sfz::Allocator* allocator) noexcept
+{
+	SpatialHashGrid* grid = getSpatialHashGrid(state, singletonIndex);
+	sfz_assert(grid->maxNumEntries == state->maxNumEntities);
+	const PositionSource src = positionSource(state, grid);
+	const ComponentMask mask =
+		ComponentMask::activeMask() | ComponentMask::fromType(grid->positionComponentType);
+	const ComponentMask* masks = state->componentMasks();
+	const uint32_t numIds = state->entityHighWaterMark;
+	const uint32_t numBuckets = grid->numBuckets;
+	const float invCellSize = grid->invCellSize;
+	uint32_t* bucketStarts = grid->bucketStarts();
+	SpatialHashGridEntry* entries = grid->entries();
+	const uint32_t numThreads =
+		(threadPool != nullptr && threadPool->isValid()) ? threadPool->numThreads() : 1;
+
+	// The entries are sorted by bucket using a two pass stable counting sort. The first pass
+	// partitions the entities by the high bits of their bucket, the second pass sorts each
+	// partition (which fits in cache) by bucket. Sorting the entire state at once would access
+	// the bucket counters and entries at random, which is several times slower for large states.
+	// Being stable, the entries within each bucket end up in ascending entity id order regardless
+	// of how the tasks are scheduled.
+	const uint32_t numPartitions = std::min(numBuckets, MAX_NUM_PARTITIONS);
+	uint32_t partitionShift = 0;
+	while ((numPartitions << partitionShift) < numBuckets) partitionShift += 1;
+	const uint32_t numIdTasks = (numIds + REBUILD_TASK_SIZE - 1) / REBUILD_TASK_SIZE;
+
+	// Count the entities of each partition, per task
+	DynArray<uint32_t> taskOffsets;
+	taskOffsets.init(numIdTasks * numPartitions + 1,
+		allocator, sfz_dbg("rebuildSpatialHashGrid::taskOffsets"));
+	taskOffsets.add(0u, numIdTasks * numPartitions + 1);
+	auto countFunc = [&](uint32_t taskIdx, uint32_t) {
+		uint32_t* counts = taskOffsets.data() + taskIdx * numPartitions;
+		const uint32_t firstId = taskIdx * REBUILD_TASK_SIZE;
+		const uint32_t lastId = std::min(firstId + REBUILD_TASK_SIZE, numIds);
+		for (uint32_t id = firstId; id < lastId; id++) {
+			if (!masks[id].fulfills(mask)) continue;
+			const uint32_t bucket = positionBucket(src.read(id), invCellSize, numBuckets);
+			counts[bucket >> partitionShift] += 1;
+		}
+	};
+	runTasks(threadPool, numIdTasks, countFunc);
+
+	// Exclusive prefix sum in partition major order, i.e. the entities of each partition are
+	// placed in task (and thus entity id) order. Also calculates the start of each partition.
+	DynArray<uint32_t> partitionStarts;
+	partitionStarts.init(numPartitions + 1,
+		allocator, sfz_dbg("rebuildSpatialHashGrid::partitionStarts"));
+	uint32_t numEntries = 0;
+	uint32_t maxPartitionSize = 0;
+	for (uint32_t p = 0; p < numPartitions; p++) {
+		partitionStarts.add(numEntries);
+		for (uint32_t taskIdx = 0; taskIdx < numIdTasks; taskIdx++) {
+			uint32_t& offset = taskOffsets[taskIdx * numPartitions + p];
+			const uint32_t count = offset;
+			offset = numEntries;
+			numEntries += count;
+		}
+		maxPartitionSize = std::max(maxPartitionSize, numEntries - partitionStarts.last());
+	}
+	partitionStarts.add(numEntries);
+
+	// Scatter the entities into their partitions
+	auto partitionFunc = [&](uint32_t taskIdx, uint32_t) {
+		uint32_t* offsets = taskOffsets.data() + taskIdx * numPartitions;
+		const uint32_t firstId = taskIdx * REBUILD_TASK_SIZE;
+		const uint32_t lastId = std::min(firstId + REBUILD_TASK_SIZE, numIds);
+		for (uint32_t id = firstId; id < lastId; id++) {
+			if (!masks[id].fulfills(mask)) continue;
+			const vec3 pos = src.read(id);
+			const uint32_t bucket = positionBucket(pos, invCellSize, numBuckets);
+			SpatialHashGridEntry& entry = entries[offsets[bucket >> partitionShift]++];
+			entry.position = pos;
+			entry.entityId = id;
+		}
+	};
+	runTasks(threadPool, numIdTasks, partitionFunc);
+
+	// Sort each partition by bucket, via a per thread copy of the partition
+	DynArray<SpatialHashGridEntry> tmp;
+	tmp.init(numThreads * maxPartitionSize, allocator, sfz_dbg("rebuildSpatialHashGrid::tmp"));
+	tmp.hackSetSize(tmp.capacity());
+	auto sortFunc = [&](uint32_t p, uint32_t threadIdx) {
+		const uint32_t begin = partitionStarts[p];
+		const uint32_t end = partitionStarts[p + 1];
+		const uint32_t firstBucket = p << partitionShift;
+		const uint32_t numPartitionBuckets = uint32_t(1) << partitionShift;
+		SpatialHashGridEntry* copy = tmp.data() + threadIdx * maxPartitionSize;
+		if (begin != end) memcpy(copy, entries + begin, (end - begin) * sizeof(SpatialHashGridEntry));
+
+		uint32_t* starts = bucketStarts + firstBucket;
+		memset(starts, 0, numPartitionBuckets * sizeof(uint32_t));
+		for (uint32_t i = 0; i < (end - begin); i++) {
+			starts[positionBucket(copy[i].position, invCellSize, numBuckets) - firstBucket] += 1;
+		}
+		uint32_t offset = begin;
+		for (uint32_t b = 0; b < numPartitionBuckets; b++) {
+			const uint32_t count = starts[b];
+			starts[b] = offset;
+			offset += count;
+		}
+		for (uint32_t i = 0; i < (end - begin); i++) {
+			const uint32_t b =
+				positionBucket(copy[i].position, invCellSize, numBuckets) - firstBucket;
+			entries[starts[b]++] = copy[i];
+		}
+
+		// starts[b] is now the end of bucket b, i.e. the start of bucket b + 1
+		for (uint32_t b = numPartitionBuckets - 1; b > 0; b--) starts[b] = starts[b - 1];
+		starts[0] = begin;
+	};
+	runTasks(threadPool, numPartitions, sortFunc);
+	bucketStarts[numBuckets] = numEntries;
+
+	// Clear the no longer used entries, so that the contents (and thus the hash) of the grid only
+	// depend on the indexed entities
+	if (grid->numEntries > numEntries) {
+		memset(entries + numEntries, 0,
+			(grid->numEntries - numEntries) * sizeof(SpatialHashGridEntry));
+	}
+	grid->numEntries = numEntries;
+
+	state->markSingletonDirty(singletonIndex);
+}
+
+} // namespace ph
@@ -0,0 +1,237 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/StateHash.hpp"
+
+#include <cstring>
+
+#include "ph/state/SimdSupport.hpp"
+
+namespace ph {
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+constexpr uint32_t STRIPE_SIZE = 64;
+constexpr uint32_t NUM_STRIPES_PER_BLOCK = 16;
+constexpr uint32_t BLOCK_SIZE = STRIPE_SIZE * NUM_STRIPES_PER_BLOCK;
+
+constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+constexpr uint32_t PRIME32_1 = 0x9E3779B1U;
+
+// Xored with the input of each lane, arbitrary bits (first digits of pi)
+alignas(32) static const uint64_t HASH_SECRET[8] = {
+	0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+	0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL, 0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL
+};
+
+static uint64_t rotl64(uint64_t val, uint32_t bits) noexcept
+{
+	return (val << bits) | (val >> (64 - bits));
+}
+
+static uint64_t avalanche(uint64_t h) noexcept
+{
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+// Accumulates numStripes stripes into the 8 lanes of acc, then optionally scrambles the lanes.
+// All implementations must give bit identical results.
+using AccumulateFunc =
+	void(*)(uint64_t acc[8], const uint8_t* data, uint32_t numStripes, bool scramble);
+
+#ifndef PH_SIMD_X86
+
+static uint64_t read64(const uint8_t* ptr) noexcept
+{
+	uint64_t val;
+	memcpy(&val, ptr, sizeof(uint64_t));
+	return val;
+}
+
+static void accumulateScalar(
+	uint64_t acc[8], const uint8_t* data, uint32_t numStripes, bool scramble) noexcept
+{
+	for (uint32_t stripeIdx = 0; stripeIdx < numStripes; stripeIdx++) {
+		const uint8_t* stripe = data + stripeIdx * STRIPE_SIZE;
+		for (uint32_t i = 0; i < 8; i++) {
+			uint64_t val = read64(stripe + i * 8);
+			uint64_t key = val ^ HASH_SECRET[i];
+			acc[i ^ 1] += val;
+			acc[i] += (key & 0xFFFFFFFFULL) * (key >> 32);
+		}
+	}
+	if (scramble) {
+		for (uint32_t i = 0; i < 8; i++) {
+			uint64_t a = acc[i];
+			a ^= a >> 47;
+			a ^= HASH_SECRET[i];
+			acc[i] = a * PRIME32_1;
+		}
+	}
+}
+
+#else
+
+static void accumulateSse2(
+	uint64_t acc[8], const uint8_t* data, uint32_t numStripes, bool scramble) noexcept
+{
+	__m128i accs[4];
+	__m128i secrets[4];
+	for (uint32_t i = 0; i < 4; i++) {
+		accs[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc) + i);
+		secrets[i] = _mm_load_si128(reinterpret_cast<const __m128i*>(HASH_SECRET) + i);
+	}
+
+	for (uint32_t stripeIdx = 0; stripeIdx < numStripes; stripeIdx++) {
+		const __m128i* stripe = reinterpret_cast<const __m128i*>(data + stripeIdx * STRIPE_SIZE);
+		for (uint32_t i = 0; i < 4; i++) {
+			__m128i val = _mm_loadu_si128(stripe + i);
+			__m128i key = _mm_xor_si128(val, secrets[i]);
+			__m128i product = _mm_mul_epu32(key, _mm_srli_epi64(key, 32));
+			__m128i swapped = _mm_shuffle_epi32(val, _MM_SHUFFLE(1, 0, 3, 2));
+			accs[i] = _mm_add_epi64(accs[i], _mm_add_epi64(product, swapped));
+		}
+	}
+
+	if (scramble) {
+		const __m128i prime = _mm_set1_epi32(int32_t(PRIME32_1));
+		for (uint32_t i = 0; i < 4; i++) {
+			__m128i a = accs[i];
+			a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+			a = _mm_xor_si128(a, secrets[i]);
+			__m128i lo = _mm_mul_epu32(a, prime);
+			__m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+			accs[i] = _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+		}
+	}
+
+	for (uint32_t i = 0; i < 4; i++) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(acc) + i, accs[i]);
+	}
+}
+
+PH_TARGET_AVX2 static void accumulateAvx2(
+	uint64_t acc[8], const uint8_t* data, uint32_t numStripes, bool scramble) noexcept
+{
+	__m256i accs[2];
+	__m256i secrets[2];
+	for (uint32_t i = 0; i < 2; i++) {
+		accs[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc) + i);
+		secrets[i] = _mm256_load_si256(reinterpret_cast<const __m256i*>(HASH_SECRET) + i);
+	}
+
+	for (uint32_t stripeIdx = 0; stripeIdx < numStripes; stripeIdx++) {
+		const __m256i* stripe = reinterpret_cast<const __m256i*>(data + stripeIdx * STRIPE_SIZE);
+		for (uint32_t i = 0; i < 2; i++) {
+			__m256i val = _mm256_loadu_si256(stripe + i);
+			__m256i key = _mm256_xor_si256(val, secrets[i]);
+			__m256i product = _mm256_mul_epu32(key, _mm256_srli_epi64(key, 32));
+			__m256i swapped = _mm256_shuffle_epi32(val, _MM_SHUFFLE(1, 0, 3, 2));
+			accs[i] = _mm256_add_epi64(accs[i], _mm256_add_epi64(product, swapped));
+		}
+	}
+
+	if (scramble) {
+		const __m256i prime = _mm256_set1_epi32(int32_t(PRIME32_1));
+		for (uint32_t i = 0; i < 2; i++) {
+			__m256i a = accs[i];
+			a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+			a = _mm256_xor_si256(a, secrets[i]);
+			__m256i lo = _mm256_mul_epu32(a, prime);
+			__m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+			accs[i] = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+		}
+	}
+
+	for (uint32_t i = 0; i < 2; i++) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(acc) + i, accs[i]);
+	}
+}
+
+#endif
+
+static AccumulateFunc selectAccumulateFunc() noexcept
+{
+#ifdef PH_SIMD_X86
+	if (cpuSupportsAvx2()) return accumulateAvx2;
+	return accumulateSse2;
+#else
+	return accumulateScalar;
+#endif
+}
+
+// State hashing
+// ------------------------------------------------------------------------------------------------
+
+uint64_t hashStateBytes(const uint8_t* data, uint64_t numBytes, uint64_t seed) noexcept
+{
+	const AccumulateFunc accumulate = selectAccumulateFunc();
+	uint64_t acc[8];
+	for (uint32_t i = 0; i < 8; i++) acc[i] = seed + HASH_SECRET[7 - i];
+
+	// Full blocks, scrambled after each block
+	const uint64_t numBlocks = numBytes / BLOCK_SIZE;
+	for (uint64_t blockIdx = 0; blockIdx < numBlocks; blockIdx++) {
+		accumulate(acc, data + blockIdx * BLOCK_SIZE, NUM_STRIPES_PER_BLOCK, true);
+	}
+
+	// Remaining stripes, the last partial stripe is zero padded (the size is mixed in below)
+	const uint64_t blocksSize = numBlocks * BLOCK_SIZE;
+	const uint32_t remainingSize = uint32_t(numBytes - blocksSize);
+	const uint32_t numStripes = remainingSize / STRIPE_SIZE;
+	accumulate(acc, data + blocksSize, numStripes, false);
+	const uint32_t tailSize = remainingSize - numStripes * STRIPE_SIZE;
+	if (tailSize != 0) {
+		alignas(32) uint8_t tail[STRIPE_SIZE] = {};
+		memcpy(tail, data + blocksSize + numStripes * STRIPE_SIZE, tailSize);
+		accumulate(acc, tail, 1, false);
+	}
+
+	// Merge lanes
+	uint64_t h = numBytes * PRIME64_1 ^ seed;
+	for (uint32_t i = 0; i < 8; i++) {
+		h ^= avalanche(acc[i]);
+		h = rotl64(h, 27) * PRIME64_1 + PRIME64_3;
+	}
+	return avalanche(h);
+}
+
+uint64_t combineStateHashes(uint64_t lhs, uint64_t rhs) noexcept
+{
+	return avalanche(rotl64(lhs, 31) * PRIME64_1 ^ rhs);
+}
+
+const char* stateHashImplName() noexcept
+{
+#ifdef PH_SIMD_X86
+	return cpuSupportsAvx2() ? "AVX2" : "SSE2";
+#else
+	return "Scalar";
+#endif
+}
+
+} // namespace ph
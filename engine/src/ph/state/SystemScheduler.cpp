@@ -0,0 +1,255 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/state/SystemScheduler.hpp"
+
+#include <mutex>
+#include <utility> // std::swap()
+
+#include <sfz/Assert.hpp>
+#include <sfz/containers/DynArray.hpp>
+
+#include "ph/util/ThreadPool.hpp"
+
+namespace ph {
+
+using sfz::DynArray;
+
+// SystemSchedulerState
+// ------------------------------------------------------------------------------------------------
+
+struct SystemNode final {
+	bool enabled = true;
+
+	// Per tick dependency graph
+	uint32_t numDependencies = 0;
+	uint32_t numDependenciesLeft = 0;
+	uint32_t firstDependentIdx = 0; // Index into dependents array
+	uint32_t numDependents = 0;
+};
+
+struct SystemSchedulerState final {
+	sfz::Allocator* allocator = nullptr;
+	DynArray<SystemDesc> systems;
+	DynArray<SystemNode> nodes;
+	DynArray<uint32_t> dependents;
+
+	// Per tick execution state, protected by mutex. Threads waiting for systems to become ready
+	// wait in ThreadPool::helpUntil(), so that they can help with the nested runs of the systems.
+	std::mutex mutex;
+	ThreadPool* threadPool = nullptr;
+	DynArray<uint32_t> readyQueue;
+	uint32_t readyQueueHead = 0;
+	uint32_t numSystemsLeft = 0;
+	GameStateHeader* state = nullptr;
+	float tickTimeSeconds = 0.0f;
+};
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+static void buildDependencyGraph(SystemSchedulerState& state) noexcept
+{
+	const uint32_t numSystems = state.systems.size();
+	state.dependents.clear();
+
+	for (uint32_t i = 0; i < numSystems; i++) {
+		SystemNode& node = state.nodes[i];
+		node.numDependencies = 0;
+		node.firstDependentIdx = state.dependents.size();
+		node.numDependents = 0;
+		if (!node.enabled) continue;
+
+		// All later conflicting systems depend on this system
+		for (uint32_t j = i + 1; j < numSystems; j++) {
+			if (!state.nodes[j].enabled) continue;
+			if (!systemsConflict(state.systems[i], state.systems[j])) continue;
+			state.dependents.add(j);
+			node.numDependents += 1;
+		}
+	}
+
+	// Count dependencies of each system
+	for (uint32_t i = 0; i < numSystems; i++) {
+		const SystemNode& node = state.nodes[i];
+		for (uint32_t j = 0; j < node.numDependents; j++) {
+			state.nodes[state.dependents[node.firstDependentIdx + j]].numDependencies += 1;
+		}
+	}
+}
+
+// Returns whether a system is ready to run or all systems of the tick have finished
+static bool systemReadyOrTickFinished(void* userPtr) noexcept
+{
+	SystemSchedulerState& state = *static_cast<SystemSchedulerState*>(userPtr);
+	std::lock_guard<std::mutex> lock(state.mutex);
+	return state.numSystemsLeft == 0 || state.readyQueueHead < state.readyQueue.size();
+}
+
+// Pulls ready systems from the queue and runs them until all systems of the tick have finished.
+// Runs on every thread of the pool.
+static void runSystemsLoop(SystemSchedulerState& state) noexcept
+{
+	while (true) {
+
+		// Wait until a system is ready or all systems are done, helps with the nested runs of
+		// the running systems (e.g. parallelForEntities()) in the meantime
+		state.threadPool->helpUntil(systemReadyOrTickFinished, &state);
+		std::unique_lock<std::mutex> lock(state.mutex);
+		if (state.numSystemsLeft == 0) return;
+		if (state.readyQueueHead >= state.readyQueue.size()) continue; // Taken by another thread
+
+		// Run system without holding the lock
+		uint32_t systemIdx = state.readyQueue[state.readyQueueHead];
+		state.readyQueueHead += 1;
+		const SystemDesc& system = state.systems[systemIdx];
+		lock.unlock();
+		system.systemFunc(state.state, state.tickTimeSeconds, system.userPtr);
+		lock.lock();
+
+		// Mark system as finished and queue dependents whose dependencies are all finished
+		state.numSystemsLeft -= 1;
+		const SystemNode& node = state.nodes[systemIdx];
+		for (uint32_t i = 0; i < node.numDependents; i++) {
+			SystemNode& dependent = state.nodes[state.dependents[node.firstDependentIdx + i]];
+			dependent.numDependenciesLeft -= 1;
+			if (dependent.numDependenciesLeft == 0) {
+				state.readyQueue.add(state.dependents[node.firstDependentIdx + i]);
+			}
+		}
+
+		// The pool's lock is taken when notifying, which may not be done while holding this lock
+		lock.unlock();
+		state.threadPool->notifyHelpers();
+	}
+}
+
+// System conflicts
+// ------------------------------------------------------------------------------------------------
+
+bool systemsConflict(const SystemDesc& a, const SystemDesc& b) noexcept
+{
+	if (a.structuralChanges || b.structuralChanges) return true;
+
+	const ComponentMask aAccess = a.readComponents | a.writeComponents;
+	const ComponentMask bAccess = b.readComponents | b.writeComponents;
+	if ((a.writeComponents & bAccess) != ComponentMask::empty()) return true;
+	if ((b.writeComponents & aAccess) != ComponentMask::empty()) return true;
+
+	const uint64_t aSingletonAccess = a.readSingletons | a.writeSingletons;
+	const uint64_t bSingletonAccess = b.readSingletons | b.writeSingletons;
+	if ((a.writeSingletons & bSingletonAccess) != 0) return true;
+	if ((b.writeSingletons & aSingletonAccess) != 0) return true;
+
+	if ((a.pushEvents & b.readEvents) != 0) return true;
+	if ((b.pushEvents & a.readEvents) != 0) return true;
+
+	return false;
+}
+
+// SystemScheduler: State methods
+// ------------------------------------------------------------------------------------------------
+
+void SystemScheduler::init(uint32_t maxNumSystems, sfz::Allocator* allocator) noexcept
+{
+	this->destroy();
+	mState = allocator->newObject<SystemSchedulerState>(sfz_dbg("SystemSchedulerState"));
+	mState->allocator = allocator;
+	mState->systems.init(maxNumSystems, allocator, sfz_dbg("SystemScheduler::systems"));
+	mState->nodes.init(maxNumSystems, allocator, sfz_dbg("SystemScheduler::nodes"));
+	mState->dependents.init(maxNumSystems * 4, allocator, sfz_dbg("SystemScheduler::dependents"));
+	mState->readyQueue.init(maxNumSystems, allocator, sfz_dbg("SystemScheduler::readyQueue"));
+}
+
+void SystemScheduler::swap(SystemScheduler& other) noexcept
+{
+	std::swap(this->mState, other.mState);
+}
+
+void SystemScheduler::destroy() noexcept
+{
+	if (mState == nullptr) return;
+	sfz::Allocator* allocator = mState->allocator;
+	allocator->deleteObject(mState);
+	mState = nullptr;
+}
+
+// SystemScheduler: Methods
+// ------------------------------------------------------------------------------------------------
+
+uint32_t SystemScheduler::addSystem(const SystemDesc& system) noexcept
+{
+	sfz_assert(system.systemFunc != nullptr);
+	uint32_t systemIdx = mState->systems.size();
+	mState->systems.add(system);
+	mState->nodes.add(SystemNode());
+	return systemIdx;
+}
+
+uint32_t SystemScheduler::numSystems() const noexcept
+{
+	return mState->systems.size();
+}
+
+const SystemDesc& SystemScheduler::system(uint32_t systemIdx) const noexcept
+{
+	return mState->systems[systemIdx];
+}
+
+void SystemScheduler::setSystemEnabled(uint32_t systemIdx, bool enabled) noexcept
+{
+	mState->nodes[systemIdx].enabled = enabled;
+}
+
+bool SystemScheduler::systemEnabled(uint32_t systemIdx) const noexcept
+{
+	return mState->nodes[systemIdx].enabled;
+}
+
+void SystemScheduler::runTick(
+	GameStateHeader* state, float tickTimeSeconds, ThreadPool& threadPool) noexcept
+{
+	buildDependencyGraph(*mState);
+
+	// Setup execution state, queue all systems without dependencies
+	mState->state = state;
+	mState->tickTimeSeconds = tickTimeSeconds;
+	mState->threadPool = &threadPool;
+	mState->readyQueue.clear();
+	mState->readyQueueHead = 0;
+	mState->numSystemsLeft = 0;
+	for (uint32_t i = 0; i < mState->nodes.size(); i++) {
+		SystemNode& node = mState->nodes[i];
+		if (!node.enabled) continue;
+		mState->numSystemsLeft += 1;
+		node.numDependenciesLeft = node.numDependencies;
+		if (node.numDependencies == 0) mState->readyQueue.add(i);
+	}
+	if (mState->numSystemsLeft == 0) return;
+
+	// Run systems on all threads of the pool
+	threadPool.run(threadPool.numThreads(), [](uint32_t, uint32_t, void* userPtr) {
+		runSystemsLoop(*static_cast<SystemSchedulerState*>(userPtr));
+	}, mState);
+
+	mState->state = nullptr;
+	mState->threadPool = nullptr;
+}
+
+} // namespace ph
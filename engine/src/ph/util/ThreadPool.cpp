@@ -0,0 +1,343 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "ph/util/ThreadPool.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility> // std::swap()
+
+#include <sfz/Assert.hpp>
+#include <sfz/containers/DynArray.hpp>
+
+namespace ph {
+
+using sfz::DynArray;
+
+// ThreadPoolState
+// ------------------------------------------------------------------------------------------------
+
+// The max number of run()s which can be active at the same time, i.e. the outermost run() plus
+// runs nested within its tasks. Further nested runs execute their tasks on the calling thread.
+constexpr uint32_t THREAD_POOL_MAX_NUM_JOBS = 16;
+
+// The range of task indices [begin, end) currently owned by a thread, packed as (begin << 32) | end
+// so that it can be modified with a single compare-and-swap. Cache line aligned to avoid false
+// sharing between threads.
+struct alignas(64) TaskRange final {
+	std::atomic<uint64_t> range{ 0 };
+};
+
+// The tasks of a single run(). A job is open for threads to join until one of its participants
+// has found all task ranges empty, no tasks are ever added to a job after it has been published.
+struct ThreadPoolJob final {
+	ThreadPoolTaskFunc taskFunc = nullptr;
+	void* userPtr = nullptr;
+	TaskRange* taskRanges = nullptr; // One per thread, indexed by threadIdx
+	uint32_t numParticipants = 0; // Including the thread which called run()
+	bool active = false;
+	bool exhausted = false;
+};
+
+struct ThreadPoolState final {
+	sfz::Allocator* allocator = nullptr;
+	DynArray<std::thread> workers;
+	TaskRange* taskRanges = nullptr; // numThreads per job
+
+	// Protects the jobs and is used together with the condition variables. jobAvailableCondition
+	// is also notified by notifyHelpers(), as threads in helpUntil() wait on it.
+	std::mutex mutex;
+	std::condition_variable jobAvailableCondition;
+	std::condition_variable jobFinishedCondition;
+	bool shutdown = false;
+	ThreadPoolJob jobs[THREAD_POOL_MAX_NUM_JOBS];
+};
+
+// Statics
+// ------------------------------------------------------------------------------------------------
+
+// The threadIdx of the current thread within the pool owning it, 0 if not owned by a pool
+static thread_local uint32_t currentThreadIdxValue = 0;
+
+// Bit i is set if the current thread participates in job i. A thread may not join a job it is
+// already running a task of, e.g. when helping from within that task in helpUntil().
+static thread_local uint32_t currentThreadJobsMask = 0;
+
+static uint64_t packRange(uint32_t begin, uint32_t end) noexcept
+{
+	return (uint64_t(begin) << 32) | uint64_t(end);
+}
+
+// Pops the first task in the owned range, returns false if the range is empty.
+static bool popTask(TaskRange& taskRange, uint32_t& taskIdxOut) noexcept
+{
+	uint64_t range = taskRange.range.load(std::memory_order_acquire);
+	while (true) {
+		uint32_t begin = uint32_t(range >> 32);
+		uint32_t end = uint32_t(range);
+		if (begin >= end) return false;
+		if (taskRange.range.compare_exchange_weak(range, packRange(begin + 1, end))) {
+			taskIdxOut = begin;
+			return true;
+		}
+	}
+}
+
+// Steals the second half of the victim's range, returns false if the range is empty.
+static bool stealTasks(TaskRange& victim, uint32_t& beginOut, uint32_t& endOut) noexcept
+{
+	uint64_t range = victim.range.load(std::memory_order_acquire);
+	while (true) {
+		uint32_t begin = uint32_t(range >> 32);
+		uint32_t end = uint32_t(range);
+		if (begin >= end) return false;
+		uint32_t mid = begin + (end - begin) / 2;
+		if (victim.range.compare_exchange_weak(range, packRange(begin, mid))) {
+			beginOut = mid;
+			endOut = end;
+			return true;
+		}
+	}
+}
+
+// Executes tasks in the thread's own range, then steals from other threads until all ranges are
+// empty.
+static void executeTasks(
+	TaskRange* taskRanges,
+	uint32_t numThreads,
+	ThreadPoolTaskFunc taskFunc,
+	void* userPtr,
+	uint32_t threadIdx) noexcept
+{
+	TaskRange& ownRange = taskRanges[threadIdx];
+	while (true) {
+		uint32_t taskIdx = 0;
+		while (popTask(ownRange, taskIdx)) {
+			taskFunc(taskIdx, threadIdx, userPtr);
+		}
+
+		// Own range is empty, attempt to steal from the other threads
+		bool stolen = false;
+		for (uint32_t i = 1; i < numThreads; i++) {
+			uint32_t victimIdx = (threadIdx + i) % numThreads;
+			uint32_t begin = 0;
+			uint32_t end = 0;
+			if (stealTasks(taskRanges[victimIdx], begin, end)) {
+				ownRange.range.store(packRange(begin, end), std::memory_order_release);
+				stolen = true;
+				break;
+			}
+		}
+		if (!stolen) return;
+	}
+}
+
+// Returns the index of a job the current thread can join, ~0 if there is none. Must be called
+// with the mutex held.
+static uint32_t findJoinableJob(const ThreadPoolState* state) noexcept
+{
+	for (uint32_t i = 0; i < THREAD_POOL_MAX_NUM_JOBS; i++) {
+		const ThreadPoolJob& job = state->jobs[i];
+		if (!job.active || job.exhausted) continue;
+		if ((currentThreadJobsMask & (1u << i)) != 0) continue;
+		return i;
+	}
+	return ~0u;
+}
+
+// Executes tasks of the given job together with its other participants. Must be called with the
+// mutex held through the given lock, which is released while executing tasks.
+static void participateInJob(
+	ThreadPoolState* state, std::unique_lock<std::mutex>& lock, uint32_t jobIdx) noexcept
+{
+	ThreadPoolJob& job = state->jobs[jobIdx];
+	job.numParticipants += 1;
+	currentThreadJobsMask |= (1u << jobIdx);
+	lock.unlock();
+
+	executeTasks(
+		job.taskRanges, state->workers.size() + 1, job.taskFunc, job.userPtr, currentThreadIdxValue);
+
+	lock.lock();
+	currentThreadJobsMask &= ~(1u << jobIdx);
+	job.exhausted = true;
+	job.numParticipants -= 1;
+	if (job.numParticipants == 0) state->jobFinishedCondition.notify_all();
+}
+
+static void workerMain(ThreadPoolState* state, uint32_t threadIdx) noexcept
+{
+	currentThreadIdxValue = threadIdx;
+	std::unique_lock<std::mutex> lock(state->mutex);
+	while (true) {
+		uint32_t jobIdx = ~0u;
+		state->jobAvailableCondition.wait(lock, [&]() {
+			jobIdx = findJoinableJob(state);
+			return state->shutdown || jobIdx != ~0u;
+		});
+		if (state->shutdown) return;
+		participateInJob(state, lock, jobIdx);
+	}
+}
+
+// ThreadPool: State methods
+// ------------------------------------------------------------------------------------------------
+
+void ThreadPool::init(uint32_t numWorkerThreads, sfz::Allocator* allocator) noexcept
+{
+	this->destroy();
+	if (numWorkerThreads == ~0u) {
+		uint32_t numHardwareThreads = std::thread::hardware_concurrency();
+		numWorkerThreads = numHardwareThreads > 1 ? numHardwareThreads - 1 : 0;
+	}
+
+	mState = allocator->newObject<ThreadPoolState>(sfz_dbg("ThreadPoolState"));
+	mState->allocator = allocator;
+	const uint32_t numTaskRanges = THREAD_POOL_MAX_NUM_JOBS * (numWorkerThreads + 1);
+	mState->taskRanges = static_cast<TaskRange*>(allocator->allocate(
+		sfz_dbg("ThreadPool::taskRanges"), sizeof(TaskRange) * numTaskRanges, 64));
+	for (uint32_t i = 0; i < numTaskRanges; i++) new (mState->taskRanges + i) TaskRange();
+	for (uint32_t i = 0; i < THREAD_POOL_MAX_NUM_JOBS; i++) {
+		mState->jobs[i].taskRanges = mState->taskRanges + i * (numWorkerThreads + 1);
+	}
+	mState->workers.init(numWorkerThreads, allocator, sfz_dbg("ThreadPool::workers"));
+	for (uint32_t i = 0; i < numWorkerThreads; i++) {
+		mState->workers.add(std::thread(workerMain, mState, i + 1));
+	}
+}
+
+void ThreadPool::swap(ThreadPool& other) noexcept
+{
+	std::swap(this->mState, other.mState);
+}
+
+void ThreadPool::destroy() noexcept
+{
+	if (mState == nullptr) return;
+
+	// Tell workers to shut down and wait for them
+	{
+		std::lock_guard<std::mutex> lock(mState->mutex);
+		mState->shutdown = true;
+	}
+	mState->jobAvailableCondition.notify_all();
+	for (std::thread& worker : mState->workers) worker.join();
+	mState->workers.destroy();
+
+	sfz::Allocator* allocator = mState->allocator;
+	allocator->deallocate(mState->taskRanges);
+	allocator->deleteObject(mState);
+	mState = nullptr;
+}
+
+// ThreadPool: Methods
+// ------------------------------------------------------------------------------------------------
+
+uint32_t ThreadPool::numThreads() const noexcept
+{
+	if (mState == nullptr) return 1;
+	return mState->workers.size() + 1;
+}
+
+uint32_t ThreadPool::currentThreadIdx() noexcept
+{
+	return currentThreadIdxValue;
+}
+
+void ThreadPool::run(uint32_t numTasks, ThreadPoolTaskFunc taskFunc, void* userPtr) noexcept
+{
+	if (numTasks == 0) return;
+	const uint32_t threadIdx = currentThreadIdxValue;
+
+	// Run everything on calling thread if there are no workers (or just a single task)
+	if (mState == nullptr || mState->workers.size() == 0 || numTasks == 1) {
+		for (uint32_t i = 0; i < numTasks; i++) taskFunc(i, threadIdx, userPtr);
+		return;
+	}
+
+	// Grab a free job slot, if all are taken by (nested) runs the tasks are run on calling thread
+	std::unique_lock<std::mutex> lock(mState->mutex);
+	uint32_t jobIdx = ~0u;
+	for (uint32_t i = 0; i < THREAD_POOL_MAX_NUM_JOBS; i++) {
+		if (!mState->jobs[i].active) {
+			jobIdx = i;
+			break;
+		}
+	}
+	if (jobIdx == ~0u) {
+		lock.unlock();
+		for (uint32_t i = 0; i < numTasks; i++) taskFunc(i, threadIdx, userPtr);
+		return;
+	}
+
+	// Publish job. Split tasks into one contiguous range per thread, threads which run out of
+	// tasks steal from the others. So ranges owned by threads that are busy elsewhere or slow to
+	// wake up still get done.
+	ThreadPoolJob& job = mState->jobs[jobIdx];
+	job.taskFunc = taskFunc;
+	job.userPtr = userPtr;
+	job.numParticipants = 0;
+	job.active = true;
+	job.exhausted = false;
+	const uint32_t numThreads = mState->workers.size() + 1;
+	for (uint32_t i = 0; i < numThreads; i++) {
+		uint32_t begin = uint32_t((uint64_t(numTasks) * i) / numThreads);
+		uint32_t end = uint32_t((uint64_t(numTasks) * (i + 1)) / numThreads);
+		job.taskRanges[i].range.store(packRange(begin, end), std::memory_order_relaxed);
+	}
+	mState->jobAvailableCondition.notify_all();
+
+	// Participate in executing tasks, then wait for all other participants to finish
+	participateInJob(mState, lock, jobIdx);
+	mState->jobFinishedCondition.wait(lock, [&]() { return job.numParticipants == 0; });
+	job.active = false;
+}
+
+void ThreadPool::helpUntil(bool(*doneFunc)(void* userPtr), void* userPtr) noexcept
+{
+	if (mState == nullptr) {
+		sfz_assert(doneFunc(userPtr));
+		return;
+	}
+	std::unique_lock<std::mutex> lock(mState->mutex);
+	while (true) {
+		uint32_t jobIdx = ~0u;
+		mState->jobAvailableCondition.wait(lock, [&]() {
+			if (doneFunc(userPtr)) return true;
+			jobIdx = findJoinableJob(mState);
+			return jobIdx != ~0u;
+		});
+		if (jobIdx == ~0u) return;
+		participateInJob(mState, lock, jobIdx);
+	}
+}
+
+void ThreadPool::notifyHelpers() noexcept
+{
+	if (mState == nullptr) return;
+
+	// Notified with the mutex held, helpers check their done function with it held
+	std::lock_guard<std::mutex> lock(mState->mutex);
+	mState->jobAvailableCondition.notify_all();
+}
+
+} // namespace ph
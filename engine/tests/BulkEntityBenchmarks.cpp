@@ -0,0 +1,81 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <algorithm>
+#include <vector>
+
+#include "ph/state/GameState.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// Spawns and despawns projectiles with 2 of 16 component types, using the per-entity functions
+// in a loop and the bulk functions.
+PH_BENCHMARK(bulkEntityOps)
+{
+	uint32_t componentSizes[16];
+	for (uint32_t& size : componentSizes) size = 32;
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = 1u << 20;
+	createInfo.numComponentTypes = 16;
+	createInfo.componentSizes = componentSizes;
+	GameStateContainer container = createGameState(createInfo);
+	GameStateHeader* state = container.getHeader();
+
+	// Template projectile to clone
+	const Entity projectile = state->createEntity();
+	uint8_t data[32] = { 1 };
+	state->addComponentUntyped(projectile, 1, data, 32);
+	state->addComponentUntyped(projectile, 2, data, 32);
+
+	for (uint32_t numEntities : { 50000u, 1000000u }) {
+		std::vector<Entity> entities(numEntities);
+		double loopCreateMs = 1e30, loopDeleteMs = 1e30, loopCloneMs = 1e30;
+		double bulkCreateMs = 1e30, bulkDeleteMs = 1e30, bulkCloneMs = 1e30;
+		for (uint32_t rep = 0; rep < 5; rep++) {
+			loopCreateMs = std::min(loopCreateMs, fastestRunMs(1, [&]() {
+				for (uint32_t i = 0; i < numEntities; i++) entities[i] = state->createEntity();
+			}));
+			loopDeleteMs = std::min(loopDeleteMs, fastestRunMs(1, [&]() {
+				for (uint32_t i = 0; i < numEntities; i++) state->deleteEntity(entities[i]);
+			}));
+			bulkCreateMs = std::min(bulkCreateMs, fastestRunMs(1, [&]() {
+				state->createEntities(numEntities, entities.data());
+			}));
+			bulkDeleteMs = std::min(bulkDeleteMs, fastestRunMs(1, [&]() {
+				state->deleteEntities(entities.data(), numEntities);
+			}));
+			loopCloneMs = std::min(loopCloneMs, fastestRunMs(1, [&]() {
+				for (uint32_t i = 0; i < numEntities; i++) entities[i] = state->cloneEntity(projectile);
+			}));
+			state->deleteEntities(entities.data(), numEntities);
+			bulkCloneMs = std::min(bulkCloneMs, fastestRunMs(1, [&]() {
+				state->cloneEntityN(projectile, numEntities, entities.data());
+			}));
+			state->deleteEntities(entities.data(), numEntities);
+		}
+		printf("  %7u entities: create loop %8.3f ms, createEntities() %8.3f ms\n",
+			numEntities, loopCreateMs, bulkCreateMs);
+		printf("  %7u entities: delete loop %8.3f ms, deleteEntities() %8.3f ms\n",
+			numEntities, loopDeleteMs, bulkDeleteMs);
+		printf("  %7u entities: clone loop  %8.3f ms, cloneEntityN()   %8.3f ms\n",
+			numEntities, loopCloneMs, bulkCloneMs);
+	}
+}
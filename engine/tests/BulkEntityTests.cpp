@@ -0,0 +1,145 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "ph/state/GameState.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+static GameStateContainer createBulkTestState(uint32_t maxNumEntities) noexcept
+{
+	static const uint32_t singletonSizes[] = { 16 };
+	static const uint32_t componentSizes[] = { 12, 0, 64, 4 };
+	static EntityQuery queries[2];
+	queries[0].required = ComponentMask::fromType(1);
+	queries[1].required = ComponentMask::fromType(1) | ComponentMask::fromType(3);
+	queries[1].excluded = ComponentMask::fromType(2);
+	GameStateCreateInfo createInfo;
+	createInfo.numSingletonStructs = 1;
+	createInfo.singletonStructSizes = singletonSizes;
+	createInfo.maxNumEntities = maxNumEntities;
+	createInfo.numComponentTypes = 4;
+	createInfo.componentSizes = componentSizes;
+	createInfo.numQueries = 2;
+	createInfo.queries = queries;
+	return createGameState(createInfo);
+}
+
+// Performs random bulk operations on one state and the equivalent per-entity operations on
+// another, the states must stay byte-identical
+PH_TEST_CASE(bulkEntityOpsMatchPerEntityOps)
+{
+	GameStateContainer bulkContainer = createBulkTestState(2000);
+	GameStateContainer loopContainer = createBulkTestState(2000);
+	GameStateHeader* bulk = bulkContainer.getHeader();
+	GameStateHeader* loop = loopContainer.getHeader();
+	std::mt19937 rng(5);
+	std::vector<Entity> entities;
+	uint8_t data[64] = { 7 };
+	for (uint32_t iter = 0; iter < 3000; iter++) {
+		const uint32_t op = rng() % 5;
+		if (op == 0 || entities.size() < 10) {
+			const uint32_t n = rng() % 50;
+			std::vector<Entity> created(n + 1);
+			const uint32_t numCreated = bulk->createEntities(n, created.data());
+			for (uint32_t i = 0; i < numCreated; i++) {
+				PH_REQUIRE(loop->createEntity() == created[i]);
+				entities.push_back(created[i]);
+			}
+			if (numCreated < n) PH_CHECK(loop->createEntity() == Entity::invalid());
+		}
+		else if (op == 1) {
+			std::vector<Entity> toDelete(rng() % 30);
+			for (Entity& entity : toDelete) entity = entities[rng() % entities.size()];
+			uint32_t numDeleted = 0;
+			for (Entity entity : toDelete) numDeleted += loop->deleteEntity(entity) ? 1 : 0;
+			PH_CHECK(bulk->deleteEntities(toDelete.data(), uint32_t(toDelete.size())) == numDeleted);
+		}
+		else if (op == 2) {
+			const Entity src = entities[rng() % entities.size()];
+			const uint32_t n = rng() % 20;
+			std::vector<Entity> clones(n + 1);
+			const uint32_t numCloned = bulk->cloneEntityN(src, n, clones.data());
+			for (uint32_t i = 0; i < numCloned; i++) {
+				PH_REQUIRE(loop->cloneEntity(src) == clones[i]);
+				entities.push_back(clones[i]);
+			}
+			if (numCloned < n) PH_CHECK(loop->cloneEntity(src) == Entity::invalid());
+		}
+		else {
+			const Entity entity = entities[rng() % entities.size()];
+			const uint32_t type = 1 + rng() % 3;
+			const bool value = (rng() % 2) != 0;
+			for (GameStateHeader* state : { bulk, loop }) {
+				uint32_t componentSize = 0;
+				if (state->componentsUntyped(type, componentSize) != nullptr) {
+					state->addComponentUntyped(entity, type, data, componentSize);
+				}
+				else {
+					state->setComponentUnsized(entity, type, value);
+				}
+			}
+		}
+		PH_REQUIRE(memcmp(bulk, loop, bulk->stateSizeBytes) == 0);
+	}
+
+	// Queries must match a full scan
+	for (uint32_t q = 0; q < bulk->numQueries; q++) {
+		uint32_t numIds = 0;
+		const uint32_t* ids = bulk->queryEntities(q, numIds);
+		uint32_t numExpected = 0;
+		for (uint32_t id = 0; id < bulk->maxNumEntities; id++) {
+			if (!bulk->queryEntry(q).matches(bulk->componentMasks()[id])) continue;
+			PH_CHECK(numExpected < numIds && ids[numExpected] == id);
+			numExpected += 1;
+		}
+		PH_CHECK(numIds == numExpected);
+	}
+}
+
+PH_TEST_CASE(deleteEntitiesClearsComponents)
+{
+	GameStateContainer container = createBulkTestState(100);
+	GameStateHeader* state = container.getHeader();
+	Entity entities[10];
+	PH_REQUIRE(state->createEntities(10, entities) == 10);
+	for (Entity entity : entities) {
+		uint8_t data[64];
+		memset(data, 0xFF, sizeof(data));
+		state->addComponentUntyped(entity, 3, data, 64);
+	}
+
+	// Duplicates and invalid entities are skipped
+	Entity toDelete[4] = { entities[2], entities[2], Entity::invalid(), entities[5] };
+	PH_CHECK(state->deleteEntities(toDelete, 4) == 2);
+	PH_CHECK(state->currentNumEntities == 8);
+	uint32_t componentSize = 0;
+	const uint8_t* components = state->componentsUntyped(3, componentSize);
+	for (uint32_t id : { entities[2].id(), entities[5].id() }) {
+		const uint8_t* component = components + id * componentSize;
+		bool allZero = true;
+		for (uint32_t i = 0; i < 64; i++) allZero = allZero && component[i] == 0;
+		PH_CHECK(allZero);
+	}
+}
@@ -0,0 +1,211 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstring>
+#include <vector>
+
+#include "ph/state/GameState.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+constexpr uint32_t TRACKED_TYPE = 1;
+constexpr uint32_t UNTRACKED_TYPE = 2;
+
+static GameStateContainer createChangeTrackingTestState(uint32_t maxNumEntities) noexcept
+{
+	static const uint32_t componentSizes[] = { 8, 4 };
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = maxNumEntities;
+	createInfo.numComponentTypes = 2;
+	createInfo.componentSizes = componentSizes;
+	createInfo.entityAllocationPolicy = EntityAllocationPolicy::LOWEST_ID_FIRST;
+	createInfo.changeTrackedComponentTypes =
+		ComponentMask::fromType(0) | ComponentMask::fromType(TRACKED_TYPE);
+	return createGameState(createInfo);
+}
+
+PH_TEST_CASE(changeTicksStampedOnAddRemoveAndWrite)
+{
+	GameStateContainer container = createChangeTrackingTestState(100);
+	GameStateHeader* state = container.getHeader();
+	PH_REQUIRE(state->changeTrackingEnabled());
+	PH_CHECK(state->componentTypeIsChangeTracked(0));
+	PH_CHECK(state->componentTypeIsChangeTracked(TRACKED_TYPE));
+	PH_CHECK(!state->componentTypeIsChangeTracked(UNTRACKED_TYPE));
+	PH_CHECK(state->componentChangeTicks(UNTRACKED_TYPE) == nullptr);
+	PH_CHECK(state->changeTick == 1);
+
+	const ComponentChangeTicks* entityTicks = state->componentChangeTicks(0);
+	const ComponentChangeTicks* ticks = state->componentChangeTicks(TRACKED_TYPE);
+	PH_REQUIRE(entityTicks != nullptr && ticks != nullptr);
+
+	// Creation is stamped as added to component type 0
+	Entity entity = state->createEntity();
+	const uint32_t id = entity.id();
+	PH_CHECK(entityTicks[id].added == 1);
+	PH_CHECK(entityTicks[id].removed == 0);
+	PH_CHECK(ticks[id].added == 0);
+
+	// Adding a component the entity does not have is an addition, adding it again a write
+	PH_CHECK(state->advanceChangeTick() == 2);
+	uint64_t value = 1;
+	PH_REQUIRE(state->addComponent(entity, TRACKED_TYPE, value));
+	PH_CHECK(ticks[id].added == 2);
+	PH_CHECK(ticks[id].written == 0);
+	PH_CHECK(state->advanceChangeTick() == 3);
+	PH_REQUIRE(state->addComponent(entity, TRACKED_TYPE, value));
+	PH_CHECK(ticks[id].added == 2);
+	PH_CHECK(ticks[id].written == 3);
+
+	// Writes through pointers are stamped by markDirty() and markDirtyRange()
+	PH_CHECK(state->advanceChangeTick() == 4);
+	*state->component<uint64_t>(TRACKED_TYPE, id) = 2;
+	state->markDirty(TRACKED_TYPE, id);
+	PH_CHECK(ticks[id].written == 4);
+	PH_CHECK(state->advanceChangeTick() == 5);
+	state->markDirtyRange(TRACKED_TYPE, 0, 10);
+	PH_CHECK(ticks[id].written == 5);
+
+	// Untracked component types do not stamp anything
+	PH_CHECK(state->advanceChangeTick() == 6);
+	uint32_t untracked = 3;
+	PH_REQUIRE(state->addComponent(entity, UNTRACKED_TYPE, untracked));
+	PH_CHECK(ticks[id].added == 2);
+	PH_CHECK(ticks[id].written == 5);
+
+	// Removal, both of a component and of the entity (which removes its components)
+	PH_REQUIRE(state->deleteComponent(entity, TRACKED_TYPE));
+	PH_CHECK(ticks[id].removed == 6);
+	PH_CHECK(state->advanceChangeTick() == 7);
+	PH_REQUIRE(state->addComponent(entity, TRACKED_TYPE, value));
+	PH_REQUIRE(state->deleteEntity(entity));
+	PH_CHECK(ticks[id].added == 7);
+	PH_CHECK(ticks[id].removed == 7);
+	PH_CHECK(entityTicks[id].removed == 7);
+
+	// Direct mask edits are stamped by componentMaskModified()
+	PH_CHECK(state->advanceChangeTick() == 8);
+	Entity other = state->createEntity();
+	ComponentMask& mask = state->componentMasks()[other.id()];
+	const ComponentMask oldMask = mask;
+	mask.setComponentType(TRACKED_TYPE, true);
+	state->componentMaskModified(other.id(), oldMask);
+	PH_CHECK(ticks[other.id()].added == 8);
+}
+
+PH_TEST_CASE(changedEntitiesFiltersBySinceTick)
+{
+	constexpr uint32_t MAX_NUM_ENTITIES = 1000;
+	GameStateContainer container = createChangeTrackingTestState(MAX_NUM_ENTITIES);
+	GameStateHeader* state = container.getHeader();
+	std::vector<Entity> entities(MAX_NUM_ENTITIES);
+	PH_REQUIRE(state->createEntities(MAX_NUM_ENTITIES, entities.data()) == MAX_NUM_ENTITIES);
+	std::vector<uint32_t> ids(MAX_NUM_ENTITIES);
+
+	// Tick 2 adds the component to every 10th entity, tick 3 writes every 100th and tick 4 removes
+	// it from a few entities in the last block
+	state->advanceChangeTick();
+	uint64_t value = 0;
+	for (uint32_t i = 0; i < MAX_NUM_ENTITIES; i += 10) {
+		PH_REQUIRE(state->addComponent(entities[i], TRACKED_TYPE, value));
+	}
+	state->advanceChangeTick();
+	for (uint32_t i = 0; i < MAX_NUM_ENTITIES; i += 100) state->markDirty(TRACKED_TYPE, i);
+	state->advanceChangeTick();
+	for (uint32_t i : { 970u, 980u, 990u }) {
+		PH_REQUIRE(state->deleteComponent(entities[i], TRACKED_TYPE));
+	}
+
+	uint32_t numChanged = state->changedEntities(
+		TRACKED_TYPE, 0, COMPONENT_CHANGE_ADDED, ids.data());
+	PH_CHECK(numChanged == 100);
+	for (uint32_t i = 0; i < numChanged; i++) PH_CHECK(ids[i] == i * 10);
+	PH_CHECK(state->changedEntities(TRACKED_TYPE, 3, COMPONENT_CHANGE_ADDED, ids.data()) == 0);
+
+	numChanged = state->changedEntities(TRACKED_TYPE, 3, COMPONENT_CHANGE_ANY, ids.data());
+	PH_REQUIRE(numChanged == 13);
+	for (uint32_t i = 0; i < 10; i++) PH_CHECK(ids[i] == i * 100);
+	PH_CHECK(ids[10] == 970 && ids[11] == 980 && ids[12] == 990);
+
+	numChanged = state->changedEntities(
+		TRACKED_TYPE, state->changeTick, COMPONENT_CHANGE_REMOVED, ids.data());
+	PH_CHECK(numChanged == 3);
+	PH_CHECK(state->changedEntities(
+		TRACKED_TYPE, state->changeTick + 1, COMPONENT_CHANGE_ANY, ids.data()) == 0);
+	PH_CHECK(state->changedEntities(UNTRACKED_TYPE, 0, COMPONENT_CHANGE_ANY, ids.data()) == 0);
+
+	// Creation of all entities at tick 1
+	PH_CHECK(state->changedEntities(0, 1, COMPONENT_CHANGE_ADDED, ids.data()) == MAX_NUM_ENTITIES);
+	PH_CHECK(state->changedEntities(0, 2, COMPONENT_CHANGE_ADDED, ids.data()) == 0);
+}
+
+// Clones are identical, including the change ticks. Compaction leaves the ticks of entities which
+// are not moved as they are and stamps moves as removals and additions.
+PH_TEST_CASE(changeTicksPreservedThroughCloneAndCompaction)
+{
+	constexpr uint32_t MAX_NUM_ENTITIES = 300;
+	GameStateContainer container = createChangeTrackingTestState(MAX_NUM_ENTITIES);
+	GameStateHeader* state = container.getHeader();
+	std::vector<Entity> entities(200);
+	PH_REQUIRE(state->createEntities(200, entities.data()) == 200);
+	state->advanceChangeTick();
+	uint64_t value = 0;
+	for (uint32_t i = 0; i < 200; i += 2) {
+		PH_REQUIRE(state->addComponent(entities[i], TRACKED_TYPE, value));
+	}
+	state->advanceChangeTick();
+	for (uint32_t i = 0; i < 100; i++) PH_REQUIRE(state->deleteEntity(entities[i]));
+	state->advanceChangeTick();
+
+	GameStateContainer clone = container.clone();
+	for (uint32_t type : { 0u, TRACKED_TYPE }) {
+		PH_CHECK(memcmp(clone.getHeader()->componentChangeTicks(type),
+			state->componentChangeTicks(type), MAX_NUM_ENTITIES * sizeof(ComponentChangeTicks)) == 0);
+	}
+	PH_CHECK(clone.getHeader()->changeTick == state->changeTick);
+
+	std::vector<ComponentChangeTicks> ticksBefore(
+		state->componentChangeTicks(TRACKED_TYPE), state->componentChangeTicks(TRACKED_TYPE) + 200);
+	std::vector<EntityRemap> remaps(100);
+	const uint32_t numMoved = state->compactEntities(100, remaps.data());
+	PH_REQUIRE(numMoved == 100);
+	const ComponentChangeTicks* ticks = state->componentChangeTicks(TRACKED_TYPE);
+	const ComponentChangeTicks* entityTicks = state->componentChangeTicks(0);
+	for (uint32_t i = 0; i < numMoved; i++) {
+		const uint32_t oldId = remaps[i].oldEntity.id();
+		const uint32_t newId = remaps[i].newEntity.id();
+		PH_CHECK(entityTicks[oldId].removed == state->changeTick);
+		PH_CHECK(entityTicks[newId].added == state->changeTick);
+		const bool hasComponent = (oldId % 2) == 0;
+		PH_CHECK((ticks[oldId].removed == state->changeTick) == hasComponent);
+		PH_CHECK((ticks[newId].added == state->changeTick) == hasComponent);
+
+		// Written is not moved, it belongs to the id
+		PH_CHECK(ticks[newId].written == ticksBefore[newId].written);
+		PH_CHECK(ticks[oldId].written == ticksBefore[oldId].written);
+	}
+
+	// Nothing else changed at the compaction tick, the earlier changes are still there
+	std::vector<uint32_t> ids(MAX_NUM_ENTITIES);
+	PH_CHECK(state->changedEntities(
+		TRACKED_TYPE, state->changeTick, COMPONENT_CHANGE_ANY, ids.data()) == 100);
+	PH_CHECK(state->changedEntities(
+		0, state->changeTick - 1, COMPONENT_CHANGE_REMOVED, ids.data()) == 200);
+}
@@ -0,0 +1,160 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "ph/state/GameState.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// The component mask and the data of all components of an entity
+static std::vector<uint8_t> entityContents(const GameStateHeader* state, uint32_t entityId) noexcept
+{
+	const uint8_t* mask = reinterpret_cast<const uint8_t*>(state->componentMasks() + entityId);
+	std::vector<uint8_t> contents(mask, mask + sizeof(ComponentMask));
+	for (uint32_t type = 1; type < state->numComponentTypes; type++) {
+		uint8_t data[64] = {};
+		uint32_t componentSize = 0;
+		state->componentsUntyped(type, componentSize);
+		if (componentSize == 0) continue;
+		if (!state->readComponentUntyped(type, entityId, data, componentSize)) continue;
+		contents.insert(contents.end(), data, data + componentSize);
+	}
+	return contents;
+}
+
+// Churns entities with dense, sparse, structure-of-arrays and unsized components, then compacts
+// them in slices of random size. Every live entity must keep its contents under its new id.
+PH_TEST_CASE(compactEntitiesPreservesEntities)
+{
+	constexpr uint32_t MAX_NUM_ENTITIES = 2000;
+	uint32_t componentSizes[] = { 8, 16, 0, 12 };
+	uint32_t sparseCapacities[] = { 0, 300, 0, 0 };
+	uint32_t soaFieldSizes[] = { 4, 8 };
+	ComponentFieldLayout fieldLayouts[4] = {};
+	fieldLayouts[3].numFields = 2;
+	fieldLayouts[3].fieldSizes = soaFieldSizes;
+	EntityQuery queries[2];
+	queries[0].required = ComponentMask::fromType(2) | ComponentMask::fromType(3);
+	queries[1].excluded = ComponentMask::fromType(4);
+
+	for (EntityAllocationPolicy policy :
+		{ EntityAllocationPolicy::LIFO, EntityAllocationPolicy::LOWEST_ID_FIRST }) {
+		GameStateCreateInfo createInfo;
+		createInfo.maxNumEntities = MAX_NUM_ENTITIES;
+		createInfo.numComponentTypes = 4;
+		createInfo.componentSizes = componentSizes;
+		createInfo.componentSparseCapacities = sparseCapacities;
+		createInfo.componentFieldLayouts = fieldLayouts;
+		createInfo.numQueries = 2;
+		createInfo.queries = queries;
+		createInfo.dirtyBlockSize = 32;
+		createInfo.entityAllocationPolicy = policy;
+		createInfo.changeTrackedComponentTypes = ComponentMask::fromType(0);
+		GameStateContainer container = createGameState(createInfo);
+		GameStateHeader* state = container.getHeader();
+		std::mt19937 rng(19);
+		std::vector<EntityRemap> remaps(64);
+		std::vector<uint32_t> ids(MAX_NUM_ENTITIES);
+
+		for (uint32_t round = 0; round < 6; round++) {
+			for (uint32_t i = 0; i < 3000; i++) {
+				const uint32_t op = rng() % 6;
+				const uint32_t id = rng() % MAX_NUM_ENTITIES;
+				const Entity entity = Entity::create(id, state->getGeneration(id));
+				uint8_t data[16] = { uint8_t(rng()), 1, 2, 3, uint8_t(rng()) };
+				if (op < 2) {
+					state->createEntity();
+				}
+				else if (op < 4) {
+					state->deleteEntity(entity);
+				}
+				else if (op == 4) {
+					state->addComponentUntyped(entity, 1, data, 8);
+					if ((rng() % 2) == 0) state->addComponentUntyped(entity, 2, data, 16);
+				}
+				else {
+					state->addComponentUntyped(entity, 4, data, 12);
+					state->setComponentUnsized(entity, 3, (rng() % 2) == 0);
+				}
+			}
+			state->advanceChangeTick();
+
+			// Remember the contents of all live entities, by their original id
+			std::map<uint32_t, std::vector<uint8_t>> contents;
+			std::map<uint32_t, uint32_t> currentToOriginal;
+			for (uint32_t id = 0; id < state->entityHighWaterMark; id++) {
+				if (!state->componentMasks()[id].active()) continue;
+				contents[id] = entityContents(state, id);
+				currentToOriginal[id] = id;
+			}
+			const uint32_t numLive = state->currentNumEntities;
+			PH_REQUIRE(contents.size() == numLive);
+
+			uint32_t totalNumMoves = 0;
+			while (true) {
+				const uint32_t maxNumMoves = 1 + rng() % 64;
+				const uint32_t numMoves = state->compactEntities(maxNumMoves, remaps.data());
+				PH_REQUIRE(numMoves <= maxNumMoves);
+				for (uint32_t i = 0; i < numMoves; i++) {
+					const uint32_t oldId = remaps[i].oldEntity.id();
+					const uint32_t newId = remaps[i].newEntity.id();
+					PH_CHECK(newId < oldId);
+					PH_CHECK(!state->checkEntityValid(remaps[i].oldEntity));
+					PH_CHECK(state->checkEntityValid(remaps[i].newEntity));
+					PH_REQUIRE(currentToOriginal.count(oldId) == 1);
+					currentToOriginal[newId] = currentToOriginal[oldId];
+					currentToOriginal.erase(oldId);
+				}
+				totalNumMoves += numMoves;
+				PH_REQUIRE(validateGameState(state, state->stateSizeBytes));
+				for (uint32_t q = 0; q < 2; q++) {
+					uint32_t numQueried = 0;
+					const uint32_t* queried = state->queryEntities(q, numQueried);
+					const uint32_t numScanned = state->scanEntities(
+						state->queryEntry(q).required, state->queryEntry(q).excluded, ids.data());
+					PH_CHECK(numQueried == numScanned);
+					PH_CHECK(memcmp(queried, ids.data(), numScanned * sizeof(uint32_t)) == 0);
+				}
+				if (numMoves == 0) break;
+			}
+
+			// The live entities are packed and keep their contents
+			PH_CHECK(state->entityHighWaterMark == numLive);
+			PH_CHECK(state->currentNumEntities == numLive);
+			for (const auto& pair : currentToOriginal) {
+				PH_CHECK(pair.first < numLive);
+				PH_CHECK(entityContents(state, pair.first) == contents[pair.second]);
+			}
+
+			// Moves are recorded as removals by change tracking
+			PH_CHECK(state->changedEntities(
+				0, state->changeTick, COMPONENT_CHANGE_REMOVED, ids.data()) == totalNumMoves);
+
+			// New entities fill the lowest free id
+			Entity created = state->createEntity();
+			PH_CHECK(created.id() == numLive);
+			state->deleteEntity(created);
+		}
+	}
+}
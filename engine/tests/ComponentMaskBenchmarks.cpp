@@ -0,0 +1,62 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <random>
+#include <vector>
+
+#include "ph/state/ComponentMask.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// Scans for 1 in 1000 entities with a required mask, with the SIMD kernel and with the
+// per-entity fulfills() loop it replaced.
+PH_BENCHMARK(componentMaskScan)
+{
+	printf("  Scan implementation: %s\n", componentMaskScanImplName());
+	std::mt19937_64 rng(2);
+	const ComponentMask required = ComponentMask::fromRawValue(0x7);
+	for (uint32_t numMasks : { 1u << 16, 1u << 20, 1u << 24 }) {
+		std::vector<ComponentMask> masks(numMasks);
+		for (ComponentMask& mask : masks) {
+			mask = ComponentMask::fromRawValue((rng() % 1000) == 0 ? 0x7 : 0x1);
+		}
+		std::vector<uint32_t> indices(numMasks);
+
+		uint32_t numMatchesSimd = 0;
+		const double simdMs = fastestRunMs(10, [&]() {
+			numMatchesSimd = scanComponentMasks(
+				masks.data(), numMasks, required, ComponentMask::empty(), indices.data());
+			doNotOptimize(indices[0]);
+		});
+		uint32_t numMatchesLoop = 0;
+		const double loopMs = fastestRunMs(10, [&]() {
+			numMatchesLoop = 0;
+			for (uint32_t i = 0; i < numMasks; i++) {
+				if (masks[i].fulfills(required)) indices[numMatchesLoop++] = i;
+			}
+			doNotOptimize(indices[0]);
+		});
+
+		printf("  %8u masks: kernel %8.3f ms, fulfills() loop %8.3f ms (%u matches)\n",
+			numMasks, simdMs, loopMs, numMatchesSimd);
+		if (numMatchesSimd != numMatchesLoop) printf("  ERROR: Results differ\n");
+	}
+}
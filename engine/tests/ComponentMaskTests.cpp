@@ -0,0 +1,155 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "ph/state/ComponentMask.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// Returns a random mask with a few of the low component types set, so that some masks match. Wide
+// masks also get bits in every other word, so that all words are compared.
+static ComponentMask randomMask(std::mt19937_64& rng) noexcept
+{
+	ComponentMask mask = ComponentMask::empty();
+	for (uint32_t i = 0; i < 8; i++) {
+		if ((rng() % 3) != 0) mask.setComponentType(i, true);
+	}
+	for (uint32_t word = 1; word < ComponentMask::NUM_WORDS; word++) {
+		if ((rng() % 2) == 0) mask.setComponentType(word * 64 + 3, true);
+	}
+	if ((rng() % 4) == 0) mask.setComponentType(COMPONENT_MASK_NUM_BITS - 1, true);
+	return mask;
+}
+
+PH_TEST_CASE(scanComponentMasksMatchesFulfills)
+{
+	std::mt19937_64 rng(2);
+	ComponentMask required = ComponentMask::fromType(0) | ComponentMask::fromType(1);
+	const ComponentMask excluded =
+		ComponentMask::fromType(4) | ComponentMask::fromType(COMPONENT_MASK_NUM_BITS - 1);
+	if (ComponentMask::NUM_WORDS > 1) required.setComponentType(67, true);
+
+	// Sizes around the number of masks tested per instruction, to cover the scalar tails
+	for (uint32_t numMasks : { 0u, 1u, 3u, 4u, 7u, 8u, 9u, 15u, 16u, 17u, 100u, 1001u }) {
+		std::vector<ComponentMask> masks(numMasks);
+		for (ComponentMask& mask : masks) mask = randomMask(rng);
+
+		std::vector<uint32_t> indices(numMasks + 1, ~0u);
+		const uint32_t numMatches =
+			scanComponentMasks(masks.data(), numMasks, required, excluded, indices.data());
+
+		uint32_t numExpected = 0;
+		for (uint32_t i = 0; i < numMasks; i++) {
+			if (!masks[i].fulfills(required, excluded)) continue;
+			PH_CHECK(numExpected < numMatches && indices[numExpected] == i);
+			numExpected += 1;
+		}
+		PH_CHECK(numMatches == numExpected);
+	}
+}
+
+PH_TEST_CASE(scanComponentMasksEmptyConstraintsMatchesAll)
+{
+	std::vector<ComponentMask> masks(37, ComponentMask::empty());
+	std::vector<uint32_t> indices(masks.size());
+	const uint32_t numMatches = scanComponentMasks(masks.data(), uint32_t(masks.size()),
+		ComponentMask::empty(), ComponentMask::empty(), indices.data());
+	PH_REQUIRE(numMatches == masks.size());
+	for (uint32_t i = 0; i < numMatches; i++) PH_CHECK(indices[i] == i);
+}
+
+PH_TEST_CASE(scanComponentMasksImplementation)
+{
+#ifdef PH_COMPONENT_MASK_SSE2
+	PH_CHECK(strcmp(componentMaskScanImplName(), "Scalar") != 0);
+#endif
+	printf("  Scan implementation: %s, %u bit masks\n",
+		componentMaskScanImplName(), COMPONENT_MASK_NUM_BITS);
+}
+
+// Wide masks
+// ------------------------------------------------------------------------------------------------
+
+// The mask operations of a given width, independent of the width the engine is compiled with
+template<uint32_t NumBits>
+static void checkWideMaskOperations()
+{
+	using Mask = ComponentMaskT<NumBits>;
+	static_assert(sizeof(Mask) == NumBits / 8, "Mask is padded");
+	constexpr uint32_t lastBit = NumBits - 1;
+
+	const Mask high = Mask::fromType(lastBit);
+	PH_CHECK(high.hasComponentType(lastBit));
+	PH_CHECK(!high.hasComponentType(lastBit - 64));
+	PH_CHECK(high.words[Mask::NUM_WORDS - 1] == (uint64_t(1) << 63));
+	PH_CHECK(high != Mask::empty());
+	PH_CHECK(Mask::fromRawValue(5).words[0] == 5);
+	for (uint32_t word = 1; word < Mask::NUM_WORDS; word++) {
+		PH_CHECK(Mask::fromRawValue(5).words[word] == 0);
+	}
+	PH_CHECK(Mask::activeMask() == Mask::fromType(0));
+	PH_CHECK(Mask::activeMask().active());
+	PH_CHECK(!high.active());
+
+	// Bitwise operators work on all words
+	const Mask a = Mask::fromType(1) | Mask::fromType(65) | high;
+	const Mask b = Mask::fromType(65) | Mask::fromType(lastBit - 1);
+	PH_CHECK((a & b) == Mask::fromType(65));
+	PH_CHECK((a | b).hasComponentType(lastBit - 1));
+	PH_CHECK((~a & a) == Mask::empty());
+	PH_CHECK((~Mask::empty()) == Mask::all());
+	for (uint32_t word = 0; word < Mask::NUM_WORDS; word++) PH_CHECK(Mask::all().words[word] == ~0ull);
+
+	Mask mask = Mask::empty();
+	mask.setComponentType(lastBit, true);
+	mask.setComponentType(70, true);
+	mask.setComponentType(70, false);
+	PH_CHECK(mask == high);
+	mask.setByte(NumBits / 8 - 1, 0x81);
+	PH_CHECK(mask.byteAt(NumBits / 8 - 1) == 0x81);
+	PH_CHECK(mask.hasComponentType(lastBit - 7));
+	PH_CHECK(mask.byteAt(8) == 0);
+
+	// fulfills() must consider every word, a missing or excluded bit in any word fails
+	const Mask entity = Mask::fromType(0) | Mask::fromType(65) | high;
+	PH_CHECK(entity.fulfills(Mask::fromType(65)));
+	PH_CHECK(entity.fulfills(high | Mask::fromType(0)));
+	PH_CHECK(!entity.fulfills(Mask::fromType(66)));
+	PH_CHECK(!entity.fulfills(Mask::fromType(lastBit - 1)));
+	PH_CHECK(entity.fulfills(Mask::fromType(0), Mask::fromType(lastBit - 1)));
+	PH_CHECK(!entity.fulfills(Mask::fromType(0), high));
+	PH_CHECK(!entity.fulfills(Mask::fromType(0), Mask::fromType(65)));
+	PH_CHECK(entity.fulfills(Mask::empty(), Mask::empty()));
+}
+
+PH_TEST_CASE(componentMask128Operations)
+{
+	checkWideMaskOperations<128>();
+}
+
+PH_TEST_CASE(componentMask256Operations)
+{
+	checkWideMaskOperations<256>();
+}
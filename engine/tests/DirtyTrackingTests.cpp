@@ -0,0 +1,137 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include "ph/state/GameState.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// 5000 entities in blocks of 32 gives 157 blocks, i.e. 3 words per component type
+static GameStateContainer createDirtyTrackingTestState(uint32_t dirtyBlockSize) noexcept
+{
+	static const uint32_t singletonSizes[] = { 16, 16 };
+	static const uint32_t componentSizes[] = { 8, 4 };
+	GameStateCreateInfo createInfo;
+	createInfo.numSingletonStructs = 2;
+	createInfo.singletonStructSizes = singletonSizes;
+	createInfo.maxNumEntities = 5000;
+	createInfo.numComponentTypes = 2;
+	createInfo.componentSizes = componentSizes;
+	createInfo.dirtyBlockSize = dirtyBlockSize;
+	return createGameState(createInfo);
+}
+
+static uint32_t countDirtyBlocks(const GameStateHeader* state, uint32_t componentType) noexcept
+{
+	const uint64_t* bits = state->dirtyBlocks(componentType);
+	uint32_t numDirty = 0;
+	for (uint32_t blockIdx = 0; blockIdx < state->numDirtyBlocks(); blockIdx++) {
+		if ((bits[blockIdx / 64] & (uint64_t(1) << (blockIdx % 64))) != 0) numDirty++;
+	}
+	return numDirty;
+}
+
+PH_TEST_CASE(dirtyBlocksAreMarkedPerBlock)
+{
+	GameStateContainer container = createDirtyTrackingTestState(32);
+	GameStateHeader* state = container.getHeader();
+	PH_REQUIRE(state->dirtyTrackingEnabled());
+	PH_CHECK(state->numDirtyBlocks() == 157);
+	state->clearDirty();
+	for (uint32_t type = 0; type < 3; type++) PH_CHECK(countDirtyBlocks(state, type) == 0);
+
+	// A single entity marks exactly its block
+	state->markDirty(1, 33);
+	PH_CHECK(countDirtyBlocks(state, 1) == 1);
+	PH_CHECK(state->dirtyBlocks(1)[0] == (uint64_t(1) << 1));
+	PH_CHECK(!state->isDirty(1, 31));
+	PH_CHECK(state->isDirty(1, 32));
+	PH_CHECK(state->isDirty(1, 63));
+	PH_CHECK(!state->isDirty(1, 64));
+	PH_CHECK(!state->isDirty(2, 33));
+	PH_CHECK(!state->isDirty(0, 33));
+
+	// A range marks every block it overlaps, also across words of the bitset
+	state->markDirtyRange(2, 2040, 20);
+	PH_CHECK(countDirtyBlocks(state, 2) == 2);
+	PH_CHECK(state->dirtyBlocks(2)[0] == (uint64_t(1) << 63));
+	PH_CHECK(state->dirtyBlocks(2)[1] == 1);
+	state->markDirtyRange(2, 2040, 0);
+	PH_CHECK(countDirtyBlocks(state, 2) == 2);
+	state->markDirtyRange(1, 0, 5000);
+	PH_CHECK(countDirtyBlocks(state, 1) == 157);
+	PH_CHECK(state->dirtyBlocks(1)[2] == (uint64_t(1) << (157 - 128)) - 1);
+	PH_CHECK(state->isDirty(1, 4999));
+
+	// The ECS functions mark the bookkeeping (type 0) and the components they modify
+	state->clearDirty();
+	Entity entity = state->createEntity();
+	PH_CHECK(state->isDirty(0, entity.id()));
+	PH_CHECK(countDirtyBlocks(state, 0) == 1);
+	PH_CHECK(countDirtyBlocks(state, 1) == 0);
+	uint32_t value = 7;
+	PH_REQUIRE(state->addComponent(entity, 2, value));
+	PH_CHECK(state->isDirty(2, entity.id()));
+	PH_CHECK(countDirtyBlocks(state, 2) == 1);
+	PH_CHECK(countDirtyBlocks(state, 1) == 0);
+
+	// Singletons are tracked individually
+	state->markSingletonDirty(1);
+	PH_CHECK(state->dirtySingletons == 2);
+}
+
+PH_TEST_CASE(clearDirtyClearsAllBits)
+{
+	GameStateContainer container = createDirtyTrackingTestState(64);
+	GameStateHeader* state = container.getHeader();
+	for (uint32_t type = 0; type < 3; type++) state->markDirtyRange(type, 0, 5000);
+	state->markSingletonDirty(0);
+	state->markSingletonDirty(1);
+	PH_CHECK(countDirtyBlocks(state, 2) == state->numDirtyBlocks());
+
+	state->clearDirty();
+	for (uint32_t type = 0; type < 3; type++) {
+		PH_CHECK(countDirtyBlocks(state, type) == 0);
+		PH_CHECK(!state->isDirty(type, 0));
+	}
+	PH_CHECK(state->dirtySingletons == 0);
+
+	// Marking after a clear only sets what is marked
+	state->markDirty(0, 4999);
+	PH_CHECK(countDirtyBlocks(state, 0) == 1);
+	PH_CHECK(state->isDirty(0, 4999));
+	PH_CHECK(countDirtyBlocks(state, 1) == 0);
+}
+
+// Without dirty tracking nothing is stored, everything counts as dirty and marking is a no-op
+PH_TEST_CASE(dirtyTrackingDisabled)
+{
+	GameStateContainer container = createDirtyTrackingTestState(0);
+	GameStateHeader* state = container.getHeader();
+	PH_CHECK(!state->dirtyTrackingEnabled());
+	PH_CHECK(state->numDirtyBlocks() == 0);
+	PH_CHECK(state->dirtyBlocks(1) == nullptr);
+	state->markDirty(1, 10);
+	state->markDirtyRange(1, 0, 5000);
+	state->markSingletonDirty(0);
+	PH_CHECK(state->isDirty(1, 10));
+	PH_CHECK(state->dirtySingletons == 0);
+	state->clearDirty();
+	PH_CHECK(state->isDirty(1, 10));
+}
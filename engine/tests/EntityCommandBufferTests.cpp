@@ -0,0 +1,152 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstring>
+#include <vector>
+
+#include <sfz/Context.hpp>
+
+#include "ph/state/EntityCommandBuffer.hpp"
+#include "ph/state/ParallelForEntities.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct Point { float x, y; };
+
+constexpr uint32_t POINT_TYPE = 1;
+constexpr uint32_t TAG_TYPE = 2;
+constexpr uint32_t DATA_TYPE = 3;
+
+static GameStateContainer createCommandTestState(uint32_t maxNumEntities) noexcept
+{
+	static const uint32_t componentSizes[] = { sizeof(Point), 0, 20 };
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = maxNumEntities;
+	createInfo.numComponentTypes = 3;
+	createInfo.componentSizes = componentSizes;
+	return createGameState(createInfo);
+}
+
+// Records commands from parallelForEntities() into per-thread buffers for a few ticks and returns
+// the resulting state
+static std::vector<uint8_t> runRecordedTicks(uint32_t numWorkers) noexcept
+{
+	ThreadPool pool;
+	pool.init(numWorkers, sfz::getDefaultAllocator());
+	GameStateContainer container = createCommandTestState(20000);
+	GameStateHeader* state = container.getHeader();
+	for (uint32_t i = 0; i < 1000; i++) {
+		Entity entity = state->createEntity();
+		state->addComponent(entity, POINT_TYPE, Point{ float(i), 0.0f });
+	}
+
+	std::vector<EntityCommandBuffer> buffers(pool.numThreads());
+	for (EntityCommandBuffer& buffer : buffers) buffer.init(1024);
+	for (uint32_t tick = 0; tick < 6; tick++) {
+		const uint8_t* generations = state->entityGenerations();
+		parallelForEntities(pool, state, ComponentMask::empty(), 64,
+			ComponentTypes<Point>{ { POINT_TYPE } }, [&](uint32_t id, Point* pos) {
+			EntityCommandBuffer& buffer = buffers[ThreadPool::currentThreadIdx()];
+			buffer.setSortKey(id);
+			Entity entity = Entity::create(id, generations[id]);
+			if (id % 3 == 0) {
+				buffer.deleteEntity(entity);
+			}
+			else if (id % 3 == 1) {
+				DeferredEntity created = buffer.createEntity();
+				buffer.addComponent(created, POINT_TYPE, Point{ pos->x + 0.5f, float(tick) });
+				if (id % 7 == 0) buffer.setComponentUnsized(created, TAG_TYPE, true);
+				DeferredEntity clone = buffer.cloneEntity(entity);
+				buffer.deleteComponent(clone, POINT_TYPE);
+			}
+			else {
+				buffer.setComponentUnsized(entity, TAG_TYPE, true);
+			}
+		});
+		playbackEntityCommandBuffers(state, buffers.data(), uint32_t(buffers.size()));
+		for (EntityCommandBuffer& buffer : buffers) buffer.clear();
+	}
+	return std::vector<uint8_t>(
+		reinterpret_cast<uint8_t*>(state), reinterpret_cast<uint8_t*>(state) + state->stateSizeBytes);
+}
+
+PH_TEST_CASE(entityCommandBufferPlaybackIsDeterministic)
+{
+	const std::vector<uint8_t> reference = runRecordedTicks(0);
+	for (uint32_t numWorkers : { 1u, 3u, 7u }) {
+		PH_CHECK(runRecordedTicks(numWorkers) == reference);
+	}
+}
+
+PH_TEST_CASE(entityCommandBufferPlaybackMatchesDirectOps)
+{
+	GameStateContainer bufferedContainer = createCommandTestState(100);
+	GameStateContainer directContainer = createCommandTestState(100);
+	GameStateHeader* buffered = bufferedContainer.getHeader();
+	GameStateHeader* direct = directContainer.getHeader();
+	Entity entities[4];
+	for (Entity& entity : entities) {
+		entity = direct->createEntity();
+		PH_REQUIRE(buffered->createEntity() == entity);
+	}
+
+	EntityCommandBuffer buffer;
+	buffer.init(256);
+	uint8_t data[20];
+	for (uint32_t i = 0; i < 20; i++) data[i] = uint8_t(i + 1);
+
+	// Recorded in reverse sort key order, played back in sort key order
+	buffer.setSortKey(2);
+	buffer.deleteEntity(entities[1]);
+	buffer.addComponentUntyped(entities[2], DATA_TYPE, data, 20);
+	buffer.setSortKey(1);
+	DeferredEntity created = buffer.createEntity();
+	buffer.addComponent(created, POINT_TYPE, Point{ 3.0f, 4.0f });
+	buffer.setComponentUnsized(created, TAG_TYPE, true);
+	DeferredEntity clone = buffer.cloneEntity(entities[0]);
+	buffer.addComponentUntyped(clone, DATA_TYPE, nullptr, 20);
+	PH_CHECK(buffer.numCommands() == 7);
+
+	Entity directCreated = direct->createEntity();
+	direct->addComponent(directCreated, POINT_TYPE, Point{ 3.0f, 4.0f });
+	direct->setComponentUnsized(directCreated, TAG_TYPE, true);
+	Entity directClone = direct->cloneEntity(entities[0]);
+	direct->addComponentUntyped(directClone, DATA_TYPE, nullptr, 20);
+	direct->deleteEntity(entities[1]);
+	direct->addComponentUntyped(entities[2], DATA_TYPE, data, 20);
+
+	PH_CHECK(playbackEntityCommandBuffers(buffered, &buffer, 1) == 0);
+	PH_CHECK(buffer.resolveEntity(created) == directCreated);
+	PH_CHECK(buffer.resolveEntity(clone) == directClone);
+	PH_CHECK(memcmp(buffered, direct, buffered->stateSizeBytes) == 0);
+
+	// Null data zero initializes the component
+	uint32_t componentSize = 0;
+	const uint8_t* components = buffered->componentsUntyped(DATA_TYPE, componentSize);
+	PH_REQUIRE(componentSize == 20);
+	bool allZero = true;
+	for (uint32_t i = 0; i < 20; i++) allZero = allZero && components[directClone.id() * 20 + i] == 0;
+	PH_CHECK(allZero);
+
+	// Deferred entities are invalid after clear
+	buffer.clear();
+	PH_CHECK(buffer.numCommands() == 0);
+	PH_CHECK(buffer.resolveEntity(created) == Entity::invalid());
+}
@@ -0,0 +1,82 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <algorithm>
+#include <vector>
+
+#include "ph/state/EntityPrefab.hpp"
+#include "ph/state/GameState.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// Spawns 10K and 90K entities with 8 component types of 32 bytes, a 4 byte one and a flag, using a
+// cloneEntity() loop, cloneEntityN() and instantiatePrefab(). Each spawn starts from the same
+// state with only the template entity in it. The 90K spawns write columns large enough to be
+// filled with streaming stores.
+PH_BENCHMARK(entityPrefabSpawn)
+{
+	const uint32_t componentSizes[] = { 32, 32, 32, 32, 32, 32, 32, 32, 4, 0 };
+	EntityQuery queries[2];
+	queries[0].required = ComponentMask::fromType(1);
+	queries[1].required = ComponentMask::fromType(9) | ComponentMask::fromType(10);
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = 100000;
+	createInfo.numComponentTypes = 10;
+	createInfo.componentSizes = componentSizes;
+	createInfo.numQueries = 2;
+	createInfo.queries = queries;
+	createInfo.dirtyBlockSize = 64;
+	GameStateContainer baseContainer = createGameState(createInfo);
+	GameStateHeader* baseState = baseContainer.getHeader();
+
+	const Entity templateEntity = baseState->createEntity();
+	uint8_t data[32] = { 1 };
+	for (uint32_t i = 1; i <= 8; i++) baseState->addComponentUntyped(templateEntity, i, data, 32);
+	baseState->addComponentUntyped(templateEntity, 9, data, 4);
+	baseState->setComponentUnsized(templateEntity, 10, true);
+	EntityPrefab prefab;
+	prefab.capture(baseState, templateEntity);
+
+	for (uint32_t numEntities : { 10000u, 90000u }) {
+		std::vector<Entity> entities(numEntities);
+		GameStateContainer container = baseContainer.clone();
+		double loopCloneMs = 1e30, bulkCloneMs = 1e30, prefabMs = 1e30;
+		for (uint32_t rep = 0; rep < 10; rep++) {
+			baseContainer.cloneTo(container);
+			loopCloneMs = std::min(loopCloneMs, fastestRunMs(1, [&]() {
+				for (uint32_t i = 0; i < numEntities; i++) {
+					entities[i] = container.getHeader()->cloneEntity(templateEntity);
+				}
+			}));
+			baseContainer.cloneTo(container);
+			bulkCloneMs = std::min(bulkCloneMs, fastestRunMs(1, [&]() {
+				container.getHeader()->cloneEntityN(templateEntity, numEntities, entities.data());
+			}));
+			baseContainer.cloneTo(container);
+			prefabMs = std::min(prefabMs, fastestRunMs(1, [&]() {
+				container.getHeader()->instantiatePrefab(prefab, numEntities, entities.data());
+			}));
+		}
+		doNotOptimize(entities[0]);
+		printf("  %u entities: clone loop %8.3f ms, cloneEntityN() %8.3f ms, "
+			"instantiatePrefab() %8.3f ms\n", numEntities, loopCloneMs, bulkCloneMs, prefabMs);
+	}
+}
@@ -0,0 +1,214 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "ph/state/EntityPrefab.hpp"
+#include "ph/state/GameState.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// Component types: 1 Particle (structure-of-arrays), 2 dense 64 bytes, 3 flag, 4 sparse 32 bytes
+// with 300 slots, 5 dense 4 bytes
+struct Particle { float pos[3]; float vel[3]; float mass; uint32_t flags; };
+
+static GameStateContainer createPrefabTestState(
+	uint32_t maxNumEntities, EntityAllocationPolicy policy, bool changeTracked) noexcept
+{
+	static const uint32_t componentSizes[] = { sizeof(Particle), 64, 0, 32, 4 };
+	static const uint32_t sparseCapacities[] = { 0, 0, 0, 300, 0 };
+	static const uint32_t particleFieldSizes[] = { 4, 4, 4, 4, 4, 4, 4, 4 };
+	static ComponentFieldLayout fieldLayouts[5];
+	fieldLayouts[0].numFields = 8;
+	fieldLayouts[0].fieldSizes = particleFieldSizes;
+	static EntityQuery queries[2];
+	queries[0].required = ComponentMask::fromType(1);
+	queries[1].required = ComponentMask::fromType(4);
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = maxNumEntities;
+	createInfo.numComponentTypes = 5;
+	createInfo.componentSizes = componentSizes;
+	createInfo.componentSparseCapacities = sparseCapacities;
+	createInfo.componentFieldLayouts = fieldLayouts;
+	createInfo.dirtyBlockSize = 64;
+	createInfo.numQueries = 2;
+	createInfo.queries = queries;
+	createInfo.entityAllocationPolicy = policy;
+	if (changeTracked) {
+		createInfo.changeTrackedComponentTypes =
+			ComponentMask::fromType(0) | ComponentMask::fromType(1) | ComponentMask::fromType(4);
+	}
+	return createGameState(createInfo);
+}
+
+// Creates a template entity with all component types, after fragmenting the free entity ids
+static Entity createPrefabTemplate(GameStateHeader* state, const Particle& particle) noexcept
+{
+	std::mt19937 rng(22);
+	std::vector<Entity> entities(2000);
+	state->createEntities(2000, entities.data());
+	for (Entity entity : entities) {
+		if (rng() % 3 == 0) state->deleteEntity(entity);
+	}
+
+	const Entity entity = state->createEntity();
+	state->addComponent(entity, 1, particle);
+	uint8_t data64[64];
+	for (uint32_t i = 0; i < 64; i++) data64[i] = uint8_t(i * 3);
+	state->addComponentUntyped(entity, 2, data64, 64);
+	state->setComponentUnsized(entity, 3, true);
+	uint8_t data32[32];
+	memset(data32, 0x5A, 32);
+	state->addComponentUntyped(entity, 4, data32, 32);
+	state->addComponent(entity, 5, uint32_t(0xDEADBEEF));
+	state->clearDirty();
+	return entity;
+}
+
+// Instantiating a prefab must produce exactly the same state as cloneEntityN() on its template,
+// including running out of sparse slots
+PH_TEST_CASE(instantiatePrefabMatchesCloneEntityN)
+{
+	for (bool lowestIdFirst : { false, true }) {
+		const EntityAllocationPolicy policy = lowestIdFirst ?
+			EntityAllocationPolicy::LOWEST_ID_FIRST : EntityAllocationPolicy::LIFO;
+		GameStateContainer prefabContainer = createPrefabTestState(4000, policy, lowestIdFirst);
+		GameStateHeader* prefabState = prefabContainer.getHeader();
+		const Particle particle = { { 1, 2, 3 }, { 4, 5, 6 }, 7, 8 };
+		const Entity templateEntity = createPrefabTemplate(prefabState, particle);
+		GameStateContainer cloneContainer = prefabContainer.clone();
+		GameStateHeader* cloneState = cloneContainer.getHeader();
+
+		EntityPrefab prefab;
+		PH_REQUIRE(prefab.capture(prefabState, templateEntity));
+		PH_CHECK(prefab.mask() == prefabState->componentMasks()[templateEntity.id()]);
+		PH_CHECK(prefab.numComponents() == 4);
+		PH_CHECK(memcmp(prefab.component<Particle>(1), &particle, sizeof(Particle)) == 0);
+		PH_CHECK(prefab.component<uint32_t>(3) == nullptr);
+
+		// The sparse component type has 300 slots, one of which is used by the template
+		std::vector<Entity> prefabEntities(1000), cloneEntities(1000);
+		const uint32_t numInstantiated =
+			prefabState->instantiatePrefab(prefab, 1000, prefabEntities.data());
+		const uint32_t numCloned = cloneState->cloneEntityN(templateEntity, 1000, cloneEntities.data());
+		PH_CHECK(numInstantiated == 299);
+		PH_REQUIRE(numInstantiated == numCloned);
+		for (uint32_t i = 0; i < numInstantiated; i++) {
+			PH_CHECK(prefabEntities[i] == cloneEntities[i]);
+		}
+		PH_CHECK(memcmp(prefabState, cloneState, prefabState->stateSizeBytes) == 0);
+		PH_CHECK(validateGameState(prefabState, prefabState->stateSizeBytes));
+	}
+}
+
+// Large spawns fill the dense columns with streaming stores, which must produce exactly the same
+// state as cloneEntityN()
+PH_TEST_CASE(instantiatePrefabLargeSpawnMatchesCloneEntityN)
+{
+	GameStateContainer prefabContainer =
+		createPrefabTestState(200000, EntityAllocationPolicy::LOWEST_ID_FIRST, false);
+	GameStateHeader* prefabState = prefabContainer.getHeader();
+	const Particle particle = { { 1, 2, 3 }, { 4, 5, 6 }, 7, 8 };
+	const Entity templateEntity = createPrefabTemplate(prefabState, particle);
+	PH_REQUIRE(prefabState->deleteComponent(templateEntity, 4));
+	GameStateContainer cloneContainer = prefabContainer.clone();
+	GameStateHeader* cloneState = cloneContainer.getHeader();
+
+	EntityPrefab prefab;
+	PH_REQUIRE(prefab.capture(prefabState, templateEntity));
+	std::vector<Entity> prefabEntities(150000), cloneEntities(150000);
+	const uint32_t numInstantiated =
+		prefabState->instantiatePrefab(prefab, 150000, prefabEntities.data());
+	const uint32_t numCloned = cloneState->cloneEntityN(templateEntity, 150000, cloneEntities.data());
+	PH_CHECK(numInstantiated == 150000);
+	PH_REQUIRE(numInstantiated == numCloned);
+	PH_CHECK(memcmp(prefabEntities.data(), cloneEntities.data(), 150000 * sizeof(Entity)) == 0);
+	PH_CHECK(memcmp(prefabState, cloneState, prefabState->stateSizeBytes) == 0);
+	PH_CHECK(validateGameState(prefabState, prefabState->stateSizeBytes));
+}
+
+// Instances get the edited components of the prefab, and the override function is called for
+// each of them afterwards
+PH_TEST_CASE(instantiatePrefabWithEditsAndOverrides)
+{
+	GameStateContainer container =
+		createPrefabTestState(4000, EntityAllocationPolicy::LOWEST_ID_FIRST, true);
+	GameStateHeader* state = container.getHeader();
+	const Particle particle = { { 1, 2, 3 }, { 4, 5, 6 }, 7, 8 };
+	const Entity templateEntity = createPrefabTemplate(state, particle);
+
+	// Without the sparse component type, so that the number of instances is not limited
+	state->deleteComponent(templateEntity, 4);
+	EntityPrefab prefab;
+	PH_REQUIRE(prefab.capture(state, templateEntity));
+	PH_CHECK(state->deleteEntity(templateEntity));
+	prefab.component<Particle>(1)->mass = 42.0f;
+
+	std::vector<Entity> entities(1000);
+	const uint32_t numInstantiated = state->instantiatePrefab(prefab, 1000, entities.data(),
+		[&](uint32_t instanceIdx, Entity entity) {
+		state->componentField<float>(1, 0)[entity.id()] = float(instanceIdx);
+	});
+	PH_REQUIRE(numInstantiated == 1000);
+	for (uint32_t i = 0; i < numInstantiated; i++) {
+		const uint32_t entityId = entities[i].id();
+		Particle instance = {};
+		PH_REQUIRE(state->readComponent(1, entityId, instance));
+		PH_CHECK(instance.pos[0] == float(i));
+		PH_CHECK(instance.pos[1] == 2.0f);
+		PH_CHECK(instance.vel[2] == 6.0f);
+		PH_CHECK(instance.mass == 42.0f);
+		uint32_t value = 0;
+		PH_CHECK(state->readComponent(5, entityId, value) && value == 0xDEADBEEF);
+		PH_CHECK(state->componentMasks()[entityId].hasComponentType(3));
+		PH_CHECK(!state->componentMasks()[entityId].hasComponentType(4));
+	}
+	PH_CHECK(validateGameState(state, state->stateSizeBytes));
+
+	// The cached hashes must account for the new instances
+	const uint64_t cachedHash = state->hash();
+	GameStateContainer uncachedContainer = container.clone();
+	ArrayHeader* hashCache = uncachedContainer.getHeader()->hashCacheArray();
+	memset(hashCache->dataUntyped(), 0, hashCache->capacity * hashCache->elementSize);
+	PH_CHECK(uncachedContainer.getHeader()->hash() == cachedHash);
+
+	// Only the instances have the Particle component, the template entity is deleted
+	uint32_t numMatches = 0;
+	state->queryEntities(0, numMatches);
+	PH_CHECK(numMatches == 1000);
+}
+
+// An invalid entity can't be captured
+PH_TEST_CASE(captureInvalidEntityFails)
+{
+	GameStateContainer container =
+		createPrefabTestState(400, EntityAllocationPolicy::LOWEST_ID_FIRST, false);
+	GameStateHeader* state = container.getHeader();
+	const Entity entity = state->createEntity();
+	PH_REQUIRE(state->deleteEntity(entity));
+	EntityPrefab prefab;
+	PH_CHECK(!prefab.capture(state, entity));
+	PH_CHECK(!prefab.isValid());
+	PH_CHECK(!prefab.capture(state, Entity::invalid()));
+	PH_CHECK(!prefab.isValid());
+}
@@ -0,0 +1,171 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstring>
+
+#include "ph/state/GameState.hpp"
+#include "ph/util/ThreadPool.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct DamageEvent { uint32_t target; uint32_t amount; };
+
+constexpr uint32_t DAMAGE_QUEUE = 0;
+constexpr uint32_t SPAWN_QUEUE = 1;
+
+static GameStateContainer createEventTestState(uint32_t damageCapacity) noexcept
+{
+	static const uint32_t componentSizes[] = { 0, 4 };
+	EventQueueDesc eventQueues[2];
+	eventQueues[DAMAGE_QUEUE].eventSize = sizeof(DamageEvent);
+	eventQueues[DAMAGE_QUEUE].capacity = damageCapacity;
+	eventQueues[SPAWN_QUEUE].eventSize = 4;
+	eventQueues[SPAWN_QUEUE].capacity = 8;
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = 16;
+	createInfo.numComponentTypes = 2;
+	createInfo.componentSizes = componentSizes;
+	createInfo.numEventQueues = 2;
+	createInfo.eventQueues = eventQueues;
+	return createGameState(createInfo);
+}
+
+PH_TEST_CASE(eventQueuePushAndDrain)
+{
+	GameStateContainer container = createEventTestState(16);
+	GameStateHeader* state = container.getHeader();
+
+	uint32_t numEvents = ~0u;
+	PH_CHECK(state->events<DamageEvent>(DAMAGE_QUEUE, numEvents) != nullptr);
+	PH_CHECK(numEvents == 0);
+
+	PH_CHECK(state->pushEvent(DAMAGE_QUEUE, DamageEvent{ 1, 10 }));
+	const DamageEvent batch[] = { { 2, 20 }, { 3, 30 }, { 4, 40 } };
+	PH_CHECK(state->pushEvents(DAMAGE_QUEUE, batch, 3) == 3);
+	uint32_t numReserved = 0;
+	DamageEvent* reserved = state->reserveEvents<DamageEvent>(DAMAGE_QUEUE, 2, numReserved);
+	PH_REQUIRE(reserved != nullptr);
+	PH_CHECK(numReserved == 2);
+	reserved[0] = { 5, 50 };
+	reserved[1] = { 6, 60 };
+
+	// Events are drained in push order, the other queue is unaffected
+	const DamageEvent* events = state->events<DamageEvent>(DAMAGE_QUEUE, numEvents);
+	PH_REQUIRE(numEvents == 6);
+	for (uint32_t i = 0; i < numEvents; i++) {
+		PH_CHECK(events[i].target == i + 1);
+		PH_CHECK(events[i].amount == (i + 1) * 10);
+	}
+	state->events<uint32_t>(SPAWN_QUEUE, numEvents);
+	PH_CHECK(numEvents == 0);
+	PH_CHECK(state->numDroppedEvents(DAMAGE_QUEUE) == 0);
+
+	// Invalid queues and mismatched event sizes are rejected
+	PH_CHECK(!state->pushEvent(2, DamageEvent{ 1, 1 }));
+	PH_CHECK(state->eventsUntyped(2, numEvents, numReserved) == nullptr);
+	PH_CHECK(state->pushEvents(SPAWN_QUEUE, static_cast<const uint32_t*>(nullptr), 0) == 0);
+}
+
+// A push which does not fit is clamped to the remaining capacity and the rest is counted as dropped,
+// also when several threads push concurrently
+PH_TEST_CASE(eventQueueOverflowIsClamped)
+{
+	GameStateContainer container = createEventTestState(16);
+	GameStateHeader* state = container.getHeader();
+
+	DamageEvent batch[10];
+	for (uint32_t i = 0; i < 10; i++) batch[i] = { i, i };
+	PH_CHECK(state->pushEvents(DAMAGE_QUEUE, batch, 10) == 10);
+	PH_CHECK(state->pushEvents(DAMAGE_QUEUE, batch, 10) == 6);
+	PH_CHECK(state->numDroppedEvents(DAMAGE_QUEUE) == 4);
+	PH_CHECK(!state->pushEvent(DAMAGE_QUEUE, batch[0]));
+	uint32_t numReserved = ~0u;
+	PH_CHECK(state->reserveEvents<DamageEvent>(DAMAGE_QUEUE, 3, numReserved) == nullptr);
+	PH_CHECK(numReserved == 0);
+	PH_CHECK(state->numDroppedEvents(DAMAGE_QUEUE) == 8);
+
+	uint32_t numEvents = 0;
+	const DamageEvent* events = state->events<DamageEvent>(DAMAGE_QUEUE, numEvents);
+	PH_REQUIRE(numEvents == 16);
+	for (uint32_t i = 0; i < numEvents; i++) PH_CHECK(events[i].target == i % 10);
+
+	// Concurrent pushes never exceed the capacity, every event is either stored or dropped
+	constexpr uint32_t CAPACITY = 1000;
+	constexpr uint32_t NUM_TASKS = 64;
+	constexpr uint32_t EVENTS_PER_TASK = 7;
+	GameStateContainer concurrentContainer = createEventTestState(CAPACITY);
+	GameStateHeader* concurrentState = concurrentContainer.getHeader();
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+	for (uint32_t round = 0; round < 4; round++) {
+		auto pushTask = [&](uint32_t taskIdx, uint32_t) {
+			for (uint32_t i = 0; i < 100; i++) {
+				DamageEvent taskEvents[EVENTS_PER_TASK];
+				for (DamageEvent& event : taskEvents) event = { taskIdx + 1, i };
+				concurrentState->pushEvents(DAMAGE_QUEUE, taskEvents, EVENTS_PER_TASK);
+			}
+		};
+		pool.runFunc(NUM_TASKS, pushTask);
+		events = concurrentState->events<DamageEvent>(DAMAGE_QUEUE, numEvents);
+		PH_CHECK(numEvents == CAPACITY);
+		PH_CHECK(concurrentState->numDroppedEvents(DAMAGE_QUEUE) ==
+			NUM_TASKS * 100 * EVENTS_PER_TASK - CAPACITY);
+		uint32_t numWritten = 0;
+		for (uint32_t i = 0; i < numEvents; i++) {
+			if (events[i].target != 0) numWritten++;
+		}
+		PH_CHECK(numWritten == CAPACITY);
+		concurrentState->clearEvents();
+	}
+}
+
+// Clearing between frames empties the queues and resets the dropped counters, leaving the state
+// identical to a newly created one
+PH_TEST_CASE(eventQueueClearBetweenFrames)
+{
+	GameStateContainer container = createEventTestState(4);
+	GameStateHeader* state = container.getHeader();
+	GameStateContainer fresh = container.clone();
+
+	for (uint32_t frame = 0; frame < 3; frame++) {
+		for (uint32_t i = 0; i < 6; i++) state->pushEvent(DAMAGE_QUEUE, DamageEvent{ frame, i });
+		PH_CHECK(state->pushEvent(SPAWN_QUEUE, frame));
+		PH_CHECK(state->numDroppedEvents(DAMAGE_QUEUE) == 2);
+
+		uint32_t numEvents = 0;
+		const DamageEvent* events = state->events<DamageEvent>(DAMAGE_QUEUE, numEvents);
+		PH_REQUIRE(numEvents == 4);
+		for (uint32_t i = 0; i < numEvents; i++) {
+			PH_CHECK(events[i].target == frame);
+			PH_CHECK(events[i].amount == i);
+		}
+
+		// Clearing a single queue leaves the others as is
+		state->clearEvents(DAMAGE_QUEUE);
+		state->events<DamageEvent>(DAMAGE_QUEUE, numEvents);
+		PH_CHECK(numEvents == 0);
+		PH_CHECK(state->numDroppedEvents(DAMAGE_QUEUE) == 0);
+		state->events<uint32_t>(SPAWN_QUEUE, numEvents);
+		PH_CHECK(numEvents == 1);
+
+		state->clearEvents();
+		PH_CHECK(memcmp(state, fresh.getHeader(), state->stateSizeBytes) == 0);
+	}
+}
@@ -0,0 +1,291 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstdio>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "ph/state/GameState.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// External id test helpers
+// ------------------------------------------------------------------------------------------------
+
+// Same hash as the external id index, used to pick ids which collide in the same group
+static uint64_t testExternalIdHash(uint64_t externalId) noexcept
+{
+	uint64_t hash = externalId;
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDull;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static GameStateContainer createExternalIdTestState(uint32_t maxNumEntities) noexcept
+{
+	static const uint32_t componentSizes[] = { 0, 4, 0 };
+	static EntityQuery query;
+	query.required = ComponentMask::fromType(2);
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = maxNumEntities;
+	createInfo.numComponentTypes = 3;
+	createInfo.componentSizes = componentSizes;
+	createInfo.numQueries = 1;
+	createInfo.queries = &query;
+	createInfo.externalIds = true;
+	return createGameState(createInfo);
+}
+
+// Checks that the external ids of all live entities and the index agree with the reference
+static bool externalIdsMatch(
+	const GameStateHeader* state, const std::map<uint64_t, Entity>& reference) noexcept
+{
+	if (state->externalIdSlotsArray()->size != reference.size()) return false;
+	for (const auto& pair : reference) {
+		if (state->findEntity(pair.first) != pair.second) return false;
+		if (state->externalId(pair.second) != pair.first) return false;
+	}
+	const uint64_t* externalIds = state->externalIds();
+	uint32_t numExternalIds = 0;
+	for (uint32_t id = 0; id < state->entityHighWaterMark; id++) {
+		if (externalIds[id] != 0) numExternalIds++;
+	}
+	return numExternalIds == reference.size();
+}
+
+// External id tests
+// ------------------------------------------------------------------------------------------------
+
+PH_TEST_CASE(externalIdsInsertFindRemove)
+{
+	GameStateContainer container = createExternalIdTestState(100);
+	GameStateHeader* state = container.getHeader();
+	PH_REQUIRE(state->externalIdsEnabled());
+
+	// Created entities are given sequential ids, which are not reused after deletion
+	Entity a = state->createEntity();
+	Entity b = state->createEntity();
+	PH_CHECK(state->externalId(a) == 1);
+	PH_CHECK(state->externalId(b) == 2);
+	PH_CHECK(state->findEntity(1) == a);
+	PH_CHECK(state->findEntity(2) == b);
+	PH_CHECK(state->findEntity(3) == Entity::invalid());
+	PH_CHECK(state->findEntity(0) == Entity::invalid());
+	PH_REQUIRE(state->deleteEntity(a));
+	PH_CHECK(state->findEntity(1) == Entity::invalid());
+	PH_CHECK(state->externalId(a) == 0);
+	Entity c = state->createEntity();
+	PH_CHECK(state->externalId(c) == 3);
+
+	// Replacing, duplicates and removal
+	PH_CHECK(state->setExternalId(b, 1000));
+	PH_CHECK(state->findEntity(2) == Entity::invalid());
+	PH_CHECK(state->findEntity(1000) == b);
+	PH_CHECK(!state->setExternalId(c, 1000));
+	PH_CHECK(state->externalId(c) == 3);
+	PH_CHECK(state->setExternalId(c, 0));
+	PH_CHECK(state->findEntity(3) == Entity::invalid());
+	PH_CHECK(state->externalId(c) == 0);
+	PH_CHECK(!state->setExternalId(a, 5));
+
+	// Ids already in use are skipped when assigning
+	PH_CHECK(state->setExternalId(c, 4));
+	Entity d = state->createEntity();
+	PH_CHECK(state->externalId(d) == 5);
+}
+
+// Fills a group of a tiny index so that ids continue in the next group, wrapping around to group
+// 0, and checks that removing from the full group leaves a tombstone which is probed past and
+// then reused
+PH_TEST_CASE(externalIdIndexTombstonesAndWrap)
+{
+	// 32 slots, i.e. two groups of 16
+	GameStateContainer container = createExternalIdTestState(28);
+	GameStateHeader* state = container.getHeader();
+	const ArrayHeader* controlBytesArray = state->externalIdIndexArray();
+	const uint8_t* controlBytes = controlBytesArray->data<uint8_t>();
+	const ExternalIdSlot* slots = state->externalIdSlotsArray()->data<ExternalIdSlot>();
+	PH_REQUIRE(controlBytesArray->capacity == 32);
+
+	std::vector<Entity> entities;
+	for (uint32_t i = 0; i < 20; i++) {
+		Entity entity = state->createEntity();
+		PH_REQUIRE(state->setExternalId(entity, 0));
+		entities.push_back(entity);
+	}
+	PH_REQUIRE(controlBytesArray->size == 0);
+
+	// 20 ids which all start probing in the last group, 4 of them wrap around to group 0
+	std::vector<uint64_t> ids;
+	for (uint64_t id = 1000; ids.size() < 20; id++) {
+		if (((testExternalIdHash(id) >> 7) & 1) == 1) ids.push_back(id);
+	}
+	std::map<uint64_t, Entity> reference;
+	for (uint32_t i = 0; i < 20; i++) {
+		PH_REQUIRE(state->setExternalId(entities[i], ids[i]));
+		reference[ids[i]] = entities[i];
+	}
+	PH_CHECK(externalIdsMatch(state, reference));
+	uint32_t numWrapped = 0;
+	for (uint32_t slotIdx = 0; slotIdx < 16; slotIdx++) {
+		if (slots[slotIdx].externalId != 0) numWrapped++;
+	}
+	PH_CHECK(numWrapped == 4);
+
+	// Removing from the full group leaves a tombstone, the wrapped ids are still found
+	PH_REQUIRE(state->deleteEntity(entities[0]));
+	reference.erase(ids[0]);
+	uint32_t numDeleted = 0;
+	for (uint32_t slotIdx = 0; slotIdx < 32; slotIdx++) {
+		if (controlBytes[slotIdx] == 1) numDeleted++;
+	}
+	PH_CHECK(numDeleted == 1);
+	PH_CHECK(controlBytesArray->size == 20);
+	PH_CHECK(externalIdsMatch(state, reference));
+
+	// The tombstone is reused by the next id probing the group
+	Entity entity = state->createEntity();
+	PH_REQUIRE(state->setExternalId(entity, 0));
+	uint64_t id = ids.back() + 1;
+	while (((testExternalIdHash(id) >> 7) & 1) != 1) id++;
+	PH_REQUIRE(state->setExternalId(entity, id));
+	reference[id] = entity;
+	numDeleted = 0;
+	for (uint32_t slotIdx = 0; slotIdx < 32; slotIdx++) {
+		if (controlBytes[slotIdx] == 1) numDeleted++;
+	}
+	PH_CHECK(numDeleted == 0);
+	PH_CHECK(controlBytesArray->size == 20);
+	PH_CHECK(externalIdsMatch(state, reference));
+
+	// Keep turning slots of the full group into tombstones while inserting into group 0, until
+	// the used slots exceed 7/8 of the index and it is rebuilt without tombstones
+	bool rebuilt = false;
+	for (uint32_t i = 1; i < 16 && !rebuilt; i++) {
+		PH_REQUIRE(state->deleteEntity(reference[ids[i]]));
+		reference.erase(ids[i]);
+		entity = state->createEntity();
+		PH_REQUIRE(state->setExternalId(entity, 0));
+		while (((testExternalIdHash(++id) >> 7) & 1) != 0) {}
+		PH_REQUIRE(state->setExternalId(entity, id));
+		reference[id] = entity;
+		rebuilt = controlBytesArray->size == state->externalIdSlotsArray()->size;
+		PH_CHECK(externalIdsMatch(state, reference));
+	}
+	PH_CHECK(rebuilt);
+	PH_CHECK(controlBytesArray->size == reference.size());
+}
+
+// Random churn against a reference map, the ids are picked from a small range so that
+// setExternalId() often collides with an id already in use
+PH_TEST_CASE(externalIdIndexChurn)
+{
+	GameStateContainer container = createExternalIdTestState(200);
+	GameStateHeader* state = container.getHeader();
+	std::map<uint64_t, Entity> reference;
+	std::vector<Entity> entities;
+	std::mt19937 rng(24);
+	for (uint32_t i = 0; i < 20000; i++) {
+		const uint32_t op = rng() % 4;
+		if (op == 0 && entities.size() < 200) {
+			Entity entity = state->createEntity();
+			PH_REQUIRE(entity != Entity::invalid());
+			reference[state->externalId(entity)] = entity;
+			entities.push_back(entity);
+		}
+		else if (op == 1 && !entities.empty()) {
+			const uint32_t idx = rng() % entities.size();
+			reference.erase(state->externalId(entities[idx]));
+			PH_REQUIRE(state->deleteEntity(entities[idx]));
+			entities[idx] = entities.back();
+			entities.pop_back();
+		}
+		else if (!entities.empty()) {
+			Entity entity = entities[rng() % entities.size()];
+			const uint64_t oldId = state->externalId(entity);
+			const uint64_t id = (rng() % 8) == 0 ? 0 : uint64_t(rng() % 5000) + 1;
+			auto it = reference.find(id);
+			const bool taken = id != 0 && it != reference.end() && it->second != entity;
+			PH_CHECK(state->setExternalId(entity, id) == !taken);
+			if (!taken) {
+				reference.erase(oldId);
+				if (id != 0) reference[id] = entity;
+			}
+		}
+		if ((i % 1000) == 0) PH_CHECK(externalIdsMatch(state, reference));
+	}
+	PH_CHECK(externalIdsMatch(state, reference));
+}
+
+// Compacting moves the external ids along with the entities, rebuilding the queries leaves them
+// as is, and they survive cloning and saving
+PH_TEST_CASE(externalIdsSurviveCompactionCloneAndSave)
+{
+	GameStateContainer container = createExternalIdTestState(1000);
+	GameStateHeader* state = container.getHeader();
+	std::vector<Entity> entities(1000);
+	PH_REQUIRE(state->createEntities(1000, entities.data()) == 1000);
+	std::map<uint64_t, Entity> reference;
+	for (uint32_t i = 0; i < 1000; i++) {
+		if ((i % 3) != 0) {
+			PH_REQUIRE(state->deleteEntity(entities[i]));
+			continue;
+		}
+		state->setComponentUnsized(entities[i], 2, true);
+		reference[state->externalId(entities[i])] = entities[i];
+	}
+	PH_REQUIRE(externalIdsMatch(state, reference));
+
+	std::vector<EntityRemap> remaps(1000);
+	const uint32_t numMoved = state->compactEntities(1000, remaps.data());
+	PH_REQUIRE(numMoved != 0);
+	for (uint32_t i = 0; i < numMoved; i++) {
+		for (auto& pair : reference) {
+			if (pair.second == remaps[i].oldEntity) pair.second = remaps[i].newEntity;
+		}
+	}
+	PH_CHECK(state->entityHighWaterMark == reference.size());
+	PH_CHECK(externalIdsMatch(state, reference));
+
+	state->rebuildQueries();
+	PH_CHECK(externalIdsMatch(state, reference));
+
+	// New entities continue from the next id, not reusing the ids of deleted entities
+	Entity entity = state->createEntity();
+	PH_CHECK(state->externalId(entity) == 1001);
+	reference[1001] = entity;
+
+	GameStateContainer clone = container.clone();
+	PH_CHECK(externalIdsMatch(clone.getHeader(), reference));
+
+	const char* path = "external_id_test.phstate";
+	PH_REQUIRE(saveGameState(state, path));
+	GameStateContainer mapped = mapGameState(path, GameStateMapMode::COPY_ON_WRITE, state);
+	PH_REQUIRE(mapped.getHeader() != nullptr);
+	PH_CHECK(externalIdsMatch(mapped.getHeader(), reference));
+	entity = mapped.getHeader()->createEntity();
+	PH_CHECK(mapped.getHeader()->externalId(entity) == 1002);
+	mapped.destroy();
+	remove(path);
+}
@@ -0,0 +1,108 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstring>
+#include <random>
+
+#include <sfz/Context.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/GameStateDelta.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+static GameStateContainer createDeltaTestState(uint32_t maxNumEntities) noexcept
+{
+	static const uint32_t componentSizes[] = { 12, 0, 64, 4 };
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = maxNumEntities;
+	createInfo.numComponentTypes = 4;
+	createInfo.componentSizes = componentSizes;
+	return createGameState(createInfo);
+}
+
+// Performs a few random entity operations on the state
+static void mutateState(GameStateHeader* state, std::mt19937& rng) noexcept
+{
+	uint8_t data[64];
+	for (uint8_t& b : data) b = uint8_t(rng());
+	const uint32_t numOps = rng() % 20;
+	for (uint32_t i = 0; i < numOps; i++) {
+		const uint32_t op = rng() % 3;
+		if (op == 0) {
+			state->createEntity();
+			continue;
+		}
+		const uint32_t id = rng() % state->maxNumEntities;
+		const Entity entity = Entity::create(id, state->entityGenerations()[id]);
+		if (op == 1) state->deleteEntity(entity);
+		else state->addComponentUntyped(entity, 2, data, 64);
+	}
+}
+
+PH_TEST_CASE(stateDeltaRoundtrip)
+{
+	std::mt19937 rng(8);
+	for (uint32_t maxNumEntities : { 1u, 5u, 100u, 70000u }) {
+		GameStateContainer base = createDeltaTestState(maxNumEntities);
+		mutateState(base.getHeader(), rng);
+		DynArray<uint8_t> delta;
+		delta.init(0, sfz::getDefaultAllocator(), sfz_dbg("stateDeltaRoundtrip"));
+		for (uint32_t iter = 0; iter < 30; iter++) {
+			GameStateContainer current = base.clone();
+			mutateState(current.getHeader(), rng);
+			const uint32_t stateSize = uint32_t(base.getHeader()->stateSizeBytes);
+			if (iter == 0) reinterpret_cast<uint8_t*>(current.getHeader())[stateSize - 1] ^= 0x55;
+
+			PH_REQUIRE(computeStateDelta(base.getHeader(), current.getHeader(), delta));
+			GameStateContainer applied = base.clone();
+			PH_REQUIRE(applyStateDelta(applied.getHeader(), delta.data(), delta.size()));
+			PH_CHECK(memcmp(applied.getHeader(), current.getHeader(), stateSize) == 0);
+
+			// Malformed deltas are rejected without modifying the state
+			GameStateContainer untouched = base.clone();
+			PH_CHECK(!applyStateDelta(untouched.getHeader(), delta.data(), delta.size() - 1));
+			PH_CHECK(memcmp(untouched.getHeader(), base.getHeader(), stateSize) == 0);
+
+			GameStateContainer copied = base.clone();
+			copyDifferingBlocks(copied.getHeader(), current.getHeader());
+			PH_CHECK(memcmp(copied.getHeader(), current.getHeader(), stateSize) == 0);
+		}
+	}
+}
+
+PH_TEST_CASE(stateDeltaOfIdenticalStatesIsEmpty)
+{
+	GameStateContainer base = createDeltaTestState(100);
+	GameStateContainer current = base.clone();
+	DynArray<uint8_t> delta;
+	delta.init(0, sfz::getDefaultAllocator(), sfz_dbg("stateDeltaOfIdenticalStatesIsEmpty"));
+	PH_REQUIRE(computeStateDelta(base.getHeader(), current.getHeader(), delta));
+	PH_REQUIRE(delta.size() == sizeof(StateDeltaHeader));
+	const StateDeltaHeader* header = reinterpret_cast<const StateDeltaHeader*>(delta.data());
+	PH_CHECK(header->numRuns == 0);
+	PH_CHECK(header->numChangedBytes == 0);
+	PH_CHECK(copyDifferingBlocks(current.getHeader(), base.getHeader()) == 0);
+
+	// States of different sizes are rejected
+	GameStateContainer other = createDeltaTestState(200);
+	PH_CHECK(!computeStateDelta(base.getHeader(), other.getHeader(), delta));
+	PH_CHECK(!applyStateDelta(other.getHeader(), delta.data(), delta.size()));
+}
@@ -0,0 +1,174 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstddef>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/GameStateHistory.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// History test helpers
+// ------------------------------------------------------------------------------------------------
+
+static GameStateContainer createHistoryTestState(uint32_t dirtyBlockSize) noexcept
+{
+	static const uint32_t singletonSizes[] = { 8 };
+	static const uint32_t componentSizes[] = { 16, 0, 4 };
+	static const uint32_t sparseCapacities[] = { 0, 0, 50 };
+	GameStateCreateInfo createInfo;
+	createInfo.numSingletonStructs = 1;
+	createInfo.singletonStructSizes = singletonSizes;
+	createInfo.maxNumEntities = 2000;
+	createInfo.numComponentTypes = 3;
+	createInfo.componentSizes = componentSizes;
+	createInfo.componentSparseCapacities = sparseCapacities;
+	createInfo.dirtyBlockSize = dirtyBlockSize;
+	return createGameState(createInfo);
+}
+
+// Simulates a tick of random changes, all made through the ECS API so that they are marked dirty
+static void simulateHistoryTestTick(GameStateHeader* state, std::mt19937& rng, uint64_t tick) noexcept
+{
+	state->clearDirty();
+	for (uint32_t i = 0; i < 40; i++) {
+		const uint32_t id = rng() % state->maxNumEntities;
+		const Entity entity = Entity::create(id, state->getGeneration(id));
+		uint8_t data[16] = { uint8_t(tick), uint8_t(rng()) };
+		switch (rng() % 5) {
+		case 0: state->createEntity(); break;
+		case 1: state->deleteEntity(entity); break;
+		case 2: state->addComponentUntyped(entity, 1, data, 16); break;
+		case 3: state->setComponentUnsized(entity, 2, (rng() % 2) == 0); break;
+		default: state->addComponentUntyped(entity, 3, data, 4); break;
+		}
+	}
+	uint32_t singletonSize = 0;
+	memcpy(state->singletonUntyped(0, singletonSize), &tick, sizeof(uint64_t));
+	state->markSingletonDirty(0);
+}
+
+// Compares the contents of two states, ignoring the dirty bits which restore() sets
+static bool historyStatesEqual(const GameStateHeader* lhs, const GameStateHeader* rhs) noexcept
+{
+	if (lhs->stateSizeBytes != rhs->stateSizeBytes) return false;
+	const uint8_t* lhsBytes = reinterpret_cast<const uint8_t*>(lhs);
+	const uint8_t* rhsBytes = reinterpret_cast<const uint8_t*>(rhs);
+	const ArrayHeader* dirtyBitset = lhs->dirtyBitsetArray();
+	const size_t dirtyBegin = static_cast<const uint8_t*>(dirtyBitset->dataUntyped()) - lhsBytes;
+	const size_t dirtyEnd = dirtyBegin + size_t(dirtyBitset->capacity) * sizeof(uint64_t);
+	const size_t singletonsBegin = offsetof(GameStateHeader, dirtySingletons);
+	const size_t singletonsEnd = singletonsBegin + sizeof(uint64_t);
+	return memcmp(lhsBytes, rhsBytes, singletonsBegin) == 0 &&
+		memcmp(lhsBytes + singletonsEnd, rhsBytes + singletonsEnd, dirtyBegin - singletonsEnd) == 0 &&
+		memcmp(lhsBytes + dirtyEnd, rhsBytes + dirtyEnd, lhs->stateSizeBytes - dirtyEnd) == 0;
+}
+
+// History tests
+// ------------------------------------------------------------------------------------------------
+
+// Pushes more snapshots than there are slots, the oldest ones are overwritten and the rest must be
+// identical to copies taken at the same time
+PH_TEST_CASE(gameStateHistoryRingBufferWraparound)
+{
+	for (uint32_t dirtyBlockSize : { 0u, 64u }) {
+		GameStateContainer container = createHistoryTestState(dirtyBlockSize);
+		GameStateHeader* state = container.getHeader();
+		GameStateHistory history;
+		history.init(state, 5);
+		PH_REQUIRE(history.isValid());
+		PH_CHECK(history.capacity() == 5);
+		PH_CHECK(history.numSnapshots() == 0);
+		PH_CHECK(history.snapshotAt(0) == nullptr);
+
+		std::mt19937 rng(9);
+		std::vector<GameStateContainer> copies;
+		for (uint64_t tick = 0; tick < 23; tick++) {
+			simulateHistoryTestTick(state, rng, tick);
+			history.snapshot(state, tick);
+			copies.push_back(container.clone());
+
+			PH_CHECK(history.numSnapshots() == (tick < 5 ? tick + 1 : 5));
+			PH_CHECK(history.newestTick() == tick);
+			PH_CHECK(history.oldestTick() == (tick < 5 ? 0 : tick - 4));
+			for (uint64_t t = 0; t <= tick; t++) {
+				const GameStateHeader* snapshot = history.snapshotAt(t);
+				if ((tick - t) >= 5) {
+					PH_CHECK(snapshot == nullptr);
+					continue;
+				}
+				PH_REQUIRE(snapshot != nullptr);
+				PH_CHECK(memcmp(snapshot, copies[t].getHeader(), state->stateSizeBytes) == 0);
+			}
+		}
+
+		history.clear();
+		PH_CHECK(history.numSnapshots() == 0);
+		PH_CHECK(history.snapshotAt(22) == nullptr);
+	}
+}
+
+// Rewinds a few ticks, discarding the newer snapshots, and simulates a different future from there
+PH_TEST_CASE(gameStateHistoryRestoreAndResimulate)
+{
+	for (uint32_t dirtyBlockSize : { 0u, 64u }) {
+		GameStateContainer container = createHistoryTestState(dirtyBlockSize);
+		GameStateHeader* state = container.getHeader();
+		GameStateHistory history;
+		history.init(state, 8);
+
+		std::mt19937 rng(10);
+		std::vector<GameStateContainer> copies;
+		for (uint64_t tick = 0; tick < 12; tick++) {
+			simulateHistoryTestTick(state, rng, tick);
+			history.snapshot(state, tick);
+			copies.push_back(container.clone());
+		}
+
+		// Ticks which are not stored cannot be restored, and leave the state as is
+		PH_CHECK(!history.restore(3, state));
+		PH_CHECK(!history.restore(12, state));
+		PH_CHECK(memcmp(state, copies[11].getHeader(), state->stateSizeBytes) == 0);
+
+		for (uint64_t restoreTick : { 4u, 8u, 7u, 12u }) {
+			PH_REQUIRE(history.restore(restoreTick, state));
+			PH_CHECK(historyStatesEqual(state, copies[restoreTick].getHeader()));
+			PH_CHECK(history.newestTick() == restoreTick);
+			PH_CHECK(history.snapshotAt(restoreTick + 1) == nullptr);
+			if (dirtyBlockSize != 0) PH_CHECK(state->dirtySingletons == 1);
+
+			// The new future overwrites the discarded snapshots and the oldest ones
+			copies.resize(restoreTick + 1);
+			for (uint64_t tick = restoreTick + 1; tick < restoreTick + 7; tick++) {
+				simulateHistoryTestTick(state, rng, tick + 100);
+				history.snapshot(state, tick);
+				copies.push_back(container.clone());
+			}
+			for (uint64_t t = history.oldestTick(); t <= history.newestTick(); t++) {
+				const GameStateHeader* snapshot = history.snapshotAt(t);
+				PH_REQUIRE(snapshot != nullptr);
+				PH_CHECK(historyStatesEqual(snapshot, copies[t].getHeader()));
+			}
+		}
+	}
+}
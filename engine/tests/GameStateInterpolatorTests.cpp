@@ -0,0 +1,112 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/GameStateInterpolator.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct InterpolatedBody { float pos[3]; float rot[4]; };
+
+constexpr uint32_t BODY_TYPE = 1;
+constexpr uint32_t NUM_BODIES = 100;
+constexpr uint32_t MOVING_ID = 5;
+constexpr uint32_t STILL_ID = 70;
+
+static GameStateContainer createInterpolatorTestState() noexcept
+{
+	static const uint32_t componentSizes[] = { sizeof(InterpolatedBody) };
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = NUM_BODIES;
+	createInfo.numComponentTypes = 1;
+	createInfo.componentSizes = componentSizes;
+	createInfo.dirtyBlockSize = 32;
+	GameStateContainer container = createGameState(createInfo);
+	GameStateHeader* state = container.getHeader();
+	for (uint32_t i = 0; i < NUM_BODIES; i++) {
+		InterpolatedBody body = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f, 1.0f } };
+		state->addComponent(state->createEntity(), BODY_TYPE, body);
+	}
+	return container;
+}
+
+// Moves one body to x = tick through a pointer, marking it dirty like game code has to
+static void moveInterpolatorTestBody(GameStateHeader* state, uint32_t tick) noexcept
+{
+	state->component<InterpolatedBody>(BODY_TYPE, MOVING_ID)->pos[0] = float(tick);
+	state->markDirty(BODY_TYPE, MOVING_ID);
+}
+
+// beginTick() must copy the blocks modified during the last tick before clearDirty() clears them.
+// Clearing first leaves the shadow copy a tick behind, so the body is interpolated from the wrong
+// tick.
+PH_TEST_CASE(interpolatorBeginTickBeforeClearDirty)
+{
+	InterpolatedComponentDesc desc;
+	desc.componentType = BODY_TYPE;
+	desc.positionOffset = offsetof(InterpolatedBody, pos);
+	desc.rotationOffset = offsetof(InterpolatedBody, rot);
+	std::vector<InterpolatedTransform> transforms(NUM_BODIES);
+
+	for (bool clearDirtyFirst : { false, true }) {
+		GameStateContainer container = createInterpolatorTestState();
+		GameStateHeader* state = container.getHeader();
+		GameStateInterpolator interpolator;
+		interpolator.init(state, &desc, 1);
+		PH_REQUIRE(interpolator.numInterpolated() == 1);
+
+		// The first frame is not interpolated
+		interpolator.interpolate(state, 0, 0.5f, transforms.data());
+		PH_CHECK(transforms[MOVING_ID].position.x == 0.0f);
+		PH_CHECK(transforms[MOVING_ID].rotation.w == 1.0f);
+
+		for (uint32_t tick = 1; tick <= 4; tick++) {
+			uint32_t numCopied = 0;
+			if (clearDirtyFirst) {
+				state->clearDirty();
+				numCopied = interpolator.beginTick(state);
+			}
+			else {
+				numCopied = interpolator.beginTick(state);
+				state->clearDirty();
+			}
+			moveInterpolatorTestBody(state, tick);
+
+			interpolator.interpolate(state, 0, 0.25f, transforms.data());
+			PH_CHECK(transforms[STILL_ID].position.x == 0.0f);
+			if (!clearDirtyFirst) {
+				// Only the block dirty since the last tick is copied (all of them the first tick,
+				// as everything was created before it)
+				PH_CHECK(numCopied == (tick == 1 ? NUM_BODIES : 32));
+				PH_CHECK(std::fabs(transforms[MOVING_ID].position.x - (float(tick) - 0.75f)) < 1e-5f);
+			}
+			else {
+				// Nothing is copied, the body is interpolated from where it was when init() was
+				// called
+				PH_CHECK(numCopied == 0);
+				PH_CHECK(std::fabs(transforms[MOVING_ID].position.x - float(tick) * 0.25f) < 1e-5f);
+			}
+		}
+	}
+}
@@ -0,0 +1,176 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstdio>
+
+#include <sfz/Context.hpp>
+
+#include "ph/state/GameStateSchema.hpp"
+#include "ph/state/GameStateSnapshot.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct SchemaSettings { uint32_t seed; float gravity; float friction; };
+struct SchemaScore { uint64_t points; };
+struct SchemaPosition { float x, y, z; };
+struct SchemaHealth { uint16_t hp; };
+struct SchemaIsPlayer {};
+
+using TestSchema = GameStateSchema<
+	TypeList<SchemaSettings, SchemaScore>,
+	TypeList<SchemaPosition, SchemaIsPlayer, SchemaHealth>,
+	500>;
+
+static_assert(TestSchema::singletonIndex<SchemaScore>() == 1, "");
+static_assert(TestSchema::componentType<SchemaPosition>() == 1, "");
+static_assert(TestSchema::componentType<SchemaHealth>() == 3, "");
+static_assert(TestSchema::componentSize(2) == 0, "Empty types are flags");
+static_assert(TestSchema::offsetComponents(2) == ~0u, "Flags have no array");
+
+// Writes through the typed accessors and checks that the runtime API sees the same thing
+static void fillSchemaTestState(GameStateHeader* state) noexcept
+{
+	TestSchema::singleton<SchemaSettings>(state) = { 42, -9.81f, 0.5f };
+	TestSchema::singleton<SchemaScore>(state).points = 1337;
+	for (uint32_t i = 0; i < 100; i++) {
+		Entity entity = state->createEntity();
+		state->addComponent(entity, TestSchema::componentType<SchemaPosition>(),
+			SchemaPosition{ float(i), 0.0f, 0.0f });
+		state->addComponent(entity, TestSchema::componentType<SchemaHealth>(), SchemaHealth{ 0 });
+		if ((i % 10) == 0) {
+			state->setComponentUnsized(entity, TestSchema::componentType<SchemaIsPlayer>(), true);
+		}
+		TestSchema::components<SchemaHealth>(state)[entity.id()].hp = uint16_t(i * 3);
+	}
+}
+
+static bool schemaTestStateContentsMatch(const GameStateHeader* state) noexcept
+{
+	if (!TestSchema::matches(state)) return false;
+	if (TestSchema::singleton<SchemaSettings>(state).seed != 42) return false;
+	if (state->singleton<SchemaScore>(1).points != 1337) return false;
+	const SchemaPosition* positions = state->components<SchemaPosition>(1);
+	const SchemaHealth* healths = TestSchema::components<SchemaHealth>(state);
+	const ComponentMask* masks = TestSchema::componentMasks(state);
+	const ComponentMask playerMask = TestSchema::componentMask<SchemaPosition, SchemaIsPlayer>();
+	for (uint32_t id = 0; id < 100; id++) {
+		const Entity entity = Entity::create(id, TestSchema::entityGenerations(state)[id]);
+		if (!state->checkEntityValid(entity)) return false;
+		if (TestSchema::components<SchemaPosition>(state)[id].x != float(id)) return false;
+		if (positions + id != &TestSchema::components<SchemaPosition>(state)[id]) return false;
+		if (healths[id].hp != id * 3) return false;
+		if (masks[id].fulfills(playerMask, ComponentMask::empty()) != ((id % 10) == 0)) return false;
+	}
+	return true;
+}
+
+// The constexpr layout matches the one computed by createGameState(), also when the create info is
+// extended with the things placed after the components, and survives saving and snapshotting
+PH_TEST_CASE(gameStateSchemaRoundtrip)
+{
+	EntityQuery query;
+	query.required = TestSchema::componentMask<SchemaIsPlayer>();
+	for (uint32_t variant = 0; variant < 2; variant++) {
+		GameStateCreateInfo createInfo = TestSchema::createInfo();
+		if (variant == 1) {
+			createInfo.numQueries = 1;
+			createInfo.queries = &query;
+			createInfo.dirtyBlockSize = 64;
+			createInfo.changeTrackedComponentTypes = ComponentMask::fromType(1);
+			createInfo.externalIds = true;
+		}
+		GameStateContainer container = createGameState(createInfo);
+		GameStateHeader* state = container.getHeader();
+		PH_REQUIRE(TestSchema::matches(state));
+		PH_CHECK(state->offsetComponentMasks == TestSchema::offsetComponentMasks());
+		for (uint32_t type = 1; type <= TestSchema::NUM_COMPONENT_TYPES; type++) {
+			uint32_t componentSize = 0;
+			const uint8_t* components = state->componentsUntyped(type, componentSize);
+			PH_CHECK(componentSize == TestSchema::componentSize(type));
+			if (componentSize == 0) continue;
+			PH_CHECK(components == state->arrayAt(TestSchema::offsetComponents(type))->dataUntyped());
+		}
+		PH_CHECK(&state->singleton<SchemaScore>(1) == &TestSchema::singleton<SchemaScore>(state));
+		fillSchemaTestState(state);
+		PH_CHECK(schemaTestStateContentsMatch(state));
+
+		DynArray<uint8_t> snapshot;
+		snapshot.init(0, sfz::getDefaultAllocator(), sfz_dbg("gameStateSchemaRoundtrip"));
+		compressGameState(state, snapshot);
+		GameStateContainer decompressed = createGameStateFromSnapshot(snapshot.data(), snapshot.size());
+		PH_CHECK(schemaTestStateContentsMatch(decompressed.getHeader()));
+
+		const char* path = "schema_test.phstate";
+		PH_REQUIRE(saveGameState(state, path));
+		GameStateContainer mapped = mapGameState(path, GameStateMapMode::READ_ONLY);
+		PH_CHECK(schemaTestStateContentsMatch(mapped.getHeader()));
+		mapped.destroy();
+		remove(path);
+	}
+}
+
+// States created with anything that changes the layout of the schema part are rejected
+PH_TEST_CASE(gameStateSchemaMismatch)
+{
+	PH_CHECK(!TestSchema::matches(nullptr));
+
+	using FewerEntities = GameStateSchema<
+		TypeList<SchemaSettings, SchemaScore>,
+		TypeList<SchemaPosition, SchemaIsPlayer, SchemaHealth>,
+		400>;
+	using ReorderedComponents = GameStateSchema<
+		TypeList<SchemaSettings, SchemaScore>,
+		TypeList<SchemaPosition, SchemaHealth, SchemaIsPlayer>,
+		500>;
+	using OtherSingletons = GameStateSchema<
+		TypeList<SchemaScore, SchemaSettings>,
+		TypeList<SchemaPosition, SchemaIsPlayer, SchemaHealth>,
+		500>;
+	using OtherPolicy = GameStateSchema<
+		TypeList<SchemaSettings, SchemaScore>,
+		TypeList<SchemaPosition, SchemaIsPlayer, SchemaHealth>,
+		500,
+		EntityAllocationPolicy::LOWEST_ID_FIRST>;
+	GameStateContainer states[] = {
+		createGameState(FewerEntities::createInfo()),
+		createGameState(ReorderedComponents::createInfo()),
+		createGameState(OtherSingletons::createInfo()),
+		createGameState(OtherPolicy::createInfo()),
+	};
+	for (GameStateContainer& container : states) {
+		PH_REQUIRE(container.getHeader() != nullptr);
+		PH_CHECK(!TestSchema::matches(container.getHeader()));
+	}
+	PH_CHECK(FewerEntities::matches(states[0].getHeader()));
+	PH_CHECK(OtherPolicy::matches(states[3].getHeader()));
+
+	// Sparse storage changes the layout of the components
+	const uint32_t sparseCapacities[] = { 0, 0, 100 };
+	GameStateCreateInfo createInfo = TestSchema::createInfo();
+	createInfo.componentSparseCapacities = sparseCapacities;
+	GameStateContainer sparse = createGameState(createInfo);
+	PH_CHECK(!TestSchema::matches(sparse.getHeader()));
+
+	// Corrupted header
+	GameStateContainer container = createGameState(TestSchema::createInfo());
+	PH_REQUIRE(TestSchema::matches(container.getHeader()));
+	container.getHeader()->magicNumber += 1;
+	PH_CHECK(!TestSchema::matches(container.getHeader()));
+}
@@ -0,0 +1,98 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <random>
+
+#include <sfz/Context.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/GameStateSnapshot.hpp"
+#include "ph/util/ThreadPool.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct Transform { float pos[3]; float rot[4]; float scale; };
+struct Velocity { float v[3]; float pad; };
+struct Health { uint32_t hp, maxHp; };
+
+// Compresses and decompresses a state with 100K live entities on a grid, with and without byte
+// plane shuffling and with and without a thread pool. Reports the compression ratio and the
+// throughput in terms of uncompressed bytes.
+PH_BENCHMARK(snapshotCompression)
+{
+	uint32_t singletonSizes[] = { 100, 4000 };
+	uint32_t componentSizes[] = { sizeof(Transform), sizeof(Velocity), sizeof(Health), 0, 128 };
+	GameStateCreateInfo createInfo;
+	createInfo.numSingletonStructs = 2;
+	createInfo.singletonStructSizes = singletonSizes;
+	createInfo.maxNumEntities = 400000;
+	createInfo.numComponentTypes = 5;
+	createInfo.componentSizes = componentSizes;
+	GameStateContainer container = createGameState(createInfo);
+	GameStateHeader* state = container.getHeader();
+
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> distr(-100.0f, 100.0f);
+	for (uint32_t i = 0; i < 120000; i++) {
+		Entity entity = state->createEntity();
+		Transform transform = {
+			{ float(i % 400) * 2.5f + distr(rng) * 0.01f, 0.0f, float(i / 400) * 2.5f },
+			{ 0.0f, 0.0f, 0.0f, 1.0f },
+			1.0f
+		};
+		state->addComponent(entity, 1, transform);
+		if ((i % 2) == 0) {
+			state->addComponent(entity, 2, Velocity{ { distr(rng) * 0.1f, 0.0f, distr(rng) * 0.1f }, 0.0f });
+		}
+		if ((i % 5) == 0) state->addComponent(entity, 3, Health{ 100, 100 });
+		if ((i % 50) == 0) {
+			uint8_t blob[128];
+			for (uint8_t& b : blob) b = uint8_t(i);
+			state->addComponentUntyped(entity, 4, blob, 128);
+		}
+	}
+	for (uint32_t i = 0; i < 20000; i++) {
+		const uint32_t id = rng() % 120000;
+		state->deleteEntity(Entity::create(id, state->getGeneration(id)));
+	}
+
+	ThreadPool pool;
+	pool.init(~0u, sfz::getDefaultAllocator());
+	GameStateContainer decompressed = container.clone();
+	DynArray<uint8_t> snapshot;
+	snapshot.init(0, sfz::getDefaultAllocator(), sfz_dbg("snapshotCompression"));
+	const double stateSizeGB = double(state->stateSizeBytes) / 1e9;
+	printf("  state %.1f MiB, %u threads in pool\n",
+		double(state->stateSizeBytes) / (1024.0 * 1024.0), pool.numThreads());
+	for (uint32_t variant = 0; variant < 4; variant++) {
+		const bool shuffle = (variant & 1) != 0;
+		ThreadPool* threadPool = (variant & 2) != 0 ? &pool : nullptr;
+		const double compressMs = fastestRunMs(5, [&]() {
+			compressGameState(state, snapshot, shuffle, threadPool);
+		});
+		const double decompressMs = fastestRunMs(5, [&]() {
+			decompressGameState(snapshot.data(), snapshot.size(), decompressed.getHeader(), threadPool);
+		});
+		printf("  shuffle %i, %u threads: ratio %5.1f, compress %6.2f GB/s, decompress %6.2f GB/s\n",
+			shuffle ? 1 : 0, threadPool != nullptr ? pool.numThreads() : 1,
+			double(state->stateSizeBytes) / double(snapshot.size()),
+			stateSizeGB / (compressMs / 1000.0), stateSizeGB / (decompressMs / 1000.0));
+	}
+}
@@ -0,0 +1,131 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <sfz/Context.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/GameStateSnapshot.hpp"
+#include "ph/util/ThreadPool.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct Transform { float pos[3]; float rot[4]; float scale; };
+
+static GameStateContainer createSnapshotTestState(uint32_t numEntities) noexcept
+{
+	static const uint32_t singletonSizes[] = { 100 };
+	static const uint32_t componentSizes[] = { sizeof(Transform), 0, 128, 12 };
+	GameStateCreateInfo createInfo;
+	createInfo.numSingletonStructs = 1;
+	createInfo.singletonStructSizes = singletonSizes;
+	createInfo.maxNumEntities = numEntities * 2;
+	createInfo.numComponentTypes = 4;
+	createInfo.componentSizes = componentSizes;
+	GameStateContainer container = createGameState(createInfo);
+	GameStateHeader* state = container.getHeader();
+
+	std::mt19937 rng(12);
+	std::uniform_real_distribution<float> distr(-1.0f, 1.0f);
+	for (uint32_t i = 0; i < numEntities; i++) {
+		Entity entity = state->createEntity();
+		Transform transform = {
+			{ float(i % 400) * 2.5f + distr(rng), 0.0f, float(i / 400) * 2.5f },
+			{ 0.0f, 0.0f, 0.0f, 1.0f },
+			1.0f
+		};
+		state->addComponent(entity, 1, transform);
+		if ((i % 5) == 0) state->setComponentUnsized(entity, 2, true);
+		if ((i % 50) == 0) {
+			uint8_t blob[128];
+			for (uint8_t& b : blob) b = uint8_t(rng());
+			state->addComponentUntyped(entity, 3, blob, 128);
+		}
+	}
+	return container;
+}
+
+PH_TEST_CASE(snapshotRoundtrip)
+{
+	GameStateContainer container = createSnapshotTestState(50000);
+	const GameStateHeader* state = container.getHeader();
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+	DynArray<uint8_t> snapshot;
+	snapshot.init(0, sfz::getDefaultAllocator(), sfz_dbg("snapshotRoundtrip"));
+	for (uint32_t variant = 0; variant < 4; variant++) {
+		const bool shuffle = (variant & 1) != 0;
+		ThreadPool* threadPool = (variant & 2) != 0 ? &pool : nullptr;
+		compressGameState(state, snapshot, shuffle, threadPool);
+		PH_CHECK(snapshot.size() < state->stateSizeBytes);
+
+		GameStateContainer decompressed = container.clone();
+		uint32_t singletonSize = 0;
+		uint8_t* singleton = decompressed.getHeader()->singletonUntyped(0, singletonSize);
+		memset(singleton, 0xFF, singletonSize);
+		PH_CHECK(decompressGameState(snapshot.data(), snapshot.size(), decompressed.getHeader(),
+			threadPool));
+		PH_CHECK(memcmp(decompressed.getHeader(), state, state->stateSizeBytes) == 0);
+
+		GameStateContainer created =
+			createGameStateFromSnapshot(snapshot.data(), snapshot.size(), threadPool);
+		PH_REQUIRE(created.getHeader() != nullptr);
+		PH_CHECK(memcmp(created.getHeader(), state, state->stateSizeBytes) == 0);
+	}
+}
+
+// Corrupted snapshots must be rejected or decompress to something, but never crash
+PH_TEST_CASE(snapshotRejectsCorruptedData)
+{
+	GameStateContainer container = createSnapshotTestState(2000);
+	const GameStateHeader* state = container.getHeader();
+	DynArray<uint8_t> snapshot;
+	snapshot.init(0, sfz::getDefaultAllocator(), sfz_dbg("snapshotRejectsCorruptedData"));
+	compressGameState(state, snapshot, true);
+	PH_REQUIRE(createGameStateFromSnapshot(snapshot.data(), snapshot.size()).getHeader() != nullptr);
+
+	// Truncated
+	PH_CHECK(createGameStateFromSnapshot(snapshot.data(), snapshot.size() - 1).getHeader() == nullptr);
+	PH_CHECK(createGameStateFromSnapshot(snapshot.data(), sizeof(SnapshotHeader)).getHeader() == nullptr);
+
+	// Header claiming a huge state is rejected before anything is allocated
+	std::vector<uint8_t> bad(snapshot.data(), snapshot.data() + snapshot.size());
+	SnapshotHeader header;
+	memcpy(&header, bad.data(), sizeof(SnapshotHeader));
+	header.stateSizeBytes = UINT32_MAX;
+	memcpy(bad.data(), &header, sizeof(SnapshotHeader));
+	PH_CHECK(createGameStateFromSnapshot(bad.data(), bad.size()).getHeader() == nullptr);
+
+	// Random bit flips
+	std::mt19937 rng(13);
+	GameStateContainer decompressed = container.clone();
+	for (uint32_t i = 0; i < 200; i++) {
+		bad.assign(snapshot.data(), snapshot.data() + snapshot.size());
+		bad[rng() % bad.size()] ^= uint8_t(1 + rng() % 255);
+		decompressGameState(bad.data(), bad.size(), decompressed.getHeader());
+		GameStateContainer created = createGameStateFromSnapshot(bad.data(), bad.size());
+		if (created.getHeader() != nullptr) {
+			PH_CHECK(validateGameState(created.getHeader(), created.numBytes()));
+		}
+	}
+}
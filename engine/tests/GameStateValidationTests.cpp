@@ -0,0 +1,88 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include "ph/state/GameState.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+static GameStateContainer createValidationTestState() noexcept
+{
+	static const uint32_t componentSizes[] = { 0, 12, 0 };
+	static EventQueueDesc eventQueues[1];
+	eventQueues[0].eventSize = 8;
+	eventQueues[0].capacity = 16;
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = 100;
+	createInfo.numComponentTypes = 3;
+	createInfo.componentSizes = componentSizes;
+	createInfo.numEventQueues = 1;
+	createInfo.eventQueues = eventQueues;
+	return createGameState(createInfo);
+}
+
+// Corrupted array offsets must be rejected without reading outside the state or through a
+// misaligned ArrayHeader
+PH_TEST_CASE(validateGameStateRejectsBadArrayOffsets)
+{
+	GameStateContainer container = createValidationTestState();
+	GameStateHeader* state = container.getHeader();
+	const uint64_t numBytes = state->stateSizeBytes;
+	PH_REQUIRE(validateGameState(state, numBytes));
+
+	for (uint32_t badOffset : { 3u, 33u, uint32_t(numBytes), 0x7FFFFFE0u }) {
+		uint32_t& componentOffset =
+			state->componentRegistryArray()->at<ComponentRegistryEntry>(1).offset;
+		const uint32_t componentOffsetBefore = componentOffset;
+		componentOffset = badOffset;
+		PH_CHECK(!validateGameState(state, numBytes));
+		componentOffset = componentOffsetBefore;
+
+		uint32_t& eventsOffset =
+			state->eventQueueRegistryArray()->at<EventQueueRegistryEntry>(0).offset;
+		const uint32_t eventsOffsetBefore = eventsOffset;
+		eventsOffset = badOffset;
+		PH_CHECK(!validateGameState(state, numBytes));
+		eventsOffset = eventsOffsetBefore;
+	}
+	PH_CHECK(validateGameState(state, numBytes));
+}
+
+// All offsets in a state are 32-bit, so a larger state must fail to be created instead of
+// wrapping around and being allocated too small
+PH_TEST_CASE(createGameStateFailsIfLargerThan4GiB)
+{
+	static const uint32_t componentSizes[] = { 0, 4096, 4096 };
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = 1 << 20;
+	createInfo.numComponentTypes = 3;
+	createInfo.componentSizes = componentSizes;
+	GameStateContainer container = createGameState(createInfo);
+	PH_CHECK(container.getHeader() == nullptr);
+	PH_CHECK(container.numBytes() == 0);
+
+	// Just below the limit is fine, but reserved so that nothing is allocated up front
+	static const uint32_t smallerComponentSizes[] = { 0, 2048, 1024 };
+	createInfo.componentSizes = smallerComponentSizes;
+	createInfo.growable = true;
+	createInfo.entityAllocationPolicy = EntityAllocationPolicy::LOWEST_ID_FIRST;
+	container = createGameState(createInfo);
+	PH_REQUIRE(container.getHeader() != nullptr);
+	PH_CHECK(container.numBytes() < uint64_t(UINT32_MAX));
+}
@@ -0,0 +1,179 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cstdio>
+#include <cstring>
+
+#include <sfz/Context.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/GameStateDelta.hpp"
+#include "ph/state/GameStateHistory.hpp"
+#include "ph/state/GameStateSnapshot.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+// Growable game state test helpers
+// ------------------------------------------------------------------------------------------------
+
+// Sparse, SoA, tag and change tracked component types, a query and external ids, so that every
+// kind of entity indexed array is present
+static GameStateCreateInfo growableTestCreateInfo() noexcept
+{
+	static const uint32_t componentSizes[] = { 0, 16, 0, 12, 8 };
+	static const uint32_t sparseCapacities[] = { 0, 0, 0, 0, 300 };
+	static const uint32_t soaFieldSizes[] = { 4, 8 };
+	static ComponentFieldLayout fieldLayouts[5];
+	fieldLayouts[3].numFields = 2;
+	fieldLayouts[3].fieldSizes = soaFieldSizes;
+	static EntityQuery query;
+	query.required = ComponentMask::fromType(2);
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = 100000;
+	createInfo.numComponentTypes = 5;
+	createInfo.componentSizes = componentSizes;
+	createInfo.componentSparseCapacities = sparseCapacities;
+	createInfo.componentFieldLayouts = fieldLayouts;
+	createInfo.numQueries = 1;
+	createInfo.queries = &query;
+	createInfo.changeTrackedComponentTypes = ComponentMask::fromType(1);
+	createInfo.externalIds = true;
+	createInfo.entityAllocationPolicy = EntityAllocationPolicy::LOWEST_ID_FIRST;
+	createInfo.growable = true;
+	return createInfo;
+}
+
+static void addGrowableTestEntities(GameStateHeader* state, uint32_t numEntities) noexcept
+{
+	for (uint32_t i = 0; i < numEntities; i++) {
+		Entity entity = state->createEntity();
+		uint8_t data[16];
+		memset(data, int(entity.id()), sizeof(data));
+		state->addComponentUntyped(entity, 1, data, 16);
+		if ((i % 3) == 0) state->setComponentUnsized(entity, 2, true);
+		if ((i % 7) == 0) state->addComponentUntyped(entity, 3, data, 12);
+		if ((i % 500) == 0) state->addComponentUntyped(entity, 4, data, 8);
+	}
+}
+
+// Compares two states through their committed ranges only, the uncommitted ranges of a reserved
+// state must never be read
+static bool growableStatesEqual(const GameStateHeader* lhs, const GameStateHeader* rhs) noexcept
+{
+	if (lhs->stateSizeBytes != rhs->stateSizeBytes) return false;
+	if (lhs->committedNumEntities != rhs->committedNumEntities) return false;
+	bool equal = true;
+	forEachGameStateRange(lhs, [&](GameStateByteRange range, bool committed) {
+		if (!committed) return;
+		const uint8_t* lhsPtr = reinterpret_cast<const uint8_t*>(lhs) + range.offsetBytes;
+		const uint8_t* rhsPtr = reinterpret_cast<const uint8_t*>(rhs) + range.offsetBytes;
+		if (memcmp(lhsPtr, rhsPtr, range.sizeBytes) != 0) equal = false;
+	});
+	return equal;
+}
+
+// Growable game state tests
+// ------------------------------------------------------------------------------------------------
+
+// Every whole-state reader and writer must work on a growable state and stay within its committed
+// memory, both when the number of committed entities is raised and when it is lowered
+PH_TEST_CASE(growableStateReadersOnlyTouchCommittedMemory)
+{
+	const GameStateCreateInfo createInfo = growableTestCreateInfo();
+	GameStateContainer container = createGameState(createInfo);
+	PH_REQUIRE(container.isReserved());
+	GameStateHeader* state = container.getHeader();
+	PH_REQUIRE(state->committedNumEntities < state->maxNumEntities);
+
+	addGrowableTestEntities(state, 1000);
+	const uint32_t smallCommitted = state->committedNumEntities;
+	const uint64_t smallHash = state->hash();
+	GameStateContainer small = container.clone();
+	PH_CHECK(growableStatesEqual(small.getHeader(), state));
+	PH_CHECK(small.getHeader()->hash() == smallHash);
+
+	GameStateHistory history;
+	history.init(state, 4);
+	history.snapshot(state, 0);
+
+	DynArray<uint8_t> smallSnapshot;
+	smallSnapshot.init(0, sfz::getDefaultAllocator(), sfz_dbg("growable"));
+	compressGameState(state, smallSnapshot, true);
+
+	addGrowableTestEntities(state, 20000);
+	const uint32_t bigCommitted = state->committedNumEntities;
+	PH_REQUIRE(smallCommitted < bigCommitted && bigCommitted < state->maxNumEntities);
+	PH_CHECK(state->hash() != smallHash);
+	GameStateContainer big = container.clone();
+	history.snapshot(state, 1);
+
+	DynArray<uint8_t> bigSnapshot;
+	bigSnapshot.init(0, sfz::getDefaultAllocator(), sfz_dbg("growable"));
+	compressGameState(state, bigSnapshot);
+
+	// Deltas in both directions
+	DynArray<uint8_t> delta;
+	delta.init(0, sfz::getDefaultAllocator(), sfz_dbg("growable"));
+	PH_REQUIRE(computeStateDelta(small.getHeader(), state, delta));
+	GameStateContainer other = createGameState(createInfo);
+	small.cloneTo(other);
+	PH_CHECK(growableStatesEqual(other.getHeader(), small.getHeader()));
+	PH_REQUIRE(applyStateDelta(other.getHeader(), delta.data(), delta.size()));
+	PH_CHECK(growableStatesEqual(other.getHeader(), state));
+	PH_REQUIRE(computeStateDelta(state, small.getHeader(), delta));
+	PH_REQUIRE(applyStateDelta(other.getHeader(), delta.data(), delta.size()));
+	PH_CHECK(growableStatesEqual(other.getHeader(), small.getHeader()));
+	PH_CHECK(other.getHeader()->hash() == smallHash);
+
+	PH_CHECK(copyDifferingBlocks(other.getHeader(), state) != 0);
+	PH_CHECK(growableStatesEqual(other.getHeader(), state));
+	PH_CHECK(copyDifferingBlocks(other.getHeader(), state) == 0);
+
+	// Rewinding lowers the number of committed entities, the state can then grow again
+	PH_REQUIRE(history.restore(0, state));
+	PH_CHECK(state->committedNumEntities == smallCommitted);
+	PH_CHECK(growableStatesEqual(state, small.getHeader()));
+	PH_CHECK(state->hash() == smallHash);
+	PH_CHECK(decompressGameState(bigSnapshot.data(), bigSnapshot.size(), state));
+	PH_CHECK(growableStatesEqual(state, big.getHeader()));
+	PH_CHECK(decompressGameState(smallSnapshot.data(), smallSnapshot.size(), state));
+	PH_CHECK(growableStatesEqual(state, small.getHeader()));
+	addGrowableTestEntities(state, 20000);
+	PH_CHECK(growableStatesEqual(state, big.getHeader()));
+	state->rebuildQueries();
+	PH_CHECK(growableStatesEqual(state, big.getHeader()));
+	PH_CHECK(validateGameState(state, state->stateSizeBytes));
+
+	GameStateContainer created =
+		createGameStateFromSnapshot(smallSnapshot.data(), smallSnapshot.size());
+	PH_REQUIRE(created.getHeader() != nullptr);
+	PH_CHECK(growableStatesEqual(created.getHeader(), small.getHeader()));
+
+	// A saved state is mapped as is, growing it must not try to commit the mapped file
+	const char* path = "growable_state_test.phstate";
+	PH_REQUIRE(saveGameState(small.getHeader(), path));
+	GameStateContainer mapped = mapGameState(path, GameStateMapMode::COPY_ON_WRITE, state);
+	PH_REQUIRE(mapped.getHeader() != nullptr);
+	PH_CHECK(growableStatesEqual(mapped.getHeader(), small.getHeader()));
+	addGrowableTestEntities(mapped.getHeader(), 20000);
+	PH_CHECK(growableStatesEqual(mapped.getHeader(), big.getHeader()));
+	mapped.destroy();
+	remove(path);
+}
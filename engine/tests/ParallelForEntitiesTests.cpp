@@ -0,0 +1,129 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <atomic>
+#include <random>
+
+#include "ph/state/ParallelForEntities.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct Position { float x, y, z; };
+struct Velocity { float x, y, z; };
+
+constexpr uint32_t POSITION_TYPE = 1;
+constexpr uint32_t VELOCITY_TYPE = 2;
+constexpr uint32_t SPARSE_TYPE = 3;
+
+// Creates a state with positions on all entities and velocities and a sparse tag on some
+static GameStateContainer createMovingEntities(uint32_t numEntities) noexcept
+{
+	uint32_t componentSizes[] = { sizeof(Position), sizeof(Velocity), 4 };
+	uint32_t sparseCapacities[] = { 0, 0, numEntities / 4 };
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = numEntities;
+	createInfo.numComponentTypes = 3;
+	createInfo.componentSizes = componentSizes;
+	createInfo.componentSparseCapacities = sparseCapacities;
+	GameStateContainer container = createGameState(createInfo);
+	GameStateHeader* state = container.getHeader();
+
+	std::mt19937 rng(4);
+	for (uint32_t i = 0; i < numEntities; i++) {
+		Entity entity = state->createEntity();
+		Position pos = { float(rng() % 1000) * 0.37f, 0.0f, 0.0f };
+		state->addComponent(entity, POSITION_TYPE, pos);
+		if ((rng() % 2) == 0) {
+			Velocity vel = { 1.1f, 0.0f, 0.0f };
+			state->addComponent(entity, VELOCITY_TYPE, vel);
+		}
+		if ((rng() % 8) == 0) {
+			uint32_t tag = i;
+			state->addComponent(entity, SPARSE_TYPE, tag);
+		}
+	}
+	return container;
+}
+
+PH_TEST_CASE(parallelForEntitiesVisitsEachMatchingEntityOnce)
+{
+	GameStateContainer container = createMovingEntities(10000);
+	GameStateHeader* state = container.getHeader();
+	for (uint32_t numWorkers : { 0u, 1u, 3u }) {
+		ThreadPool pool;
+		pool.init(numWorkers, sfz::getDefaultAllocator());
+
+		// Typed, integrates positions of entities with velocities
+		GameStateContainer before = container.clone();
+		parallelForEntities(pool, state, ComponentMask::empty(), 100,
+			ComponentTypes<Position, Velocity>{ { POSITION_TYPE, VELOCITY_TYPE } },
+			[](uint32_t, Position* pos, Velocity* vel) { pos->x += vel->x; });
+		const ComponentMask* masks = state->componentMasks();
+		for (uint32_t id = 0; id < state->entityHighWaterMark; id++) {
+			const float expected = before.getHeader()->components<Position>(POSITION_TYPE)[id].x +
+				(masks[id].hasComponentType(VELOCITY_TYPE) ? 1.1f : 0.0f);
+			PH_CHECK(state->components<Position>(POSITION_TYPE)[id].x == expected);
+		}
+
+		// Untyped, sparse component types are accessed through component()
+		std::atomic<uint32_t> numVisited = { 0 };
+		std::atomic<uint32_t> numWrongTags = { 0 };
+		parallelForEntities(pool, state, ComponentMask::fromType(SPARSE_TYPE), 0,
+			[&](uint32_t entityId) {
+				numVisited += 1;
+				const uint32_t* tag = state->component<uint32_t>(SPARSE_TYPE, entityId);
+				if (tag == nullptr || *tag != entityId) numWrongTags += 1;
+			});
+		uint32_t numExpected = 0;
+		for (uint32_t id = 0; id < state->entityHighWaterMark; id++) {
+			if (masks[id].hasComponentType(SPARSE_TYPE)) numExpected += 1;
+		}
+		PH_CHECK(numVisited == numExpected);
+		PH_CHECK(numWrongTags == 0);
+	}
+}
+
+PH_TEST_CASE(parallelReduceEntitiesIsIndependentOfThreadCount)
+{
+	GameStateContainer container = createMovingEntities(10000);
+	GameStateHeader* state = container.getHeader();
+	float sums[3] = {};
+	uint32_t counts[3] = {};
+	const uint32_t numWorkers[3] = { 0, 1, 3 };
+	for (uint32_t i = 0; i < 3; i++) {
+		ThreadPool pool;
+		pool.init(numWorkers[i], sfz::getDefaultAllocator());
+		sums[i] = parallelSumEntities<float>(pool, state, ComponentMask::empty(), 100,
+			ComponentTypes<Position>{ { POSITION_TYPE } },
+			[](uint32_t, Position* pos) { return pos->x; });
+		counts[i] = parallelReduceEntities(pool, state, ComponentMask::fromType(VELOCITY_TYPE), 256,
+			0u, [](uint32_t) { return 1u; }, [](uint32_t lhs, uint32_t rhs) { return lhs + rhs; });
+	}
+
+	// Floating point sums are only bit-exact because the combine order is fixed
+	PH_CHECK(sums[0] == sums[1] && sums[0] == sums[2]);
+	PH_CHECK(counts[0] == counts[1] && counts[0] == counts[2]);
+	uint32_t numExpected = 0;
+	for (uint32_t id = 0; id < state->entityHighWaterMark; id++) {
+		if (state->componentMasks()[id].hasComponentType(VELOCITY_TYPE)) numExpected += 1;
+	}
+	PH_CHECK(counts[0] == numExpected);
+}
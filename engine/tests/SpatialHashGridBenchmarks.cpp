@@ -0,0 +1,117 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+#include <sfz/Context.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/SpatialHashGrid.hpp"
+#include "ph/util/ThreadPool.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct Body { float mass; float pos[3]; float vel[3]; };
+
+// Moves 100K and 1M entities (roughly 128 cubic units of space each) and rebuilds the grid each
+// tick, with and without a thread pool. Compares sphere queries with a radius of a few cells to a
+// brute force scan of all entities.
+PH_BENCHMARK(spatialHashGridMovingEntities)
+{
+	ThreadPool pool;
+	pool.init(~0u, sfz::getDefaultAllocator());
+	for (uint32_t numEntities : { 100000u, 1000000u }) {
+		uint32_t componentSizes[] = { sizeof(Body) };
+		uint32_t numBuckets = 1;
+		while (numBuckets < numEntities) numBuckets *= 2;
+		uint32_t singletonSizes[] = { spatialHashGridSizeBytes(numBuckets, numEntities) };
+		GameStateCreateInfo createInfo;
+		createInfo.numSingletonStructs = 1;
+		createInfo.singletonStructSizes = singletonSizes;
+		createInfo.maxNumEntities = numEntities;
+		createInfo.numComponentTypes = 1;
+		createInfo.componentSizes = componentSizes;
+		GameStateContainer container = createGameState(createInfo);
+		GameStateHeader* state = container.getHeader();
+		initSpatialHashGrid(state, 0, numBuckets, 4.0f, 1, offsetof(Body, pos));
+
+		const float halfWorldSize = 0.5f * std::cbrt(float(numEntities) * 128.0f);
+		std::mt19937 rng(17);
+		std::uniform_real_distribution<float> posDistr(-halfWorldSize, halfWorldSize);
+		std::uniform_real_distribution<float> velDistr(-5.0f, 5.0f);
+		for (uint32_t i = 0; i < numEntities; i++) {
+			Body body = {
+				1.0f,
+				{ posDistr(rng), posDistr(rng), posDistr(rng) },
+				{ velDistr(rng), velDistr(rng), velDistr(rng) }
+			};
+			state->addComponent(state->createEntity(), 1, body);
+		}
+
+		Body* bodies = state->components<Body>(1);
+		auto moveEntities = [&]() {
+			for (uint32_t i = 0; i < numEntities; i++) {
+				for (uint32_t k = 0; k < 3; k++) bodies[i].pos[k] += bodies[i].vel[k] * 0.1f;
+			}
+		};
+		const double serialMs = fastestRunMs(10, [&]() {
+			moveEntities();
+			rebuildSpatialHashGrid(state, 0);
+		});
+		const double parallelMs = fastestRunMs(10, [&]() {
+			moveEntities();
+			rebuildSpatialHashGrid(state, 0, &pool);
+		});
+		const double moveMs = fastestRunMs(10, moveEntities);
+
+		// Queries
+		const SpatialHashGrid* grid = getSpatialHashGrid(state, 0);
+		std::vector<uint32_t> ids(numEntities);
+		std::vector<vec3> centers(1000);
+		for (vec3& center : centers) center = vec3(posDistr(rng), posDistr(rng), posDistr(rng));
+		uint64_t numFound = 0;
+		const double queryMs = fastestRunMs(5, [&]() {
+			numFound = 0;
+			for (vec3 center : centers) {
+				numFound += grid->querySphere(center, 8.0f, ids.data(), numEntities);
+			}
+		});
+		const double bruteForceMs = fastestRunMs(5, [&]() {
+			uint32_t numInside = 0;
+			const vec3 center = centers[0];
+			for (uint32_t i = 0; i < numEntities; i++) {
+				const float dx = bodies[i].pos[0] - center.x;
+				const float dy = bodies[i].pos[1] - center.y;
+				const float dz = bodies[i].pos[2] - center.z;
+				numInside += (dx * dx + dy * dy + dz * dz) <= 64.0f ? 1 : 0;
+			}
+			doNotOptimize(numInside);
+		});
+
+		printf("  %7u entities: move + rebuild %7.2f ms, with %u threads %7.2f ms (move %.2f ms)\n",
+			numEntities, serialMs, pool.numThreads(), parallelMs, moveMs);
+		printf("  %7u entities: query %6.2f us (avg %.1f hits), brute force scan %7.3f ms\n",
+			numEntities, 1000.0 * queryMs / double(centers.size()),
+			double(numFound) / double(centers.size()), bruteForceMs);
+	}
+}
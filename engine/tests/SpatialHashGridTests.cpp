@@ -0,0 +1,142 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <sfz/Context.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/state/SpatialHashGrid.hpp"
+#include "ph/util/ThreadPool.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct Body { float mass; float pos[3]; float vel[3]; };
+
+constexpr uint32_t BODY_TYPE = 1;
+constexpr uint32_t GRID_SINGLETON = 1;
+
+static GameStateContainer createGridTestState(uint32_t numEntities, bool soa) noexcept
+{
+	static const uint32_t componentSizes[] = { sizeof(Body) };
+	static const uint32_t fieldSizes[] = { 4, 4, 4, 4, 12 };
+	ComponentFieldLayout fieldLayouts[1] = {};
+	fieldLayouts[0].numFields = 5;
+	fieldLayouts[0].fieldSizes = fieldSizes;
+	uint32_t numBuckets = 1;
+	while (numBuckets < numEntities) numBuckets *= 2;
+	const uint32_t singletonSizes[] = { 32, spatialHashGridSizeBytes(numBuckets, numEntities) };
+	GameStateCreateInfo createInfo;
+	createInfo.numSingletonStructs = 2;
+	createInfo.singletonStructSizes = singletonSizes;
+	createInfo.maxNumEntities = numEntities;
+	createInfo.numComponentTypes = 1;
+	createInfo.componentSizes = componentSizes;
+	if (soa) createInfo.componentFieldLayouts = fieldLayouts;
+	GameStateContainer container = createGameState(createInfo);
+	GameStateHeader* state = container.getHeader();
+	initSpatialHashGrid(state, GRID_SINGLETON, numBuckets, 4.0f, BODY_TYPE, offsetof(Body, pos));
+
+	std::mt19937 rng(17);
+	std::uniform_real_distribution<float> distr(-100.0f, 100.0f);
+	for (uint32_t i = 0; i < numEntities; i++) {
+		Entity entity = state->createEntity();
+		if ((i % 10) == 0) continue;
+		Body body = { 1.0f, { distr(rng), distr(rng), distr(rng) }, { 0.0f, 0.0f, 0.0f } };
+		if ((i % 50) == 1) body.pos[0] = 1e20f;
+		state->addComponent(entity, BODY_TYPE, body);
+		if ((i % 7) == 0) state->deleteEntity(entity);
+	}
+	return container;
+}
+
+// Returns the ids of all entities within the sphere, by scanning all entities
+static std::vector<uint32_t> bruteForceQuerySphere(
+	const GameStateHeader* state, vec3 center, float radius) noexcept
+{
+	std::vector<uint32_t> ids;
+	const ComponentMask mask = ComponentMask::activeMask() | ComponentMask::fromType(BODY_TYPE);
+	for (uint32_t id = 0; id < state->entityHighWaterMark; id++) {
+		if (!state->componentMasks()[id].fulfills(mask)) continue;
+		Body body;
+		state->readComponent(BODY_TYPE, id, body);
+		const float dx = body.pos[0] - center.x;
+		const float dy = body.pos[1] - center.y;
+		const float dz = body.pos[2] - center.z;
+		if ((dx * dx + dy * dy + dz * dz) <= radius * radius) ids.push_back(id);
+	}
+	return ids;
+}
+
+PH_TEST_CASE(spatialHashGridQueriesMatchBruteForce)
+{
+	std::mt19937 rng(18);
+	std::uniform_real_distribution<float> distr(-100.0f, 100.0f);
+	for (bool soa : { false, true }) {
+		GameStateContainer container = createGridTestState(5000, soa);
+		GameStateHeader* state = container.getHeader();
+		rebuildSpatialHashGrid(state, GRID_SINGLETON);
+		const SpatialHashGrid* grid = getSpatialHashGrid(state, GRID_SINGLETON);
+		PH_CHECK(grid->bucketStarts()[grid->numBuckets] == grid->numEntries);
+
+		std::vector<uint32_t> ids(5000);
+		for (uint32_t i = 0; i < 200; i++) {
+			const vec3 center = vec3(distr(rng), distr(rng), distr(rng));
+			const float radius = (i % 10) == 0 ? 60.0f : float(rng() % 8);
+			const uint32_t numFound = grid->querySphere(center, radius, ids.data(), 5000);
+			std::vector<uint32_t> found(ids.begin(), ids.begin() + std::min(numFound, 5000u));
+			std::sort(found.begin(), found.end());
+			PH_CHECK(found == bruteForceQuerySphere(state, center, radius));
+
+			const vec3 min = vec3(center.x - radius, center.y - radius, center.z - radius);
+			const vec3 max = vec3(center.x + radius, center.y + radius, center.z + radius);
+			PH_CHECK(grid->queryAABB(min, max, ids.data(), 0) >= numFound);
+		}
+	}
+}
+
+// The grid must be identical regardless of the number of threads, and after re-initializing it
+// must be identical to a newly initialized grid
+PH_TEST_CASE(spatialHashGridRebuildIsDeterministic)
+{
+	GameStateContainer container = createGridTestState(40000, false);
+	GameStateHeader* state = container.getHeader();
+	GameStateContainer fresh = container.clone();
+	rebuildSpatialHashGrid(state, GRID_SINGLETON);
+
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+	GameStateContainer parallel = fresh.clone();
+	rebuildSpatialHashGrid(parallel.getHeader(), GRID_SINGLETON, &pool);
+	uint32_t singletonSize = 0;
+	const uint8_t* grid = state->singletonUntyped(GRID_SINGLETON, singletonSize);
+	PH_CHECK(memcmp(grid, parallel.getHeader()->singletonUntyped(GRID_SINGLETON, singletonSize),
+		singletonSize) == 0);
+
+	const SpatialHashGrid* gridHeader = getSpatialHashGrid(state, GRID_SINGLETON);
+	initSpatialHashGrid(state, GRID_SINGLETON, gridHeader->numBuckets, 4.0f, BODY_TYPE,
+		offsetof(Body, pos));
+	PH_CHECK(memcmp(grid, fresh.getHeader()->singletonUntyped(GRID_SINGLETON, singletonSize),
+		singletonSize) == 0);
+}
@@ -0,0 +1,111 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+#include <random>
+
+#include <sfz/Context.hpp>
+
+#include "ph/state/GameState.hpp"
+#include "ph/util/ThreadPool.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+struct Vec4 { float x, y, z, w; };
+
+static GameStateContainer createHashTestState(uint32_t dirtyBlockSize) noexcept
+{
+	static const uint32_t singletonSizes[] = { 16, 32 };
+	static const uint32_t componentSizes[] = { sizeof(Vec4), sizeof(Vec4), 0, 64 };
+	GameStateCreateInfo createInfo;
+	createInfo.numSingletonStructs = 2;
+	createInfo.singletonStructSizes = singletonSizes;
+	createInfo.maxNumEntities = 5000;
+	createInfo.numComponentTypes = 4;
+	createInfo.componentSizes = componentSizes;
+	createInfo.dirtyBlockSize = dirtyBlockSize;
+	return createGameState(createInfo);
+}
+
+// Performs the same random operations on a state with dirty tracking (cached hashes) and one
+// without, the hashes must always match
+PH_TEST_CASE(cachedStateHashMatchesUncached)
+{
+	GameStateContainer cachedContainer = createHashTestState(64);
+	GameStateContainer uncachedContainer = createHashTestState(0);
+	std::mt19937 rng(13);
+	for (uint32_t tick = 0; tick < 300; tick++) {
+		const uint32_t op = rng() % 4;
+		const uint32_t id = rng() % 5000;
+		const uint8_t singletonByte = uint8_t(rng());
+		for (GameStateHeader* state : { cachedContainer.getHeader(), uncachedContainer.getHeader() }) {
+			const Entity entity = Entity::create(id, state->getGeneration(id));
+			if (op == 0) {
+				Entity created = state->createEntity();
+				if (created != Entity::invalid()) state->addComponent(created, 1, Vec4{ 1, 2, 3, 4 });
+			}
+			else if (op == 1) {
+				if (state->componentMasks()[id].hasComponentType(1)) {
+					state->component<Vec4>(1, id)->x += 1.0f;
+					state->markDirty(1, id);
+				}
+			}
+			else if (op == 2) {
+				uint32_t singletonSize = 0;
+				state->singletonUntyped(0, singletonSize)[id % singletonSize] ^= singletonByte;
+				state->markSingletonDirty(0);
+			}
+			else {
+				state->deleteEntity(entity);
+			}
+		}
+		const uint64_t cachedHash = cachedContainer.getHeader()->hash();
+		PH_CHECK(cachedHash != 0);
+		PH_CHECK(cachedHash == uncachedContainer.getHeader()->hash());
+		for (uint32_t i = 0; i < 4; i++) PH_CHECK(cachedContainer.getHeader()->componentTypeHash(i) != 0);
+	}
+}
+
+// Marking dirty is thread safe, all marked blocks must invalidate the cached hash
+PH_TEST_CASE(parallelMarkDirtyInvalidatesCachedHash)
+{
+	GameStateContainer container = createHashTestState(64);
+	GameStateHeader* state = container.getHeader();
+	Entity entities[5000];
+	PH_REQUIRE(state->createEntities(5000, entities) == 5000);
+	for (Entity entity : entities) state->addComponent(entity, 1, Vec4{ 0, 0, 0, 0 });
+	const uint64_t hashBefore = state->hash();
+
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+	Vec4* components = state->components<Vec4>(1);
+	auto writeTask = [&](uint32_t id, uint32_t) {
+		components[id].x = 1.0f;
+		state->markDirty(1, id);
+	};
+	pool.runFunc(5000, writeTask);
+	const uint64_t hashAfter = state->hash();
+	PH_CHECK(hashAfter != hashBefore);
+
+	GameStateContainer uncachedContainer = createHashTestState(0);
+	GameStateHeader* uncached = uncachedContainer.getHeader();
+	PH_REQUIRE(uncached->createEntities(5000, entities) == 5000);
+	for (Entity entity : entities) uncached->addComponent(entity, 1, Vec4{ 1, 0, 0, 0 });
+	PH_CHECK(hashAfter == uncached->hash());
+}
@@ -0,0 +1,116 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "ph/state/ParallelForEntities.hpp"
+#include "ph/state/SystemScheduler.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+PH_TEST_CASE(systemSchedulerRespectsConflicts)
+{
+	struct SystemData {
+		std::atomic<uint32_t>* order = nullptr;
+		uint32_t started = 0;
+		uint32_t finished = 0;
+	};
+	std::atomic<uint32_t> order = { 0 };
+	SystemData data[5];
+	SystemDesc systems[5];
+	systems[0].writeComponents = ComponentMask::fromType(1);
+	systems[1].readComponents = ComponentMask::fromType(2);
+	systems[2].readComponents = ComponentMask::fromType(1); // Depends on 0
+	systems[3].writeSingletons = 1;
+	systems[4].structuralChanges = true; // Depends on all
+
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+	SystemScheduler scheduler;
+	scheduler.init(8);
+	for (uint32_t i = 0; i < 5; i++) {
+		data[i].order = &order;
+		systems[i].systemFunc = [](GameStateHeader*, float, void* userPtr) {
+			SystemData& system = *static_cast<SystemData*>(userPtr);
+			system.started = (*system.order)++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			system.finished = (*system.order)++;
+		};
+		systems[i].userPtr = &data[i];
+		scheduler.addSystem(systems[i]);
+	}
+
+	for (uint32_t rep = 0; rep < 10; rep++) {
+		order = 0;
+		scheduler.runTick(nullptr, 0.01f, pool);
+		PH_CHECK(data[2].started > data[0].finished);
+		for (uint32_t i = 0; i < 4; i++) PH_CHECK(data[4].started > data[i].finished);
+	}
+}
+
+PH_TEST_CASE(systemSchedulerSystemsCanUseParallelFor)
+{
+	uint32_t componentSizes[] = { 4, 4 };
+	GameStateCreateInfo createInfo;
+	createInfo.maxNumEntities = 20000;
+	createInfo.numComponentTypes = 2;
+	createInfo.componentSizes = componentSizes;
+	GameStateContainer container = createGameState(createInfo);
+	GameStateHeader* state = container.getHeader();
+	for (uint32_t i = 0; i < createInfo.maxNumEntities; i++) {
+		Entity entity = state->createEntity();
+		state->addComponent(entity, 1, uint32_t(0));
+		state->addComponent(entity, 2, uint32_t(0));
+	}
+
+	// Two independent systems, each incrementing its own component in parallel on the same pool
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+	struct SystemData {
+		ThreadPool* pool = nullptr;
+		uint32_t componentType = 0;
+	};
+	SystemData data[2] = { { &pool, 1 }, { &pool, 2 } };
+	SystemScheduler scheduler;
+	scheduler.init(2);
+	for (SystemData& system : data) {
+		SystemDesc desc;
+		desc.writeComponents = ComponentMask::fromType(system.componentType);
+		desc.systemFunc = [](GameStateHeader* state, float, void* userPtr) {
+			const SystemData& system = *static_cast<const SystemData*>(userPtr);
+			uint32_t* values = state->components<uint32_t>(system.componentType);
+			parallelForEntities(*system.pool, state, ComponentMask::fromType(system.componentType),
+				64, [&](uint32_t entityId) { values[entityId] += 1; });
+		};
+		desc.userPtr = &system;
+		scheduler.addSystem(desc);
+	}
+
+	for (uint32_t rep = 0; rep < 20; rep++) scheduler.runTick(state, 0.01f, pool);
+	for (uint32_t type = 1; type <= 2; type++) {
+		const uint32_t* values = state->components<uint32_t>(type);
+		uint32_t numWrong = 0;
+		for (uint32_t i = 0; i < createInfo.maxNumEntities; i++) numWrong += values[i] != 20 ? 1 : 0;
+		PH_CHECK(numWrong == 0);
+	}
+}
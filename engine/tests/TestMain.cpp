@@ -0,0 +1,42 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <cstdio>
+#include <cstring>
+
+#include "Testing.hpp"
+
+// Runs all registered tests, or the ones whose name contains argv[1]. Returns non-zero if any
+// test failed.
+int main(int argc, char* argv[])
+{
+	const char* filter = argc > 1 ? argv[1] : nullptr;
+	uint32_t numTests = 0;
+	uint32_t numFailedTests = 0;
+	for (ph::TestRegistration* test = ph::registeredTests; test != nullptr; test = test->next) {
+		if (filter != nullptr && strstr(test->name, filter) == nullptr) continue;
+		printf("%s\n", test->name);
+		ph::numFailedChecks = 0;
+		test->func();
+		numTests += 1;
+		if (ph::numFailedChecks != 0) numFailedTests += 1;
+	}
+	printf("\n%u / %u tests passed\n", numTests - numFailedTests, numTests);
+	return numFailedTests == 0 ? 0 : 1;
+}
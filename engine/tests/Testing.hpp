@@ -0,0 +1,113 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+namespace ph {
+
+// Minimal test and benchmark framework for the game state, see TestMain.cpp and
+// BenchmarkMain.cpp. Tests and benchmarks register themselves when their translation unit is
+// loaded, each executable runs all of them or the ones whose name contains the first argument.
+
+// Registration
+// ------------------------------------------------------------------------------------------------
+
+struct TestRegistration final {
+	const char* name = nullptr;
+	void(*func)() = nullptr;
+	TestRegistration* next = nullptr;
+
+	// Appends to the end of the list, so that the tests of a file run in declaration order
+	TestRegistration(TestRegistration*& list, const char* nameIn, void(*funcIn)()) noexcept
+		: name(nameIn), func(funcIn)
+	{
+		TestRegistration** last = &list;
+		while (*last != nullptr) last = &(*last)->next;
+		*last = this;
+	}
+};
+
+inline TestRegistration* registeredTests = nullptr;
+inline TestRegistration* registeredBenchmarks = nullptr;
+
+// The number of failed checks in the currently running test
+inline uint32_t numFailedChecks = 0;
+
+inline void reportFailedCheck(const char* file, int line, const char* expr) noexcept
+{
+	printf("    %s:%i: CHECK FAILED: %s\n", file, line, expr);
+	numFailedChecks += 1;
+}
+
+// Test macros
+// ------------------------------------------------------------------------------------------------
+
+#define PH_TEST_CASE(name) \
+	static void name(); \
+	static ph::TestRegistration name##Registration(ph::registeredTests, #name, name); \
+	static void name()
+
+#define PH_BENCHMARK(name) \
+	static void name(); \
+	static ph::TestRegistration name##Registration(ph::registeredBenchmarks, #name, name); \
+	static void name()
+
+// Checks the condition and continues the test if it fails
+#define PH_CHECK(cond) \
+	do { if (!(cond)) ph::reportFailedCheck(__FILE__, __LINE__, #cond); } while (false)
+
+// Checks the condition and returns from the test if it fails
+#define PH_REQUIRE(cond) \
+	do { if (!(cond)) { ph::reportFailedCheck(__FILE__, __LINE__, #cond); return; } } while (false)
+
+// Benchmark helpers
+// ------------------------------------------------------------------------------------------------
+
+// Runs func numRuns times and returns the time of the fastest run in milliseconds
+template<typename Func>
+double fastestRunMs(uint32_t numRuns, Func&& func) noexcept
+{
+	double fastest = 1e30;
+	for (uint32_t i = 0; i < numRuns; i++) {
+		auto before = std::chrono::high_resolution_clock::now();
+		func();
+		auto after = std::chrono::high_resolution_clock::now();
+		fastest = std::min(fastest, std::chrono::duration<double, std::milli>(after - before).count());
+	}
+	return fastest;
+}
+
+// Prevents the compiler from optimizing away the computation of the given value
+template<typename T>
+void doNotOptimize(const T& value) noexcept
+{
+#ifdef _MSC_VER
+	const volatile T* ptr = &value;
+	(void)ptr;
+#else
+	asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+} // namespace ph
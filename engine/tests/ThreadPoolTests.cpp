@@ -0,0 +1,110 @@
+// Copyright (c) Peter Hillerström (skipifzero.com, peter@hstroem.se)
+//               For other contributors see Contributors.txt
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include <atomic>
+#include <vector>
+
+#include <sfz/Context.hpp>
+
+#include "ph/util/ThreadPool.hpp"
+
+#include "Testing.hpp"
+
+using namespace ph;
+
+PH_TEST_CASE(threadPoolRunsEachTaskOnce)
+{
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+	std::vector<std::atomic<uint32_t>> numRuns(1000);
+	for (uint32_t rep = 0; rep < 50; rep++) {
+		auto func = [&](uint32_t taskIdx, uint32_t) { numRuns[taskIdx] += 1; };
+		pool.runFunc(uint32_t(numRuns.size()), func);
+	}
+	for (const std::atomic<uint32_t>& n : numRuns) PH_CHECK(n == 50);
+}
+
+PH_TEST_CASE(threadPoolNestedRuns)
+{
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+
+	// Each outer task runs nested tasks, which in turn run nested tasks
+	std::atomic<uint32_t> numInnerTasks = { 0 };
+	std::atomic<uint32_t> numWrongThreadIdxs = { 0 };
+	auto innerFunc = [&](uint32_t, uint32_t threadIdx) {
+		numInnerTasks += 1;
+		if (threadIdx != ThreadPool::currentThreadIdx()) numWrongThreadIdxs += 1;
+	};
+	auto middleFunc = [&](uint32_t, uint32_t threadIdx) {
+		if (threadIdx != ThreadPool::currentThreadIdx()) numWrongThreadIdxs += 1;
+		pool.runFunc(50, innerFunc);
+	};
+	auto outerFunc = [&](uint32_t, uint32_t threadIdx) {
+		if (threadIdx != ThreadPool::currentThreadIdx()) numWrongThreadIdxs += 1;
+		pool.runFunc(20, middleFunc);
+	};
+	for (uint32_t rep = 0; rep < 10; rep++) {
+		numInnerTasks = 0;
+		pool.runFunc(8, outerFunc);
+		PH_CHECK(numInnerTasks == 8 * 20 * 50);
+	}
+	PH_CHECK(numWrongThreadIdxs == 0);
+}
+
+// Recursively runs two tasks each running two tasks, down to the given depth
+static void runRecursively(ThreadPool& pool, uint32_t depth, std::atomic<uint32_t>& numLeaves) noexcept
+{
+	if (depth == 0) {
+		numLeaves += 1;
+		return;
+	}
+	auto func = [&](uint32_t, uint32_t) { runRecursively(pool, depth - 1, numLeaves); };
+	pool.runFunc(2, func);
+}
+
+PH_TEST_CASE(threadPoolDeeplyNestedRuns)
+{
+	// Deeper than the max number of active runs, the innermost runs are executed on the calling
+	// thread
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+	std::atomic<uint32_t> numLeaves = { 0 };
+	runRecursively(pool, 18, numLeaves);
+	PH_CHECK(numLeaves == (1u << 18));
+}
+
+PH_TEST_CASE(threadPoolThreadIdxsAreUniqueWithinRun)
+{
+	ThreadPool pool;
+	pool.init(3, sfz::getDefaultAllocator());
+
+	// Counts the tasks currently running on each thread index, never more than one
+	std::atomic<uint32_t> running[4] = {};
+	std::atomic<uint32_t> numCollisions = { 0 };
+	auto innerFunc = [&](uint32_t, uint32_t threadIdx) {
+		if (running[threadIdx].fetch_add(1) != 0) numCollisions += 1;
+		volatile uint32_t spin = 0;
+		for (uint32_t i = 0; i < 1000; i++) spin = spin + i;
+		running[threadIdx] -= 1;
+	};
+	auto outerFunc = [&](uint32_t, uint32_t) { pool.runFunc(200, innerFunc); };
+	pool.runFunc(2, outerFunc);
+	PH_CHECK(numCollisions == 0);
+}